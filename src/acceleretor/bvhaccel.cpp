@@ -243,6 +243,25 @@ bool BVHAccel::Intersect(Ray *ray, Sphere **hitSphere, unsigned int *primitiveIn
 	return (*primitiveIndex) != 0xffffffffu;
 }
 
+bool BVHAccel::IntersectP(const Ray *ray) const {
+	unsigned int currentNode = 0; // Root Node
+	unsigned int stopNode = bvhTree[0].skipIndex; // Non-existent
+
+	while (currentNode < stopNode) {
+		float hitT;
+		if (bvhTree[currentNode].bsphere.IntersectP(ray, &hitT)) {
+			// Stop at the first intersection found
+			if ((bvhTree[currentNode].primitiveIndex != 0xffffffffu) && (hitT < ray->maxt))
+				return true;
+
+			currentNode++;
+		} else
+			currentNode = bvhTree[currentNode].skipIndex;
+	}
+
+	return false;
+}
+
 // For some debuging
 bool BVHAccel::CheckBoundingSpheres(const Sphere &parentSphere, const BVHAccelTreeNode *bvhTree) {
 	if (bvhTree->leftChild) {
@@ -0,0 +1,291 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+
+#include "sfera.h"
+#include "benchmarksession.h"
+#include "gamelevel.h"
+#include "epsilon.h"
+#include "renderer/cpu/singlecpurenderer.h"
+#include "renderer/cpu/multicpurenderer.h"
+#include "renderer/ocl/oclrenderer.h"
+#include "physic/gamephysic.h"
+
+static string JSONString(const string &s) {
+	stringstream ss;
+	ss << '"';
+	for (size_t i = 0; i < s.length(); ++i) {
+		const char c = s[i];
+		if ((c == '"') || (c == '\\'))
+			ss << '\\' << c;
+		else if ((unsigned char)c < 0x20)
+			ss << "\\u" << setw(4) << setfill('0') << hex << (int)c << dec;
+		else
+			ss << c;
+	}
+	ss << '"';
+
+	return ss.str();
+}
+
+// The stage times are in milliseconds, the stages never timed are skipped
+static void WriteStageTimes(ostream &os, const char **stageNames,
+		const vector<double> &stageTimes) {
+	os << "{";
+	bool first = true;
+	for (size_t i = 0; i < stageTimes.size(); ++i) {
+		if (stageTimes[i] <= 0.0)
+			continue;
+
+		os << (first ? " " : ", ") << JSONString(stageNames[i]) << ": " <<
+				1000.0 * stageTimes[i];
+		first = false;
+	}
+	os << " }";
+}
+
+// Nearest rank percentile of sorted values
+static double Percentile(const vector<double> &sortedValues, const double p) {
+	if (sortedValues.size() == 0)
+		return 0.0;
+
+	const size_t rank = (size_t)ceil(p / 100.0 * sortedValues.size());
+	return sortedValues[Clamp<size_t>(rank, 1, sortedValues.size()) - 1];
+}
+
+BenchmarkSession::BenchmarkSession(const GameConfig *cfg) : gameConfig(cfg) {
+}
+
+BenchmarkSession::~BenchmarkSession() {
+#if !defined(SFERA_DISABLE_OPENCL)
+	OCLRenderer::FreeDeviceResources();
+#endif
+}
+
+void BenchmarkSession::SetScriptedInputs(GamePlayer &player, const unsigned int frame) const {
+	// The time as seen by the player, at the screen refresh cap
+	const unsigned int refreshCap = Max(1u, gameConfig->GetScreenRefreshCap());
+	const float t = frame / (float)refreshCap;
+
+	// An 8 seconds loop: go forward, turn left, go forward, turn right and
+	// jump at the beginning of each loop
+	const unsigned int phase = (frame / (2 * refreshCap)) % 4;
+	player.inputGoForward = true;
+	player.inputTurnLeft = (phase == 1);
+	player.inputTurnRight = (phase == 3);
+	player.inputSlowDown = false;
+	if (frame % (8 * refreshCap) == 0)
+		player.inputJump = true;
+
+	// The camera orbits around the player once every loop
+	player.targetPuppet = true;
+	player.viewPhi = M_PI / 8.f + (2.f * M_PI / 8.f) * t;
+	player.viewTheta = -M_PI / 2.f + .25f * sinf(t);
+}
+
+void BenchmarkSession::Run(const string &levelFileName) {
+	SFERA_LOG("Benchmark level: " << levelFileName);
+
+	GameLevel *gameLevel = new GameLevel(gameConfig, levelFileName);
+	EPSILON = gameLevel->epsilon;
+	gameLevel->startTime = WallClockTime();
+
+	// The physic engine is driven by the benchmark loop, not by a PhysicThread
+	GamePhysic *gamePhysic = new GamePhysic(gameLevel);
+
+	LevelRenderer *renderer;
+	switch (gameConfig->GetRendererType()) {
+		case SINGLE_CPU:
+			renderer = new SingleCPURenderer(gameLevel, true);
+			break;
+		case MULTI_CPU:
+			renderer = new MultiCPURenderer(gameLevel, true);
+			break;
+#if !defined(SFERA_DISABLE_OPENCL)
+		case OPENCL:
+			renderer = new OCLRenderer(gameLevel, true);
+			break;
+#endif
+		default:
+			throw runtime_error("Unknown renderer type in BenchmarkSession::Run()");
+			break;
+	}
+
+	//--------------------------------------------------------------------------
+	// Render the frames
+	//--------------------------------------------------------------------------
+
+	const unsigned int frames = Max(1u, gameConfig->GetBenchmarkFrames());
+	const unsigned int warmUpFrames = gameConfig->GetBenchmarkWarmUpFrames();
+	const unsigned int physicSteps = gameConfig->GetBenchmarkPhysicSteps();
+	SFERA_LOG("Benchmark frames: " << frames << " (warm up: " << warmUpFrames <<
+			", physic steps for each frame: " << physicSteps << ")");
+
+	vector<double> frameTimes;
+	frameTimes.reserve(frames);
+	unsigned long long sampleCount = 0;
+	unsigned long long startRayCount = 0;
+	double physicTime = 0.0;
+	double startTime = WallClockTime();
+
+	for (unsigned int frame = 0; frame < warmUpFrames + frames; ++frame) {
+		if (frame == warmUpFrames) {
+			startRayCount = renderer->GetRayCount();
+			startTime = WallClockTime();
+
+			if (gameLevel->frameProfiler) {
+				gameLevel->frameProfiler->Reset();
+				gameLevel->physicProfiler->Reset();
+			}
+		}
+
+		const double t0 = WallClockTime();
+
+		SetScriptedInputs(*(gameLevel->player), frame);
+		for (unsigned int i = 0; i < physicSteps; ++i)
+			gamePhysic->DoStep();
+
+		const double t1 = WallClockTime();
+
+		const size_t samples = renderer->DrawFrame();
+
+		const double t2 = WallClockTime();
+
+		if (gameLevel->frameProfiler)
+			gameLevel->frameProfiler->EndRecord();
+
+		if (frame >= warmUpFrames) {
+			frameTimes.push_back(t2 - t0);
+			physicTime += t1 - t0;
+			sampleCount += samples;
+		}
+	}
+
+	const double totalTime = WallClockTime() - startTime;
+	const unsigned long long rayCount = renderer->GetRayCount() - startRayCount;
+	const unsigned int sphereCount = gameLevel->scene->spheres.size();
+
+	// The mean time of each stage over the last profiler.records frames
+	vector<double> frameStageTimes, physicStageTimes;
+	if (gameLevel->frameProfiler) {
+		double recordTime;
+		gameLevel->frameProfiler->GetMeanTimes(frameStageTimes, &recordTime);
+		gameLevel->physicProfiler->GetMeanTimes(physicStageTimes, &recordTime);
+	}
+	gameLevel->SaveProfiles("-benchmark");
+
+	delete renderer;
+	delete gamePhysic;
+	delete gameLevel;
+
+	//--------------------------------------------------------------------------
+	// Report the result
+	//--------------------------------------------------------------------------
+
+	WriteReport(cout, levelFileName, sphereCount, totalTime, sampleCount, rayCount,
+			frameTimes, physicTime, frameStageTimes, physicStageTimes);
+
+	const string &outputFileName = gameConfig->GetBenchmarkOutput();
+	if (outputFileName != "") {
+		ofstream file(outputFileName.c_str());
+		if (!file.is_open())
+			throw runtime_error("Unable to open benchmark output file: " + outputFileName);
+
+		WriteReport(file, levelFileName, sphereCount, totalTime, sampleCount, rayCount,
+				frameTimes, physicTime, frameStageTimes, physicStageTimes);
+		if (!file.good())
+			throw runtime_error("Error while writing benchmark output file: " + outputFileName);
+	}
+}
+
+void BenchmarkSession::WriteReport(ostream &os, const string &levelFileName,
+		const unsigned int sphereCount, const double totalTime,
+		const unsigned long long sampleCount, const unsigned long long rayCount,
+		const vector<double> &frameTimes, const double physicTime,
+		const vector<double> &frameStageTimes, const vector<double> &physicStageTimes) const {
+	string rendererType;
+	switch (gameConfig->GetRendererType()) {
+		case SINGLE_CPU:
+			rendererType = "SINGLE_CPU";
+			break;
+		case MULTI_CPU:
+			rendererType = "MULTI_CPU";
+			break;
+		case OPENCL:
+			rendererType = "OPENCL";
+			break;
+		default:
+			rendererType = "UNKNOWN";
+			break;
+	}
+
+	vector<double> sortedTimes(frameTimes);
+	sort(sortedTimes.begin(), sortedTimes.end());
+	const size_t frames = sortedTimes.size();
+	double sum = 0.0;
+	for (size_t i = 0; i < frames; ++i)
+		sum += sortedTimes[i];
+
+	// The frame times are in milliseconds
+	os << fixed << setprecision(3) <<
+			"{\n"
+			"  \"level\": " << JSONString(levelFileName) << ",\n"
+			"  \"renderer\": " << JSONString(rendererType) << ",\n"
+			"  \"width\": " << gameConfig->GetScreenWidth() << ",\n"
+			"  \"height\": " << gameConfig->GetScreenHeight() << ",\n"
+			"  \"spheres\": " << sphereCount << ",\n"
+			"  \"frames\": " << frames << ",\n"
+			"  \"warmUpFrames\": " << gameConfig->GetBenchmarkWarmUpFrames() << ",\n"
+			"  \"physicSteps\": " << gameConfig->GetBenchmarkPhysicSteps() << ",\n"
+			"  \"totalTime\": " << totalTime << ",\n"
+			"  \"framesPerSec\": " << frames / totalTime << ",\n"
+			"  \"samples\": " << sampleCount << ",\n"
+			"  \"samplesPerSec\": " << sampleCount / totalTime << ",\n"
+			"  \"rays\": " << rayCount << ",\n"
+			"  \"raysPerSec\": " << rayCount / totalTime << ",\n"
+			"  \"frameTime\": {\n"
+			"    \"mean\": " << 1000.0 * sum / frames << ",\n"
+			"    \"min\": " << 1000.0 * sortedTimes.front() << ",\n"
+			"    \"p50\": " << 1000.0 * Percentile(sortedTimes, 50.0) << ",\n"
+			"    \"p95\": " << 1000.0 * Percentile(sortedTimes, 95.0) << ",\n"
+			"    \"p99\": " << 1000.0 * Percentile(sortedTimes, 99.0) << ",\n"
+			"    \"max\": " << 1000.0 * sortedTimes.back() << "\n"
+			"  },\n"
+			"  \"physicTime\": {\n"
+			"    \"mean\": " << 1000.0 * physicTime / frames << "\n"
+			"  }";
+
+	// Only available if the profiler is enabled
+	if (frameStageTimes.size() > 0) {
+		os << ",\n"
+				"  \"stages\": {\n"
+				"    \"frame\": ";
+		WriteStageTimes(os, FrameStageNames, frameStageTimes);
+		os << ",\n"
+				"    \"physic\": ";
+		WriteStageTimes(os, PhysicStageNames, physicStageTimes);
+		os << "\n"
+				"  }";
+	}
+
+	os << "\n"
+			"}\n";
+}
@@ -30,7 +30,8 @@
 
 static const string SFERA_LABEL = "Sfera v" SFERA_VERSION_MAJOR "." SFERA_VERSION_MINOR " (Written by David \"Dade\" Bucciarelli)";
 
-DisplaySession::DisplaySession(const GameConfig *cfg) : gameConfig(cfg) {
+DisplaySession::DisplaySession(const GameConfig *cfg) : gameConfig(cfg),
+		showProfiler(false) {
 	const unsigned int width = gameConfig->GetScreenWidth();
 	const unsigned int height = gameConfig->GetScreenHeight();
 
@@ -83,6 +84,11 @@ DisplaySession::DisplaySession(const GameConfig *cfg) : gameConfig(cfg) {
 }
 
 DisplaySession::~DisplaySession() {
+#if !defined(SFERA_DISABLE_OPENCL)
+	// The OpenCL contexts can share objects with the OpenGL one
+	OCLRenderer::FreeDeviceResources();
+#endif
+
 	TTF_CloseFont(fontSmall);
 	TTF_CloseFont(fontMedium);
 	TTF_CloseFont(fontBig);
@@ -121,11 +127,68 @@ void DisplaySession::DrawLevelLabels(const string &bottomLabel, const string &to
 	renderText->Free(topLabelSurf);
 }
 
+void DisplaySession::DrawProfilerLabels(const vector<string> &labels) const {
+	vector<SDL_Surface *> labelSurfs;
+	int width = 0;
+	int height = 0;
+	for (size_t i = 0; i < labels.size(); ++i) {
+		SDL_Surface *labelSurf = renderText->Create(labels[i]);
+		if (labelSurf) {
+			labelSurfs.push_back(labelSurf);
+			width = Max(width, labelSurf->w);
+			height += labelSurf->h;
+		}
+	}
+	if (labelSurfs.size() == 0)
+		return;
+
+	// Just below the top label
+	const int top = gameConfig->GetScreenHeight() - labelSurfs[0]->h - 1;
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glColor4f(0.f, 0.f, 0.f, 0.5f);
+	glRecti(0, top - height, width, top - 1);
+
+	glColor4f(1.0f, 1.0f, 1.0f, 1.f);
+	int y = top;
+	for (size_t i = 0; i < labelSurfs.size(); ++i) {
+		y -= labelSurfs[i]->h;
+		renderText->Draw(labelSurfs[i], 0, y);
+		renderText->Free(labelSurfs[i]);
+	}
+	glDisable(GL_BLEND);
+}
+
+static void AppendProfilerLabels(const StageProfiler *profiler, vector<string> &labels) {
+	vector<double> stageTimes;
+	double recordTime;
+	const unsigned int count = profiler->GetMeanTimes(stageTimes, &recordTime);
+	if (count == 0)
+		return;
+
+	stringstream ss;
+	ss << "[" << profiler->GetName() << " " << fixed << setprecision(2) <<
+			recordTime * 1000.0 << "ms, last " << count << "]";
+	labels.push_back(ss.str());
+
+	for (unsigned int i = 0; i < profiler->GetStageCount(); ++i) {
+		if (stageTimes[i] <= 0.0)
+			continue;
+
+		stringstream ss;
+		ss << "  " << profiler->GetStageName(i) << " " << fixed << setprecision(2) <<
+				stageTimes[i] * 1000.0 << "ms";
+		if (recordTime > 0.0)
+			ss << " (" << setprecision(1) << 100.0 * stageTimes[i] / recordTime << "%)";
+		labels.push_back(ss.str());
+	}
+}
+
 bool DisplaySession::RunLevel(GameSession &gameSession) {
 	GameLevel *currentLevel = gameSession.currentLevel;
 
-	GamePhysic gamePhysic(currentLevel);
-	PhysicThread physicThread(&gamePhysic);
+	PhysicThread physicThread(gameSession.currentPhysic);
 
 	LevelRenderer *renderer;
 	switch (gameConfig->GetRendererType()) {
@@ -160,6 +223,13 @@ bool DisplaySession::RunLevel(GameSession &gameSession) {
 				"[font=big]High Score " << fixed << setprecision(2) << highScore << "secs";
 	const string introMsg = ss.str();
 
+	// Start to profile with the level
+	StageProfiler *frameProfiler = currentLevel->frameProfiler;
+	if (frameProfiler) {
+		frameProfiler->Reset();
+		currentLevel->physicProfiler->Reset();
+	}
+
 	physicThread.Start();
 
 	unsigned int frame = 0;
@@ -169,6 +239,7 @@ bool DisplaySession::RunLevel(GameSession &gameSession) {
 	double currentRefreshTime = 0.0;
 	string topLabel = "";
 	string bottomLabel = "";
+	vector<string> profilerLabels;
 
 	bool quit = false;
 	bool levelDone = false;
@@ -277,6 +348,10 @@ bool DisplaySession::RunLevel(GameSession &gameSession) {
 							}
 							break;
 						}
+						case SDLK_p:
+							if (frameProfiler)
+								showProfiler = !showProfiler;
+							break;
 						default:
 							break;
 					}
@@ -321,13 +396,26 @@ bool DisplaySession::RunLevel(GameSession &gameSession) {
 		// Draw text
 		//----------------------------------------------------------------------
 
-		DrawLevelLabels(bottomLabel, topLabel);
+		{
+			ScopedStageTimer timer(frameProfiler, FRAME_STAGE_TEXT);
 
-		// Draw the intro message during the first 5 seconds
-		if (WallClockTime() - currentLevel->startTime < 5.0)
-			renderText->Draw(introMsg, true);
+			DrawLevelLabels(bottomLabel, topLabel);
+			if (showProfiler)
+				DrawProfilerLabels(profilerLabels);
 
-		SDL_GL_SwapBuffers();
+			// Draw the intro message during the first 5 seconds
+			if (WallClockTime() - currentLevel->startTime < 5.0)
+				renderText->Draw(introMsg, true);
+		}
+
+		{
+			ScopedStageTimer timer(frameProfiler, FRAME_STAGE_SWAP);
+
+			SDL_GL_SwapBuffers();
+		}
+
+		if (frameProfiler)
+			frameProfiler->EndRecord();
 
 		//----------------------------------------------------------------------
 		// Sleep if we are going too fast
@@ -363,10 +451,16 @@ bool DisplaySession::RunLevel(GameSession &gameSession) {
 			stringstream ss;
 			ss << "[Sample/sec: " << fixed << setprecision(2) << (sampleSec / 100000) <<
 					"M s/s][Frame/sec: " << frameSec <<	"/" << gameConfig->GetScreenRefreshCap() <<
-					"][Physic engine Hz: " << gamePhysic.GetRunningHz() <<
+					"][Physic engine Hz: " << gameSession.currentPhysic->GetRunningHz() <<
 					"/"<< gameConfig->GetPhysicRefreshRate() << "]";
 			topLabel = ss.str();
 
+			profilerLabels.clear();
+			if (showProfiler) {
+				AppendProfilerLabels(frameProfiler, profilerLabels);
+				AppendProfilerLabels(currentLevel->physicProfiler, profilerLabels);
+			}
+
 			frameStartTime = now;
 			frame = 0;
 			totalSampleCount = 0;
@@ -386,6 +480,10 @@ bool DisplaySession::RunLevel(GameSession &gameSession) {
 	// Freeze the world
 	physicThread.Stop();
 
+	// Load the next level while the result is shown
+	if (levelDone)
+		gameSession.PreloadNextLevel();
+
 	//--------------------------------------------------------------------------
 	// Show the end of level result
 	//--------------------------------------------------------------------------
@@ -410,6 +508,14 @@ bool DisplaySession::RunLevel(GameSession &gameSession) {
 	}
 	const string msg = ss.str();
 
+	// After the level time has been taken. A failure to write the profiles
+	// isn't fatal for the game.
+	try {
+		currentLevel->SaveProfiles("-level" + ToString(gameSession.GetCurrentLevel()));
+	} catch (const std::exception &err) {
+		SFERA_LOG("[DisplaySession] Error while saving the level profiles: " << err.what());
+	}
+
 	// Wait for a key/mouse event
 	const double startTime = WallClockTime();
 	for (bool endWait = false; !endWait;) {
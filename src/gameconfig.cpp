@@ -46,18 +46,40 @@ const string GameConfig::RENDERER_FILTER_RADIUS = "renderer.filter.radius";
 const string GameConfig::RENDERER_FILTER_RADIUS_DEFAULT = "1";
 const string GameConfig::RENDERER_FILTER_ITERATIONS = "renderer.filter.iterations";
 const string GameConfig::RENDERER_FILTER_ITERATIONS_DEFAULT = "3";
+const string GameConfig::RENDERER_SAMPLER_TYPE = "renderer.sampler.type";
+const string GameConfig::RENDERER_SAMPLER_TYPE_DEFAULT = "SOBOL";
 const string GameConfig::RENDERER_TYPE = "renderer.type";
 #if !defined(SFERA_DISABLE_OPENCL)
 const string GameConfig::RENDERER_TYPE_DEFAULT = "OPENCL";
 #else
-const string GameConfig::RENDERER_TYPE_DEFAULT = "MULTICPU";
+const string GameConfig::RENDERER_TYPE_DEFAULT = "MULTI_CPU";
 #endif
+const string GameConfig::RENDERER_FASTSPHERICALMATH = "renderer.fastsphericalmath";
+const string GameConfig::RENDERER_FASTSPHERICALMATH_DEFAULT = "true";
+const string GameConfig::TEXTUREMAPS_CACHE_MAXSIZE = "texturemaps.cache.maxsize";
+const string GameConfig::TEXTUREMAPS_CACHE_MAXSIZE_DEFAULT = "256";
 const string GameConfig::OPENCL_DEVICES_USEONLYGPUS = "opencl.devices.useonlygpus";
 const string GameConfig::OPENCL_DEVICES_USEONLYGPUS_DEFAULT = "true";
 const string GameConfig::OPENCL_DEVICES_SELECT = "opencl.devices.select";
 const string GameConfig::OPENCL_DEVICES_SELECT_DEFAULT = "";
 const string GameConfig::OPENCL_MEMTYPE = "opencl.memtype";
 const string GameConfig::OPENCL_MEMTYPE_DEFAULT = "__constant";
+const string GameConfig::BENCHMARK_FRAMES = "benchmark.frames";
+const string GameConfig::BENCHMARK_FRAMES_DEFAULT = "300";
+const string GameConfig::BENCHMARK_WARMUPFRAMES = "benchmark.warmupframes";
+const string GameConfig::BENCHMARK_WARMUPFRAMES_DEFAULT = "30";
+const string GameConfig::BENCHMARK_PHYSICSTEPS = "benchmark.physicsteps";
+const string GameConfig::BENCHMARK_PHYSICSTEPS_DEFAULT = "0";
+const string GameConfig::BENCHMARK_OUTPUT = "benchmark.output";
+const string GameConfig::BENCHMARK_OUTPUT_DEFAULT = "";
+const string GameConfig::PROFILER_ENABLE = "profiler.enable";
+const string GameConfig::PROFILER_ENABLE_DEFAULT = "true";
+const string GameConfig::PROFILER_RECORDS = "profiler.records";
+const string GameConfig::PROFILER_RECORDS_DEFAULT = "256";
+const string GameConfig::PROFILER_OUTPUT = "profiler.output";
+const string GameConfig::PROFILER_OUTPUT_DEFAULT = "";
+const string GameConfig::PROFILER_FORMAT = "profiler.format";
+const string GameConfig::PROFILER_FORMAT_DEFAULT = "CSV";
 
 GameConfig::GameConfig(const string &fileName) {
 	InitValues();
@@ -103,10 +125,21 @@ void GameConfig::InitValues() {
 	cfg.SetString(RENDERER_FILTER_TYPE, RENDERER_FILTER_TYPE_DEFAULT);
 	cfg.SetString(RENDERER_FILTER_RADIUS, RENDERER_FILTER_RADIUS_DEFAULT);
 	cfg.SetString(RENDERER_FILTER_ITERATIONS, RENDERER_FILTER_ITERATIONS_DEFAULT);
+	cfg.SetString(RENDERER_SAMPLER_TYPE, RENDERER_SAMPLER_TYPE_DEFAULT);
 	cfg.SetString(RENDERER_TYPE, RENDERER_TYPE_DEFAULT);
+	cfg.SetString(RENDERER_FASTSPHERICALMATH, RENDERER_FASTSPHERICALMATH_DEFAULT);
+	cfg.SetString(TEXTUREMAPS_CACHE_MAXSIZE, TEXTUREMAPS_CACHE_MAXSIZE_DEFAULT);
 	cfg.SetString(OPENCL_DEVICES_USEONLYGPUS, OPENCL_DEVICES_USEONLYGPUS_DEFAULT);
 	cfg.SetString(OPENCL_DEVICES_SELECT, OPENCL_DEVICES_SELECT_DEFAULT);
 	cfg.SetString(OPENCL_MEMTYPE, OPENCL_MEMTYPE_DEFAULT);
+	cfg.SetString(BENCHMARK_FRAMES, BENCHMARK_FRAMES_DEFAULT);
+	cfg.SetString(BENCHMARK_WARMUPFRAMES, BENCHMARK_WARMUPFRAMES_DEFAULT);
+	cfg.SetString(BENCHMARK_PHYSICSTEPS, BENCHMARK_PHYSICSTEPS_DEFAULT);
+	cfg.SetString(BENCHMARK_OUTPUT, BENCHMARK_OUTPUT_DEFAULT);
+	cfg.SetString(PROFILER_ENABLE, PROFILER_ENABLE_DEFAULT);
+	cfg.SetString(PROFILER_RECORDS, PROFILER_RECORDS_DEFAULT);
+	cfg.SetString(PROFILER_OUTPUT, PROFILER_OUTPUT_DEFAULT);
+	cfg.SetString(PROFILER_FORMAT, PROFILER_FORMAT_DEFAULT);
 }
 
 void GameConfig::InitCachedValues() {
@@ -138,6 +171,16 @@ void GameConfig::InitCachedValues() {
 	rendererFilterRadius = (unsigned int)cfg.GetInt(RENDERER_FILTER_RADIUS, atoi(RENDERER_FILTER_RADIUS_DEFAULT.c_str()));
 	rendererFilterIterations = (unsigned int)cfg.GetInt(RENDERER_FILTER_ITERATIONS, atoi(RENDERER_FILTER_ITERATIONS_DEFAULT.c_str()));
 
+	string samplerType = cfg.GetString(RENDERER_SAMPLER_TYPE, RENDERER_SAMPLER_TYPE_DEFAULT);
+	if (samplerType == "RANDOM")
+		rendererSamplerType = SAMPLER_RANDOM;
+	else if (samplerType == "SOBOL")
+		rendererSamplerType = SAMPLER_SOBOL;
+	else if (samplerType == "SOBOL_BLUENOISE")
+		rendererSamplerType = SAMPLER_SOBOL_BLUENOISE;
+	else
+		throw runtime_error("Unknown sampler type: " + samplerType);
+
 	string rendType = cfg.GetString(RENDERER_TYPE, RENDERER_TYPE_DEFAULT);
 	if (rendType == "SINGLE_CPU")
 		rendererType = SINGLE_CPU;
@@ -150,6 +193,10 @@ void GameConfig::InitCachedValues() {
 	else
 		throw runtime_error("Unknown rendrer type: " + rendType);
 
+	rendererFastSphericalMath = (cfg.GetString(RENDERER_FASTSPHERICALMATH, RENDERER_FASTSPHERICALMATH_DEFAULT) == "true");
+
+	textureMapsCacheMaxSize = (unsigned int)cfg.GetInt(TEXTUREMAPS_CACHE_MAXSIZE, atoi(TEXTUREMAPS_CACHE_MAXSIZE_DEFAULT.c_str()));
+
 	openCLUseOnlyGPUs = (cfg.GetString(OPENCL_DEVICES_USEONLYGPUS, OPENCL_DEVICES_USEONLYGPUS_DEFAULT) == "true");
 	openCLDeviceSelect = cfg.GetString(OPENCL_DEVICES_SELECT, OPENCL_DEVICES_SELECT_DEFAULT);
 	openCLMemType = cfg.GetString(OPENCL_MEMTYPE, OPENCL_MEMTYPE_DEFAULT);
@@ -161,4 +208,23 @@ void GameConfig::InitCachedValues() {
 		ss << "opencl.devices." << i << ".sampleperpass";
 		openCLSamplePerPass[i] = (unsigned int)cfg.GetInt(ss.str(), rendererSamplePerPass);
 	}
+
+	benchmarkFrames = (unsigned int)cfg.GetInt(BENCHMARK_FRAMES, atoi(BENCHMARK_FRAMES_DEFAULT.c_str()));
+	benchmarkWarmUpFrames = (unsigned int)cfg.GetInt(BENCHMARK_WARMUPFRAMES, atoi(BENCHMARK_WARMUPFRAMES_DEFAULT.c_str()));
+	benchmarkPhysicSteps = (unsigned int)cfg.GetInt(BENCHMARK_PHYSICSTEPS, atoi(BENCHMARK_PHYSICSTEPS_DEFAULT.c_str()));
+	// 0 means the steps done by the physic engine at the screen refresh cap
+	if (benchmarkPhysicSteps == 0)
+		benchmarkPhysicSteps = Max(1u, physicRefreshRate / Max(1u, screenRefreshCap));
+	benchmarkOutput = cfg.GetString(BENCHMARK_OUTPUT, BENCHMARK_OUTPUT_DEFAULT);
+
+	profilerEnable = (cfg.GetString(PROFILER_ENABLE, PROFILER_ENABLE_DEFAULT) == "true");
+	profilerRecords = (unsigned int)Max(1, cfg.GetInt(PROFILER_RECORDS, atoi(PROFILER_RECORDS_DEFAULT.c_str())));
+	profilerOutput = cfg.GetString(PROFILER_OUTPUT, PROFILER_OUTPUT_DEFAULT);
+	const string profilerFormat = cfg.GetString(PROFILER_FORMAT, PROFILER_FORMAT_DEFAULT);
+	if (profilerFormat == "CSV")
+		profilerOutputExtension = ".csv";
+	else if (profilerFormat == "JSON")
+		profilerOutputExtension = ".json";
+	else
+		throw runtime_error("Unknown profiler output format: " + profilerFormat);
 }
@@ -18,29 +18,35 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <memory>
+
 #include "gamelevel.h"
-#include "epsilon.h"
 #include "sdl/editaction.h"
 
 GameLevel::GameLevel(const GameConfig *cfg, const string &levelFileName) : gameConfig(cfg) {
 	SFERA_LOG("Reading level: " << levelFileName);
 
-	Properties lvlProp(levelFileName);
+	// The spheres are read from the compiled level if it is available, it is
+	// freed (with its mapped region) even if the parsing of the level fails
+	std::auto_ptr<CompiledLevel> level(CompiledLevel::Read(levelFileName));
+	const Properties &lvlProp(level->GetProperties());
 	texMapCache = new TextureMapCache();
 
 	//--------------------------------------------------------------------------
 	// Read the path tracing configuration
 	//--------------------------------------------------------------------------
 
-	EPSILON = lvlProp.GetFloat("path.epsilon", 0.001f);
+	epsilon = lvlProp.GetFloat("path.epsilon", 0.001f);
 	maxPathDiffuseBounces = lvlProp.GetInt("path.maxdiffusebounces", 2);
 	maxPathSpecularGlossyBounces = lvlProp.GetInt("path.maxspecularglossybounces", 4);
+	russianRouletteDepth = lvlProp.GetInt("path.russianroulette.depth", 3);
+	russianRouletteCap = Clamp(lvlProp.GetFloat("path.russianroulette.cap", .5f), 0.01f, 1.f);
 
 	//--------------------------------------------------------------------------
 	// Read the scene
 	//--------------------------------------------------------------------------
 
-	scene = new Scene(lvlProp, texMapCache);
+	scene = new Scene(*level, texMapCache);
 	offPillCount = 0;
 
 	//--------------------------------------------------------------------------
@@ -77,6 +83,18 @@ GameLevel::GameLevel(const GameConfig *cfg, const string &levelFileName) : gameC
 
 	editActionList.AddAllAction();
 
+	level.reset();
+
+	if (gameConfig->GetProfilerEnable()) {
+		frameProfiler = new StageProfiler("frame", FrameStageNames, FRAME_STAGE_COUNT,
+				gameConfig->GetProfilerRecords());
+		physicProfiler = new StageProfiler("physic", PhysicStageNames, PHYSIC_STAGE_COUNT,
+				gameConfig->GetProfilerRecords());
+	} else {
+		frameProfiler = NULL;
+		physicProfiler = NULL;
+	}
+
 	startTime = WallClockTime();
 }
 
@@ -86,6 +104,8 @@ GameLevel::~GameLevel() {
 	delete camera;
 	delete texMapCache;
 	delete toneMap;
+	delete frameProfiler;
+	delete physicProfiler;
 }
 
 void GameLevel::Refresh(const float refreshRate) {
@@ -93,4 +113,14 @@ void GameLevel::Refresh(const float refreshRate) {
 	player->ApplyInputs(refreshRate);
 	player->UpdatePuppet();
 	player->UpdateCamera(*camera, gameConfig->GetScreenWidth(), gameConfig->GetScreenHeight());
-}
\ No newline at end of file
+}
+
+void GameLevel::SaveProfiles(const string &suffix) const {
+	const string &output = gameConfig->GetProfilerOutput();
+	if (!frameProfiler || (output == ""))
+		return;
+
+	const string &extension = gameConfig->GetProfilerOutputExtension();
+	frameProfiler->Save(output + suffix + "-frame" + extension);
+	physicProfiler->Save(output + suffix + "-physic" + extension);
+}
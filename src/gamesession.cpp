@@ -24,24 +24,46 @@
 #include <boost/filesystem.hpp>
 
 #include "gamesession.h"
+#include "epsilon.h"
 
 using namespace boost::filesystem;
 
 GameSession::GameSession(const GameConfig *cfg, const string &pack) :
-	gameConfig(cfg), packName(pack), currentLevel(NULL), packLevelList(packName),
-	currentLevelNumber(0), highScores(&packLevelList), totalLevelsTime(0.0) {
+	gameConfig(cfg), packName(pack), currentLevel(NULL), currentPhysic(NULL),
+	packLevelList(packName), currentLevelNumber(0), highScores(&packLevelList),
+	totalLevelsTime(0.0), preloadThread(NULL), preloadedLevelNumber(0),
+	preloadedLevel(NULL), preloadedPhysic(NULL) {
 }
 
 GameSession::~GameSession() {
 	// Save the high scores
 	highScores.Save();
 
+	WaitPreloadedLevel();
+	delete preloadedPhysic;
+	delete preloadedLevel;
+
+	delete currentPhysic;
 	delete currentLevel;
 }
 
 void GameSession::Begin(const unsigned int startLevel) {
 	currentLevelNumber = startLevel;
-	LoadLevel(currentLevelNumber);
+
+	GameLevel *gameLevel;
+	GamePhysic *gamePhysic;
+	LoadLevel(currentLevelNumber, &gameLevel, &gamePhysic);
+	SetCurrentLevel(gameLevel, gamePhysic);
+}
+
+void GameSession::PreloadNextLevel() {
+	// Check if there is a next level or if it is already loading
+	if ((currentLevelNumber + 1 > packLevelList.names.size()) || preloadThread ||
+			(preloadedLevelNumber == currentLevelNumber + 1))
+		return;
+
+	preloadedLevelNumber = currentLevelNumber + 1;
+	preloadThread = new boost::thread(boost::bind(GameSession::PreloadThreadImpl, this));
 }
 
 bool GameSession::NextLevel() {
@@ -51,17 +73,77 @@ bool GameSession::NextLevel() {
 	if (currentLevelNumber > packLevelList.names.size())
 		return false;
 
-	LoadLevel(currentLevelNumber);
+	GameLevel *gameLevel = NULL;
+	GamePhysic *gamePhysic = NULL;
+	if (preloadedLevelNumber == currentLevelNumber) {
+		WaitPreloadedLevel();
+
+		gameLevel = preloadedLevel;
+		gamePhysic = preloadedPhysic;
+		preloadedLevel = NULL;
+		preloadedPhysic = NULL;
+	}
+	preloadedLevelNumber = 0;
+
+	// Load the level now if it wasn't preloaded or the preloading has failed
+	if (!gameLevel)
+		LoadLevel(currentLevelNumber, &gameLevel, &gamePhysic);
+
+	SetCurrentLevel(gameLevel, gamePhysic);
 
 	return true;
 }
 
-void GameSession::LoadLevel(const unsigned int level) {
+void GameSession::LoadLevel(const unsigned int level,
+		GameLevel **gameLevel, GamePhysic **gamePhysic) const {
 	stringstream ss;
 	ss << "gamedata/packs/" + packName + "/lvl" << std::setw(2) << std::setfill('0') <<
 			level << "-" + packLevelList.names[level - 1] << ".lvl";
 
-	currentLevel = new GameLevel(gameConfig, ss.str());
+	*gameLevel = new GameLevel(gameConfig, ss.str());
+	try {
+		*gamePhysic = new GamePhysic(*gameLevel);
+	} catch (...) {
+		delete *gameLevel;
+		throw;
+	}
+}
+
+void GameSession::SetCurrentLevel(GameLevel *gameLevel, GamePhysic *gamePhysic) {
+	GameLevel *previousLevel = currentLevel;
+	delete currentPhysic;
+
+	currentLevel = gameLevel;
+	currentPhysic = gamePhysic;
+
+	// The level may have been loaded some time ago
+	EPSILON = currentLevel->epsilon;
+	currentLevel->startTime = WallClockTime();
+
+	// Deleted after the new level has been loaded, so the texture maps used
+	// by both are not released
+	delete previousLevel;
+}
+
+void GameSession::WaitPreloadedLevel() {
+	if (preloadThread) {
+		preloadThread->join();
+		delete preloadThread;
+		preloadThread = NULL;
+	}
+}
+
+void GameSession::PreloadThreadImpl(GameSession *gameSession) {
+	SFERA_LOG("[GameSession] Preloading level: " << gameSession->preloadedLevelNumber);
+
+	try {
+		gameSession->LoadLevel(gameSession->preloadedLevelNumber,
+				&gameSession->preloadedLevel, &gameSession->preloadedPhysic);
+	} catch (const std::exception &err) {
+		SFERA_LOG("[GameSession] Error while preloading level: " << err.what());
+		gameSession->preloadedLevel = NULL;
+		gameSession->preloadedPhysic = NULL;
+	}
 }
 
 void GameSession::SetLevelTime(const double t) {
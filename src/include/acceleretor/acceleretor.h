@@ -38,6 +38,8 @@ public:
 	virtual void Init(const vector<const Sphere *> &spheres) = 0;
 
 	virtual bool Intersect(Ray *ray, Sphere **hitSphere, unsigned int *primitiveIndex) const = 0;
+	// Returns true if there is any intersection (i.e. for shadow rays)
+	virtual bool IntersectP(const Ray *ray) const = 0;
 };
 
 #endif	/* _SFERA_ACCELERETOR_H */
@@ -50,6 +50,7 @@ public:
 	AcceleratorType GetType() const { return ACCEL_BVH; }
 
 	bool Intersect(Ray *ray, Sphere **hitSphere, unsigned int *primitiveIndex) const;
+	bool IntersectP(const Ray *ray) const;
 
 
 	unsigned int nNodes;
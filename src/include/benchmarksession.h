@@ -0,0 +1,50 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _SFERA_BENCHMARKSESSION_H
+#define	_SFERA_BENCHMARKSESSION_H
+
+#include "sfera.h"
+#include "gameconfig.h"
+#include "gameplayer.h"
+
+// Runs a level for a fixed number of frames without SDL, TTF or OpenGL. The
+// player and the camera follow a scripted path and the physic engine does a
+// fixed number of steps for each frame, so every run renders the same frames.
+// The result is reported in JSON format.
+class BenchmarkSession {
+public:
+	BenchmarkSession(const GameConfig *cfg);
+	~BenchmarkSession();
+
+	void Run(const string &levelFileName);
+
+	const GameConfig *gameConfig;
+
+private:
+	void SetScriptedInputs(GamePlayer &player, const unsigned int frame) const;
+	void WriteReport(ostream &os, const string &levelFileName,
+		const unsigned int sphereCount, const double totalTime,
+		const unsigned long long sampleCount, const unsigned long long rayCount,
+		const vector<double> &frameTimes, const double physicTime,
+		const vector<double> &frameStageTimes, const vector<double> &physicStageTimes) const;
+};
+
+#endif	/* _SFERA_BENCHMARKSESSION_H */
@@ -37,6 +37,7 @@ public:
 
 private:
 	void DrawLevelLabels(const string &bottomLabel, const string &topLabel) const;
+	void DrawProfilerLabels(const vector<string> &labels) const;
 
 	bool RunIntro();
 	bool RunStartMenu();
@@ -49,6 +50,9 @@ private:
 
 	TTF_Font *fontSmall, *fontMedium, *fontBig;
 	RenderText *renderText;
+
+	// Toggled with the 'p' key, it is kept between levels
+	bool showProfiler;
 };
 
 #endif	/* _SFERA_DISPLAYSESSION_H */
@@ -23,6 +23,7 @@
 
 #include "sfera.h"
 #include "utils/properties.h"
+#include "utils/sampler.h"
 
 typedef enum {
 	NO_FILTER, BLUR_LIGHT, BLUR_HEAVY, BOX
@@ -58,13 +59,35 @@ public:
 	FilterType GetRendererFilterType() const { return rendererFilterType; }
 	unsigned int GetRendererFilterRaidus() const { return rendererFilterRadius; }
 	unsigned int GetRendererFilterIterations() const { return rendererFilterIterations; }
+	SamplerType GetRendererSamplerType() const { return rendererSamplerType; }
 	RendererType GetRendererType() const { return rendererType; }
+	// Use the polynomial approximations of SphericalPhi() and SphericalTheta()
+	bool GetRendererFastSphericalMath() const { return rendererFastSphericalMath; }
+
+	// Max. size (in Mbytes) of the texture maps kept across the levels
+	unsigned int GetTextureMapsCacheMaxSize() const { return textureMapsCacheMaxSize; }
 
 	bool GetOpenCLUseOnlyGPUs() const { return openCLUseOnlyGPUs; }
 	const string &GetOpenCLDeviceSelect() const { return openCLDeviceSelect; }
 	unsigned int GetOpenCLDeviceSamplePerPass(const size_t index) const { return openCLSamplePerPass[index]; }
 	const string &GetOpenCLMemType() const { return openCLMemType; }
 
+	// Benchmark mode parameters
+	unsigned int GetBenchmarkFrames() const { return benchmarkFrames; }
+	unsigned int GetBenchmarkWarmUpFrames() const { return benchmarkWarmUpFrames; }
+	// Physic engine steps done for each rendered frame
+	unsigned int GetBenchmarkPhysicSteps() const { return benchmarkPhysicSteps; }
+	const string &GetBenchmarkOutput() const { return benchmarkOutput; }
+
+	// Per-stage timings of the frames and of the physic steps
+	bool GetProfilerEnable() const { return profilerEnable; }
+	// Size of the ring buffers of the timings
+	unsigned int GetProfilerRecords() const { return profilerRecords; }
+	// The timings are saved at the end of each level only if it is not empty
+	const string &GetProfilerOutput() const { return profilerOutput; }
+	// ".csv" or ".json"
+	const string &GetProfilerOutputExtension() const { return profilerOutputExtension; }
+
 private:
 	// List of possible properties
 	const static string SCREEN_WIDTH;
@@ -93,14 +116,36 @@ private:
 	const static string RENDERER_FILTER_RADIUS_DEFAULT;
 	const static string RENDERER_FILTER_ITERATIONS;
 	const static string RENDERER_FILTER_ITERATIONS_DEFAULT;
+	const static string RENDERER_SAMPLER_TYPE;
+	const static string RENDERER_SAMPLER_TYPE_DEFAULT;
 	const static string RENDERER_TYPE;
 	const static string RENDERER_TYPE_DEFAULT;
+	const static string RENDERER_FASTSPHERICALMATH;
+	const static string RENDERER_FASTSPHERICALMATH_DEFAULT;
+	const static string TEXTUREMAPS_CACHE_MAXSIZE;
+	const static string TEXTUREMAPS_CACHE_MAXSIZE_DEFAULT;
 	const static string OPENCL_DEVICES_USEONLYGPUS;
 	const static string OPENCL_DEVICES_USEONLYGPUS_DEFAULT;
 	const static string OPENCL_DEVICES_SELECT;
 	const static string OPENCL_DEVICES_SELECT_DEFAULT;
 	const static string OPENCL_MEMTYPE;
 	const static string OPENCL_MEMTYPE_DEFAULT;
+	const static string BENCHMARK_FRAMES;
+	const static string BENCHMARK_FRAMES_DEFAULT;
+	const static string BENCHMARK_WARMUPFRAMES;
+	const static string BENCHMARK_WARMUPFRAMES_DEFAULT;
+	const static string BENCHMARK_PHYSICSTEPS;
+	const static string BENCHMARK_PHYSICSTEPS_DEFAULT;
+	const static string BENCHMARK_OUTPUT;
+	const static string BENCHMARK_OUTPUT_DEFAULT;
+	const static string PROFILER_ENABLE;
+	const static string PROFILER_ENABLE_DEFAULT;
+	const static string PROFILER_RECORDS;
+	const static string PROFILER_RECORDS_DEFAULT;
+	const static string PROFILER_OUTPUT;
+	const static string PROFILER_OUTPUT_DEFAULT;
+	const static string PROFILER_FORMAT;
+	const static string PROFILER_FORMAT_DEFAULT;
 
 	void InitValues();
 	void InitCachedValues();
@@ -122,13 +167,27 @@ private:
 	FilterType rendererFilterType;
 	unsigned int rendererFilterRadius;
 	unsigned int rendererFilterIterations;
+	SamplerType rendererSamplerType;
 	RendererType rendererType;
+	bool rendererFastSphericalMath;
+
+	unsigned int textureMapsCacheMaxSize;
 
 	bool openCLUseOnlyGPUs;
 	string openCLDeviceSelect;
 	string openCLMemType;
 
 	vector<unsigned int> openCLSamplePerPass;
+
+	unsigned int benchmarkFrames;
+	unsigned int benchmarkWarmUpFrames;
+	unsigned int benchmarkPhysicSteps;
+	string benchmarkOutput;
+
+	bool profilerEnable;
+	unsigned int profilerRecords;
+	string profilerOutput;
+	string profilerOutputExtension;
 };
 
 #endif	/* _SFERA_GAMECONFIG_H */
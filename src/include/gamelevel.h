@@ -29,6 +29,7 @@
 #include "sdl/texmap.h"
 #include "sdl/editaction.h"
 #include "pixel/tonemap.h"
+#include "utils/stageprofiler.h"
 
 class GameLevel {
 public:
@@ -36,13 +37,22 @@ public:
 	~GameLevel();
 
 	void Refresh(const float refreshRate);
+	// Saves the profiles in <profiler.output><suffix>-frame.csv (or .json)
+	// and <profiler.output><suffix>-physic.csv, if profiler.output is set
+	void SaveProfiles(const string &suffix) const;
 
 	mutable boost::mutex levelMutex;
 
 	const GameConfig *gameConfig;
 
+	// Copied in the global EPSILON when the level becomes the current one
+	float epsilon;
 	unsigned int maxPathDiffuseBounces;
 	unsigned int maxPathSpecularGlossyBounces;
+	// Russian roulette is used after russianRouletteDepth bounces, paths
+	// survive with a probability of at least russianRouletteCap
+	unsigned int russianRouletteDepth;
+	float russianRouletteCap;
 	Scene *scene;
 	TextureMapCache *texMapCache;
 	ToneMap *toneMap;
@@ -54,6 +64,11 @@ public:
 	unsigned int offPillCount;
 
 	EditActionList editActionList;
+
+	// The stages of the frames and of the physic steps, NULL if the profiling
+	// is disabled
+	StageProfiler *frameProfiler;
+	StageProfiler *physicProfiler;
 };
 
 #endif	/* _SFERA_GAMELEVEL_H */
@@ -24,6 +24,7 @@
 #include "sfera.h"
 #include "gameconfig.h"
 #include "gamelevel.h"
+#include "physic/gamephysic.h"
 #include "utils/packlevellist.h"
 #include "utils/packhighscore.h"
 
@@ -33,6 +34,9 @@ public:
 	~GameSession();
 
 	void Begin(const unsigned int startLevel = 1);
+	// Starts loading the next level in background, NextLevel() will then
+	// only have to wait for the end of the loading
+	void PreloadNextLevel();
 	bool NextLevel();
 
 	unsigned int GetCurrentLevel() const { return currentLevelNumber; }
@@ -63,9 +67,14 @@ public:
 	const string packName;
 
 	GameLevel *currentLevel;
+	GamePhysic *currentPhysic;
 
 private:
-	void LoadLevel(const unsigned int level);
+	void LoadLevel(const unsigned int level, GameLevel **gameLevel, GamePhysic **gamePhysic) const;
+	void SetCurrentLevel(GameLevel *gameLevel, GamePhysic *gamePhysic);
+	void WaitPreloadedLevel();
+
+	static void PreloadThreadImpl(GameSession *gameSession);
 
 	PackLevelList packLevelList;
 	unsigned int currentLevelNumber;
@@ -73,6 +82,11 @@ private:
 	PackHighScore highScores;
 
 	double totalLevelsTime;
+
+	boost::thread *preloadThread;
+	unsigned int preloadedLevelNumber;
+	GameLevel *preloadedLevel;
+	GamePhysic *preloadedPhysic;
 };
 
 #endif	/* _SFERA_GAMESESSION_H */
@@ -173,6 +173,17 @@ inline float SphericalPhi(const Vector &v) {
 	return (p < 0.f) ? p + 2.f * M_PI : p;
 }
 
+// Same of SphericalTheta() and SphericalPhi() but with the polynomial
+// approximations of acosf() and atan2f()
+inline float FastSphericalTheta(const Vector &v) {
+	return FastAcos(v.z);
+}
+
+inline float FastSphericalPhi(const Vector &v) {
+	float p = FastAtan2(v.y, v.x);
+	return (p < 0.f) ? p + 2.f * M_PI : p;
+}
+
 inline float CosTheta(const Vector &w) {
 	return w.z;
 }
@@ -210,23 +210,43 @@ public:
 	static void ApplyBlurHeavyFilter(Pixel *frameBuffer, Pixel *tmpFrameBuffer,
 		const unsigned int width, const unsigned int height);
 
-private:
+	// The single passes of the separable filters, they work only on the
+	// [yStart, yEnd) band of rows so they can be split across multiple
+	// threads. All X passes must be completed before any Y pass starts
+	// (and vice versa).
 	static void ApplyBoxFilterX(const Pixel *src, Pixel *dst,
-		const unsigned int width, const unsigned int height, const unsigned int radius);
+		const unsigned int width, const unsigned int height, const unsigned int radius,
+		const unsigned int yStart, const unsigned int yEnd);
+	// rowSums is a scratch buffer of width * 3 floats owned by the caller
+	// (one for each thread). If continueRowSums is true, the band starts
+	// where the previous call with the same buffer has ended and its running
+	// sums are reused (i.e. a band processed in tiles).
 	static void ApplyBoxFilterY(const Pixel *src, Pixel *dst,
-		const unsigned int width, const unsigned int height, const unsigned int radius);
-	static void ApplyBoxFilterXR1(const Pixel *src, Pixel *dst,
-		const unsigned int width, const unsigned int height);
-	static void ApplyBoxFilterYR1(const Pixel *src, Pixel *dst,
-		const unsigned int width, const unsigned int height);
-	static void ApplyBlurLightFilterXR1(const Pixel *src, Pixel *dst,
-		const unsigned int width, const unsigned int height);
-	static void ApplyBlurLightFilterYR1(const Pixel *src, Pixel *dst,
-		const unsigned int width, const unsigned int height);
-	static void ApplyBlurHeavyFilterXR1(const Pixel *src, Pixel *dst,
-		const unsigned int width, const unsigned int height);
-	static void ApplyBlurHeavyFilterYR1(const Pixel *src, Pixel *dst,
-		const unsigned int width, const unsigned int height);
+		const unsigned int width, const unsigned int height, const unsigned int radius,
+		const unsigned int yStart, const unsigned int yEnd,
+		float *rowSums, const bool continueRowSums = false);
+	static void ApplyBlurLightFilterX(const Pixel *src, Pixel *dst,
+		const unsigned int width, const unsigned int height,
+		const unsigned int yStart, const unsigned int yEnd);
+	static void ApplyBlurLightFilterY(const Pixel *src, Pixel *dst,
+		const unsigned int width, const unsigned int height,
+		const unsigned int yStart, const unsigned int yEnd);
+	static void ApplyBlurHeavyFilterX(const Pixel *src, Pixel *dst,
+		const unsigned int width, const unsigned int height,
+		const unsigned int yStart, const unsigned int yEnd);
+	static void ApplyBlurHeavyFilterY(const Pixel *src, Pixel *dst,
+		const unsigned int width, const unsigned int height,
+		const unsigned int yStart, const unsigned int yEnd);
+
+private:
+	static void ApplyBlurFilterX(const Pixel *src, Pixel *dst,
+		const unsigned int width, const unsigned int height,
+		const float aF, const float bF, const float cF,
+		const unsigned int yStart, const unsigned int yEnd);
+	static void ApplyBlurFilterY(const Pixel *src, Pixel *dst,
+		const unsigned int width, const unsigned int height,
+		const float aF, const float bF, const float cF,
+		const unsigned int yStart, const unsigned int yEnd);
 
 	const unsigned int width, height;
 
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _SFERA_PIXELBUFFERRING_H
+#define	_SFERA_PIXELBUFFERRING_H
+
+#include "sfera.h"
+
+#define PIXELBUFFERRING_MAX_SIZE 3
+
+//------------------------------------------------------------------------------
+// A ring of RGBA8 pixel buffer objects used to stream frames to the GPU.
+//
+// When ARB_buffer_storage and ARB_sync are available the buffers are
+// persistently mapped and a fence protects each buffer until the GPU has
+// consumed it. Otherwise each buffer is orphaned and mapped again every time
+// it is acquired. All methods must be called by the thread owning the OpenGL
+// context, the memory returned by GetPixels() can be written by any thread.
+//
+// In headless mode (i.e. without an OpenGL context) the buffers are plain
+// memory and nothing is drawn.
+//------------------------------------------------------------------------------
+
+class PixelBufferRing {
+public:
+	PixelBufferRing(const unsigned int width, const unsigned int height,
+		const unsigned int size = PIXELBUFFERRING_MAX_SIZE, const bool headless = false);
+	~PixelBufferRing();
+
+	// Returns the index of the next free buffer, waiting for the GPU if required
+	unsigned int Acquire();
+	unsigned char *GetPixels(const unsigned int index) const { return pixels[index]; }
+	// Draws an acquired buffer, the buffer is then released
+	void Draw(const unsigned int index);
+
+	bool IsPersistent() const { return persistent; }
+	bool IsHeadless() const { return headless; }
+
+private:
+	void Map(const unsigned int index);
+	void WaitFence(const unsigned int index);
+
+	const unsigned int width, height;
+	const unsigned int size;
+	unsigned int next;
+
+	bool headless, persistent;
+	GLuint pbo[PIXELBUFFERRING_MAX_SIZE];
+	unsigned char *pixels[PIXELBUFFERRING_MAX_SIZE];
+#if defined(GL_ARB_sync)
+	GLsync fence[PIXELBUFFERRING_MAX_SIZE];
+#endif
+};
+
+#endif	/* _SFERA_PIXELBUFFERRING_H */
@@ -43,6 +43,10 @@ public:
 
 	virtual ToneMapType GetType() const = 0;
 	virtual void Map(FrameBuffer *src, FrameBuffer *dst) const = 0;
+	// Tone map, gamma correct and pack to RGBA8 a span of count pixels. The
+	// average luminance of the frame is required only by some operator.
+	virtual void MapRGBA8(const Pixel *src, unsigned char *dst,
+		const unsigned int count, const float averageLuminance) const = 0;
 
 protected:
 	void InitGammaTable();
@@ -61,8 +65,23 @@ protected:
 		return Spectrum(Radiance2PixelFloat(c.r), Radiance2PixelFloat(c.g), Radiance2PixelFloat(c.b));
 	}
 
+	unsigned char Radiance2PixelUChar(const float x) const {
+		const unsigned int index = Min<unsigned int>(
+			Floor2UInt(GAMMA_TABLE_SIZE * Clamp(x, 0.f, 1.f)),
+				GAMMA_TABLE_SIZE - 1);
+		return gammaTableUChar[index];
+	}
+
+	void Radiance2PixelRGBA8(const Spectrum& c, unsigned char *dst) const {
+		dst[0] = Radiance2PixelUChar(c.r);
+		dst[1] = Radiance2PixelUChar(c.g);
+		dst[2] = Radiance2PixelUChar(c.b);
+		dst[3] = 255;
+	}
+
 	float gamma;
 	float gammaTable[GAMMA_TABLE_SIZE];
+	unsigned char gammaTableUChar[GAMMA_TABLE_SIZE];
 };
 
 class LinearToneMap : public ToneMap {
@@ -73,6 +92,8 @@ public:
 
 	ToneMapType GetType() const { return TONEMAP_LINEAR; }
 	void Map(FrameBuffer *src, FrameBuffer *dst) const;
+	void MapRGBA8(const Pixel *src, unsigned char *dst,
+		const unsigned int count, const float averageLuminance) const;
 
 	float scale;
 };
@@ -88,6 +109,8 @@ public:
 
 	ToneMapType GetType() const { return TONEMAP_REINHARD02; }
 	void Map(FrameBuffer *src, FrameBuffer *dst) const;
+	void MapRGBA8(const Pixel *src, unsigned char *dst,
+		const unsigned int count, const float averageLuminance) const;
 
 	float preScale, postScale, burn;
 };
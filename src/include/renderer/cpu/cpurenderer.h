@@ -22,32 +22,96 @@
 #define	_SFERA_CPURENDERER_H
 
 #include "gamelevel.h"
-#include "utils/randomgen.h"
+#include "utils/sampler.h"
 #include "renderer/levelrenderer.h"
+#include "renderer/cpu/cpuscene.h"
 #include "pixel/framebuffer.h"
+#include "pixel/pixelbufferring.h"
 #include "acceleretor/acceleretor.h"
 #include "acceleretor/bvhaccel.h"
 
+#define CPURENDERER_POSTPROCESS_TILE_HEIGHT 8
+
+// BVH tree parameters used by BuildAcceleretor()
+#define CPURENDERER_BVH_TREETYPE 4 // Tree type to generate (2 = binary, 4 = quad, 8 = octree)
+#define CPURENDERER_BVH_ISECTCOST 80
+#define CPURENDERER_BVH_TRAVCOST 10
+#define CPURENDERER_BVH_EMPTYBONUS 0.5f
+
 class CPURenderer : public LevelRenderer {
 public:
-	CPURenderer(GameLevel *level);
+	CPURenderer(GameLevel *level, const bool headless);
 	~CPURenderer();
 
 protected:
 	BVHAccel *BuildAcceleretor();
+	Sampler *AllocSampler() const;
 	Spectrum SampleImage(
-		RandomGenerator &rnd,
+		Sampler &sampler,
 		const Accelerator &accel, const PerspectiveCamera &camera,
-		const float screenX, const float screenY);
-	void ApplyFilter();
-	void BlendFrame();
-	void ApplyToneMapping();
-	void CopyFrame();
+		const vector<cpuscene::SphereRecord> &sphereRecords,
+		const float screenX, const float screenY, unsigned int &rayCount) {
+		return (this->*sampleImageImpl)(sampler, accel, camera, sphereRecords,
+				screenX, screenY, rayCount);
+	}
+	// The path tracer is specialized at compile time for the features used by
+	// the level (like the OpenCL kernel with the PARAM_* defines) and the right
+	// version is selected by the constructor. The traced rays are added to
+	// rayCount.
+	template <bool HAS_TEXMAPS, bool HAS_BUMPMAPS, bool ONLY_MATTE> Spectrum SampleImageImpl(
+		Sampler &sampler,
+		const Accelerator &accel, const PerspectiveCamera &camera,
+		const vector<cpuscene::SphereRecord> &sphereRecords,
+		const float screenX, const float screenY, unsigned int &rayCount);
+	// Spherical coordinates used to address the texture maps and the infinite
+	// light
+	void SphericalCoords(const Vector &v, float *phi, float *theta) const {
+		if (fastSphericalMath) {
+			*phi = FastSphericalPhi(v);
+			*theta = FastSphericalTheta(v);
+		} else {
+			*phi = SphericalPhi(v);
+			*theta = SphericalTheta(v);
+		}
+	}
+	// Next event estimation of the infinite light
+	template <bool ONLY_MATTE> Spectrum SampleInfiniteLight(Sampler &sampler, const Accelerator &accel,
+		const cpuscene::Material &mat, const Point &hitPoint, const Vector &wo,
+		const Normal &N, const Normal &shadeN, unsigned int &rayCount) const;
+	unsigned int GetFilterPassCount() const;
+	// Filter passes on the [yStart, yEnd) band of rows. The Y pass uses the
+	// filterRowSums scratch buffer of the calling thread (see
+	// FrameBuffer::ApplyBoxFilterY()).
+	void ApplyFilterX(const unsigned int yStart, const unsigned int yEnd);
+	void ApplyFilterY(const unsigned int yStart, const unsigned int yEnd,
+		float *filterRowSums, const bool continueRowSums = false);
+	void ApplyFilter(float *filterRowSums);
+	float UpdateBlendFactor();
+	// Writes the RGBA8 band to toneMapPixels and returns the sum of the
+	// luminance of the blended band
+	double PostProcess(const unsigned int yStart, const unsigned int yEnd,
+		const float blendFactor, unsigned char *toneMapPixels,
+		float *filterRowSums);
+
+	// Flat materials and texture maps tables
+	CPUScene *cpuScene;
+
+	typedef Spectrum (CPURenderer::*SampleImageFunc)(
+		Sampler &sampler,
+		const Accelerator &accel, const PerspectiveCamera &camera,
+		const vector<cpuscene::SphereRecord> &sphereRecords,
+		const float screenX, const float screenY, unsigned int &rayCount);
+	SampleImageFunc sampleImageImpl;
+	bool fastSphericalMath;
 
 	FrameBuffer *passFrameBuffer;
 	FrameBuffer *tmpFrameBuffer;
 	FrameBuffer *frameBuffer;
-	FrameBuffer *toneMapFrameBuffer;
+	// RGBA8 frames streamed to the GPU
+	PixelBufferRing *pixelBuffers;
+
+	// Average luminance of the previous frame, used by the tone mapping
+	float averageLuminance;
 
 	double timeSinceLastCameraEdit, timeSinceLastNoCameraEdit;
 };
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _SFERA_CPUSCENE_H
+#define	_SFERA_CPUSCENE_H
+
+#include <vector>
+#include <map>
+
+#include "gamelevel.h"
+#include "sdl/material.h"
+#include "sdl/texmap.h"
+#include "utils/sampler.h"
+
+#define CPUSCENE_NULL_INDEX 0xffffffffu
+
+namespace cpuscene {
+
+// The parameters of all material types in a single flat record. The meaning
+// of Kr and Kt depends on the type:
+//  MATTE: Kr = diffuse color
+//  MIRROR, METAL: Kr = reflection color
+//  GLASS: Kr = reflection color, Kt = refraction color
+//  ALLOY: Kr = reflection color, Kt = diffuse color
+typedef struct {
+	MaterialType type;
+	Spectrum emission;
+	Spectrum Kr, Kt;
+	float exponent;
+	float outsideIor, ior;
+	float R0;
+} Material;
+
+// One for each sphere of the scene and of the player puppet
+typedef struct {
+	unsigned int matIndex;
+	// CPUSCENE_NULL_INDEX if the sphere has no map
+	unsigned int texMapIndex, bumpMapIndex;
+} SphereRecord;
+
+}
+
+class CPUScene {
+public:
+	CPUScene(const GameLevel *level);
+	~CPUScene() { }
+
+	// The material of a sphere can change while playing (i.e. the pills
+	// turned off) so this has to be called, with the level mutex locked, for
+	// each frame. The texture and bump maps are written only the first time
+	// a sphereRecords vector is used, the following calls copy just the
+	// material indices of the scene.
+	void CompileSpheres(vector<cpuscene::SphereRecord> &sphereRecords) const;
+
+	// Translates a material in the flat record used by the renderers
+	static void CompileMaterial(const Material *m, cpuscene::Material *cpum);
+
+	static bool IsSpecular(const cpuscene::Material &mat) {
+		// Mirror and glass scatter only in a single direction so they can not
+		// be used for next event estimation
+		return (mat.type == MIRROR) || (mat.type == GLASS);
+	}
+
+	// Returns the weight of the sampled direction. The pdf is in solid angle
+	// for all not specular materials.
+	static Spectrum Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce);
+
+	// Returns the weight returned by Sample_f() for the direction wi times the
+	// pdf of sampling wi (i.e. the function estimated by Sample_f()) and the
+	// pdf. It is used for next event estimation.
+	static Spectrum Evaluate(const cpuscene::Material &mat,
+		const Vector &wo, const Vector &wi, const Normal &N, const Normal &shadeN,
+		float *pdf);
+
+	// The implementation of each material type, they can be used directly
+	// when the type is known in advance
+	static Spectrum Matte_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce);
+	static Spectrum Matte_Evaluate(const cpuscene::Material &mat,
+		const Vector &wo, const Vector &wi, const Normal &N, const Normal &shadeN,
+		float *pdf);
+	static Spectrum Mirror_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce);
+	static Spectrum Glass_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce);
+	static Spectrum Metal_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce);
+	static Spectrum Metal_Evaluate(const cpuscene::Material &mat,
+		const Vector &wo, const Vector &wi, const Normal &N, const Normal &shadeN,
+		float *pdf);
+	static Spectrum Alloy_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce);
+	static Spectrum Alloy_Evaluate(const cpuscene::Material &mat,
+		const Vector &wo, const Vector &wi, const Normal &N, const Normal &shadeN,
+		float *pdf);
+
+	// Scene materials followed by the player puppet ones
+	bool enable_MAT_MATTE, enable_MAT_MIRROR, enable_MAT_GLASS,
+		enable_MAT_METAL, enable_MAT_ALLOY;
+	vector<cpuscene::Material> mats;
+	vector<const TexMapInstance *> texMaps;
+	vector<const BumpMapInstance *> bumpMaps;
+
+private:
+	void CompileMaterials();
+	void CompileTextureMaps();
+
+	const GameLevel *gameLevel;
+
+	// Texture and bump map indices of each sphere, they never change
+	vector<cpuscene::SphereRecord> sphereMaps;
+};
+
+#endif	/* _SFERA_CPUSCENE_H */
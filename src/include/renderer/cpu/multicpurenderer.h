@@ -21,32 +21,53 @@
 #ifndef _SFERA_MULTICPURENDERER_H
 #define	_SFERA_MULTICPURENDERER_H
 
-#include "utils/randomgen.h"
 #include "renderer/levelrenderer.h"
 #include "pixel/framebuffer.h"
 #include "acceleretor/acceleretor.h"
 #include "renderer/cpu/cpurenderer.h"
 
+#define MULTICPURENDERER_CACHE_LINE_SIZE 64
+
 class MultiCPURendererThread;
 
+// The state of a frame traveling through the rendering pipeline
+typedef struct {
+	Accelerator *accel;
+	PerspectiveCamera camera;
+	vector<cpuscene::SphereRecord> sphereRecords;
+	float blendFactor;
+	// RGBA8, it is a buffer of CPURenderer::pixelBuffers
+	unsigned int pixelBufferIndex;
+	unsigned char *toneMapPixels;
+} MultiCPURendererFrame;
+
 class MultiCPURenderer : public CPURenderer {
 public:
-	MultiCPURenderer(GameLevel *level);
+	MultiCPURenderer(GameLevel *level, const bool headless = false);
 	~MultiCPURenderer();
 
 	size_t DrawFrame();
+	unsigned long long GetRayCount() const;
 
 	friend class MultiCPURendererThread;
 
 private:
 	size_t threadCount;
 	vector<MultiCPURendererThread *> renderThread;
+	// Used to hand a new frame to the render threads
 	boost::barrier *barrier;
+	// Used only among render threads
+	boost::barrier *threadBarrier;
 
-	vector<FrameBuffer *> threadPassFrameBuffer;
+	// Render threads work on frames[frameIndex % 2] while the main thread
+	// displays the other one and prepares the next
+	MultiCPURendererFrame frames[2];
+	size_t frameIndex;
 
-	Accelerator *accel;
-	PerspectiveCamera cameraCopy;
+	// Rays traced by the completed frames, published by the first render
+	// thread at the end of each frame
+	mutable boost::mutex rayCountMutex;
+	unsigned long long rayCount;
 };
 
 class MultiCPURendererThread {
@@ -57,6 +78,8 @@ public:
 	void Start();
 	void Stop();
 
+	friend class MultiCPURenderer;
+
 private:
 	static void MultiCPURenderThreadImpl(MultiCPURendererThread *renderThread);
 
@@ -64,7 +87,17 @@ private:
 	boost::thread *renderThread;
 
 	MultiCPURenderer *renderer;
-	RandomGenerator rnd;
+	Sampler *sampler;
+	// Scratch buffer of the filter Y passes
+	vector<float> filterRowSums;
+
+	// Luminance of the band post-processed by this thread and the rays it has
+	// traced in the current frame. They are padded to their own cache line in order to avoid false
+	// sharing among threads.
+	char padding0[MULTICPURENDERER_CACHE_LINE_SIZE];
+	double luminance;
+	unsigned long long rayCount;
+	char padding1[MULTICPURENDERER_CACHE_LINE_SIZE];
 };
 
 #endif	/* _SFERA_MULTICPURENDERER_H */
@@ -22,7 +22,6 @@
 #define	_SFERA_SINGLECPURENDERER_H
 
 #include "gamelevel.h"
-#include "utils/randomgen.h"
 #include "renderer/levelrenderer.h"
 #include "pixel/framebuffer.h"
 #include "acceleretor/acceleretor.h"
@@ -30,13 +29,18 @@
 
 class SingleCPURenderer : public CPURenderer {
 public:
-	SingleCPURenderer(GameLevel *level);
+	SingleCPURenderer(GameLevel *level, const bool headless = false);
 	~SingleCPURenderer();
 
 	size_t DrawFrame();
+	unsigned long long GetRayCount() const { return rayCount; }
 
 private:
-	RandomGenerator rnd;
+	Sampler *sampler;
+	// Scratch buffer of the filter Y passes
+	vector<float> filterRowSums;
+	unsigned int frameCount;
+	unsigned long long rayCount;
 };
 
 #endif	/* _SFERA_SINGLECPURENDERER_H */
@@ -23,14 +23,21 @@
 
 #include "gamelevel.h"
 
+// A headless renderer doesn't require an OpenGL context and doesn't draw
+// anything on the screen (see the benchmark mode)
 class LevelRenderer {
 public:
-	LevelRenderer(GameLevel *level) : gameLevel(level) { }
-	~LevelRenderer() { }
+	LevelRenderer(GameLevel *level, const bool headlessMode = false) :
+		gameLevel(level), headless(headlessMode) { }
+	virtual ~LevelRenderer() { }
 
+	// Returns the number of samples rendered
 	virtual size_t DrawFrame() = 0;
+	// Returns the number of rays traced since the start
+	virtual unsigned long long GetRayCount() const = 0;
 
 	GameLevel *gameLevel;
+	const bool headless;
 };
 
 #endif	/* _SFERA_LEVELRENDERER_H */
@@ -33,14 +33,18 @@ typedef struct {
 	float lensRadius;
 	float focalDistance;
 	float yon, hither;
+	float pixelSpreadAngle;
 
 	float rasterToCameraMatrix[4][4];
 	float cameraToWorldMatrix[4][4];
 } Camera;
 
 typedef struct {
-	unsigned int rgbOffset;
+	// Offset in bytes of the texels, it is a multiple of 4
+	unsigned int texelsOffset;
 	unsigned int width, height;
+	// One of TextureMapFormat
+	unsigned int format;
 } TexMap;
 
 typedef struct {
@@ -123,8 +127,10 @@ public:
 
 	// Compiled TextureMaps
 	vector<compiledscene::TexMap> texMaps;
-	unsigned int totRGBTexMem;
-	Spectrum *rgbTexMem;
+	// Identifiers of the maps in texMem (see TextureMap::GetId())
+	vector<unsigned int> texMapIds;
+	unsigned int totTexMem;
+	unsigned char *texMem;
 
 	vector<compiledscene::TexMapInstance> sphereTexs;
 	vector<compiledscene::BumpMapInstance> sphereBumps;
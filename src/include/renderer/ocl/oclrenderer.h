@@ -30,31 +30,42 @@
 
 #define WORKGROUP_SIZE 64
 
-namespace ocl_kernels {
-
-typedef struct {
-	unsigned int s1, s2, s3;
-} Seed;
+class OCLRendererThread;
 
+// OpenCL resources kept across the levels, and so across the renderers: the
+// context of a device and the texture map buffers. The buffers are uploaded
+// again only when the texture maps used by the level change.
 typedef struct {
-	// The task seed
-	Seed seed;
-} GPUTask;
-
-}
+	cl::Device device;
+	cl::Context *ctx;
 
-class OCLRendererThread;
+	// The identifiers of the maps in each buffer (see TextureMap::GetId())
+	cl::Buffer *infiniteLightBuffer;
+	vector<unsigned int> infiniteLightMapIds;
+	cl::Buffer *texMapTexelsBuffer;
+	vector<unsigned int> texMapIds;
+} OCLDeviceResources;
 
 class OCLRenderer : public LevelRenderer {
 public:
-	OCLRenderer(GameLevel *level);
+	OCLRenderer(GameLevel *level, const bool headless = false);
 	~OCLRenderer();
 
 	size_t DrawFrame();
+	// The rays are counted only in headless mode
+	unsigned long long GetRayCount() const;
+
+	// It has to be called before the OpenGL context is destroyed
+	static void FreeDeviceResources();
 
 	friend class OCLRendererThread;
 
 protected:
+	static void FreeDeviceResources(OCLDeviceResources *resources);
+
+	// Indexed like renderThread
+	static vector<OCLDeviceResources *> deviceResources;
+
 	vector<OCLRendererThread *> renderThread;
 	boost::barrier *barrier;
 
@@ -78,6 +89,7 @@ public:
 
 protected:
 	void DrawFrame();
+	unsigned long long GetRayCount() const;
 
 private:
 	static void OCLRenderThreadStaticImpl(OCLRendererThread *renderThread);
@@ -88,9 +100,18 @@ private:
 	void AllocOCLBufferRO(cl::Buffer **buff, void *src, const size_t size, const string &desc);
 	void AllocOCLBufferRW(cl::Buffer **buff, const size_t size, const string &desc);
 	void FreeOCLBuffer(cl::Buffer **buff);
+	// Uploads the texels of the level if they are not already in the
+	// persistent buffer
+	void UpdateTexelsBuffer(cl::Buffer **buff, const vector<unsigned int> &ids,
+		vector<unsigned int> &bufferIds, void *src, const size_t size, const string &desc);
 
 	void UpdateBVHBuffer();
 	void UpdateMaterialsBuffer();
+	// Returns the event to pass to an enqueue command to add its time to a
+	// stage of the profiler, NULL if the thread is not profiled
+	cl::Event *ProfileEvent(const FrameStage stage);
+	// It has to be called after the queue has been flushed
+	void AddProfileEventTimes();
 
 	size_t index;
 	OCLRenderer *renderer;
@@ -100,7 +121,6 @@ private:
 	cl::Context *ctx;
 	cl::CommandQueue *cmdQueue;
 
-	cl::Kernel *kernelInit;
 	cl::Kernel *kernelInitFrameBuffer;
 	cl::Kernel *kernelPathTracing;
 	cl::Kernel *kernelApplyBlurLightFilterXR1;
@@ -109,22 +129,33 @@ private:
 	cl::Kernel *kernelApplyBlurHeavyFilterYR1;
 	cl::Kernel *kernelApplyBoxFilterXR1;
 	cl::Kernel *kernelApplyBoxFilterYR1;
+	unsigned int pathTracingSampleIndexArg;
 
 	cl::Buffer *passFrameBuffer;
 	cl::Buffer *tmpFrameBuffer;
 
 	cl::Buffer *bvhBuffer;
-	cl::Buffer *gpuTaskBuffer;
 	cl::Buffer *cameraBuffer;
 	cl::Buffer *infiniteLightBuffer;
+	cl::Buffer *infiniteLightDistributionBuffer;
 	cl::Buffer *matBuffer;
 	cl::Buffer *matIndexBuffer;
 	cl::Buffer *texMapBuffer;
-	cl::Buffer *texMapRGBBuffer;
+	cl::Buffer *texMapTexelsBuffer;
 	cl::Buffer *texMapInstanceBuffer;
 	cl::Buffer *bumpMapInstanceBuffer;
+	// The rays traced for each pixel, only in headless mode
+	cl::Buffer *rayCountBuffer;
 
 	size_t usedDeviceMemory;
+	// Number of passes rendered, used to index the samples of the sampler
+	unsigned int passCount;
+
+	// The frame profiler of the level for the first thread, NULL otherwise
+	StageProfiler *profiler;
+	// Commands enqueued and not yet added to the profiler
+	vector<FrameStage> profileStages;
+	vector<cl::Event> profileEvents;
 
 	//--------------------------------------------------------------------------
 	// Used only in Multi-GPUs case
@@ -143,8 +174,9 @@ private:
 	cl::Buffer *frameBuffer;
 	cl::Buffer *toneMapFrameBuffer;
 
+	// A plain cl::Buffer in headless mode, a cl::BufferGL otherwise
 	GLuint pbo;
-	cl::BufferGL *pboBuff;
+	cl::Buffer *pboBuff;
 };
 
 #endif
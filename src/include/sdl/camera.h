@@ -30,7 +30,7 @@ public:
 	PerspectiveCamera() { }
 	PerspectiveCamera(const Point &o, const Point &t, const Vector &u) :
 		orig(o), target(t), up(Normalize(u)), fieldOfView(45.f), clipHither(1e-3f), clipYon(1e30f),
-		lensRadius(0.f), focalDistance(10.f) {
+		lensRadius(0.f), focalDistance(10.f), pixelSpreadAngle(0.f) {
 		const float nan = std::numeric_limits<float>::quiet_NaN();
 		lastUpdateOrig = Point(nan, nan, nan);
 		lastUpdateTarget = Point(nan, nan, nan);
@@ -106,6 +106,8 @@ public:
 	float GetClipHither() const { return clipHither; }
 	float GetLensRadius() const { return lensRadius; }
 	float GetFocalDistance() const { return focalDistance; }
+	// The angle covered by a pixel, used to estimate the footprint of a ray
+	float GetPixelSpreadAngle() const { return pixelSpreadAngle; }
 
 	// User defined values
 	Point orig, target;
@@ -116,6 +118,7 @@ private:
 	Vector lastUpdateUp;
 
 	float fieldOfView, clipHither, clipYon, lensRadius, focalDistance;
+	float pixelSpreadAngle;
 
 	// Calculated values
 	Vector dir, x, y;
@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _SFERA_SDL_COMPILEDLEVEL_H
+#define	_SFERA_SDL_COMPILEDLEVEL_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "sfera.h"
+#include "utils/properties.h"
+#include "geometry/point.h"
+
+namespace boost { namespace interprocess {
+	class mapped_region;
+} }
+
+// Compiled levels are stored next to the .lvl file, the version has to be
+// increased every time the layout of the file changes
+#define COMPILEDLEVEL_EXTENSION ".clvl"
+#define COMPILEDLEVEL_VERSION 1
+
+// Flags of the spheres
+#define COMPILEDLEVEL_SPHERE_STATIC 1
+#define COMPILEDLEVEL_SPHERE_ATTRACTOR 2
+#define COMPILEDLEVEL_SPHERE_PILL 4
+
+// The damping of the spheres without an explicit one. They are swapped
+// compared to the physic engine defaults since the first version of the .lvl
+// parser and all levels are tuned with them (see physic/gamephysic.h).
+#define COMPILEDLEVEL_DEFAULT_LINEAR_DAMPING PHYSIC_DEFAULT_ANGULAR_DAMPING
+#define COMPILEDLEVEL_DEFAULT_ANGULAR_DAMPING PHYSIC_DEFAULT_LINEAR_DAMPING
+
+// A level with the spheres stored as arrays, one for each field. The .lvl
+// file is parsed only once, the compiled file is then mapped in memory and
+// the arrays are used as they are. The file is written in the native byte
+// order.
+class CompiledLevel {
+public:
+	class TexMapRef {
+	public:
+		bool operator<(const TexMapRef &ref) const;
+
+		std::string fileName;
+		bool bumpMap;
+		float shiftU, shiftV, scaleU, scaleV;
+		// Only used by bump maps
+		float scale;
+	};
+
+	// Parses the spheres of a .lvl file
+	CompiledLevel(const Properties &lvlProp);
+	// Maps a compiled level file
+	CompiledLevel(const std::string &fileName);
+	~CompiledLevel();
+
+	// Used to build a level, not available for a mapped file. The
+	// materials and the texture maps are added only once, their index is
+	// returned.
+	unsigned int AddMaterial(const std::string &matName);
+	int AddTexMapRef(const TexMapRef &ref);
+	void AddSphere(const Point &center, const float rad, const float m,
+		const float linearDamp, const float angularDamp, const unsigned char sphereFlags,
+		const unsigned int materialIndex, const int texMapIndex, const int bumpMapIndex);
+
+	// Writes the compiled file
+	void Save(const std::string &fileName) const;
+	// Writes a .lvl file
+	void SaveText(const std::string &fileName) const;
+
+	// Returns the compiled level if it is up to date, the parsed .lvl
+	// file otherwise
+	static CompiledLevel *Read(const std::string &lvlFileName);
+	// Writes the compiled version of a .lvl file next to it
+	static void Compile(const std::string &lvlFileName);
+	static std::string GetCompiledFileName(const std::string &lvlFileName);
+
+	// All the properties of the level but the spheres: path tracing, film,
+	// player, infinite light and materials
+	const Properties &GetProperties() const { return properties; }
+
+	// Materials and texture maps used by the spheres
+	vector<string> materialNames;
+	vector<TexMapRef> texMapRefs;
+
+	unsigned int sphereCount;
+	const float *centers; // 3 for each sphere
+	const float *radius;
+	const float *mass;
+	const float *linearDamping;
+	const float *angularDamping;
+	const unsigned int *materialIndices;
+	const int *texMapIndices; // -1 if the sphere has no texture map
+	const int *bumpMapIndices; // -1 if the sphere has no bump map
+	const unsigned char *flags;
+
+private:
+	class SphereParser;
+	friend class SphereParser;
+
+	struct FileHeader;
+	struct FileTexMapRef;
+	// The offset of each block of the file (and the size of the file as
+	// last one) and the size of each block
+	static void GetBlockOffsets(const FileHeader &header, size_t *offsets, size_t *sizes);
+
+	void UpdateSpherePointers();
+
+	Properties properties;
+
+	// The arrays of a parsed .lvl file
+	vector<float> centersData, radiusData, massData, linearDampingData, angularDampingData;
+	vector<unsigned int> materialIndicesData;
+	vector<int> texMapIndicesData, bumpMapIndicesData;
+	vector<unsigned char> flagsData;
+
+	std::map<string, unsigned int> materialIndexMap;
+	std::map<TexMapRef, int> texMapIndexMap;
+
+	// The compiled file mapped in memory, the arrays point inside it
+	boost::interprocess::mapped_region *region;
+};
+
+#endif	/* _SFERA_SDL_COMPILEDLEVEL_H */
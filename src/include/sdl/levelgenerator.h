@@ -0,0 +1,73 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _SFERA_SDL_LEVELGENERATOR_H
+#define	_SFERA_SDL_LEVELGENERATOR_H
+
+#include <string>
+#include <vector>
+
+#include "sfera.h"
+#include "utils/properties.h"
+#include "utils/randomgen.h"
+#include "sdl/compiledlevel.h"
+
+// Builds large levels for scale testing. The configuration is a .lvl file
+// (with the path tracing, film, player, infinite light, material and any
+// hand made sphere definitions) plus the generator.* properties describing
+// the spheres to add. The same configuration always produces the same level.
+class LevelGenerator {
+public:
+	LevelGenerator(const Properties &genProp);
+	~LevelGenerator();
+
+	// Writes a compiled level if the file has the .clvl extension, a .lvl
+	// file otherwise
+	void Save(const std::string &fileName) const;
+
+	unsigned int GetSphereCount() const { return level.sphereCount; }
+
+private:
+	void AddFractal(const unsigned int depth, const unsigned int maxDepth,
+		const Point &center, const float rad, const int direction);
+	void AddRandomField();
+	void AddShells();
+	void AddBodies(const std::string &propRoot, const unsigned char flags,
+		const std::string &defaultRadius);
+	void AddPills();
+
+	// Adds a sphere with a material from the mix and (maybe) a texture map
+	// and a bump map
+	void AddSphere(const Point &center, const float rad, const unsigned char flags);
+	Point RandomPoint(const std::vector<float> &bbox);
+
+	const Properties &props;
+	CompiledLevel level;
+	RandomGenerator rng;
+
+	// The material mix, the cumulative weights are normalized
+	std::vector<unsigned int> materials;
+	std::vector<float> materialWeights;
+
+	int texMapIndex, bumpMapIndex;
+	float texMapFraction, bumpMapFraction;
+};
+
+#endif	/* _SFERA_SDL_LEVELGENERATOR_H */
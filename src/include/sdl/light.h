@@ -21,10 +21,16 @@
 #ifndef _SFERA_SDL_LIGHT_H
 #define	_SFERA_SDL_LIGHT_H
 
+#include <vector>
+
 #include "geometry/vector.h"
 #include "pixel/spectrum.h"
 #include "sdl/texmap.h"
 
+// Maximum resolution of the luminance distribution used to sample the map
+#define INFINITELIGHT_DISTRIBUTION_MAX_WIDTH 512
+#define INFINITELIGHT_DISTRIBUTION_MAX_HEIGHT 256
+
 class InfiniteLight {
 public:
 	InfiniteLight(TexMapInstance *tx);
@@ -48,12 +54,44 @@ public:
 
 	const TexMapInstance *GetTexture() const { return tex; }
 
-	Spectrum Le(const Vector &dir) const;
+	// The footprint is the angle covered by the ray, it is used to select the
+	// level of detail of the map
+	Spectrum Le(const Vector &dir, const float footprint = 0.f) const {
+		return Le(SphericalPhi(dir), SphericalTheta(dir), footprint);
+	}
+	// Same as above but with the spherical coordinates of the direction
+	Spectrum Le(const float phi, const float theta, const float footprint = 0.f) const;
+
+	// Builds the luminance distribution used by Sample_L() and Pdf(), it has
+	// to be called after SetGain() and SetShift()
+	void Preprocess();
+
+	// Samples a direction with a probability proportional to the luminance
+	// of the map, the pdf is in solid angle
+	Spectrum Sample_L(const float u0, const float u1, Vector *dir, float *pdf) const;
+	float Pdf(const Vector &dir) const {
+		return Pdf(SphericalPhi(dir), SphericalTheta(dir));
+	}
+	float Pdf(const float phi, const float theta) const;
+
+	// The distribution is stored in a single array with the same layout used
+	// by the OpenCL kernel: the marginal CDF of the rows (height + 1 values),
+	// the conditional CDF of each row (height * (width + 1) values) and the
+	// pdf of each cell (width * height values)
+	unsigned int GetDistributionWidth() const { return distributionWidth; }
+	unsigned int GetDistributionHeight() const { return distributionHeight; }
+	const std::vector<float> &GetDistribution() const { return distribution; }
 
 protected:
+	static unsigned int SampleCDF(const float *cdf, const unsigned int count,
+		const float u, float *du);
+
 	TexMapInstance *tex;
 	float shiftU, shiftV;
 	Spectrum gain;
+
+	unsigned int distributionWidth, distributionHeight;
+	std::vector<float> distribution;
 };
 
 #endif	/* _SFERA_SDL_LIGHT_H */
@@ -27,7 +27,6 @@
 #include "geometry/normal.h"
 #include "pixel/spectrum.h"
 #include "utils/utils.h"
-#include "utils/randomgen.h"
 
 class Scene;
 
@@ -42,10 +41,6 @@ public:
 
 	virtual MaterialType GetType() const = 0;
 
-	virtual Spectrum Sample_f(RandomGenerator &rnd,
-		const Vector &wo, Vector *wi, const Normal &N,
-		const Normal &shadeN, float *pdf, bool &diffuseBounce) const = 0;
-
 	void SetEmission(const Spectrum &e) { emission = e; }
 	const Spectrum &GetEmission() const { return emission; }
 
@@ -61,10 +56,6 @@ public:
 
 	MaterialType GetType() const { return MATTE; }
 
-	Spectrum Sample_f(RandomGenerator &rnd,
-		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
-		float *pdf, bool &diffuseBounce) const;
-
 	const Spectrum &GetKd() const { return Kd; }
 
 private:
@@ -79,10 +70,6 @@ public:
 
 	MaterialType GetType() const { return MIRROR; }
 
-	Spectrum Sample_f(RandomGenerator &rnd,
-		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
-		float *pdf, bool &diffuseBounce) const;
-
 	const Spectrum &GetKr() const { return Kr; }
 
 private:
@@ -107,10 +94,6 @@ public:
 
 	MaterialType GetType() const { return GLASS; }
 
-	Spectrum Sample_f(RandomGenerator &rnd,
-		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
-		float *pdf, bool &diffuseBounce) const;
-
 	const Spectrum &GetKrefl() const { return Krefl; }
 	const Spectrum &GetKrefrct() const { return Krefrct; }
 	const float GetOutsideIOR() const { return ousideIor; }
@@ -132,16 +115,9 @@ public:
 
 	MaterialType GetType() const { return METAL; }
 
-	Spectrum Sample_f(RandomGenerator &rnd,
-		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
-		float *pdf, bool &diffuseBounce) const;
-
 	const Spectrum &GetKr() const { return Kr; }
 	float GetExp() const { return exponent; }
 
-	static Vector GlossyReflection(const Vector &wo, const float exponent,
-		const Normal &shadeN, const float u0, const float u1);
-
 private:
 	Spectrum Kr;
 	float exponent;
@@ -160,10 +136,6 @@ public:
 
 	MaterialType GetType() const { return ALLOY; }
 
-	Spectrum Sample_f(RandomGenerator &rnd,
-		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
-		float *pdf, bool &diffuseBounce) const;
-
 	const Spectrum &GetKrefl() const { return Krefl; }
 	const Spectrum &GetKd() const { return Kdiff; }
 	float GetExp() const { return exponent; }
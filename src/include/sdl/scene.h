@@ -26,6 +26,7 @@
 
 #include "sfera.h"
 #include "utils/properties.h"
+#include "sdl/compiledlevel.h"
 #include "gamesphere.h"
 #include "sdl/material.h"
 #include "sdl/texmap.h"
@@ -33,7 +34,7 @@
 
 class Scene {
 public:
-	Scene(const Properties &scnProp, TextureMapCache *texMapCache);
+	Scene(const CompiledLevel &level, TextureMapCache *texMapCache);
 	~Scene();
 
 	float gravityConstant;
@@ -43,14 +44,15 @@ public:
 	vector<Material *> materials; // All materials
 	map<string, size_t> materialIndices; // All materials indices
 
-	map<string, size_t> sphereIndices; // All object indices
 	vector<GameSphere> spheres; // All sferes
 	vector<Material *> sphereMaterials; // One for each object
+	vector<unsigned int> sphereMaterialIndices; // Index in materials of sphereMaterials
 	vector<TexMapInstance *> sphereTexMaps; // One for each object
 	vector<BumpMapInstance *> sphereBumpMaps; // One for each object
 
 	unsigned int pillCount;
 	Material *pillOffMaterial;
+	unsigned int pillOffMaterialIndex;
 
 private:
 	void CreateMaterial(const string &propName, const Properties &prop);
@@ -22,24 +22,130 @@
 #define	_SFERA_SDL_TEXMAP_H
 
 #include <string>
+#include <cstring>
 #include <vector>
 #include <map>
 
+// SSE2 is required for the integer unpacking of the RGBA8 texels
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define SFERA_TEXMAP_SSE
+#endif
+
 #include "geometry/vector.h"
 #include "geometry/normal.h"
 #include "geometry/uv.h"
 #include "pixel/spectrum.h"
+#include "utils/utils.h"
+
+namespace boost { namespace interprocess {
+	class mapped_region;
+} }
+
+// The texels are stored in the most compact format able to hold the image.
+// The values are shared with the OpenCL kernel.
+typedef enum {
+	TEXMAP_RGBA8 = 0, // LDR images, alpha is not used
+	TEXMAP_RGB_HALF = 1, // HDR images
+	TEXMAP_GRADIENT_HALF = 2 // Bump maps, the (u, v) height gradient
+} TextureMapFormat;
+
+// The texels are stored in square tiles (row-major inside each tile) so the
+// 4 texels of a bilinear lookup are usually in the same cache line. The map
+// has an extra row and column, a copy of the first ones, so only the
+// top-left texel of a lookup has to be wrapped. The same layout is used by
+// the OpenCL kernel.
+#define TEXMAP_TILE_SIZE 4
+
+// Levels of the mip pyramid, enough for 32768x32768 maps
+#define TEXMAP_MAX_LEVELS 16
+
+// The packed texels are cached in gamedata/cache/*.stex files, the version
+// has to be increased every time the layout of the texels changes
+#define TEXMAP_CACHE_DIR "gamedata/cache/"
+#define TEXMAP_CACHE_VERSION 1
 
 class TextureMap {
 public:
-	TextureMap(const std::string &fileName);
-	TextureMap(Spectrum *cols, const unsigned int w, const unsigned int h);
+	// Bump maps are stored as the gradient of the max of the channels (i.e.
+	// Spectrum::Filter()), the color returned has the u and v gradients in r
+	// and g.
+	// The texels are mapped from the cache file when it is up to date, the
+	// image is decoded (and the cache written) otherwise.
+	TextureMap(const std::string &fileName, const bool bumpMap = false);
+	// A map of the width x height pixels in memory (i.e. a procedural map),
+	// it is never cached
+	TextureMap(const unsigned int width, const unsigned int height,
+		const vector<Spectrum> &pixels, const bool isHDR, const bool bumpMap = false);
 
 	~TextureMap();
 
+	// Bilinear lookup of the full resolution map
 	const Spectrum GetColor(const UV &uv) const {
-		const float s = uv.u * width - 0.5f;
-		const float t = uv.v * height - 0.5f;
+		return GetLevelColor(0, uv);
+	}
+
+	// Trilinear lookup of the mip pyramid, see GetLevelOfDetail()
+	const Spectrum GetColor(const UV &uv, const float lod) const {
+		const float l = Clamp(lod, 0.f, levelCount - 1.f);
+		const unsigned int l0 = (unsigned int)l;
+		const float k = l - l0;
+
+		if ((k > 0.f) && (l0 + 1 < levelCount))
+			return (1.f - k) * GetLevelColor(l0, uv) + k * GetLevelColor(l0 + 1, uv);
+		else
+			return GetLevelColor(l0, uv);
+	}
+
+	// Returns the level of detail of a footprint, the size of the footprint
+	// is along v in the [0, 1] texture space
+	float GetLevelOfDetail(const float footprintV) const {
+		return logf(footprintV * height) * (float)M_LOG2E;
+	}
+
+	// A unique identifier of the map, never reused during the life of the
+	// process (unlike the address of the object)
+	unsigned int GetId() const { return id; }
+	unsigned int GetWidth() const { return width; }
+	unsigned int GetHeight() const { return height; }
+	unsigned int GetLevelCount() const { return levelCount; }
+	TextureMapFormat GetFormat() const { return format; }
+	// All levels, one after the other
+	const unsigned char *GetTexels() const { return texels; };
+	size_t GetTexelsSize() const { return texelCount * GetTexelSize(format); }
+
+	// A texel of the full resolution map
+	Spectrum GetTexel(const int s, const int t) const {
+		return DecodeTexel(GetTexelIndex(0, Mod<int>(s, width), Mod<int>(t, height)));
+	}
+
+	static size_t GetTexelSize(const TextureMapFormat format) {
+		switch (format) {
+			case TEXMAP_RGBA8:
+				return 4 * sizeof(unsigned char);
+			case TEXMAP_RGB_HALF:
+				return 3 * sizeof(unsigned short);
+			case TEXMAP_GRADIENT_HALF:
+				return 2 * sizeof(unsigned short);
+			default:
+				assert (false);
+				return 0;
+		}
+	}
+
+private:
+	typedef struct {
+		unsigned int width, height;
+		// Tiles needed to cover the level and the padding
+		unsigned int tileCountX, tileCountY;
+		// Index of the first texel of the level
+		unsigned int offset;
+	} Level;
+
+	const Spectrum GetLevelColor(const unsigned int level, const UV &uv) const {
+		const Level &lvl(levels[level]);
+		const float s = uv.u * lvl.width - 0.5f;
+		const float t = uv.v * lvl.height - 0.5f;
 
 		const int s0 = Floor2Int(s);
 		const int t0 = Floor2Int(t);
@@ -50,35 +156,121 @@ public:
 		const float ids = 1.f - ds;
 		const float idt = 1.f - dt;
 
-		return ids * idt * GetTexel(s0, t0) +
-				ids * dt * GetTexel(s0, t0 + 1) +
-				ds * idt * GetTexel(s0 + 1, t0) +
-				ds * dt * GetTexel(s0 + 1, t0 + 1);
+		// The padding takes care of the wrapping of s0 + 1 and t0 + 1
+		const unsigned int x0 = Mod<int>(s0, lvl.width);
+		const unsigned int y0 = Mod<int>(t0, lvl.height);
+		const unsigned int index00 = GetTexelIndex(level, x0, y0);
+		const unsigned int index01 = GetTexelIndex(level, x0, y0 + 1);
+		const unsigned int index10 = GetTexelIndex(level, x0 + 1, y0);
+		const unsigned int index11 = GetTexelIndex(level, x0 + 1, y0 + 1);
+
+#if defined(SFERA_TEXMAP_SSE)
+		// The 4 taps are blended as (r, g, b, 0) vectors, the RGBA8 scale is
+		// folded in the weights
+		const float scale = (format == TEXMAP_RGBA8) ? (1.f / 255.f) : 1.f;
+		const __m128 c = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(scale * ids * idt), DecodeTexelSSE(index00)),
+					_mm_mul_ps(_mm_set1_ps(scale * ids * dt), DecodeTexelSSE(index01))),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(scale * ds * idt), DecodeTexelSSE(index10)),
+					_mm_mul_ps(_mm_set1_ps(scale * ds * dt), DecodeTexelSSE(index11))));
+
+		float rgb[4];
+		_mm_storeu_ps(rgb, c);
+		return Spectrum(rgb[0], rgb[1], rgb[2]);
+#else
+		return ids * idt * DecodeTexel(index00) +
+				ids * dt * DecodeTexel(index01) +
+				ds * idt * DecodeTexel(index10) +
+				ds * dt * DecodeTexel(index11);
+#endif
 	};
 
-	const UV &GetDuDv() const {
-		return DuDv;
-	}
-
-	unsigned int GetWidth() const { return width; }
-	unsigned int GetHeight() const { return height; }
-	const Spectrum *GetPixels() const { return pixels; };
-
-private:
-	const Spectrum &GetTexel(const int s, const int t) const {
-		const unsigned int u = Mod<int>(s, width);
-		const unsigned int v = Mod<int>(t, height);
+	// x and y can be up to the width and height of the level (i.e. the padding)
+	unsigned int GetTexelIndex(const unsigned int level,
+			const unsigned int x, const unsigned int y) const {
+		const Level &lvl(levels[level]);
+		assert (x <= lvl.width);
+		assert (y <= lvl.height);
 
-		const unsigned index = v * width + u;
-		assert (index >= 0);
-		assert (index < width * height);
+		const unsigned int tileIndex = (y / TEXMAP_TILE_SIZE) * lvl.tileCountX + x / TEXMAP_TILE_SIZE;
+		return lvl.offset + tileIndex * (TEXMAP_TILE_SIZE * TEXMAP_TILE_SIZE) +
+				(y % TEXMAP_TILE_SIZE) * TEXMAP_TILE_SIZE + x % TEXMAP_TILE_SIZE;
+	}
 
-		return pixels[index];
+	Spectrum DecodeTexel(const unsigned int index) const {
+		switch (format) {
+			case TEXMAP_RGBA8: {
+				const unsigned char *texel = &texels[index * 4];
+				return Spectrum(texel[0], texel[1], texel[2]) * (1.f / 255.f);
+			}
+			case TEXMAP_RGB_HALF: {
+				const unsigned short *texel = &((const unsigned short *)texels)[index * 3];
+				return Spectrum(HalfToFloat(texel[0]), HalfToFloat(texel[1]), HalfToFloat(texel[2]));
+			}
+			case TEXMAP_GRADIENT_HALF: {
+				const unsigned short *texel = &((const unsigned short *)texels)[index * 2];
+				return Spectrum(HalfToFloat(texel[0]), HalfToFloat(texel[1]), 0.f);
+			}
+			default:
+				assert (false);
+				return Spectrum();
+		}
 	}
 
+#if defined(SFERA_TEXMAP_SSE)
+	// Like DecodeTexel() but the RGBA8 texels are not scaled to [0, 1]
+	__m128 DecodeTexelSSE(const unsigned int index) const {
+		switch (format) {
+			case TEXMAP_RGBA8: {
+				int rgba;
+				memcpy(&rgba, &texels[index * 4], sizeof(int));
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i texel = _mm_cvtsi32_si128(rgba);
+				return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(texel, zero), zero));
+			}
+			case TEXMAP_RGB_HALF: {
+				const unsigned short *texel = &((const unsigned short *)texels)[index * 3];
+				return _mm_setr_ps(HalfToFloat(texel[0]), HalfToFloat(texel[1]), HalfToFloat(texel[2]), 0.f);
+			}
+			case TEXMAP_GRADIENT_HALF: {
+				const unsigned short *texel = &((const unsigned short *)texels)[index * 2];
+				return _mm_setr_ps(HalfToFloat(texel[0]), HalfToFloat(texel[1]), 0.f, 0.f);
+			}
+			default:
+				assert (false);
+				return _mm_setzero_ps();
+		}
+	}
+#endif
+
+	void SetTexel(const unsigned int level, const unsigned int x, const unsigned int y,
+		const Spectrum &c);
+	// Copies the first row and column of a level in its padding
+	void FillPadding(const unsigned int level);
+	// Selects the format of the texels and packs the decoded image
+	void PackTexels(vector<Spectrum> &pixels, const bool isHDR, const bool bumpMap);
+	// Packs the full resolution image and builds the mip pyramid
+	void BuildLevels(vector<Spectrum> &pixels);
+	// The layout of the mip pyramid of a width x height map, returns the
+	// texel count of all levels
+	static unsigned long long ComputeLevels(const unsigned int width, const unsigned int height,
+		Level *levels, unsigned int *levelCount);
+
+	struct CacheHeader;
+	static std::string GetCacheFileName(const std::string &fileName, const bool bumpMap);
+	// Returns false if the cache file is missing or out of date
+	bool LoadCache(const std::string &fileName, const bool bumpMap);
+	void SaveCache(const std::string &fileName, const bool bumpMap) const;
+
+	unsigned int id;
 	unsigned int width, height;
-	Spectrum *pixels;
-	UV DuDv;
+	unsigned int levelCount;
+	Level levels[TEXMAP_MAX_LEVELS];
+	TextureMapFormat format;
+	unsigned int texelCount;
+	unsigned char *texels;
+	// The cache file mapped in memory, texels points inside it
+	boost::interprocess::mapped_region *texelsRegion;
 };
 
 class TexMapInstance {
@@ -93,10 +285,13 @@ public:
 	float GetScaleU() const { return scaleU; }
 	float GetScaleV() const { return scaleV; }
 
-	Spectrum SphericalMap(const Vector &dir) const {
-		const UV uv(SphericalPhi(dir) * INV_TWOPI * scaleU + shiftU,
-				SphericalTheta(dir) * INV_PI  * scaleV + shiftV);
-		return texMap->GetColor(uv);
+	// The map is addressed with the spherical coordinates of the hit point (see
+	// SphericalPhi() and SphericalTheta()). The footprint is the angle covered
+	// on the sphere, it is used to select the level of detail of the map
+	Spectrum SphericalMap(const float phi, const float theta, const float footprint = 0.f) const {
+		const UV uv(phi * INV_TWOPI * scaleU + shiftU,
+				theta * INV_PI  * scaleV + shiftV);
+		return texMap->GetColor(uv, texMap->GetLevelOfDetail(footprint * INV_PI * scaleV));
 	}
 
 private:
@@ -118,21 +313,17 @@ public:
 	float GetScaleV() const { return scaleV; }
 	float GetScale() const { return scale; }
 
-	Normal SphericalMap(const Vector &dir, const Normal &N) const {
-		const UV uv(SphericalPhi(dir) * INV_TWOPI * scaleU + shiftU,
-				SphericalTheta(dir) * INV_PI  * scaleV + shiftV);
-
-		const UV &dudv = texMap->GetDuDv();
-
-		const float b0 = texMap->GetColor(uv).Filter();
+	// See TexMapInstance::SphericalMap()
+	Normal SphericalMap(const float phi, const float theta, const Normal &N,
+			const float footprint = 0.f) const {
+		const UV uv(phi * INV_TWOPI * scaleU + shiftU,
+				theta * INV_PI  * scaleV + shiftV);
 
-		const UV uvdu(uv.u + dudv.u, uv.v);
-		const float bu = texMap->GetColor(uvdu).Filter();
+		// A gradient map (see TextureMap)
+		const Spectrum gradient = texMap->GetColor(uv,
+				texMap->GetLevelOfDetail(footprint * INV_PI * scaleV));
 
-		const UV uvdv(uv.u, uv.v + dudv.v);
-		const float bv = texMap->GetColor(uvdv).Filter();
-
-		const Vector bump(scale * (bu - b0), scale * (bv - b0), 1.f);
+		const Vector bump(scale * gradient.r, scale * gradient.g, 1.f);
 
 		Vector v1, v2;
 		CoordinateSystem(Vector(N), &v1, &v2);
@@ -149,9 +340,14 @@ private:
 	const float scale;
 };
 
+// The texture maps used by a level. The maps are shared by all the levels
+// through a process-wide cache: they are reference counted and the ones not
+// used anymore are kept, up to a memory cap, in case a next level needs them.
+// The least recently used are evicted first.
 class TextureMapCache {
 public:
 	TextureMapCache();
+	// Releases the texture maps used by the level
 	~TextureMapCache();
 
 	TexMapInstance *GetTexMapInstance(const std::string &fileName,
@@ -161,12 +357,20 @@ public:
 		const float scale);
 
 	void GetTexMaps(std::vector<TextureMap *> &tms);
-	unsigned int GetSize()const { return maps.size(); }
-  
+	unsigned int GetSize()const { return maps.size() + gradientMaps.size(); }
+
+	// The process-wide cache can use up to maxSize bytes, more only if all
+	// the maps are in use
+	static void SetSharedMaxSize(const size_t maxSize);
+	// Frees all the texture maps not in use
+	static void FreeShared();
+
 private:
-	TextureMap *GetTextureMap(const std::string &fileName);
+	TextureMap *GetTextureMap(const std::string &fileName, const bool bumpMap);
 
 	std::map<std::string, TextureMap *> maps;
+	// Gradient versions used by bump maps
+	std::map<std::string, TextureMap *> gradientMaps;
 	std::vector<TexMapInstance *> texInstances;
 	std::vector<BumpMapInstance *> bumpInstances;
 };
@@ -121,4 +121,11 @@ inline float UniformConePdf(float costhetamax) {
 	return 1.f / (2.f * M_PI * (1.f - costhetamax));
 }
 
+inline float PowerHeuristic(const float fPdf, const float gPdf) {
+	const float f2 = fPdf * fPdf;
+	const float g2 = gPdf * gPdf;
+
+	return f2 / (f2 + g2);
+}
+
 #endif	/* _SFERA_SDL_MC_H */
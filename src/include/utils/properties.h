@@ -24,7 +24,12 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <iostream>
 
+// The properties are kept sorted by key, so all the keys with the same prefix
+// are one after the other. The numeric vectors are parsed only the first
+// time they are requested, so a Properties object can not be read by
+// multiple threads at the same time.
 class Properties {
 public:
 	Properties() { }
@@ -33,19 +38,29 @@ public:
 
 	void Load(const Properties &prop);
 	void LoadFile(const std::string &fileName);
+	void LoadStream(std::istream &stream);
 	void SaveFile(const std::string &fileName);
+	void SaveStream(std::ostream &stream) const;
 
 	std::vector<std::string> GetAllKeys() const;
-	std::vector<std::string> GetAllKeys(const std::string prefix) const;
+	std::vector<std::string> GetAllKeys(const std::string &prefix) const;
 
-	bool IsDefined(const std::string propName) const;
-	std::string GetString(const std::string propName, const std::string defaultValue) const;
-	int GetInt(const std::string propName, const int defaultValue) const;
-	float GetFloat(const std::string propName, const float defaultValue) const;
+	// Calls visitor(key, value) for each property with the prefix, in key
+	// order and without copying them
+	template <class T> void Visit(const std::string &prefix, T &visitor) const {
+		for (std::map<std::string, Value>::const_iterator it = props.lower_bound(prefix);
+				(it != props.end()) && (it->first.compare(0, prefix.length(), prefix) == 0); ++it)
+			visitor(it->first, it->second.value);
+	}
 
-	std::vector<std::string> GetStringVector(const std::string propName, const std::string &defaultValue) const;
-	std::vector<int> GetIntVector(const std::string propName, const std::string &defaultValue) const;
-	std::vector<float> GetFloatVector(const std::string propName, const std::string &defaultValue) const;
+	bool IsDefined(const std::string &propName) const;
+	std::string GetString(const std::string &propName, const std::string &defaultValue) const;
+	int GetInt(const std::string &propName, const int defaultValue) const;
+	float GetFloat(const std::string &propName, const float defaultValue) const;
+
+	std::vector<std::string> GetStringVector(const std::string &propName, const std::string &defaultValue) const;
+	std::vector<int> GetIntVector(const std::string &propName, const std::string &defaultValue) const;
+	std::vector<float> GetFloatVector(const std::string &propName, const std::string &defaultValue) const;
 
 	void SetString(const std::string &propName, const std::string &value);
 	std::string SetString(const std::string &property);
@@ -58,7 +73,20 @@ public:
 	static std::vector<float> ConvertToFloatVector(const std::string &values);
 
 private:
-	std::map<std::string, std::string> props;
+	class Value {
+	public:
+		Value() : floatsParsed(false) { }
+
+		std::string value;
+		// The cached result of ConvertToFloatVector(value)
+		mutable bool floatsParsed;
+		mutable std::vector<float> floats;
+	};
+
+	// Returns NULL if the property is not defined
+	const Value *GetValue(const std::string &propName) const;
+
+	std::map<std::string, Value> props;
 };
 
 #endif	/* _SFERA_PROPERTIES_H */
@@ -20,98 +20,88 @@
 
 #include <stddef.h>
 
-// Tausworthe (taus113) random numbergenerator by radiance
-// Based on code from GSL (GNU Scientific Library)
-// MASK assures 64bit safety
-
 #ifndef _SFERA_RANDOM_H
 #define _SFERA_RANDOM_H
 
 #define MASK 0xffffffffUL
 #define FLOATMASK 0x00ffffffUL
 
-#define RAN_BUFFER_AMOUNT 2048
-
 static const float invUI = (1.f / (FLOATMASK + 1UL));
 
-class RandomGenerator {
-public:
-	RandomGenerator(const unsigned long seed) {
-		buf = new unsigned long[RAN_BUFFER_AMOUNT];
-		bufid = RAN_BUFFER_AMOUNT;
-
-		init(seed);
+//------------------------------------------------------------------------------
+// Philox4x32-10 counter-based random number generator (Salmon et al.,
+// "Parallel Random Numbers: As Easy as 1, 2, 3", 2011)
+//
+// It is a keyed bijection of a 128bit counter so any random number can be
+// computed directly from its coordinates (i.e. pixel, sample, dimension)
+// without any state. The OpenCL kernel has the same implementation.
+//------------------------------------------------------------------------------
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+inline void Philox4x32(const unsigned int c0, const unsigned int c1,
+		const unsigned int c2, const unsigned int c3,
+		const unsigned int key0, const unsigned int key1, unsigned int result[4]) {
+	unsigned int x0 = c0;
+	unsigned int x1 = c1;
+	unsigned int x2 = c2;
+	unsigned int x3 = c3;
+	unsigned int k0 = key0;
+	unsigned int k1 = key1;
+
+	for (unsigned int i = 0; i < 10; ++i) {
+		const unsigned long long p0 = (unsigned long long)PHILOX_M0 * x0;
+		const unsigned long long p1 = (unsigned long long)PHILOX_M1 * x2;
+
+		x0 = (unsigned int)(p1 >> 32) ^ x1 ^ k0;
+		x1 = (unsigned int)p1;
+		x2 = (unsigned int)(p0 >> 32) ^ x3 ^ k1;
+		x3 = (unsigned int)p0;
+
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
 	}
 
-	~RandomGenerator() {
-		delete[] buf;
-	}
+	result[0] = x0;
+	result[1] = x1;
+	result[2] = x2;
+	result[3] = x3;
+}
 
-	unsigned long uintValue() {
-		// Repopulate buffer if necessary
-		if (bufid == RAN_BUFFER_AMOUNT) {
-			for (int i = 0; i < RAN_BUFFER_AMOUNT; ++i)
-				buf[i] = nobuf_generateUInt();
-			bufid = 0;
+// Uses the 24 most significant bits
+inline float UIntToFloat(const unsigned int x) {
+	return (x >> 8) * invUI;
+}
+
+// A sequential stream of Philox4x32 random numbers
+class RandomGenerator {
+public:
+	RandomGenerator(const unsigned int seed) : key(seed), counter(0), index(4) { }
+	~RandomGenerator() { }
+
+	unsigned int uintValue() {
+		if (index == 4) {
+			Philox4x32((unsigned int)counter, (unsigned int)(counter >> 32), 0, 0,
+					key, 0, values);
+			++counter;
+			index = 0;
 		}
 
-		return buf[bufid++];
+		return values[index++];
 	}
 
 	float floatValue() {
-		return (uintValue() & FLOATMASK) * invUI;
+		return UIntToFloat(uintValue());
 	}
 
 private:
-	void init(const unsigned long tn) {
-		taus113_set(tn);
-	}
-
-	unsigned long LCG(const unsigned long n) {
-		return 69069UL * n; // The result is clamped to 32 bits (long)
-	}
-
-	void taus113_set(unsigned long s) {
-		if (!s)
-			s = 1UL; // default seed is 1
-
-		z1 = LCG(s);
-		if (z1 < 2UL)
-			z1 += 2UL;
-		z2 = LCG(z1);
-		if (z2 < 8UL)
-			z2 += 8UL;
-		z3 = LCG(z2);
-		if (z3 < 16UL)
-			z3 += 16UL;
-		z4 = LCG(z3);
-		if (z4 < 128UL)
-			z4 += 128UL;
-
-		// Calling RNG ten times to satify recurrence condition
-		for (int i = 0; i < 10; ++i)
-			nobuf_generateUInt();
-	}
-
-	unsigned long nobuf_generateUInt() {
-		const unsigned long b1 = ((((z1 << 6UL) & MASK) ^ z1) >> 13UL);
-		z1 = ((((z1 & 4294967294UL) << 18UL) & MASK) ^ b1);
-
-		const unsigned long b2 = ((((z2 << 2UL) & MASK) ^ z2) >> 27UL);
-		z2 = ((((z2 & 4294967288UL) << 2UL) & MASK) ^ b2);
-
-		const unsigned long b3 = ((((z3 << 13UL) & MASK) ^ z3) >> 21UL);
-		z3 = ((((z3 & 4294967280UL) << 7UL) & MASK) ^ b3);
-
-		const unsigned long b4 = ((((z4 << 3UL) & MASK) ^ z4) >> 12UL);
-		z4 = ((((z4 & 4294967168UL) << 13UL) & MASK) ^ b4);
-
-		return (z1 ^ z2 ^ z3 ^ z4);
-	}
-
-	unsigned long z1, z2, z3, z4;
-	unsigned long *buf;
-	int bufid;
+	const unsigned int key;
+	unsigned long long counter;
+	unsigned int values[4];
+	unsigned int index;
 };
 
 /*
@@ -0,0 +1,222 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _SFERA_SAMPLER_H
+#define _SFERA_SAMPLER_H
+
+#include "utils/utils.h"
+#include "utils/randomgen.h"
+
+//------------------------------------------------------------------------------
+// Samplers
+//
+// Each sample of a pixel is a point in a multi-dimensional space: dimensions
+// 0 and 1 are used for the pixel jitter, 2 and 3 for the lens and then
+// SAMPLER_BOUNCE_DIMENSION_COUNT dimensions for each bounce of the path (the
+// material sampling first, the light sampling at SAMPLER_BOUNCE_LIGHT_OFFSET
+// and the Russian roulette at SAMPLER_BOUNCE_RR_OFFSET).
+// The OpenCL kernel uses the same layout.
+//------------------------------------------------------------------------------
+
+#define SAMPLER_BOUNCE_DIMENSION_OFFSET 4
+#define SAMPLER_BOUNCE_DIMENSION_COUNT 8
+#define SAMPLER_BOUNCE_BSDF_OFFSET 0
+#define SAMPLER_BOUNCE_LIGHT_OFFSET 4
+#define SAMPLER_BOUNCE_RR_OFFSET 6
+
+typedef enum {
+	SAMPLER_RANDOM, SAMPLER_SOBOL, SAMPLER_SOBOL_BLUENOISE
+} SamplerType;
+
+class Sampler {
+public:
+	Sampler() : dimension(0) { }
+	virtual ~Sampler() { }
+
+	virtual SamplerType GetType() const = 0;
+
+	// Start the sampleIndex-th sample of pixel (x, y)
+	virtual void StartSample(const unsigned int x, const unsigned int y,
+		const unsigned int sampleIndex) { dimension = 0; }
+	void StartBounce(const unsigned int depth,
+			const unsigned int offset = SAMPLER_BOUNCE_BSDF_OFFSET) {
+		dimension = SAMPLER_BOUNCE_DIMENSION_OFFSET +
+				depth * SAMPLER_BOUNCE_DIMENSION_COUNT + offset;
+	}
+
+	// Returns the value of the next dimension
+	virtual float GetSample() = 0;
+
+protected:
+	unsigned int dimension;
+};
+
+//------------------------------------------------------------------------------
+// Uniform random sampler
+//
+// Stateless: the random numbers of each block of 4 dimensions (i.e. the
+// material or the light sampling of a bounce) are computed at once by
+// Philox4x32 from the pixel, the sample index and the block index, so the
+// result doesn't depend on how pixels are assigned to the threads.
+//------------------------------------------------------------------------------
+
+class RandomSampler : public Sampler {
+public:
+	RandomSampler(const unsigned int s) : seed(s), pixel(0), sampleIndex(0),
+		block(0xffffffffu) { }
+
+	SamplerType GetType() const { return SAMPLER_RANDOM; }
+
+	void StartSample(const unsigned int x, const unsigned int y,
+			const unsigned int index) {
+		dimension = 0;
+		pixel = x | (y << 16);
+		sampleIndex = index;
+		block = 0xffffffffu;
+	}
+
+	float GetSample() {
+		const unsigned int d = dimension++;
+
+		if ((d >> 2) != block) {
+			block = d >> 2;
+			Philox4x32(pixel, sampleIndex, block, 0, seed, 0, values);
+		}
+
+		return UIntToFloat(values[d & 3u]);
+	}
+
+private:
+	const unsigned int seed;
+
+	unsigned int pixel;
+	unsigned int sampleIndex;
+	unsigned int block;
+	unsigned int values[4];
+};
+
+//------------------------------------------------------------------------------
+// Owen scrambled Sobol sampler
+//
+// Dimensions are padded pairs of the 2D Sobol (0,2)-sequence, each pair with
+// its own shuffling of the sample index and each dimension with its own
+// hash-based Owen scrambling (Burley, "Practical Hash-based Owen Scrambling",
+// 2020). With blue noise enabled, all pixels share the same sequence and are
+// decorrelated by a screen-space R2 dither (a Cranley-Patterson rotation that
+// distributes the error as blue noise) instead of a per-pixel seed.
+//------------------------------------------------------------------------------
+
+inline unsigned int SamplerHash(unsigned int x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+
+	return x;
+}
+
+inline unsigned int ReverseBits(unsigned int x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+
+	return x;
+}
+
+inline unsigned int NestedUniformScramble(unsigned int x, const unsigned int seed) {
+	// Laine-Karras style permutation applied to the reversed bits (with the
+	// improved constants by N. Vegdahl, the original ones mix poorly the
+	// high bits)
+	x = ReverseBits(x);
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+
+	return ReverseBits(x);
+}
+
+inline unsigned int Sobol02(unsigned int index, const unsigned int dim) {
+	if (dim == 0)
+		return ReverseBits(index);
+
+	unsigned int result = 0;
+	for (unsigned int v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+		if (index & 1u)
+			result ^= v;
+	}
+
+	return result;
+}
+
+class SobolSampler : public Sampler {
+public:
+	SobolSampler(const unsigned int s, const bool bn) : seed(SamplerHash(s)),
+		blueNoise(bn), pixelSeed(0), sampleIndex(0), dither(0.f) { }
+
+	SamplerType GetType() const { return blueNoise ? SAMPLER_SOBOL_BLUENOISE : SAMPLER_SOBOL; }
+
+	void StartSample(const unsigned int x, const unsigned int y,
+			const unsigned int index) {
+		dimension = 0;
+		sampleIndex = index;
+
+		if (blueNoise) {
+			pixelSeed = seed;
+			// R2 sequence dither, in 0.32 fixed point to wrap around for free
+			dither = UIntToFloat(x * 3242174889u + y * 2447445414u);
+		} else
+			pixelSeed = SamplerHash(seed ^ SamplerHash(x ^ SamplerHash(y)));
+	}
+
+	float GetSample() {
+		const unsigned int d = dimension++;
+
+		const unsigned int pairSeed = SamplerHash(pixelSeed ^ (d >> 1));
+		const unsigned int index = NestedUniformScramble(sampleIndex, pairSeed);
+		const unsigned int v = NestedUniformScramble(Sobol02(index, d & 1u),
+				SamplerHash(pairSeed ^ (d + 1)));
+
+		float u = UIntToFloat(v);
+		if (blueNoise) {
+			// Cranley-Patterson rotation, each dimension uses a different
+			// offset of the dither
+			u += dither + d * 0.6180339887f;
+			u -= Floor2Int(u);
+			u = Min(u, 0.99999994f);
+		}
+
+		return u;
+	}
+
+private:
+	const unsigned int seed;
+	const bool blueNoise;
+
+	unsigned int pixelSeed;
+	unsigned int sampleIndex;
+	float dither;
+};
+
+#endif	/* _SFERA_SAMPLER_H */
@@ -0,0 +1,131 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _SFERA_STAGEPROFILER_H
+#define	_SFERA_STAGEPROFILER_H
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "sfera.h"
+
+// The stages of a frame, each renderer uses only some of them
+typedef enum {
+	// CPU renderers
+	FRAME_STAGE_ACCEL_BUILD, FRAME_STAGE_RENDER, FRAME_STAGE_FILTER,
+	FRAME_STAGE_BLEND_TONEMAP, FRAME_STAGE_GL_UPLOAD,
+	// OpenCL renderer
+	FRAME_STAGE_RECOMPILE, FRAME_STAGE_KERNEL_INITFB, FRAME_STAGE_KERNEL_PATHTRACING,
+	FRAME_STAGE_KERNEL_FILTER, FRAME_STAGE_KERNEL_BLEND, FRAME_STAGE_KERNEL_TONEMAP,
+	FRAME_STAGE_KERNEL_UPDATEPIXELBUFFER, FRAME_STAGE_READBACK, FRAME_STAGE_PBO_DRAW,
+	// Both: the merge of the frame buffers of the devices and the time spent
+	// waiting for the render threads
+	FRAME_STAGE_MERGE, FRAME_STAGE_SYNC,
+	// Display
+	FRAME_STAGE_TEXT, FRAME_STAGE_SWAP,
+	FRAME_STAGE_COUNT
+} FrameStage;
+
+typedef enum {
+	PHYSIC_STAGE_GRAVITY, PHYSIC_STAGE_STEP_SIMULATION, PHYSIC_STAGE_MANIFOLD_SCAN,
+	PHYSIC_STAGE_COUNT
+} PhysicStage;
+
+extern const char *FrameStageNames[FRAME_STAGE_COUNT];
+extern const char *PhysicStageNames[PHYSIC_STAGE_COUNT];
+
+//------------------------------------------------------------------------------
+// The time spent in each stage of the last records (i.e. frames or physic
+// steps) kept in a ring buffer.
+//
+// The stages of the current record can be timed by any thread (i.e. the render
+// threads), EndRecord() moves the current record in the ring. The times are in
+// seconds.
+//------------------------------------------------------------------------------
+
+class StageProfiler {
+public:
+	StageProfiler(const string &profilerName, const char **names,
+		const unsigned int count, const unsigned int size);
+	~StageProfiler() { }
+
+	void AddTime(const unsigned int stage, const double t) {
+		boost::unique_lock<boost::mutex> lock(mutex);
+		current[stage] += t;
+	}
+	void EndRecord();
+	// Drops all the records (i.e. the warm up frames)
+	void Reset();
+
+	const string &GetName() const { return name; }
+	unsigned int GetStageCount() const { return stageCount; }
+	const char *GetStageName(const unsigned int stage) const { return stageNames[stage]; }
+
+	// The mean of the records in the ring, the time of a record is the one
+	// between the end of the previous record and its end
+	unsigned int GetMeanTimes(vector<double> &stageTimes, double *recordTime) const;
+
+	// One row (or object) for each record in the ring, the times are in
+	// milliseconds
+	void WriteCSV(ostream &os) const;
+	void WriteJSON(ostream &os) const;
+	// The format is selected by the extension of the file: .json or CSV
+	void Save(const string &fileName) const;
+
+private:
+	// Index of the i-th oldest record in the ring
+	unsigned int GetRecordIndex(const unsigned int i) const {
+		return (nextRecord + ringSize - recordCount + i) % ringSize;
+	}
+	// Each record is the end time, the record time and the stage times
+	const double *GetRecord(const unsigned int index) const {
+		return &records[index * (stageCount + 2)];
+	}
+
+	const string name;
+	const char **stageNames;
+	const unsigned int stageCount;
+	const unsigned int ringSize;
+
+	mutable boost::mutex mutex;
+	vector<double> current;
+	vector<double> records;
+	unsigned int nextRecord, recordCount;
+	double startTime, lastEndTime;
+};
+
+// Adds the time of its scope to a stage, it does nothing if the profiler is
+// NULL (i.e. the profiling is disabled)
+class ScopedStageTimer {
+public:
+	ScopedStageTimer(StageProfiler *p, const unsigned int s) :
+		profiler(p), stage(s), startTime(p ? WallClockTime() : 0.0) { }
+	~ScopedStageTimer() {
+		if (profiler)
+			profiler->AddTime(stage, WallClockTime() - startTime);
+	}
+
+private:
+	StageProfiler *profiler;
+	const unsigned int stage;
+	const double startTime;
+};
+
+#endif	/* _SFERA_STAGEPROFILER_H */
@@ -111,6 +111,40 @@ inline float Degrees(float rad) {
 	return (180.f / M_PI) * rad;
 }
 
+// Polynomial approximation of atan2f(), the max. error is 2e-6 radians
+inline float FastAtan2(const float y, const float x) {
+	const float ax = fabsf(x);
+	const float ay = fabsf(y);
+	const float maxA = (ax > ay) ? ax : ay;
+	if (maxA == 0.f)
+		return 0.f;
+	const float minA = (ax > ay) ? ay : ax;
+
+	// atan() in [0, 1]
+	const float a = minA / maxA;
+	const float s = a * a;
+	float r = (((((-0.01172120f * s + 0.05265332f) * s - 0.11643287f) * s +
+			0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;
+
+	if (ay > ax)
+		r = (float)(M_PI / 2.0) - r;
+	if (x < 0.f)
+		r = (float)M_PI - r;
+
+	return (y < 0.f) ? -r : r;
+}
+
+// Polynomial approximation of acosf() (Abramowitz and Stegun 4.4.46), the max.
+// error is 5e-7 radians
+inline float FastAcos(const float x) {
+	const float ax = Min(fabsf(x), 1.f);
+	const float r = sqrtf(1.f - ax) * (((((((-0.0012624911f * ax + 0.0066700901f) * ax -
+			0.0170881256f) * ax + 0.0308918810f) * ax - 0.0501743046f) * ax +
+			0.0889789874f) * ax - 0.2145988016f) * ax + 1.5707963050f);
+
+	return (x < 0.f) ? (float)M_PI - r : r;
+}
+
 inline float Sgn(float a) {
 	return a < 0.f ? -1.f : 1.f;
 }
@@ -191,4 +225,49 @@ inline unsigned int UIntLog2(unsigned int value) {
 	return l;
 }
 
+// IEEE 754 half precision conversions, used to store HDR texture maps. Values
+// out of the half range are clamped to the largest half.
+inline unsigned short FloatToHalf(const float val) {
+	union { float f; unsigned int i; } v;
+	v.f = val;
+	const unsigned int sign = (v.i >> 16) & 0x8000u;
+	const unsigned int absBits = v.i & 0x7fffffffu;
+
+	// Infinity and NaN
+	if (absBits >= 0x7f800000u)
+		return (unsigned short)(sign | ((absBits > 0x7f800000u) ? 0x7e00u : 0x7c00u));
+	// Too large: it would round to infinity
+	if (absBits >= 0x477ff000u)
+		return (unsigned short)(sign | 0x7bffu);
+	// Normal, rounded to nearest
+	if (absBits >= 0x38800000u)
+		return (unsigned short)(sign | ((absBits - (112u << 23) + 0x1000u) >> 13));
+	// Too small: it would round to zero
+	if (absBits < 0x33000000u)
+		return (unsigned short)sign;
+
+	// Denormal, rounded to nearest
+	const unsigned int shift = 126u - (absBits >> 23);
+	const unsigned int mantissa = (absBits & 0x7fffffu) | 0x800000u;
+	return (unsigned short)(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+}
+
+inline float HalfToFloat(const unsigned short h) {
+	const unsigned int sign = (h & 0x8000u) << 16;
+	const unsigned int exponent = (h >> 10) & 0x1fu;
+	const unsigned int mantissa = h & 0x3ffu;
+
+	union { float f; unsigned int i; } v;
+	if (exponent == 0) {
+		// Zero or denormal
+		v.f = mantissa * (1.f / 16777216.f);
+		v.i |= sign;
+	} else if (exponent == 31)
+		v.i = sign | 0x7f800000u | (mantissa << 13);
+	else
+		v.i = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+
+	return v.f;
+}
+
 #endif	/* _SFERA_UTILS_H */
@@ -0,0 +1,784 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+// Microbenchmarks of the hot code paths of the renderers. Each case runs on
+// synthetic data at several sizes, so an optimization of a single path can be
+// measured in isolation without a level, a window or an OpenCL device.
+
+#include <algorithm>
+#include <memory>
+
+#include "sfera.h"
+#include "geometry/sphere.h"
+#include "acceleretor/bvhaccel.h"
+#include "renderer/cpu/cpuscene.h"
+#include "renderer/cpu/cpurenderer.h"
+#include "pixel/framebuffer.h"
+#include "pixel/tonemap.h"
+#include "sdl/camera.h"
+#include "sdl/material.h"
+#include "sdl/texmap.h"
+#include "utils/mc.h"
+#include "utils/randomgen.h"
+#include "utils/sampler.h"
+
+void SferaDebugHandler(const char *msg) {
+	cerr << "[SferaMicroBench] " << msg << endl;
+}
+
+// Written at the end of each batch so the compiler can not drop the work
+static volatile float benchSink = 0.f;
+
+//------------------------------------------------------------------------------
+// Benchmark framework
+//------------------------------------------------------------------------------
+
+// A case of a benchmark: the constructor prepares the synthetic data and each
+// call to Run() executes a batch of GetOpCount() operations on it
+class MicroBench {
+public:
+	MicroBench(const string &n, const string &s) : name(n), size(s) { }
+	virtual ~MicroBench() { }
+
+	virtual unsigned int GetOpCount() const = 0;
+	virtual void Run() = 0;
+
+	const string name, size;
+};
+
+class MicroBenchRunner {
+public:
+	MicroBenchRunner(const double t, const string &f) : minTime(t), filter(f) {
+		cout << setw(32) << left << "# name" << setw(12) << "size" <<
+				setw(8) << right << "batches" << setw(14) << "ns/op (min)" <<
+				setw(14) << "ns/op (p50)" << setw(12) << "Mops/sec" << endl;
+	}
+
+	// The cases not matching the filter are not even built, some of them
+	// have expensive setups
+	bool IsSelected(const string &name) const {
+		return (filter.length() == 0) || (name.find(filter) != string::npos);
+	}
+
+	// Runs batches until minTime has elapsed (at least 3) and prints the
+	// per operation time of the best and of the median batch. It deletes the
+	// bench.
+	void Measure(MicroBench *bench) const {
+		// Warm up the caches and the branch predictors
+		bench->Run();
+
+		vector<double> batchTimes;
+		double totalTime = 0.0;
+		while ((totalTime < minTime) || (batchTimes.size() < 3)) {
+			const double t0 = WallClockTime();
+			bench->Run();
+			const double dt = WallClockTime() - t0;
+
+			batchTimes.push_back(dt);
+			totalTime += dt;
+		}
+		sort(batchTimes.begin(), batchTimes.end());
+
+		const double opCount = bench->GetOpCount();
+		const double minOpTime = batchTimes[0] / opCount;
+		const double medianOpTime = batchTimes[batchTimes.size() / 2] / opCount;
+		cout << setw(32) << left << bench->name << setw(12) << bench->size <<
+				setw(8) << right << batchTimes.size() <<
+				fixed << setprecision(2) << setw(14) << minOpTime * 1e9 <<
+				setw(14) << medianOpTime * 1e9 <<
+				setw(12) << 1e-6 / minOpTime << endl;
+		cout.unsetf(ios_base::floatfield);
+
+		delete bench;
+	}
+
+private:
+	const double minTime;
+	const string filter;
+};
+
+static string SizeString(const unsigned int count) {
+	stringstream ss;
+	ss << count;
+	return ss.str();
+}
+
+static string SizeString(const unsigned int width, const unsigned int height) {
+	stringstream ss;
+	ss << width << "x" << height;
+	return ss.str();
+}
+
+static Vector RandomDirection(RandomGenerator &rng) {
+	const float u1 = rng.floatValue();
+	const float u2 = rng.floatValue();
+	return UniformSampleSphere(u1, u2);
+}
+
+static Point RandomPoint(RandomGenerator &rng, const float size) {
+	const float x = rng.floatValue();
+	const float y = rng.floatValue();
+	const float z = rng.floatValue();
+	return Point(size * (x - .5f), size * (y - .5f), size * (z - .5f));
+}
+
+static void RandomPixels(RandomGenerator &rng, Pixel *pixels, const unsigned int count) {
+	// Some pixels are brighter than 1.0 like in a rendered frame
+	for (unsigned int i = 0; i < count; ++i) {
+		const float k = (rng.floatValue() < .05f) ? 8.f : 1.f;
+		const float r = rng.floatValue();
+		const float g = rng.floatValue();
+		const float b = rng.floatValue();
+		pixels[i] = k * Spectrum(r, g, b);
+	}
+}
+
+// Operations of each batch for the cases with a per-item cost
+#define MICROBENCH_BATCH_SIZE (1u << 20)
+
+//------------------------------------------------------------------------------
+// Sphere::Intersect() and Sphere::IntersectP()
+//------------------------------------------------------------------------------
+
+// The size is the count of spheres tested round robin, the bigger ones
+// don't fit in the caches
+class SphereBench : public MicroBench {
+public:
+	SphereBench(const unsigned int count, const bool shadow) :
+		MicroBench(shadow ? "sphere.intersectp" : "sphere.intersect", SizeString(count)),
+		isShadowRay(shadow), spheres(count), rays(1024) {
+		RandomGenerator rng(count);
+		for (unsigned int i = 0; i < spheres.size(); ++i)
+			spheres[i] = Sphere(RandomPoint(rng, 20.f), .5f + 1.5f * rng.floatValue());
+
+		// Rays from the outside toward the spheres, so about half of the tests
+		// are hits
+		for (unsigned int i = 0; i < rays.size(); ++i) {
+			const Point o = RandomPoint(rng, 20.f) + 40.f * RandomDirection(rng);
+			rays[i] = Ray(o, Normalize(RandomPoint(rng, 20.f) - o));
+		}
+	}
+
+	unsigned int GetOpCount() const { return MICROBENCH_BATCH_SIZE; }
+
+	void Run() {
+		const unsigned int sphereMask = spheres.size() - 1;
+		const unsigned int rayMask = rays.size() - 1;
+		float sum = 0.f;
+		if (isShadowRay) {
+			for (unsigned int i = 0; i < MICROBENCH_BATCH_SIZE; ++i) {
+				float hitT;
+				if (spheres[i & sphereMask].IntersectP(&rays[i & rayMask], &hitT))
+					sum += hitT;
+			}
+		} else {
+			for (unsigned int i = 0; i < MICROBENCH_BATCH_SIZE; ++i) {
+				Ray &ray(rays[i & rayMask]);
+				ray.maxt = std::numeric_limits<float>::infinity();
+				if (spheres[i & sphereMask].Intersect(&ray))
+					sum += ray.maxt;
+			}
+		}
+		benchSink = sum;
+	}
+
+private:
+	const bool isShadowRay;
+	vector<Sphere> spheres;
+	vector<Ray> rays;
+};
+
+//------------------------------------------------------------------------------
+// BVHAccel
+//------------------------------------------------------------------------------
+
+// A cloud of spheres with a constant density whatever the count is
+static void RandomSphereCloud(const unsigned int count, vector<Sphere> &spheres,
+		float *size) {
+	RandomGenerator rng(count);
+	*size = 4.f * powf((float)count, 1.f / 3.f);
+
+	spheres.resize(count);
+	for (unsigned int i = 0; i < count; ++i)
+		spheres[i] = Sphere(RandomPoint(rng, *size), .25f + .75f * rng.floatValue());
+}
+
+static BVHAccel *BuildBVH(const vector<Sphere> &spheres) {
+	vector<const Sphere *> sphereList(spheres.size());
+	for (size_t i = 0; i < spheres.size(); ++i)
+		sphereList[i] = &spheres[i];
+
+	// The same tree parameters of CPURenderer::BuildAcceleretor()
+	return new BVHAccel(sphereList, CPURENDERER_BVH_TREETYPE,
+			CPURENDERER_BVH_ISECTCOST, CPURENDERER_BVH_TRAVCOST,
+			CPURENDERER_BVH_EMPTYBONUS);
+}
+
+class BVHBuildBench : public MicroBench {
+public:
+	BVHBuildBench(const unsigned int count) :
+		MicroBench("bvh.build", SizeString(count)) {
+		float size;
+		RandomSphereCloud(count, spheres, &size);
+	}
+
+	// One operation for each sphere
+	unsigned int GetOpCount() const { return spheres.size(); }
+
+	void Run() {
+		BVHAccel *bvh = BuildBVH(spheres);
+		benchSink = bvh->nNodes;
+		delete bvh;
+	}
+
+private:
+	vector<Sphere> spheres;
+};
+
+class BVHIntersectBench : public MicroBench {
+public:
+	BVHIntersectBench(const unsigned int count, const bool shadow) :
+		MicroBench(shadow ? "bvh.intersectp" : "bvh.intersect", SizeString(count)),
+		isShadowRay(shadow), rays(4096) {
+		float size;
+		RandomSphereCloud(count, spheres, &size);
+		bvh = BuildBVH(spheres);
+
+		// Rays leaving from inside the cloud in all directions, like the
+		// bounces of a path
+		RandomGenerator rng(count + 1);
+		for (unsigned int i = 0; i < rays.size(); ++i)
+			rays[i] = Ray(RandomPoint(rng, size), RandomDirection(rng));
+	}
+	~BVHIntersectBench() {
+		delete bvh;
+	}
+
+	unsigned int GetOpCount() const { return rays.size(); }
+
+	void Run() {
+		float sum = 0.f;
+		if (isShadowRay) {
+			for (unsigned int i = 0; i < rays.size(); ++i) {
+				if (bvh->IntersectP(&rays[i]))
+					sum += 1.f;
+			}
+		} else {
+			for (unsigned int i = 0; i < rays.size(); ++i) {
+				Ray &ray(rays[i]);
+				ray.maxt = std::numeric_limits<float>::infinity();
+
+				Sphere *hitSphere;
+				unsigned int index;
+				if (bvh->Intersect(&ray, &hitSphere, &index))
+					sum += ray.maxt;
+			}
+		}
+		benchSink = sum;
+	}
+
+private:
+	const bool isShadowRay;
+	vector<Sphere> spheres;
+	BVHAccel *bvh;
+	vector<Ray> rays;
+};
+
+//------------------------------------------------------------------------------
+// Random number generators
+//------------------------------------------------------------------------------
+
+// The size is the count of generators used round robin (i.e. one for each
+// pixel of a tile)
+template <class T> class RandomGeneratorBench : public MicroBench {
+public:
+	RandomGeneratorBench(const string &name, const unsigned int count) :
+		MicroBench(name, SizeString(count)) {
+		for (unsigned int i = 0; i < count; ++i)
+			generators.push_back(T(i + 1));
+	}
+
+	unsigned int GetOpCount() const { return MICROBENCH_BATCH_SIZE; }
+
+	void Run() {
+		const unsigned int mask = generators.size() - 1;
+		float sum = 0.f;
+		for (unsigned int i = 0; i < MICROBENCH_BATCH_SIZE; ++i)
+			sum += generators[i & mask].floatValue();
+		benchSink = sum;
+	}
+
+private:
+	vector<T> generators;
+};
+
+//------------------------------------------------------------------------------
+// CPUScene::Sample_f()
+//------------------------------------------------------------------------------
+
+static cpuscene::Material CompileMaterial(const MaterialType type) {
+	std::auto_ptr<Material> m;
+	switch (type) {
+		case MIRROR:
+			m.reset(new MirrorMaterial(Spectrum(.9f, .9f, .9f)));
+			break;
+		case GLASS:
+			m.reset(new GlassMaterial(Spectrum(.9f, .9f, .9f), Spectrum(.9f, .9f, .9f), 1.f, 1.5f));
+			break;
+		case METAL:
+			m.reset(new MetalMaterial(Spectrum(.9f, .7f, .4f), 50.f));
+			break;
+		case ALLOY:
+			m.reset(new AlloyMaterial(Spectrum(.7f, .1f, .1f), Spectrum(.9f, .9f, .9f), 50.f, .3f));
+			break;
+		default:
+			m.reset(new MatteMaterial(Spectrum(.75f, .75f, .75f)));
+			break;
+	}
+
+	cpuscene::Material mat;
+	CPUScene::CompileMaterial(m.get(), &mat);
+
+	return mat;
+}
+
+static string MaterialName(const MaterialType type) {
+	switch (type) {
+		case MATTE: return "matte";
+		case MIRROR: return "mirror";
+		case GLASS: return "glass";
+		case METAL: return "metal";
+		case ALLOY: return "alloy";
+		default: return "unknown";
+	}
+}
+
+// The size is the count of different hit points, the sampler is restarted
+// for each sample like the renderers do for each pixel
+class MaterialBench : public MicroBench {
+public:
+	MaterialBench(const MaterialType type, const unsigned int count) :
+		MicroBench("material." + MaterialName(type) + ".sample_f", SizeString(count)),
+		mat(CompileMaterial(type)), sampler(count), wo(count), normals(count) {
+		RandomGenerator rng(count);
+		for (unsigned int i = 0; i < count; ++i) {
+			normals[i] = Normal(RandomDirection(rng));
+
+			// Glass is hit from both sides
+			wo[i] = RandomDirection(rng);
+			if ((type != GLASS) && (Dot(wo[i], Vector(normals[i])) < 0.f))
+				wo[i] = -wo[i];
+		}
+	}
+
+	unsigned int GetOpCount() const { return MICROBENCH_BATCH_SIZE; }
+
+	void Run() {
+		const unsigned int mask = wo.size() - 1;
+		float sum = 0.f;
+		for (unsigned int i = 0; i < MICROBENCH_BATCH_SIZE; ++i) {
+			sampler.StartSample(i & 0xffffu, i >> 16, 0);
+			sampler.StartBounce(0);
+
+			const unsigned int index = i & mask;
+			Vector wi;
+			float pdf;
+			bool diffuseBounce;
+			const Spectrum f = CPUScene::Sample_f(mat, sampler, wo[index], &wi,
+					normals[index], normals[index], &pdf, diffuseBounce);
+			sum += f.r + wi.x;
+		}
+		benchSink = sum;
+	}
+
+private:
+	const cpuscene::Material mat;
+	RandomSampler sampler;
+	vector<Vector> wo;
+	vector<Normal> normals;
+};
+
+//------------------------------------------------------------------------------
+// TextureMap::GetColor() and BumpMapInstance::SphericalMap()
+//------------------------------------------------------------------------------
+
+// A size x size map of smooth noise, a multiple of the period of the sines
+// so it wraps without seams
+static TextureMap *SyntheticTextureMap(const unsigned int size, const bool isHDR,
+		const bool bumpMap) {
+	RandomGenerator rng(size);
+	vector<Spectrum> pixels(size * size);
+	const float k = 8.f * M_PI / size;
+	for (unsigned int y = 0; y < size; ++y) {
+		for (unsigned int x = 0; x < size; ++x) {
+			const float v = .5f + .25f * sinf(k * x) * cosf(k * y);
+			const float noise = .25f * rng.floatValue();
+			pixels[x + y * size] = Spectrum(v + noise, v, 1.f - v) * (isHDR ? 4.f : 1.f);
+		}
+	}
+
+	return new TextureMap(size, size, pixels, isHDR, bumpMap);
+}
+
+// Lookups at random coordinates: the worst case for the caches, the bigger
+// maps are the slower ones
+class TextureMapBench : public MicroBench {
+public:
+	TextureMapBench(const unsigned int size, const bool isHDR, const bool trilinear) :
+		MicroBench(string("texmap.getcolor.") + (isHDR ? "hdr" : "rgba8") +
+			(trilinear ? ".lod" : ""), SizeString(size, size)),
+		useLevelOfDetail(trilinear), uvs(1u << 16), lods(1u << 16) {
+		texMap = SyntheticTextureMap(size, isHDR, false);
+
+		RandomGenerator rng(size + 1);
+		for (unsigned int i = 0; i < uvs.size(); ++i) {
+			const float u = rng.floatValue();
+			const float v = rng.floatValue();
+			uvs[i] = UV(u, v);
+			lods[i] = rng.floatValue() * texMap->GetLevelCount();
+		}
+	}
+	~TextureMapBench() {
+		delete texMap;
+	}
+
+	unsigned int GetOpCount() const { return uvs.size(); }
+
+	void Run() {
+		float sum = 0.f;
+		if (useLevelOfDetail) {
+			for (unsigned int i = 0; i < uvs.size(); ++i)
+				sum += texMap->GetColor(uvs[i], lods[i]).g;
+		} else {
+			for (unsigned int i = 0; i < uvs.size(); ++i)
+				sum += texMap->GetColor(uvs[i]).g;
+		}
+		benchSink = sum;
+	}
+
+private:
+	const bool useLevelOfDetail;
+	TextureMap *texMap;
+	vector<UV> uvs;
+	vector<float> lods;
+};
+
+class BumpMapBench : public MicroBench {
+public:
+	BumpMapBench(const unsigned int size) :
+		MicroBench("bumpmap.sphericalmap", SizeString(size, size)),
+		phis(1u << 16), thetas(1u << 16), normals(1u << 16), footprints(1u << 16) {
+		texMap = SyntheticTextureMap(size, false, true);
+		bumpMap = new BumpMapInstance(texMap, 0.f, 0.f, 1.f, 1.f, 1.f);
+
+		RandomGenerator rng(size + 1);
+		for (unsigned int i = 0; i < phis.size(); ++i) {
+			const Vector dir = RandomDirection(rng);
+			phis[i] = SphericalPhi(dir);
+			thetas[i] = SphericalTheta(dir);
+			normals[i] = Normal(dir);
+			// Up to a few degrees, like a far away sphere
+			footprints[i] = .05f * rng.floatValue();
+		}
+	}
+	~BumpMapBench() {
+		delete bumpMap;
+		delete texMap;
+	}
+
+	unsigned int GetOpCount() const { return phis.size(); }
+
+	void Run() {
+		float sum = 0.f;
+		for (unsigned int i = 0; i < phis.size(); ++i)
+			sum += bumpMap->SphericalMap(phis[i], thetas[i], normals[i], footprints[i]).x;
+		benchSink = sum;
+	}
+
+private:
+	TextureMap *texMap;
+	BumpMapInstance *bumpMap;
+	vector<float> phis, thetas;
+	vector<Normal> normals;
+	vector<float> footprints;
+};
+
+//------------------------------------------------------------------------------
+// FrameBuffer filters and tone mapping
+//------------------------------------------------------------------------------
+
+typedef enum {
+	FILTER_BOX, FILTER_BLUR_LIGHT, FILTER_BLUR_HEAVY
+} FilterBenchType;
+
+static string FilterName(const FilterBenchType type) {
+	switch (type) {
+		case FILTER_BOX: return "framebuffer.boxfilter";
+		case FILTER_BLUR_LIGHT: return "framebuffer.blurlightfilter";
+		case FILTER_BLUR_HEAVY: return "framebuffer.blurheavyfilter";
+		default: return "unknown";
+	}
+}
+
+// Both the X and the Y pass, an operation is a pixel
+class FilterBench : public MicroBench {
+public:
+	FilterBench(const FilterBenchType type, const unsigned int w, const unsigned int h) :
+		MicroBench(FilterName(type), SizeString(w, h)), filterType(type),
+		width(w), height(h), frameBuffer(w, h), tmpFrameBuffer(w, h) {
+		RandomGenerator rng(w * h);
+		RandomPixels(rng, frameBuffer.GetPixels(), width * height);
+	}
+
+	unsigned int GetOpCount() const { return width * height; }
+
+	void Run() {
+		switch (filterType) {
+			case FILTER_BOX:
+				// The default radius of the game configuration
+				FrameBuffer::ApplyBoxFilter(frameBuffer.GetPixels(), tmpFrameBuffer.GetPixels(),
+						width, height, 1);
+				break;
+			case FILTER_BLUR_LIGHT:
+				FrameBuffer::ApplyBlurLightFilter(frameBuffer.GetPixels(), tmpFrameBuffer.GetPixels(),
+						width, height);
+				break;
+			case FILTER_BLUR_HEAVY:
+				FrameBuffer::ApplyBlurHeavyFilter(frameBuffer.GetPixels(), tmpFrameBuffer.GetPixels(),
+						width, height);
+				break;
+		}
+		benchSink = frameBuffer.GetPixels()[0].r;
+	}
+
+private:
+	const FilterBenchType filterType;
+	const unsigned int width, height;
+	FrameBuffer frameBuffer, tmpFrameBuffer;
+};
+
+// ToneMap::Map() or, with packRGBA8, ToneMap::MapRGBA8() of the whole frame.
+// An operation is a pixel.
+class ToneMapBench : public MicroBench {
+public:
+	ToneMapBench(ToneMap *tm, const bool packRGBA8, const unsigned int w, const unsigned int h) :
+		MicroBench(string("tonemap.") +
+			((tm->GetType() == TONEMAP_LINEAR) ? "linear" : "reinhard02") +
+			(packRGBA8 ? ".maprgba8" : ".map"), SizeString(w, h)),
+		toneMap(tm), isRGBA8(packRGBA8), width(w), height(h),
+		src(w, h), dst(w, h), rgba8(4 * w * h) {
+		RandomGenerator rng(w * h);
+		RandomPixels(rng, src.GetPixels(), width * height);
+
+		float luminance = 0.f;
+		for (unsigned int i = 0; i < width * height; ++i)
+			luminance += src.GetPixels()[i].Y();
+		averageLuminance = luminance / (width * height);
+	}
+	~ToneMapBench() {
+		delete toneMap;
+	}
+
+	unsigned int GetOpCount() const { return width * height; }
+
+	void Run() {
+		if (isRGBA8) {
+			toneMap->MapRGBA8(src.GetPixels(), &rgba8[0], width * height, averageLuminance);
+			benchSink = rgba8[0];
+		} else {
+			toneMap->Map(&src, &dst);
+			benchSink = dst.GetPixels()[0].r;
+		}
+	}
+
+private:
+	ToneMap *toneMap;
+	const bool isRGBA8;
+	const unsigned int width, height;
+	FrameBuffer src, dst;
+	vector<unsigned char> rgba8;
+	float averageLuminance;
+};
+
+//------------------------------------------------------------------------------
+// PerspectiveCamera::GenerateRay()
+//------------------------------------------------------------------------------
+
+// One ray for each pixel of the film, with the pixel jitter
+class CameraBench : public MicroBench {
+public:
+	CameraBench(const unsigned int w, const unsigned int h) :
+		MicroBench("camera.generateray", SizeString(w, h)), width(w), height(h),
+		camera(Point(0.f, -10.f, 5.f), Point(0.f, 0.f, 0.f), Vector(0.f, 0.f, 1.f)),
+		jitters(1024) {
+		camera.Update(width, height);
+
+		RandomGenerator rng(w * h);
+		for (unsigned int i = 0; i < jitters.size(); ++i)
+			jitters[i] = rng.floatValue();
+	}
+
+	unsigned int GetOpCount() const { return width * height; }
+
+	void Run() {
+		float sum = 0.f;
+		unsigned int index = 0;
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x) {
+				const float jx = jitters[index++ & 1023];
+				const float jy = jitters[index++ & 1023];
+
+				Ray ray;
+				camera.GenerateRay(x + jx, y + jy, width, height, &ray, jx, jy);
+				sum += ray.d.x;
+			}
+		}
+		benchSink = sum;
+	}
+
+private:
+	const unsigned int width, height;
+	PerspectiveCamera camera;
+	vector<float> jitters;
+};
+
+//------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------
+
+static void RunAll(const MicroBenchRunner &runner) {
+	static const unsigned int filmSizes[3][2] = {
+		{ 320, 240 }, { 640, 480 }, { 1920, 1080 }
+	};
+
+	// Must be powers of 2, they are used as masks
+	static const unsigned int sphereCounts[3] = { 64, 4096, 262144 };
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (runner.IsSelected("sphere.intersect"))
+			runner.Measure(new SphereBench(sphereCounts[i], false));
+		if (runner.IsSelected("sphere.intersectp"))
+			runner.Measure(new SphereBench(sphereCounts[i], true));
+	}
+
+	static const unsigned int bvhSphereCounts[3] = { 1024, 8192, 65536 };
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (runner.IsSelected("bvh.build"))
+			runner.Measure(new BVHBuildBench(bvhSphereCounts[i]));
+		if (runner.IsSelected("bvh.intersect"))
+			runner.Measure(new BVHIntersectBench(bvhSphereCounts[i], false));
+		if (runner.IsSelected("bvh.intersectp"))
+			runner.Measure(new BVHIntersectBench(bvhSphereCounts[i], true));
+	}
+
+	static const unsigned int generatorCounts[3] = { 1, 64, 4096 };
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (runner.IsSelected("rng.philox"))
+			runner.Measure(new RandomGeneratorBench<RandomGenerator>("rng.philox", generatorCounts[i]));
+		if (runner.IsSelected("rng.tausworthe"))
+			runner.Measure(new RandomGeneratorBench<TauswortheRandomGenerator>("rng.tausworthe", generatorCounts[i]));
+	}
+
+	static const MaterialType materialTypes[5] = { MATTE, MIRROR, GLASS, METAL, ALLOY };
+	static const unsigned int hitPointCounts[2] = { 256, 65536 };
+	for (unsigned int m = 0; m < 5; ++m) {
+		for (unsigned int i = 0; i < 2; ++i) {
+			if (runner.IsSelected("material." + MaterialName(materialTypes[m]) + ".sample_f"))
+				runner.Measure(new MaterialBench(materialTypes[m], hitPointCounts[i]));
+		}
+	}
+
+	static const unsigned int mapSizes[3] = { 64, 512, 2048 };
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (runner.IsSelected("texmap.getcolor.rgba8"))
+			runner.Measure(new TextureMapBench(mapSizes[i], false, false));
+		if (runner.IsSelected("texmap.getcolor.rgba8.lod"))
+			runner.Measure(new TextureMapBench(mapSizes[i], false, true));
+		if (runner.IsSelected("texmap.getcolor.hdr"))
+			runner.Measure(new TextureMapBench(mapSizes[i], true, false));
+		if (runner.IsSelected("texmap.getcolor.hdr.lod"))
+			runner.Measure(new TextureMapBench(mapSizes[i], true, true));
+		if (runner.IsSelected("bumpmap.sphericalmap"))
+			runner.Measure(new BumpMapBench(mapSizes[i]));
+	}
+
+	static const FilterBenchType filterTypes[3] = { FILTER_BOX, FILTER_BLUR_LIGHT, FILTER_BLUR_HEAVY };
+	for (unsigned int f = 0; f < 3; ++f) {
+		for (unsigned int i = 0; i < 3; ++i) {
+			if (runner.IsSelected(FilterName(filterTypes[f])))
+				runner.Measure(new FilterBench(filterTypes[f], filmSizes[i][0], filmSizes[i][1]));
+		}
+	}
+
+	// The default parameters of GameLevel
+	for (unsigned int i = 0; i < 3; ++i) {
+		const unsigned int w = filmSizes[i][0];
+		const unsigned int h = filmSizes[i][1];
+
+		if (runner.IsSelected("tonemap.linear.map"))
+			runner.Measure(new ToneMapBench(new LinearToneMap(2.2f, 1.f), false, w, h));
+		if (runner.IsSelected("tonemap.linear.maprgba8"))
+			runner.Measure(new ToneMapBench(new LinearToneMap(2.2f, 1.f), true, w, h));
+		if (runner.IsSelected("tonemap.reinhard02.map"))
+			runner.Measure(new ToneMapBench(new Reinhard02ToneMap(2.2f, 1.f, 1.2f, 3.75f), false, w, h));
+		if (runner.IsSelected("tonemap.reinhard02.maprgba8"))
+			runner.Measure(new ToneMapBench(new Reinhard02ToneMap(2.2f, 1.f, 1.2f, 3.75f), true, w, h));
+	}
+
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (runner.IsSelected("camera.generateray"))
+			runner.Measure(new CameraBench(filmSizes[i][0], filmSizes[i][1]));
+	}
+}
+
+int main(int argc, char *argv[]) {
+	try {
+		double minTime = .5;
+		string filter;
+		for (int i = 1; i < argc; i++) {
+			if (argv[i][0] == '-') {
+				if (argv[i][1] == 'h') {
+					SFERA_LOG("Usage: " << argv[0] << " [options] [case name filter]" << endl <<
+							" -t [minimum time of each case in seconds]" << endl <<
+							" -h <display this help and exit>");
+					exit(EXIT_SUCCESS);
+				}
+
+				else if ((argv[i][1] == 't') && (i + 1 < argc)) minTime = atof(argv[++i]);
+
+				else {
+					SFERA_LOG("Invalid option: " << argv[i]);
+					exit(EXIT_FAILURE);
+				}
+			} else
+				filter = argv[i];
+		}
+
+		MicroBenchRunner runner(minTime, filter);
+		RunAll(runner);
+	} catch (const runtime_error &err) {
+		SFERA_LOG("RUNTIME ERROR: " << err.what());
+		return EXIT_FAILURE;
+	} catch (const exception &err) {
+		SFERA_LOG("ERROR: " << err.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -128,18 +128,23 @@ void GamePhysic::UpdateGameSphere(GameSphere &gameSphere, btRigidBody *dynamicRi
 
 void GamePhysic::DoStep() {
 	boost::unique_lock<boost::mutex> lock(gameLevel->levelMutex);
+	StageProfiler *profiler = gameLevel->physicProfiler;
 
-	// Update the gravity of all dynamic spheres
-	vector<GameSphere> &gameSpheres(gameLevel->scene->spheres);
-	for (size_t i = 0; i < dynamicRigidBodies.size() - 1; ++i)
-		UpdateGameSphere(gameSpheres[dynamicRigidBodyIndices[i]], dynamicRigidBodies[i]);
-
-	// Update the player
 	GamePlayer &player(*(gameLevel->player));
 	btRigidBody *playerRigidBody = dynamicRigidBodies[dynamicRigidBodies.size() - 1];
-	UpdateGameSphere(player.body, playerRigidBody);
-	const btVector3 &v = playerRigidBody->getGravity();
-	player.SetGravity(Vector(v.getX(), v.getY(), v.getZ()));
+	{
+		ScopedStageTimer timer(profiler, PHYSIC_STAGE_GRAVITY);
+
+		// Update the gravity of all dynamic spheres
+		vector<GameSphere> &gameSpheres(gameLevel->scene->spheres);
+		for (size_t i = 0; i < dynamicRigidBodies.size() - 1; ++i)
+			UpdateGameSphere(gameSpheres[dynamicRigidBodyIndices[i]], dynamicRigidBodies[i]);
+
+		// Update the player
+		UpdateGameSphere(player.body, playerRigidBody);
+		const btVector3 &v = playerRigidBody->getGravity();
+		player.SetGravity(Vector(v.getX(), v.getY(), v.getZ()));
+	}
 
 	// Apply user inputs
 	if (player.inputGoForward) {
@@ -171,37 +176,48 @@ void GamePhysic::DoStep() {
 			jump.z));
 	}
 
-	dynamicsWorld->stepSimulation(1.f / gameLevel->gameConfig->GetPhysicRefreshRate(), 4);
+	{
+		ScopedStageTimer timer(profiler, PHYSIC_STAGE_STEP_SIMULATION);
+		dynamicsWorld->stepSimulation(1.f / gameLevel->gameConfig->GetPhysicRefreshRate(), 4);
+	}
 
 	gameLevel->Refresh(gameLevel->gameConfig->GetPhysicRefreshRate());
 
-	// Check if one of the pills was hit
-	int numManifolds = dispatcher->getNumManifolds();
-	for (int i = 0; i < numManifolds; i++) {
-		btPersistentManifold *contactManifold = dispatcher->getManifoldByIndexInternal(i);
-		btCollisionObject *objA = (btCollisionObject*)(contactManifold->getBody0());
-		btCollisionObject *objB = (btCollisionObject*)(contactManifold->getBody1());
-
-		int numContacts = contactManifold->getNumContacts();
-		if (numContacts > 0) {
-			GameSphere *sphereA = (GameSphere *)objA->getUserPointer();
-			GameSphere *sphereB = (GameSphere *)objB->getUserPointer();
-			if (sphereA->puppetObject)
-				Swap(sphereA, sphereB);
-
-			if (sphereA->pillObject && sphereB->puppetObject && !sphereA->isPillOff) {
-				// Disable the pill
-				sphereA->isPillOff = true;
-				++(gameLevel->offPillCount);
-				// Use the off material for this pill
-				gameLevel->scene->sphereMaterials[sphereA->index] = gameLevel->scene->pillOffMaterial;
-				gameLevel->editActionList.AddAction(MATERIALS_EDIT);
+	{
+		ScopedStageTimer timer(profiler, PHYSIC_STAGE_MANIFOLD_SCAN);
+
+		// Check if one of the pills was hit
+		int numManifolds = dispatcher->getNumManifolds();
+		for (int i = 0; i < numManifolds; i++) {
+			btPersistentManifold *contactManifold = dispatcher->getManifoldByIndexInternal(i);
+			btCollisionObject *objA = (btCollisionObject*)(contactManifold->getBody0());
+			btCollisionObject *objB = (btCollisionObject*)(contactManifold->getBody1());
+
+			int numContacts = contactManifold->getNumContacts();
+			if (numContacts > 0) {
+				GameSphere *sphereA = (GameSphere *)objA->getUserPointer();
+				GameSphere *sphereB = (GameSphere *)objB->getUserPointer();
+				if (sphereA->puppetObject)
+					Swap(sphereA, sphereB);
+
+				if (sphereA->pillObject && sphereB->puppetObject && !sphereA->isPillOff) {
+					// Disable the pill
+					sphereA->isPillOff = true;
+					++(gameLevel->offPillCount);
+					// Use the off material for this pill
+					gameLevel->scene->sphereMaterials[sphereA->index] = gameLevel->scene->pillOffMaterial;
+					gameLevel->scene->sphereMaterialIndices[sphereA->index] = gameLevel->scene->pillOffMaterialIndex;
+					gameLevel->editActionList.AddAction(MATERIALS_EDIT);
+				}
 			}
 		}
 	}
 
 	gameLevel->editActionList.AddAction(CAMERA_EDIT);
 	gameLevel->editActionList.AddAction(GEOMETRY_EDIT);
+
+	if (profiler)
+		profiler->EndRecord();
 }
 
 //------------------------------------------------------------------------------
@@ -18,310 +18,224 @@
  *                                                                         *
  ***************************************************************************/
 
-#include "pixel/framebuffer.h"
+#include <vector>
+#include <algorithm>
 
-void FrameBuffer::ApplyBoxFilterX(const Pixel *src, Pixel *dest,
-	const unsigned int width, const unsigned int height, const unsigned int radius) {
-    const float scale = 1.0f / (float)((radius << 1) + 1);
-
-    // Do left edge
-    Pixel t = src[0] * radius;
-    for (unsigned int x = 0; x < (radius + 1); ++x)
-        t += src[x];
-    dest[0] = t * scale;
-
-    for (unsigned int x = 1; x < (radius + 1); ++x) {
-        t += src[x + radius];
-        t -= src[0];
-        dest[x] = t * scale;
-    }
-
-    // Main loop
-    for (unsigned int x = (radius + 1); x < width - radius; ++x) {
-        t += src[x + radius];
-        t -= src[x - radius - 1];
-        dest[x] = t * scale;
-    }
-
-    // Do right edge
-    for (unsigned int x = width - radius; x < width; ++x) {
-        t += src[width - 1];
-        t -= src[x - radius - 1];
-        dest[x] = t * scale;
-    }
-}
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+#include <xmmintrin.h>
+#define SFERA_FRAMEBUFFER_SSE
+#endif
 
-void FrameBuffer::ApplyBoxFilterY(const Pixel *src, Pixel *dst,
-	const unsigned int width, const unsigned int height, const unsigned int radius) {
-    const float scale = 1.0f / (float)((radius << 1) + 1);
-
-    // Do left edge
-    Pixel t = src[0] * radius;
-    for (unsigned int y = 0; y < (radius + 1); ++y) {
-        t += src[y * width];
-    }
-    dst[0] = t * scale;
-
-    for (unsigned int y = 1; y < (radius + 1); ++y) {
-        t += src[(y + radius) * width];
-        t -= src[0];
-        dst[y * width] = t * scale;
-    }
-
-    // Main loop
-    for (unsigned int y = (radius + 1); y < (height - radius); ++y) {
-        t += src[(y + radius) * width];
-        t -= src[((y - radius) * width) - width];
-        dst[y * width] = t * scale;
-    }
-
-    // Do right edge
-    for (unsigned int y = height - radius; y < height; ++y) {
-        t += src[(height - 1) * width];
-        t -= src[((y - radius) * width) - width];
-        dst[y * width] = t * scale;
-    }
-}
+#include "pixel/framebuffer.h"
 
-void FrameBuffer::ApplyBoxFilterXR1(const Pixel *src, Pixel *dest,
-	const unsigned int width, const unsigned int height) {
-    const float scale = 1.f / 3.f;
-
-    // Do left edge
-    Pixel t = 2.f * src[0];
-	t += src[1];
-    dest[0] = t * scale;
-
-	t += src[2];
-	t -= src[0];
-	dest[1] = t * scale;
-
-    // Main loop
-    for (unsigned int x = 2; x < width - 1; ++x) {
-        t += src[x + 1];
-        t -= src[x - 2];
-        dest[x] = t * scale;
-    }
-
-    // Do right edge
-	t += src[width - 1];
-	t -= src[width - 3];
-	dest[width - 1] = t * scale;
-}
+//------------------------------------------------------------------------------
+// Row helpers
+//
+// A Pixel is 3 packed floats so a whole row (or a whole run of pixels) can be
+// processed as a flat array of floats. This allows to work on several columns
+// at once with SIMD instructions and to run the Y pass row by row, walking the
+// memory sequentially instead of with a stride of width.
+//------------------------------------------------------------------------------
+
+// dst[i] = aK * a[i] + bK * b[i] + cK * c[i]
+static void WeightRows(const float *a, const float *b, const float *c, float *dst,
+		const unsigned int count, const float aK, const float bK, const float cK) {
+	unsigned int i = 0;
+
+#if defined(SFERA_FRAMEBUFFER_SSE)
+	const __m128 aK4 = _mm_set1_ps(aK);
+	const __m128 bK4 = _mm_set1_ps(bK);
+	const __m128 cK4 = _mm_set1_ps(cK);
+	for (; i + 4 <= count; i += 4) {
+		const __m128 v = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(aK4, _mm_loadu_ps(&a[i])), _mm_mul_ps(bK4, _mm_loadu_ps(&b[i]))),
+				_mm_mul_ps(cK4, _mm_loadu_ps(&c[i])));
+		_mm_storeu_ps(&dst[i], v);
+	}
+#endif
 
-void FrameBuffer::ApplyBoxFilterYR1(const Pixel *src, Pixel *dst,
-	const unsigned int width, const unsigned int height) {
-    const float scale = 1.f / 3.f;
-
-    // Do left edge
-	Pixel t = 2.f * src[0];
-	t += src[width];
-	dst[0] = t * scale;
-
-	t += src[2 * width];
-	t -= src[0];
-	dst[width] = t * scale;
-
-    // Main loop
-    for (unsigned int y = 2; y < height - 1; ++y) {
-        t += src[(y + 1) * width];
-        t -= src[((y - 1) * width) - width];
-        dst[y * width] = t * scale;
-    }
-
-    // Do right edge
-	t += src[(height - 1) * width];
-	t -= src[((height - 2) * width) - width];
-	dst[(height - 1) * width] = t * scale;
+	for (; i < count; ++i)
+		dst[i] = aK * a[i] + bK * b[i] + cK * c[i];
 }
 
-void FrameBuffer::ApplyBlurLightFilterXR1(const Pixel *src, Pixel *dst,
-	const unsigned int width, const unsigned int height) {
-	const float aF = .15f;
-	const float bF = 1.f;
-	const float cF = .15f;
-
-	// Do left edge
-	Pixel a = 0.f;
-	Pixel b = src[0];
-	Pixel c = src[1];
+// dst[i] = scale * acc[i]; acc[i] += add[i] - sub[i]
+static void AccumulateRows(float *acc, const float *add, const float *sub, float *dst,
+		const unsigned int count, const float scale) {
+	unsigned int i = 0;
+
+#if defined(SFERA_FRAMEBUFFER_SSE)
+	const __m128 scale4 = _mm_set1_ps(scale);
+	for (; i + 4 <= count; i += 4) {
+		const __m128 t = _mm_loadu_ps(&acc[i]);
+		_mm_storeu_ps(&dst[i], _mm_mul_ps(scale4, t));
+		_mm_storeu_ps(&acc[i], _mm_add_ps(t, _mm_sub_ps(_mm_loadu_ps(&add[i]), _mm_loadu_ps(&sub[i]))));
+	}
+#endif
 
-	const float leftTotF = bF + cF;
-	const float bLeftK = bF / leftTotF;
-	const float cLeftK = cF / leftTotF;
-	dst[0] = bLeftK  * b + cLeftK * c;
+	for (; i < count; ++i) {
+		dst[i] = scale * acc[i];
+		acc[i] += add[i] - sub[i];
+	}
+}
 
-    // Main loop
-	const float totF = aF + bF + cF;
-	const float aK = aF / totF;
-	const float bK = bF / totF;
-	const float cK = cF / totF;
+//------------------------------------------------------------------------------
+// Box filter
+//------------------------------------------------------------------------------
+
+void FrameBuffer::ApplyBoxFilterX(const Pixel *src, Pixel *dst,
+	const unsigned int width, const unsigned int height, const unsigned int radius,
+	const unsigned int yStart, const unsigned int yEnd) {
+	const float scale = 1.0f / (float)((radius << 1) + 1);
+	const int lastX = (int)width - 1;
+
+	for (unsigned int y = yStart; y < yEnd; ++y) {
+		const Pixel *s = &src[y * width];
+		Pixel *d = &dst[y * width];
+
+		// Left edge, pixels outside the frame are clamped
+		Pixel t = s[0] * radius;
+		for (unsigned int x = 0; x < radius + 1; ++x)
+			t += s[Min<int>(x, lastX)];
+
+		for (int x = 0; x < (int)width; ++x) {
+			d[x] = t * scale;
+			t += s[Min<int>(x + radius + 1, lastX)];
+			t -= s[Max<int>(x - (int)radius, 0)];
+		}
+	}
+}
 
-	for (unsigned int x = 1; x < width - 1; ++x) {
-		a = b;
-		b = c;
-		c = src[x + 1];
+void FrameBuffer::ApplyBoxFilterY(const Pixel *src, Pixel *dst,
+	const unsigned int width, const unsigned int height, const unsigned int radius,
+	const unsigned int yStart, const unsigned int yEnd,
+	float *rowSums, const bool continueRowSums) {
+	const float scale = 1.0f / (float)((radius << 1) + 1);
+	const unsigned int count = width * 3;
+	const int lastY = (int)height - 1;
+
+	// The running sum of the rows is kept for all columns at once
+	if (!continueRowSums) {
+		std::fill(rowSums, rowSums + count, 0.f);
+		for (int k = (int)yStart - (int)radius; k <= (int)yStart + (int)radius; ++k) {
+			const float *row = (const float *)&src[Clamp<int>(k, 0, lastY) * width];
+			for (unsigned int i = 0; i < count; ++i)
+				rowSums[i] += row[i];
+		}
+	}
 
-		dst[x] = aK * a + bK * b + cK * c;
-    }
+	for (int y = (int)yStart; y < (int)yEnd; ++y) {
+		const float *add = (const float *)&src[Min<int>(y + radius + 1, lastY) * width];
+		const float *sub = (const float *)&src[Max<int>(y - (int)radius, 0) * width];
 
-    // Do right edge
-	const float rightTotF = aF + bF;
-	const float aRightK = aF / rightTotF;
-	const float bRightK = bF / rightTotF;
-	a = b;
-	b = c;
-	dst[width - 1] = aRightK * a + bRightK * b;
+		AccumulateRows(rowSums, add, sub, (float *)&dst[y * width], count, scale);
+	}
 }
 
-void FrameBuffer::ApplyBlurLightFilterYR1(const Pixel *src, Pixel *dst,
-	const unsigned int width, const unsigned int height) {
-	const float aF = .15f;
-	const float bF = 1.f;
-	const float cF = .15f;
-
-	// Do left edge
-	Pixel a = 0.f;
-	Pixel b = src[0];
-	Pixel c = src[width];
+//------------------------------------------------------------------------------
+// Blur filters
+//------------------------------------------------------------------------------
 
+void FrameBuffer::ApplyBlurFilterX(const Pixel *src, Pixel *dst,
+	const unsigned int width, const unsigned int height,
+	const float aF, const float bF, const float cF,
+	const unsigned int yStart, const unsigned int yEnd) {
+	// Edges are renormalized
 	const float leftTotF = bF + cF;
 	const float bLeftK = bF / leftTotF;
 	const float cLeftK = cF / leftTotF;
-	dst[0] = bLeftK  * b + cLeftK * c;
 
-    // Main loop
 	const float totF = aF + bF + cF;
 	const float aK = aF / totF;
 	const float bK = bF / totF;
 	const float cK = cF / totF;
 
-    for (unsigned int y = 1; y < height - 1; ++y) {
-		a = b;
-		b = c;
-		c = src[(y + 1) * width];
-
-		dst[y * width] = aK * a + bK * b + cK * c;
-    }
-
-    // Do right edge
 	const float rightTotF = aF + bF;
 	const float aRightK = aF / rightTotF;
 	const float bRightK = bF / rightTotF;
-	a = b;
-	b = c;
-	dst[(height - 1) * width] = aRightK * a + bRightK * b;
-}
 
-void FrameBuffer::ApplyBlurHeavyFilterXR1(const Pixel *src, Pixel *dst,
-	const unsigned int width, const unsigned int height) {
-	const float aF = .35f;
-	const float bF = 1.f;
-	const float cF = .35f;
+	for (unsigned int y = yStart; y < yEnd; ++y) {
+		const Pixel *s = &src[y * width];
+		Pixel *d = &dst[y * width];
 
-	// Do left edge
-	Pixel a = 0.f;
-	Pixel b = src[0];
-	Pixel c = src[1];
+		d[0] = bLeftK * s[0] + cLeftK * s[1];
 
-	const float leftTotF = bF + cF;
-	const float bLeftK = bF / leftTotF;
-	const float cLeftK = cF / leftTotF;
-	dst[0] = bLeftK  * b + cLeftK * c;
-
-    // Main loop
-	const float totF = aF + bF + cF;
-	const float aK = aF / totF;
-	const float bK = bF / totF;
-	const float cK = cF / totF;
-
-	for (unsigned int x = 1; x < width - 1; ++x) {
-		a = b;
-		b = c;
-		c = src[x + 1];
+		// All inner pixels of the row at once: the 3 taps are just the float
+		// array shifted by one pixel
+		const float *sf = (const float *)s;
+		WeightRows(sf, sf + 3, sf + 6, (float *)&d[1], (width - 2) * 3, aK, bK, cK);
 
-		dst[x] = aK * a + bK * b + cK * c;
-    }
-
-    // Do right edge
-	const float rightTotF = aF + bF;
-	const float aRightK = aF / rightTotF;
-	const float bRightK = bF / rightTotF;
-	a = b;
-	b = c;
-	dst[width - 1] = aRightK * a + bRightK * b;
+		d[width - 1] = aRightK * s[width - 2] + bRightK * s[width - 1];
+	}
 }
 
-void FrameBuffer::ApplyBlurHeavyFilterYR1(const Pixel *src, Pixel *dst,
-	const unsigned int width, const unsigned int height) {
-	const float aF = .35f;
-	const float bF = 1.f;
-	const float cF = .35f;
-
-	// Do left edge
-	Pixel a = 0.f;
-	Pixel b = src[0];
-	Pixel c = src[width];
-
-	const float leftTotF = bF + cF;
-	const float bLeftK = bF / leftTotF;
-	const float cLeftK = cF / leftTotF;
-	dst[0] = bLeftK  * b + cLeftK * c;
+void FrameBuffer::ApplyBlurFilterY(const Pixel *src, Pixel *dst,
+	const unsigned int width, const unsigned int height,
+	const float aF, const float bF, const float cF,
+	const unsigned int yStart, const unsigned int yEnd) {
+	const unsigned int count = width * 3;
+
+	for (unsigned int y = yStart; y < yEnd; ++y) {
+		const float *b = (const float *)&src[y * width];
+		float *d = (float *)&dst[y * width];
+
+		if (y == 0) {
+			// Top edge
+			const float totF = bF + cF;
+			WeightRows(b, b, b + count, d, count, 0.f, bF / totF, cF / totF);
+		} else if (y == height - 1) {
+			// Bottom edge
+			const float totF = aF + bF;
+			WeightRows(b - count, b, b, d, count, aF / totF, bF / totF, 0.f);
+		} else {
+			const float totF = aF + bF + cF;
+			WeightRows(b - count, b, b + count, d, count, aF / totF, bF / totF, cF / totF);
+		}
+	}
+}
 
-    // Main loop
-	const float totF = aF + bF + cF;
-	const float aK = aF / totF;
-	const float bK = bF / totF;
-	const float cK = cF / totF;
+void FrameBuffer::ApplyBlurLightFilterX(const Pixel *src, Pixel *dst,
+	const unsigned int width, const unsigned int height,
+	const unsigned int yStart, const unsigned int yEnd) {
+	ApplyBlurFilterX(src, dst, width, height, .15f, 1.f, .15f, yStart, yEnd);
+}
 
-    for (unsigned int y = 1; y < height - 1; ++y) {
-		a = b;
-		b = c;
-		c = src[(y + 1) * width];
+void FrameBuffer::ApplyBlurLightFilterY(const Pixel *src, Pixel *dst,
+	const unsigned int width, const unsigned int height,
+	const unsigned int yStart, const unsigned int yEnd) {
+	ApplyBlurFilterY(src, dst, width, height, .15f, 1.f, .15f, yStart, yEnd);
+}
 
-		dst[y * width] = aK * a + bK * b + cK * c;
-    }
+void FrameBuffer::ApplyBlurHeavyFilterX(const Pixel *src, Pixel *dst,
+	const unsigned int width, const unsigned int height,
+	const unsigned int yStart, const unsigned int yEnd) {
+	ApplyBlurFilterX(src, dst, width, height, .35f, 1.f, .35f, yStart, yEnd);
+}
 
-    // Do right edge
-	const float rightTotF = aF + bF;
-	const float aRightK = aF / rightTotF;
-	const float bRightK = bF / rightTotF;
-	a = b;
-	b = c;
-	dst[(height - 1) * width] = aRightK * a + bRightK * b;
+void FrameBuffer::ApplyBlurHeavyFilterY(const Pixel *src, Pixel *dst,
+	const unsigned int width, const unsigned int height,
+	const unsigned int yStart, const unsigned int yEnd) {
+	ApplyBlurFilterY(src, dst, width, height, .35f, 1.f, .35f, yStart, yEnd);
 }
 
+//------------------------------------------------------------------------------
+// Full frame filters
+//------------------------------------------------------------------------------
+
 void FrameBuffer::ApplyBoxFilter(Pixel *frameBuffer, Pixel *tmpFrameBuffer,
 	const unsigned int width, const unsigned int height, const unsigned int radius) {
-	if (radius == 1) {
-		for (unsigned int i = 0; i < height; ++i)
-			ApplyBoxFilterXR1(&frameBuffer[i * width], &tmpFrameBuffer[i * width], width, height);
-
-		for (unsigned int i = 0; i < width; ++i)
-			ApplyBoxFilterYR1(&tmpFrameBuffer[i], &frameBuffer[i], width, height);
-	} else {
-		for (unsigned int i = 0; i < height; ++i)
-			ApplyBoxFilterX(&frameBuffer[i * width], &tmpFrameBuffer[i * width], width, height, radius);
-
-		for (unsigned int i = 0; i < width; ++i)
-			ApplyBoxFilterY(&tmpFrameBuffer[i], &frameBuffer[i], width, height, radius);
-	}
+	std::vector<float> rowSums(width * 3);
+	ApplyBoxFilterX(frameBuffer, tmpFrameBuffer, width, height, radius, 0, height);
+	ApplyBoxFilterY(tmpFrameBuffer, frameBuffer, width, height, radius, 0, height, &rowSums[0]);
 }
 
 void FrameBuffer::ApplyBlurLightFilter(Pixel *frameBuffer, Pixel *tmpFrameBuffer,
 	const unsigned int width, const unsigned int height) {
-	for (unsigned int i = 0; i < height; ++i)
-		ApplyBlurLightFilterXR1(&frameBuffer[i * width], &tmpFrameBuffer[i * width], width, height);
-
-	for (unsigned int i = 0; i < width; ++i)
-		ApplyBlurLightFilterYR1(&tmpFrameBuffer[i], &frameBuffer[i], width, height);
+	ApplyBlurLightFilterX(frameBuffer, tmpFrameBuffer, width, height, 0, height);
+	ApplyBlurLightFilterY(tmpFrameBuffer, frameBuffer, width, height, 0, height);
 }
 
 void FrameBuffer::ApplyBlurHeavyFilter(Pixel *frameBuffer, Pixel *tmpFrameBuffer,
 	const unsigned int width, const unsigned int height) {
-	for (unsigned int i = 0; i < height; ++i)
-		ApplyBlurHeavyFilterXR1(&frameBuffer[i * width], &tmpFrameBuffer[i * width], width, height);
-
-	for (unsigned int i = 0; i < width; ++i)
-		ApplyBlurHeavyFilterYR1(&tmpFrameBuffer[i], &frameBuffer[i], width, height);
+	ApplyBlurHeavyFilterX(frameBuffer, tmpFrameBuffer, width, height, 0, height);
+	ApplyBlurHeavyFilterY(tmpFrameBuffer, frameBuffer, width, height, 0, height);
 }
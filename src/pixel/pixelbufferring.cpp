@@ -0,0 +1,144 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "sfera.h"
+#include "pixel/pixelbufferring.h"
+
+PixelBufferRing::PixelBufferRing(const unsigned int w, const unsigned int h,
+		const unsigned int s, const bool headlessMode) : width(w), height(h),
+		size(Clamp<unsigned int>(s, 1, PIXELBUFFERRING_MAX_SIZE)), next(0),
+		headless(headlessMode) {
+	const GLsizeiptrARB bufferSize = width * height * 4;
+
+	if (headless) {
+		SFERA_LOG("Pixel buffer ring size: " << size << " (headless)");
+
+		persistent = false;
+		for (unsigned int i = 0; i < size; ++i)
+			pixels[i] = new unsigned char[bufferSize];
+		return;
+	}
+
+#if defined(GL_ARB_buffer_storage) && defined(GL_ARB_sync)
+	persistent = glewIsSupported("GL_ARB_buffer_storage GL_ARB_sync");
+#else
+	persistent = false;
+#endif
+	SFERA_LOG("Pixel buffer ring size: " << size << (persistent ? " (persistent mapping)" : ""));
+
+	glGenBuffersARB(size, pbo);
+	for (unsigned int i = 0; i < size; ++i) {
+		pixels[i] = NULL;
+#if defined(GL_ARB_sync)
+		fence[i] = 0;
+#endif
+
+		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[i]);
+#if defined(GL_ARB_buffer_storage) && defined(GL_ARB_sync)
+		if (persistent) {
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER_ARB, bufferSize, NULL, flags);
+			pixels[i] = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER_ARB, 0, bufferSize, flags);
+			if (!pixels[i])
+				throw runtime_error("Unable to persistently map a pixel buffer object");
+		} else
+#endif
+			glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, bufferSize, NULL, GL_STREAM_DRAW_ARB);
+	}
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+}
+
+PixelBufferRing::~PixelBufferRing() {
+	if (headless) {
+		for (unsigned int i = 0; i < size; ++i)
+			delete[] pixels[i];
+		return;
+	}
+
+	for (unsigned int i = 0; i < size; ++i) {
+		WaitFence(i);
+
+		if (pixels[i]) {
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[i]);
+			glUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB);
+		}
+	}
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+	glDeleteBuffersARB(size, pbo);
+}
+
+void PixelBufferRing::WaitFence(const unsigned int index) {
+#if defined(GL_ARB_sync)
+	if (fence[index]) {
+		while (glClientWaitSync(fence[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+			;
+		glDeleteSync(fence[index]);
+		fence[index] = 0;
+	}
+#endif
+}
+
+void PixelBufferRing::Map(const unsigned int index) {
+	// Orphan the old storage so the driver doesn't have to wait for the GPU
+	const GLsizeiptrARB bufferSize = width * height * 4;
+
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[index]);
+	glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, bufferSize, NULL, GL_STREAM_DRAW_ARB);
+	pixels[index] = (unsigned char *)glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+	if (!pixels[index])
+		throw runtime_error("Unable to map a pixel buffer object");
+}
+
+unsigned int PixelBufferRing::Acquire() {
+	const unsigned int index = next;
+	next = (next + 1) % size;
+
+	if (headless)
+		return index;
+
+	if (persistent)
+		WaitFence(index);
+	else if (!pixels[index])
+		Map(index);
+
+	return index;
+}
+
+void PixelBufferRing::Draw(const unsigned int index) {
+	if (headless)
+		return;
+
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[index]);
+	if (!persistent) {
+		glUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB);
+		pixels[index] = NULL;
+	}
+
+	glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+#if defined(GL_ARB_sync)
+	if (persistent)
+		fence[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+#endif
+}
@@ -33,8 +33,10 @@ ToneMap::ToneMap(const float g) : gamma(g) {
 void ToneMap::InitGammaTable() {
 	float x = 0.f;
 	const float dx = 1.f / GAMMA_TABLE_SIZE;
-	for (unsigned int i = 0; i < GAMMA_TABLE_SIZE; ++i, x += dx)
+	for (unsigned int i = 0; i < GAMMA_TABLE_SIZE; ++i, x += dx) {
 		gammaTable[i] = powf(Clamp(x, 0.f, 1.f), 1.f / gamma);
+		gammaTableUChar[i] = (unsigned char)Floor2UInt(gammaTable[i] * 255.f + .5f);
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -57,6 +59,16 @@ void LinearToneMap::Map(FrameBuffer *src, FrameBuffer *dst) const {
 	}
 }
 
+void LinearToneMap::MapRGBA8(const Pixel *src, unsigned char *dst,
+		const unsigned int count, const float averageLuminance) const {
+	for (unsigned int i = 0; i < count; ++i) {
+		Radiance2PixelRGBA8(scale * (*src), dst);
+
+		++src;
+		dst += 4;
+	}
+}
+
 //------------------------------------------------------------------------------
 // Reinhard02 tonemapping
 //------------------------------------------------------------------------------
@@ -112,3 +124,35 @@ void Reinhard02ToneMap::Map(FrameBuffer *src, FrameBuffer *dst) const {
 		++pixels;
 	}
 }
+
+void Reinhard02ToneMap::MapRGBA8(const Pixel *src, unsigned char *dst,
+		const unsigned int count, const float averageLuminance) const {
+	const float alpha = .1f;
+
+	// Avoid division by zero
+	const float Ywa = (averageLuminance == 0.f) ? 1.f : averageLuminance;
+
+	const float Yw = preScale * alpha * burn;
+	const float invY2 = 1.f / (Yw * Yw);
+	const float pScale = postScale * preScale * alpha / Ywa;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		// Convert to XYZ color space
+		Spectrum xyz(
+			0.412453f * src->r + 0.357580f * src->g + 0.180423f * src->b,
+			0.212671f * src->r + 0.715160f * src->g + 0.072169f * src->b,
+			0.019334f * src->r + 0.119193f * src->g + 0.950227f * src->b);
+
+		const float ys = xyz.g;
+		xyz *= pScale * (1.f + ys * invY2) / (1.f + ys);
+
+		// Convert back to RGB color space and do the gamma correction
+		Radiance2PixelRGBA8(Spectrum(
+				3.240479f * xyz.r - 1.537150f * xyz.g - 0.498535f * xyz.b,
+				-0.969256f * xyz.r + 1.875991f * xyz.g + 0.041556f * xyz.b,
+				0.055648f * xyz.r - 0.204043f * xyz.g + 1.057311f * xyz.b), dst);
+
+		++src;
+		dst += 4;
+	}
+}
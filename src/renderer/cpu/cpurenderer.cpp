@@ -20,30 +20,74 @@
 
 #include "sfera.h"
 #include "sdl/editaction.h"
+#include "utils/mc.h"
 #include "renderer/cpu/cpurenderer.h"
 
-CPURenderer::CPURenderer(GameLevel *level) :
-	LevelRenderer(level), timeSinceLastCameraEdit(WallClockTime()),
+CPURenderer::CPURenderer(GameLevel *level, const bool headless) :
+	LevelRenderer(level, headless), averageLuminance(0.f),
+		timeSinceLastCameraEdit(WallClockTime()),
 		timeSinceLastNoCameraEdit(WallClockTime()) {
 	const unsigned int width = gameLevel->gameConfig->GetScreenWidth();
 	const unsigned int height = gameLevel->gameConfig->GetScreenHeight();
 
+	cpuScene = new CPUScene(gameLevel);
+
+	//--------------------------------------------------------------------------
+	// Select the path tracer for the features used by the level
+	//--------------------------------------------------------------------------
+
+	const bool hasTexMaps = (cpuScene->texMaps.size() > 0);
+	const bool hasBumpMaps = (cpuScene->bumpMaps.size() > 0);
+	const bool onlyMatte = !(cpuScene->enable_MAT_MIRROR || cpuScene->enable_MAT_GLASS ||
+		cpuScene->enable_MAT_METAL || cpuScene->enable_MAT_ALLOY);
+	if (hasTexMaps) {
+		if (hasBumpMaps) {
+			if (onlyMatte)
+				sampleImageImpl = &CPURenderer::SampleImageImpl<true, true, true>;
+			else
+				sampleImageImpl = &CPURenderer::SampleImageImpl<true, true, false>;
+		} else {
+			if (onlyMatte)
+				sampleImageImpl = &CPURenderer::SampleImageImpl<true, false, true>;
+			else
+				sampleImageImpl = &CPURenderer::SampleImageImpl<true, false, false>;
+		}
+	} else {
+		if (hasBumpMaps) {
+			if (onlyMatte)
+				sampleImageImpl = &CPURenderer::SampleImageImpl<false, true, true>;
+			else
+				sampleImageImpl = &CPURenderer::SampleImageImpl<false, true, false>;
+		} else {
+			if (onlyMatte)
+				sampleImageImpl = &CPURenderer::SampleImageImpl<false, false, true>;
+			else
+				sampleImageImpl = &CPURenderer::SampleImageImpl<false, false, false>;
+		}
+	}
+	fastSphericalMath = gameLevel->gameConfig->GetRendererFastSphericalMath();
+	SFERA_LOG("[CPURenderer] Path tracer features: " <<
+		(hasTexMaps ? "texture maps " : "") <<
+		(hasBumpMaps ? "bump maps " : "") <<
+		(fastSphericalMath ? "fast spherical math " : "") <<
+		(onlyMatte ? "matte only" : "all materials"));
+
 	passFrameBuffer = new FrameBuffer(width, height);
 	tmpFrameBuffer = new FrameBuffer(width, height);
 	frameBuffer = new FrameBuffer(width, height);
-	toneMapFrameBuffer = new FrameBuffer(width, height);
+	pixelBuffers = new PixelBufferRing(width, height, PIXELBUFFERRING_MAX_SIZE, headless);
 
 	passFrameBuffer->Clear();
 	tmpFrameBuffer->Clear();
 	frameBuffer->Clear();
-	toneMapFrameBuffer->Clear();
 }
 
 CPURenderer::~CPURenderer() {
+	delete cpuScene;
 	delete passFrameBuffer;
 	delete tmpFrameBuffer;
 	delete frameBuffer;
-	delete toneMapFrameBuffer;
+	delete pixelBuffers;
 }
 
 BVHAccel *CPURenderer::BuildAcceleretor() {
@@ -51,11 +95,6 @@ BVHAccel *CPURenderer::BuildAcceleretor() {
 	// Build the Accelerator
 	//--------------------------------------------------------------------------
 
-	const int treeType = 4; // Tree type to generate (2 = binary, 4 = quad, 8 = octree)
-	const int isectCost = 80;
-	const int travCost = 10;
-	const float emptyBonus = 0.5f;
-
 	const vector<GameSphere> &spheres(gameLevel->scene->spheres);
 	vector<const Sphere *> sphereList(gameLevel->scene->spheres.size() + GAMEPLAYER_PUPPET_SIZE);
 	for (size_t s = 0; s < spheres.size(); ++s)
@@ -66,18 +105,34 @@ BVHAccel *CPURenderer::BuildAcceleretor() {
 		sphereList[s + spheres.size()] = puppet;
 	}
 
-	return new BVHAccel(sphereList, treeType, isectCost, travCost, emptyBonus);
+	return new BVHAccel(sphereList, CPURENDERER_BVH_TREETYPE,
+			CPURENDERER_BVH_ISECTCOST, CPURENDERER_BVH_TRAVCOST,
+			CPURENDERER_BVH_EMPTYBONUS);
+}
+
+Sampler *CPURenderer::AllocSampler() const {
+	switch (gameLevel->gameConfig->GetRendererSamplerType()) {
+		case SAMPLER_RANDOM:
+			return new RandomSampler(0);
+		case SAMPLER_SOBOL:
+			return new SobolSampler(0, false);
+		case SAMPLER_SOBOL_BLUENOISE:
+			return new SobolSampler(0, true);
+		default:
+			throw runtime_error("Unknown sampler type in CPURenderer::AllocSampler()");
+	}
 }
 
-Spectrum CPURenderer::SampleImage(
-		RandomGenerator &rnd,
+template <bool HAS_TEXMAPS, bool HAS_BUMPMAPS, bool ONLY_MATTE> Spectrum CPURenderer::SampleImageImpl(
+		Sampler &sampler,
 		const Accelerator &accel, const PerspectiveCamera &camera,
-		const float screenX, const float screenY) {
+		const vector<cpuscene::SphereRecord> &sphereRecords,
+		const float screenX, const float screenY, unsigned int &rayCount) {
 	Ray ray;
 	camera.GenerateRay(
 		screenX, screenY,
 		gameLevel->gameConfig->GetScreenWidth(), gameLevel->gameConfig->GetScreenHeight(),
-		&ray, rnd.floatValue(), rnd.floatValue());
+		&ray, sampler.GetSample(), sampler.GetSample());
 
 	const Scene &scene(*(gameLevel->scene));
 	Spectrum throughput(1.f, 1.f, 1.f);
@@ -87,53 +142,67 @@ Spectrum CPURenderer::SampleImage(
 	const unsigned int maxDiffuseBounces = gameLevel->maxPathDiffuseBounces;
 	unsigned int specularGlossyBounces = 0;
 	const unsigned int maxSpecularGlossyBounces = gameLevel->maxPathSpecularGlossyBounces;
+	const unsigned int rrDepth = gameLevel->russianRouletteDepth;
+	const float rrCap = gameLevel->russianRouletteCap;
+
+	// Used to weight the infinite light hit by a path with the next event
+	// estimation done at the previous vertex
+	bool lastSpecular = true;
+	float lastPdf = 0.f;
+
+	// A ray cone used to select the level of detail of the texture maps, its
+	// spread is the one of a camera pixel along the whole path
+	const float coneSpread = camera.GetPixelSpreadAngle();
+	float coneWidth = 0.f;
 
-	const vector<GameSphere> &spheres(scene.spheres);
 	for(;;) {
 		// Check for intersection with objects
 		Sphere *hitSphere;
 		unsigned int sphereIndex;
+		++rayCount;
 		if (accel.Intersect(&ray, &hitSphere, &sphereIndex)) {
-			const Material *hitMat;
-			const TexMapInstance *texMap;
-			const BumpMapInstance *bumpMap;
-
-			if (sphereIndex >= spheres.size()) {
-				// I'm hitting the puppet
-				const unsigned int puppetIndex = sphereIndex - spheres.size();
-				
-				hitMat = gameLevel->player->puppetMaterial[puppetIndex];
-				texMap = NULL;
-				bumpMap = NULL;
-			} else {
-				hitMat = scene.sphereMaterials[sphereIndex];
-				texMap = scene.sphereTexMaps[sphereIndex];
-				bumpMap = scene.sphereBumpMaps[sphereIndex];
-			}
+			// The puppet spheres follow the scene ones
+			const cpuscene::SphereRecord &sphereRecord(sphereRecords[sphereIndex]);
+			const cpuscene::Material &hitMat(cpuScene->mats[sphereRecord.matIndex]);
+			const bool hasTexMap = HAS_TEXMAPS && (sphereRecord.texMapIndex != CPUSCENE_NULL_INDEX);
+			const bool hasBumpMap = HAS_BUMPMAPS && (sphereRecord.bumpMapIndex != CPUSCENE_NULL_INDEX);
 
 			const Point hitPoint(ray(ray.maxt));
 			Normal N(Normalize(hitPoint - hitSphere->center));
 
+			// The angle covered by the cone on the sphere
+			coneWidth += coneSpread * ray.maxt;
+			const float footprint = coneWidth / hitSphere->rad;
+
+			// Shared by the texture and bump maps
+			float phi, theta;
+			if (hasTexMap || hasBumpMap)
+				SphericalCoords(Vector(N), &phi, &theta);
+
 			// Apply bump mapping
 			Normal shadeN;
-			if (bumpMap)
-				shadeN = bumpMap->SphericalMap(Vector(N), N);
+			if (hasBumpMap)
+				shadeN = cpuScene->bumpMaps[sphereRecord.bumpMapIndex]->SphericalMap(phi, theta, N, footprint);
 			else
 				shadeN = N;
 
 			// Check if I have to flip the normal
 			shadeN = (Dot(Vector(N), ray.d) > 0.f) ? (-shadeN) : shadeN;
 
-			radiance += throughput * hitMat->GetEmission();
+			radiance += throughput * hitMat.emission;
 
 			Vector wi;
 			float pdf;
 			bool diffuseBounce;
-			Spectrum f = hitMat->Sample_f(rnd, -ray.d, &wi, N, shadeN, &pdf, diffuseBounce);
+			const unsigned int depth = diffuseBounces + specularGlossyBounces;
+			sampler.StartBounce(depth);
+			Spectrum f = ONLY_MATTE ?
+				CPUScene::Matte_Sample_f(hitMat, sampler, -ray.d, &wi, N, shadeN, &pdf, diffuseBounce) :
+				CPUScene::Sample_f(hitMat, sampler, -ray.d, &wi, N, shadeN, &pdf, diffuseBounce);
 			if ((pdf <= 0.f) || f.Black())
 				return radiance;
 
-			if (diffuseBounce) {
+			if (ONLY_MATTE || diffuseBounce) {
 				++diffuseBounces;
 
 				if (diffuseBounces > maxDiffuseBounces)
@@ -146,22 +215,89 @@ Spectrum CPURenderer::SampleImage(
 			}
 
 			// Apply texture map
-			if (texMap)
-				f *= texMap->SphericalMap(Vector(N));
+			Spectrum texColor;
+			if (hasTexMap) {
+				texColor = cpuScene->texMaps[sphereRecord.texMapIndex]->SphericalMap(phi, theta, footprint);
+				f *= texColor;
+			}
+
+			// Sample the infinite light
+			lastSpecular = !ONLY_MATTE && CPUScene::IsSpecular(hitMat);
+			if (!lastSpecular) {
+				sampler.StartBounce(depth, SAMPLER_BOUNCE_LIGHT_OFFSET);
+				Spectrum Ld = SampleInfiniteLight<ONLY_MATTE>(sampler, accel, hitMat, hitPoint, -ray.d, N, shadeN, rayCount);
+				if (hasTexMap)
+					Ld *= texColor;
+
+				radiance += throughput * Ld;
+			}
+			lastPdf = pdf;
 
 			throughput *= f;
+			if (throughput.Black())
+				return radiance;
+
+			// Russian roulette
+			if (depth >= rrDepth) {
+				const float rrProb = Max(Min(1.f, throughput.Y()), rrCap);
+				sampler.StartBounce(depth, SAMPLER_BOUNCE_RR_OFFSET);
+				if (sampler.GetSample() >= rrProb)
+					return radiance;
+
+				throughput /= rrProb;
+			}
 
 			ray = Ray(hitPoint, wi);
-		} else
-			return radiance + throughput * scene.infiniteLight->Le(ray.d);
+		} else {
+			float phi, theta;
+			SphericalCoords(ray.d, &phi, &theta);
+
+			const Spectrum Le = scene.infiniteLight->Le(phi, theta, coneSpread);
+			if (lastSpecular)
+				return radiance + throughput * Le;
+
+			// Multiple importance sampling with the next event estimation
+			const float lightPdf = scene.infiniteLight->Pdf(phi, theta);
+			return radiance + throughput * Le * PowerHeuristic(lastPdf, lightPdf);
+		}
 	}
 }
 
-void CPURenderer::ApplyFilter() {
-	//--------------------------------------------------------------------------
-	// Apply a filter: approximated by applying a box filter multiple times
-	//--------------------------------------------------------------------------
+template <bool ONLY_MATTE> Spectrum CPURenderer::SampleInfiniteLight(Sampler &sampler, const Accelerator &accel,
+		const cpuscene::Material &mat, const Point &hitPoint, const Vector &wo,
+		const Normal &N, const Normal &shadeN, unsigned int &rayCount) const {
+	const float u0 = sampler.GetSample();
+	const float u1 = sampler.GetSample();
+
+	Vector wi;
+	float lightPdf;
+	const Spectrum Le = gameLevel->scene->infiniteLight->Sample_L(u0, u1, &wi, &lightPdf);
+	if ((lightPdf <= 0.f) || Le.Black())
+		return Spectrum();
+
+	float bsdfPdf;
+	const Spectrum f = ONLY_MATTE ?
+		CPUScene::Matte_Evaluate(mat, wo, wi, N, shadeN, &bsdfPdf) :
+		CPUScene::Evaluate(mat, wo, wi, N, shadeN, &bsdfPdf);
+	if (f.Black())
+		return Spectrum();
+
+	const Ray shadowRay(hitPoint, wi);
+	++rayCount;
+	if (accel.IntersectP(&shadowRay))
+		return Spectrum();
+
+	return f * Le * (PowerHeuristic(lightPdf, bsdfPdf) / lightPdf);
+}
 
+unsigned int CPURenderer::GetFilterPassCount() const {
+	const GameConfig &gameConfig(*(gameLevel->gameConfig));
+
+	return (gameConfig.GetRendererFilterType() == NO_FILTER) ?
+		0 : gameConfig.GetRendererFilterIterations();
+}
+
+void CPURenderer::ApplyFilterX(const unsigned int yStart, const unsigned int yEnd) {
 	const GameConfig &gameConfig(*(gameLevel->gameConfig));
 	const unsigned int width = gameConfig.GetScreenWidth();
 	const unsigned int height = gameConfig.GetScreenHeight();
@@ -169,38 +305,68 @@ void CPURenderer::ApplyFilter() {
 	switch (gameConfig.GetRendererFilterType()) {
 		case NO_FILTER:
 			break;
-		case BLUR_LIGHT: {
-			const unsigned int filterPassCount = gameConfig.GetRendererFilterIterations();
-			for (unsigned int i = 0; i < filterPassCount; ++i)
-				FrameBuffer::ApplyBlurLightFilter(passFrameBuffer->GetPixels(), tmpFrameBuffer->GetPixels(),
-						width, height);
+		case BLUR_LIGHT:
+			FrameBuffer::ApplyBlurLightFilterX(passFrameBuffer->GetPixels(), tmpFrameBuffer->GetPixels(),
+					width, height, yStart, yEnd);
 			break;
-		}
-		case BLUR_HEAVY: {
-			const unsigned int filterPassCount = gameConfig.GetRendererFilterIterations();
-			for (unsigned int i = 0; i < filterPassCount; ++i)
-				FrameBuffer::ApplyBlurHeavyFilter(passFrameBuffer->GetPixels(), tmpFrameBuffer->GetPixels(),
-						width, height);
+		case BLUR_HEAVY:
+			FrameBuffer::ApplyBlurHeavyFilterX(passFrameBuffer->GetPixels(), tmpFrameBuffer->GetPixels(),
+					width, height, yStart, yEnd);
 			break;
-		}
-		case BOX: {
-			const unsigned int filterPassCount = gameConfig.GetRendererFilterIterations();
-			for (unsigned int i = 0; i < filterPassCount; ++i)
-				FrameBuffer::ApplyBoxFilter(passFrameBuffer->GetPixels(), tmpFrameBuffer->GetPixels(),
-						width, height, gameConfig.GetRendererFilterRaidus());
+		case BOX:
+			FrameBuffer::ApplyBoxFilterX(passFrameBuffer->GetPixels(), tmpFrameBuffer->GetPixels(),
+					width, height, gameConfig.GetRendererFilterRaidus(), yStart, yEnd);
 			break;
-		}
 	}
 }
 
-void CPURenderer::BlendFrame() {
+void CPURenderer::ApplyFilterY(const unsigned int yStart, const unsigned int yEnd,
+		float *filterRowSums, const bool continueRowSums) {
+	const GameConfig &gameConfig(*(gameLevel->gameConfig));
+	const unsigned int width = gameConfig.GetScreenWidth();
+	const unsigned int height = gameConfig.GetScreenHeight();
+
+	switch (gameConfig.GetRendererFilterType()) {
+		case NO_FILTER:
+			break;
+		case BLUR_LIGHT:
+			FrameBuffer::ApplyBlurLightFilterY(tmpFrameBuffer->GetPixels(), passFrameBuffer->GetPixels(),
+					width, height, yStart, yEnd);
+			break;
+		case BLUR_HEAVY:
+			FrameBuffer::ApplyBlurHeavyFilterY(tmpFrameBuffer->GetPixels(), passFrameBuffer->GetPixels(),
+					width, height, yStart, yEnd);
+			break;
+		case BOX:
+			FrameBuffer::ApplyBoxFilterY(tmpFrameBuffer->GetPixels(), passFrameBuffer->GetPixels(),
+					width, height, gameConfig.GetRendererFilterRaidus(), yStart, yEnd,
+					filterRowSums, continueRowSums);
+			break;
+	}
+}
+
+void CPURenderer::ApplyFilter(float *filterRowSums) {
+	//--------------------------------------------------------------------------
+	// Apply a filter: approximated by applying a box filter multiple times.
+	// The Y pass of the last iteration is done by PostProcess().
+	//--------------------------------------------------------------------------
+
+	const unsigned int height = gameLevel->gameConfig->GetScreenHeight();
+
+	const unsigned int filterPassCount = GetFilterPassCount();
+	for (unsigned int i = 0; i < filterPassCount; ++i) {
+		ApplyFilterX(0, height);
+		if (i < filterPassCount - 1)
+			ApplyFilterY(0, height, filterRowSums);
+	}
+}
+
+float CPURenderer::UpdateBlendFactor() {
 	//--------------------------------------------------------------------------
-	// Blend the new frame with the old one
+	// Calculate the factor used to blend the new frame with the old one
 	//--------------------------------------------------------------------------
 
 	const GameConfig &gameConfig(*(gameLevel->gameConfig));
-	const unsigned int width = gameConfig.GetScreenWidth();
-	const unsigned int height = gameConfig.GetScreenHeight();
 
 	const float ghostTimeLength = gameConfig.GetRendererGhostFactorTime();
 	float k;
@@ -216,39 +382,44 @@ void CPURenderer::BlendFrame() {
 		k = dt / ghostTimeLength;
 	}
 
-	const float blendFactor = (1.f - k) * gameConfig.GetRendererGhostFactorCameraEdit() +
+	return (1.f - k) * gameConfig.GetRendererGhostFactorCameraEdit() +
 		k * gameConfig.GetRendererGhostFactorNoCameraEdit();
-
-	for (unsigned int y = 0; y < height; ++y) {
-		for (unsigned int x = 0; x < width; ++x) {
-			const Pixel *p = passFrameBuffer->GetPixel(x, y);
-			frameBuffer->BlendPixel(x, y, *p, blendFactor);
-		}
-	}
 }
 
-void CPURenderer::ApplyToneMapping() {
+double CPURenderer::PostProcess(const unsigned int yStart, const unsigned int yEnd,
+		const float blendFactor, unsigned char *toneMapPixels,
+		float *filterRowSums) {
 	//--------------------------------------------------------------------------
-	// Tone mapping
+	// Last filter pass, blend with the old frame, tone mapping and RGBA8
+	// packing fused in a single sweep. The band of rows is processed in
+	// small tiles so each tile is still in cache for all the steps.
 	//--------------------------------------------------------------------------
 
-	const GameConfig &gameConfig(*(gameLevel->gameConfig));
-	const unsigned int width = gameConfig.GetScreenWidth();
-	const unsigned int height = gameConfig.GetScreenHeight();
+	const unsigned int width = gameLevel->gameConfig->GetScreenWidth();
+	const bool hasFilter = (GetFilterPassCount() > 0);
+	const ToneMap &toneMap(*(gameLevel->toneMap));
+	const float k = blendFactor;
+
+	double luminance = 0.0;
+	for (unsigned int tileStartY = yStart; tileStartY < yEnd; tileStartY += CPURENDERER_POSTPROCESS_TILE_HEIGHT) {
+		const unsigned int tileEndY = Min(tileStartY + CPURENDERER_POSTPROCESS_TILE_HEIGHT, yEnd);
+
+		// The tiles of the band continue the running sums of the previous one
+		if (hasFilter)
+			ApplyFilterY(tileStartY, tileEndY, filterRowSums, tileStartY != yStart);
+
+		const unsigned int offset = tileStartY * width;
+		const unsigned int count = (tileEndY - tileStartY) * width;
+
+		const Pixel *p = passFrameBuffer->GetPixel(offset);
+		Pixel *f = frameBuffer->GetPixel(offset);
+		for (unsigned int i = 0; i < count; ++i) {
+			f[i] = (1.f - k) * f[i] + k * p[i];
+			luminance += f[i].Y();
+		}
 
-	gameLevel->toneMap->Map(frameBuffer, toneMapFrameBuffer);
+		toneMap.MapRGBA8(f, &toneMapPixels[offset * 4], count, averageLuminance);
+	}
 
-	glDrawPixels(width, height, GL_RGB, GL_FLOAT, toneMapFrameBuffer->GetPixels());
+	return luminance;
 }
-
-void CPURenderer::CopyFrame() {
-	//--------------------------------------------------------------------------
-	// Copy the frame
-	//--------------------------------------------------------------------------
-
-	const GameConfig &gameConfig(*(gameLevel->gameConfig));
-	const unsigned int width = gameConfig.GetScreenWidth();
-	const unsigned int height = gameConfig.GetScreenHeight();
-
-	glDrawPixels(width, height, GL_RGB, GL_FLOAT, toneMapFrameBuffer->GetPixels());
-}
\ No newline at end of file
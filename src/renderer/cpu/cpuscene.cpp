@@ -0,0 +1,496 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "sfera.h"
+#include "geometry/vector_normal.h"
+#include "utils/mc.h"
+#include "renderer/cpu/cpuscene.h"
+
+CPUScene::CPUScene(const GameLevel *level) : gameLevel(level) {
+	CompileMaterials();
+	CompileTextureMaps();
+}
+
+void CPUScene::CompileMaterial(const Material *m, cpuscene::Material *cpum) {
+	cpum->type = m->GetType();
+	cpum->emission = m->GetEmission();
+	cpum->exponent = 0.f;
+	cpum->outsideIor = 0.f;
+	cpum->ior = 0.f;
+	cpum->R0 = 0.f;
+
+	switch (m->GetType()) {
+		case MATTE: {
+			const MatteMaterial *mm = (const MatteMaterial *)m;
+
+			cpum->Kr = mm->GetKd();
+			break;
+		}
+		case MIRROR: {
+			const MirrorMaterial *mm = (const MirrorMaterial *)m;
+
+			cpum->Kr = mm->GetKr();
+			break;
+		}
+		case GLASS: {
+			const GlassMaterial *gm = (const GlassMaterial *)m;
+
+			cpum->Kr = gm->GetKrefl();
+			cpum->Kt = gm->GetKrefrct();
+			cpum->outsideIor = gm->GetOutsideIOR();
+			cpum->ior = gm->GetIOR();
+			cpum->R0 = gm->GetR0();
+			break;
+		}
+		case METAL: {
+			const MetalMaterial *mm = (const MetalMaterial *)m;
+
+			cpum->Kr = mm->GetKr();
+			cpum->exponent = mm->GetExp();
+			break;
+		}
+		case ALLOY: {
+			const AlloyMaterial *am = (const AlloyMaterial *)m;
+
+			cpum->Kr = am->GetKrefl();
+			cpum->Kt = am->GetKd();
+			cpum->exponent = am->GetExp();
+			cpum->R0 = am->GetR0();
+			break;
+		}
+		default: {
+			cpum->type = MATTE;
+			cpum->Kr = Spectrum(0.75f, 0.75f, 0.75f);
+			break;
+		}
+	}
+}
+
+void CPUScene::CompileMaterials() {
+	const Scene &scene(*(gameLevel->scene));
+
+	enable_MAT_MATTE = false;
+	enable_MAT_MIRROR = false;
+	enable_MAT_GLASS = false;
+	enable_MAT_METAL = false;
+	enable_MAT_ALLOY = false;
+
+	mats.resize(scene.materials.size() + GAMEPLAYER_PUPPET_SIZE);
+
+	// Add scene materials, in the same order of Scene::sphereMaterialIndices
+	for (unsigned int i = 0; i < scene.materials.size(); ++i)
+		CompileMaterial(scene.materials[i], &mats[i]);
+
+	// Add player materials
+	for (unsigned int i = 0; i < GAMEPLAYER_PUPPET_SIZE; ++i)
+		CompileMaterial(gameLevel->player->puppetMaterial[i], &mats[i + scene.materials.size()]);
+
+	// Set the flags by the compiled type, unknown types are compiled as matte
+	for (unsigned int i = 0; i < mats.size(); ++i) {
+		switch (mats[i].type) {
+			case MATTE:
+				enable_MAT_MATTE = true;
+				break;
+			case MIRROR:
+				enable_MAT_MIRROR = true;
+				break;
+			case GLASS:
+				enable_MAT_GLASS = true;
+				break;
+			case METAL:
+				enable_MAT_METAL = true;
+				break;
+			case ALLOY:
+				enable_MAT_ALLOY = true;
+				break;
+		}
+	}
+}
+
+void CPUScene::CompileTextureMaps() {
+	const Scene &scene(*(gameLevel->scene));
+	const unsigned int sphereCount = scene.spheres.size();
+
+	texMaps.resize(0);
+	bumpMaps.resize(0);
+	sphereMaps.resize(sphereCount);
+
+	// Each instance is stored only once even if it is shared by many spheres
+	map<const TexMapInstance *, unsigned int> texMapIndices;
+	map<const BumpMapInstance *, unsigned int> bumpMapIndices;
+	for (unsigned int i = 0; i < sphereCount; ++i) {
+		const TexMapInstance *t = scene.sphereTexMaps[i];
+		if (t) {
+			map<const TexMapInstance *, unsigned int>::const_iterator it = texMapIndices.find(t);
+			if (it == texMapIndices.end()) {
+				sphereMaps[i].texMapIndex = texMaps.size();
+				texMapIndices[t] = texMaps.size();
+				texMaps.push_back(t);
+			} else
+				sphereMaps[i].texMapIndex = it->second;
+		} else
+			sphereMaps[i].texMapIndex = CPUSCENE_NULL_INDEX;
+
+		const BumpMapInstance *b = scene.sphereBumpMaps[i];
+		if (b) {
+			map<const BumpMapInstance *, unsigned int>::const_iterator it = bumpMapIndices.find(b);
+			if (it == bumpMapIndices.end()) {
+				sphereMaps[i].bumpMapIndex = bumpMaps.size();
+				bumpMapIndices[b] = bumpMaps.size();
+				bumpMaps.push_back(b);
+			} else
+				sphereMaps[i].bumpMapIndex = it->second;
+		} else
+			sphereMaps[i].bumpMapIndex = CPUSCENE_NULL_INDEX;
+	}
+}
+
+void CPUScene::CompileSpheres(vector<cpuscene::SphereRecord> &sphereRecords) const {
+	const Scene &scene(*(gameLevel->scene));
+	const unsigned int sphereCount = scene.spheres.size();
+
+	if (sphereRecords.size() != sphereCount + GAMEPLAYER_PUPPET_SIZE) {
+		sphereRecords.resize(sphereCount + GAMEPLAYER_PUPPET_SIZE);
+		copy(sphereMaps.begin(), sphereMaps.end(), sphereRecords.begin());
+
+		// Player puppet has no texture or bump maps
+		for (unsigned int i = 0; i < GAMEPLAYER_PUPPET_SIZE; ++i) {
+			cpuscene::SphereRecord &r(sphereRecords[i + sphereCount]);
+			r.matIndex = i + scene.materials.size();
+			r.texMapIndex = CPUSCENE_NULL_INDEX;
+			r.bumpMapIndex = CPUSCENE_NULL_INDEX;
+		}
+	}
+
+	const unsigned int *matIndices = &scene.sphereMaterialIndices[0];
+	for (unsigned int i = 0; i < sphereCount; ++i)
+		sphereRecords[i].matIndex = matIndices[i];
+}
+
+//------------------------------------------------------------------------------
+// Materials
+//------------------------------------------------------------------------------
+
+static Vector GlossyReflection(const Vector &wo, const float exponent,
+	const Normal &shadeN, const float u0, const float u1) {
+	const float phi = 2.f * M_PI * u0;
+	const float cosTheta = powf(1.f - u1, exponent);
+	const float sinTheta = sqrtf(1.f - cosTheta * cosTheta);
+	const float x = cosf(phi) * sinTheta;
+	const float y = sinf(phi) * sinTheta;
+	const float z = cosTheta;
+
+	const Vector dir = -wo;
+	const float dp = Dot(shadeN, dir);
+	const Vector w = dir - (2.f * dp) * Vector(shadeN);
+
+	Vector u;
+	if (fabsf(shadeN.x) > .1f) {
+		const Vector a(0.f, 1.f, 0.f);
+		u = Cross(a, w);
+	} else {
+		const Vector a(1.f, 0.f, 0.f);
+		u = Cross(a, w);
+	}
+	u = Normalize(u);
+	Vector v = Cross(w, u);
+
+	return x * u + y * v + z * w;
+}
+
+static float GlossyReflectionPdf(const Vector &wo, const float exponent,
+	const Normal &shadeN, const Vector &wi) {
+	const Vector dir = -wo;
+	const float dp = Dot(shadeN, dir);
+	const Vector w = dir - (2.f * dp) * Vector(shadeN);
+
+	const float cosAlpha = Dot(w, wi);
+	if (cosAlpha <= 0.f)
+		return 0.f;
+
+	// exponent is 1 / (n + 1) of the Phong lobe
+	return INV_TWOPI / exponent * powf(cosAlpha, 1.f / exponent - 1.f);
+}
+
+Spectrum CPUScene::Matte_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce) {
+	Vector dir = CosineSampleHemisphere(sampler.GetSample(), sampler.GetSample());
+	if (dir.z < 0.f)
+		dir.z = -dir.z;
+
+	const float dp = dir.z;
+	// Using 0.0001 instead of 0.0 to cut down fireflies
+	if (dp <= 0.0001f) {
+		*pdf = 0.f;
+		return Spectrum();
+	}
+
+	*pdf = dp * INV_PI;
+
+	Vector v1, v2;
+	CoordinateSystem(Vector(shadeN), &v1, &v2);
+
+	dir = Vector(
+			v1.x * dir.x + v2.x * dir.y + shadeN.x * dir.z,
+			v1.y * dir.x + v2.y * dir.y + shadeN.y * dir.z,
+			v1.z * dir.x + v2.z * dir.y + shadeN.z * dir.z);
+
+	(*wi) = dir;
+
+	diffuseBounce = true;
+
+	return mat.Kr * dp;
+}
+
+Spectrum CPUScene::Matte_Evaluate(const cpuscene::Material &mat,
+		const Vector &wo, const Vector &wi, const Normal &N, const Normal &shadeN,
+		float *pdf) {
+	const float dp = Dot(shadeN, wi);
+	if (dp <= 0.0001f) {
+		*pdf = 0.f;
+		return Spectrum();
+	}
+
+	*pdf = dp * INV_PI;
+
+	return mat.Kr * (dp * (*pdf));
+}
+
+Spectrum CPUScene::Mirror_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce) {
+	const Vector dir = -wo;
+	const float dp = Dot(shadeN, dir);
+	(*wi) = dir - (2.f * dp) * Vector(shadeN);
+
+	diffuseBounce = false;
+	*pdf = 1.f;
+
+	return mat.Kr;
+}
+
+Spectrum CPUScene::Glass_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce) {
+	const Vector rayDir = -wo;
+	const Vector reflDir = rayDir - (2.f * Dot(N, rayDir)) * Vector(N);
+
+	// Ray from outside going in ?
+	const bool into = (Dot(N, shadeN) > 0.f);
+
+	const float nc = mat.outsideIor;
+	const float nt = mat.ior;
+	const float nnt = into ? (nc / nt) : (nt / nc);
+	const float ddn = Dot(rayDir, shadeN);
+	const float cos2t = 1.f - nnt * nnt * (1.f - ddn * ddn);
+
+	diffuseBounce = false;
+
+	// Total internal reflection
+	if (cos2t < 0.f) {
+		(*wi) = reflDir;
+		*pdf = 1.f;		
+
+		return mat.Kr;
+	}
+
+	const float kk = (into ? 1.f : -1.f) * (ddn * nnt + sqrtf(cos2t));
+	const Vector nkk = kk * Vector(N);
+	const Vector transDir = Normalize(nnt * rayDir - nkk);
+
+	const float c = 1.f - (into ? -ddn : Dot(transDir, N));
+
+	const float R0 = mat.R0;
+	const float Re = R0 + (1.f - R0) * c * c * c * c * c;
+	const float Tr = 1.f - Re;
+	const float P = .25f + .5f * Re;
+
+	if (Tr == 0.f) {
+		if (Re == 0.f) {
+			*pdf = 0.f;
+			return Spectrum();
+		} else {
+			(*wi) = reflDir;
+			*pdf = 1.f;
+
+			return mat.Kr;
+		}
+	} else if (Re == 0.f) {
+		(*wi) = transDir;
+		*pdf = 1.f;
+
+		return mat.Kt;
+	} else if (sampler.GetSample() < P) {
+		(*wi) = reflDir;
+		*pdf = P / Re;
+
+		return mat.Kr / (*pdf);
+	} else {
+		(*wi) = transDir;
+		*pdf = (1.f - P) / Tr;
+
+		return mat.Kt / (*pdf);
+	}
+}
+
+Spectrum CPUScene::Metal_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce) {
+	(*wi) = GlossyReflection(wo, mat.exponent, shadeN, sampler.GetSample(), sampler.GetSample());
+
+	if (Dot(*wi, shadeN) > 0.f) {
+		diffuseBounce = false;
+		*pdf = GlossyReflectionPdf(wo, mat.exponent, shadeN, *wi);
+
+		return mat.Kr;
+	} else {
+		*pdf = 0.f;
+
+		return Spectrum();
+	}
+}
+
+Spectrum CPUScene::Metal_Evaluate(const cpuscene::Material &mat,
+		const Vector &wo, const Vector &wi, const Normal &N, const Normal &shadeN,
+		float *pdf) {
+	if (Dot(wi, shadeN) <= 0.f) {
+		*pdf = 0.f;
+		return Spectrum();
+	}
+
+	*pdf = GlossyReflectionPdf(wo, mat.exponent, shadeN, wi);
+
+	return mat.Kr * (*pdf);
+}
+
+Spectrum CPUScene::Alloy_Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce) {
+	// Schilick's approximation
+	const float c = 1.f - Dot(wo, shadeN);
+	const float R0 = mat.R0;
+	const float Re = R0 + (1.f - R0) * c * c * c * c * c;
+
+	const float P = .25f + .5f * Re;
+
+	// The first 2 dimensions are used for the direction so they are a
+	// well stratified pair
+	const float u0 = sampler.GetSample();
+	const float u1 = sampler.GetSample();
+
+	if (sampler.GetSample() < P) {
+		(*wi) = GlossyReflection(wo, mat.exponent, shadeN, u0, u1);
+
+		// The pdf of both lobes is required by multiple importance sampling
+		const float dp = Max(0.f, Dot(*wi, shadeN));
+		*pdf = P * GlossyReflectionPdf(wo, mat.exponent, shadeN, *wi) +
+				(1.f - P) * dp * INV_PI;
+		diffuseBounce = false;
+
+		return mat.Kr * (Re / P);
+	} else {
+		Vector dir = CosineSampleHemisphere(u0, u1);
+		if (dir.z < 0.f)
+			dir.z = -dir.z;
+
+		const float dp = dir.z;
+		// Using 0.0001 instead of 0.0 to cut down fireflies
+		if (dp <= 0.0001f) {
+			*pdf = 0.f;
+			return Spectrum();
+		}
+
+		Vector v1, v2;
+		CoordinateSystem(Vector(shadeN), &v1, &v2);
+
+		dir = Vector(
+				v1.x * dir.x + v2.x * dir.y + shadeN.x * dir.z,
+				v1.y * dir.x + v2.y * dir.y + shadeN.y * dir.z,
+				v1.z * dir.x + v2.z * dir.y + shadeN.z * dir.z);
+
+		(*wi) = dir;
+
+		*pdf = P * GlossyReflectionPdf(wo, mat.exponent, shadeN, *wi) +
+				(1.f - P) * dp * INV_PI;
+		diffuseBounce = true;
+
+		return mat.Kt * dp;
+	}
+}
+
+Spectrum CPUScene::Alloy_Evaluate(const cpuscene::Material &mat,
+		const Vector &wo, const Vector &wi, const Normal &N, const Normal &shadeN,
+		float *pdf) {
+	// Schilick's approximation
+	const float c = 1.f - Dot(wo, shadeN);
+	const float R0 = mat.R0;
+	const float Re = R0 + (1.f - R0) * c * c * c * c * c;
+
+	const float P = .25f + .5f * Re;
+
+	const float glossyPdf = GlossyReflectionPdf(wo, mat.exponent, shadeN, wi);
+	float dp = Dot(wi, shadeN);
+	// Same cut of Alloy_Sample_f() for the diffuse lobe
+	if (dp <= 0.0001f)
+		dp = 0.f;
+	const float diffusePdf = dp * INV_PI;
+
+	*pdf = P * glossyPdf + (1.f - P) * diffusePdf;
+
+	return mat.Kr * (Re * glossyPdf) + mat.Kt * ((1.f - P) * dp * diffusePdf);
+}
+
+Spectrum CPUScene::Sample_f(const cpuscene::Material &mat, Sampler &sampler,
+		const Vector &wo, Vector *wi, const Normal &N, const Normal &shadeN,
+		float *pdf, bool &diffuseBounce) {
+	switch (mat.type) {
+		case MATTE:
+			return Matte_Sample_f(mat, sampler, wo, wi, N, shadeN, pdf, diffuseBounce);
+		case MIRROR:
+			return Mirror_Sample_f(mat, sampler, wo, wi, N, shadeN, pdf, diffuseBounce);
+		case GLASS:
+			return Glass_Sample_f(mat, sampler, wo, wi, N, shadeN, pdf, diffuseBounce);
+		case METAL:
+			return Metal_Sample_f(mat, sampler, wo, wi, N, shadeN, pdf, diffuseBounce);
+		case ALLOY:
+			return Alloy_Sample_f(mat, sampler, wo, wi, N, shadeN, pdf, diffuseBounce);
+		default:
+			*pdf = 0.f;
+			return Spectrum();
+	}
+}
+
+Spectrum CPUScene::Evaluate(const cpuscene::Material &mat,
+		const Vector &wo, const Vector &wi, const Normal &N, const Normal &shadeN,
+		float *pdf) {
+	switch (mat.type) {
+		case MATTE:
+			return Matte_Evaluate(mat, wo, wi, N, shadeN, pdf);
+		case METAL:
+			return Metal_Evaluate(mat, wo, wi, N, shadeN, pdf);
+		case ALLOY:
+			return Alloy_Evaluate(mat, wo, wi, N, shadeN, pdf);
+		default:
+			// Specular materials
+			*pdf = 0.f;
+			return Spectrum();
+	}
+}
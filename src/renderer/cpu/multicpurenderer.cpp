@@ -24,24 +24,38 @@
 #include "renderer/cpu/singlecpurenderer.h"
 #include "renderer/cpu/multicpurenderer.h"
 
+// Adds the time since startTime to a stage and returns the current time. The
+// render threads time the stages including the barriers at their end, so the
+// load imbalance is included.
+static double AddStageTime(StageProfiler *profiler, const FrameStage stage,
+		const double startTime) {
+	const double now = WallClockTime();
+	profiler->AddTime(stage, now - startTime);
+
+	return now;
+}
+
 //------------------------------------------------------------------------------
 // MultiCPURenderer
 //------------------------------------------------------------------------------
 
-MultiCPURenderer::MultiCPURenderer(GameLevel *level) : CPURenderer(level) {
-	const unsigned int width = gameLevel->gameConfig->GetScreenWidth();
-	const unsigned int height = gameLevel->gameConfig->GetScreenHeight();
-
+MultiCPURenderer::MultiCPURenderer(GameLevel *level, const bool headless) :
+	CPURenderer(level, headless) {
 	threadCount = boost::thread::hardware_concurrency();
 
-	// Initialize all frame buffers
-	for (size_t i = 0; i < threadCount; ++i) {
-		threadPassFrameBuffer.push_back(new FrameBuffer(width, height / threadCount));
-		threadPassFrameBuffer[i]->Clear();
+	// Initialize the pipeline
+	for (size_t i = 0; i < 2; ++i) {
+		frames[i].accel = NULL;
+		frames[i].blendFactor = 1.f;
+		frames[i].pixelBufferIndex = 0;
+		frames[i].toneMapPixels = NULL;
 	}
+	frameIndex = 0;
+	rayCount = 0;
 
-	// Create synchronization barrier
+	// Create synchronization barriers
 	barrier = new boost::barrier(threadCount + 1);
+	threadBarrier = new boost::barrier(threadCount);
 
 	// Start all threads
 	for (size_t i = 0; i < threadCount; ++i) {
@@ -58,8 +72,11 @@ MultiCPURenderer::~MultiCPURenderer() {
 		delete renderThread[i];
 	}
 
-	for (size_t i = 0; i < threadCount; ++i)
-		delete threadPassFrameBuffer[i];
+	for (size_t i = 0; i < 2; ++i)
+		delete frames[i].accel;
+
+	delete barrier;
+	delete threadBarrier;
 }
 
 size_t MultiCPURenderer::DrawFrame() {
@@ -67,78 +84,87 @@ size_t MultiCPURenderer::DrawFrame() {
 	const unsigned int width = gameConfig.GetScreenWidth();
 	const unsigned int height = gameConfig.GetScreenHeight();
 
+	// The render threads can still be working on the previous frame so only
+	// the other slot of the pipeline can be touched here
+	MultiCPURendererFrame &nextFrame(frames[frameIndex % 2]);
+	MultiCPURendererFrame &prevFrame(frames[(frameIndex + 1) % 2]);
+	StageProfiler *profiler = gameLevel->frameProfiler;
 
 	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_ACCEL_BUILD);
 		boost::unique_lock<boost::mutex> lock(gameLevel->levelMutex);
 
 		//----------------------------------------------------------------------
 		// Build the Accelerator
 		//----------------------------------------------------------------------
 
-		accel = BuildAcceleretor();
+		nextFrame.accel = BuildAcceleretor();
+		cpuScene->CompileSpheres(nextFrame.sphereRecords);
 
 		//----------------------------------------------------------------------
 		// Copy the Camera
 		//----------------------------------------------------------------------
 
-		memcpy(&cameraCopy, gameLevel->camera, sizeof(PerspectiveCamera));
+		memcpy(&nextFrame.camera, gameLevel->camera, sizeof(PerspectiveCamera));
 	}
 
-	//----------------------------------------------------------------------
-	// Rendering
-	//----------------------------------------------------------------------
-
-	barrier->wait();
-	// Other threads do the rendering
-	barrier->wait();
-
-	delete accel;
+	nextFrame.blendFactor = UpdateBlendFactor();
+	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_GL_UPLOAD);
+		nextFrame.pixelBufferIndex = pixelBuffers->Acquire();
+		nextFrame.toneMapPixels = pixelBuffers->GetPixels(nextFrame.pixelBufferIndex);
+	}
 
 	//--------------------------------------------------------------------------
-	// Merge all thread frames
+	// Wait for the end of the previous frame and start the new one
 	//--------------------------------------------------------------------------
 
-	for (unsigned int y = 0; y < height; ++y) {
-		const Pixel *p = threadPassFrameBuffer[y % threadCount]->GetPixel(0, y / threadCount);
-
-		for (unsigned int x = 0; x < width; ++x)
-			passFrameBuffer->SetPixel(x, y, *p++);
+	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_SYNC);
+		barrier->wait();
 	}
+	++frameIndex;
 
 	//--------------------------------------------------------------------------
-	// Apply a filter: approximated by applying a box filter multiple times
+	// Display the previous frame while the render threads work on the new one
 	//--------------------------------------------------------------------------
 
-	ApplyFilter();
+	delete prevFrame.accel;
+	prevFrame.accel = NULL;
 
-	//--------------------------------------------------------------------------
-	// Blend the new frame with the old one
-	//--------------------------------------------------------------------------
-
-	BlendFrame();
+	// Nothing to display at the very first frame
+	if (prevFrame.toneMapPixels) {
+		ScopedStageTimer timer(profiler, FRAME_STAGE_GL_UPLOAD);
+		pixelBuffers->Draw(prevFrame.pixelBufferIndex);
+		prevFrame.toneMapPixels = NULL;
+	}
 
-	//--------------------------------------------------------------------------
-	// Tone mapping
-	//--------------------------------------------------------------------------
+	return gameConfig.GetRendererSamplePerPass() * width * height;
+}
 
-	ApplyToneMapping();
-	CopyFrame();
+unsigned long long MultiCPURenderer::GetRayCount() const {
+	// The frame still in the pipeline is not included
+	boost::unique_lock<boost::mutex> lock(rayCountMutex);
 
-	return gameConfig.GetRendererSamplePerPass() * width * height;
+	return rayCount;
 }
 
 //------------------------------------------------------------------------------
 // MultiCPURendererThread
 //------------------------------------------------------------------------------
 
-MultiCPURendererThread::MultiCPURendererThread(const size_t threadIndex, MultiCPURenderer *multiCPURenderer) :
-	rnd(threadIndex + 1) {
+MultiCPURendererThread::MultiCPURendererThread(const size_t threadIndex, MultiCPURenderer *multiCPURenderer) {
 	index = threadIndex;
+	luminance = 0.0;
+	rayCount = 0;
 	renderer = multiCPURenderer;
 	renderThread = NULL;
+	sampler = renderer->AllocSampler();
+	filterRowSums.resize(renderer->gameLevel->gameConfig->GetScreenWidth() * 3);
 }
 
 MultiCPURendererThread::~MultiCPURendererThread() {
+	delete sampler;
 }
 
 void MultiCPURendererThread::Start() {
@@ -157,41 +183,110 @@ void MultiCPURendererThread::Stop() {
 void MultiCPURendererThread::MultiCPURenderThreadImpl(MultiCPURendererThread *renderThread) {
 	try {
 		const size_t index = renderThread->index;
-		RandomGenerator &rnd(renderThread->rnd);
-		const GameLevel *gameLevel = renderThread->renderer->gameLevel;
-		FrameBuffer *threadPassFrameBuffer = renderThread->renderer->threadPassFrameBuffer[index];
+		Sampler &sampler(*(renderThread->sampler));
+		MultiCPURenderer *renderer = renderThread->renderer;
+		const GameLevel *gameLevel = renderer->gameLevel;
+		FrameBuffer *passFrameBuffer = renderer->passFrameBuffer;
 
 		const GameConfig &gameConfig(*(gameLevel->gameConfig));
 		const unsigned int width = gameConfig.GetScreenWidth();
 		const unsigned int height = gameConfig.GetScreenHeight();
 		const unsigned int samplePerPass = gameConfig.GetRendererSamplePerPass();
-		const size_t threadCount = renderThread->renderer->threadCount;
+		const size_t threadCount = renderer->threadCount;
 		const float sampleScale = 1.f / samplePerPass;
+		// Only the first thread is profiled, the work is evenly split
+		StageProfiler *profiler = (index == 0) ? gameLevel->frameProfiler : NULL;
+
+		// The band of rows filtered and post-processed by this thread
+		const unsigned int filterStartY = (unsigned int)((index * height) / threadCount);
+		const unsigned int filterEndY = (unsigned int)(((index + 1) * height) / threadCount);
+
+		for (size_t frameIndex = 0; !boost::this_thread::interruption_requested(); ++frameIndex) {
+			// Wait for a new frame
+			renderer->barrier->wait();
 
-		while (!boost::this_thread::interruption_requested()) {
-			renderThread->renderer->barrier->wait();
+			const MultiCPURendererFrame &frame(renderer->frames[frameIndex % 2]);
 
 			//------------------------------------------------------------------
 			// Render
 			//------------------------------------------------------------------
 
-			for (unsigned int i = 0; i < samplePerPass; ++i) {
-				for (unsigned int y = index; y < height; y += threadCount) {
-					for (unsigned int x = 0; x < width; ++x) {
-						Spectrum s = renderThread->renderer->SampleImage(
-								rnd, *(renderThread->renderer->accel), renderThread->renderer->cameraCopy,
-								x + rnd.floatValue() - .5f, y + rnd.floatValue() - .5f) *
-								sampleScale;
-
-						if (i == 0)
-							threadPassFrameBuffer->SetPixel(x, y / threadCount, s);
-						else
-							threadPassFrameBuffer->AddPixel(x, y / threadCount, s);
+			// Each thread renders interleaved rows straight into the pass frame
+			// buffer. All samples of a pixel are accumulated before the store so
+			// every pixel is written only once.
+			double stageStartTime = profiler ? WallClockTime() : 0.0;
+			unsigned int frameRayCount = 0;
+			for (unsigned int y = index; y < height; y += threadCount) {
+				Pixel *p = passFrameBuffer->GetPixel(0, y);
+
+				for (unsigned int x = 0; x < width; ++x) {
+					Spectrum s;
+					for (unsigned int i = 0; i < samplePerPass; ++i) {
+						sampler.StartSample(x, y, (unsigned int)frameIndex * samplePerPass + i);
+						const float screenX = x + sampler.GetSample() - .5f;
+						const float screenY = y + sampler.GetSample() - .5f;
+
+						s += renderer->SampleImage(
+								sampler, *(frame.accel), frame.camera, frame.sphereRecords,
+								screenX, screenY, frameRayCount);
 					}
+
+					*p++ = s * sampleScale;
+				}
+			}
+			renderThread->rayCount = frameRayCount;
+
+			renderer->threadBarrier->wait();
+			if (profiler)
+				stageStartTime = AddStageTime(profiler, FRAME_STAGE_RENDER, stageStartTime);
+
+			//------------------------------------------------------------------
+			// Filter
+			//------------------------------------------------------------------
+
+			// All X passes have to be done before any Y pass starts (and
+			// vice versa)
+			const unsigned int filterPassCount = renderer->GetFilterPassCount();
+			for (unsigned int i = 0; i < filterPassCount; ++i) {
+				renderer->ApplyFilterX(filterStartY, filterEndY);
+				renderer->threadBarrier->wait();
+
+				// The Y pass of the last iteration is fused with the post-processing
+				if (i < filterPassCount - 1) {
+					renderer->ApplyFilterY(filterStartY, filterEndY, &renderThread->filterRowSums[0]);
+					renderer->threadBarrier->wait();
 				}
 			}
 
-			renderThread->renderer->barrier->wait();
+			if (profiler)
+				stageStartTime = AddStageTime(profiler, FRAME_STAGE_FILTER, stageStartTime);
+
+			//------------------------------------------------------------------
+			// Post-processing
+			//------------------------------------------------------------------
+
+			renderThread->luminance = renderer->PostProcess(
+					filterStartY, filterEndY, frame.blendFactor, frame.toneMapPixels,
+					&renderThread->filterRowSums[0]);
+
+			renderer->threadBarrier->wait();
+			if (profiler)
+				AddStageTime(profiler, FRAME_STAGE_BLEND_TONEMAP, stageStartTime);
+
+			// Used by the tone mapping of the next frame
+			if (index == 0) {
+				double luminance = 0.0;
+				unsigned long long totalRayCount = 0;
+				for (size_t i = 0; i < threadCount; ++i) {
+					luminance += renderer->renderThread[i]->luminance;
+					totalRayCount += renderer->renderThread[i]->rayCount;
+				}
+				renderer->averageLuminance = luminance / (width * height);
+
+				// GetRayCount() is called by the main thread at any time
+				boost::unique_lock<boost::mutex> lock(renderer->rayCountMutex);
+				renderer->rayCount += totalRayCount;
+			}
 		}
 	} catch (boost::thread_interrupted) {
 		SFERA_LOG("[RenderThread::" << renderThread->index << "] Render thread halted");
@@ -23,11 +23,16 @@
 #include "acceleretor/bvhaccel.h"
 #include "renderer/cpu/singlecpurenderer.h"
 
-SingleCPURenderer::SingleCPURenderer(GameLevel *level) : CPURenderer(level),
-		rnd(1) {
+SingleCPURenderer::SingleCPURenderer(GameLevel *level, const bool headless) :
+	CPURenderer(level, headless) {
+	sampler = AllocSampler();
+	filterRowSums.resize(level->gameConfig->GetScreenWidth() * 3);
+	frameCount = 0;
+	rayCount = 0;
 }
 
 SingleCPURenderer::~SingleCPURenderer() {
+	delete sampler;
 }
 
 size_t SingleCPURenderer::DrawFrame() {
@@ -36,10 +41,14 @@ size_t SingleCPURenderer::DrawFrame() {
 	const unsigned int height = gameConfig.GetScreenHeight();
 	const unsigned int samplePerPass = gameConfig.GetRendererSamplePerPass();
 
+	StageProfiler *profiler = gameLevel->frameProfiler;
+
 	BVHAccel *accel;
 	PerspectiveCamera cameraCopy;
+	vector<cpuscene::SphereRecord> sphereRecords;
 
 	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_ACCEL_BUILD);
 		boost::unique_lock<boost::mutex> lock(gameLevel->levelMutex);
 
 		//----------------------------------------------------------------------
@@ -47,6 +56,7 @@ size_t SingleCPURenderer::DrawFrame() {
 		//----------------------------------------------------------------------
 
 		accel = BuildAcceleretor();
+		cpuScene->CompileSpheres(sphereRecords);
 
 		//----------------------------------------------------------------------
 		// Copy the Camera
@@ -60,42 +70,68 @@ size_t SingleCPURenderer::DrawFrame() {
 	//----------------------------------------------------------------------
 
 	const float sampleScale = 1.f / samplePerPass;
-	for (unsigned int i = 0; i < samplePerPass; ++i) {
-		for (unsigned int y = 0; y < height; ++y) {
-			for (unsigned int x = 0; x < width; ++x) {
-				Spectrum s = SampleImage(rnd, *accel, cameraCopy,
-						x + rnd.floatValue() - .5f, y + rnd.floatValue() - .5f) *
-						sampleScale;
-
-				if (i == 0)
-					passFrameBuffer->SetPixel(x, y, s);
-				else
-					passFrameBuffer->AddPixel(x, y, s);
+	unsigned int frameRayCount = 0;
+	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_RENDER);
+
+		for (unsigned int i = 0; i < samplePerPass; ++i) {
+			for (unsigned int y = 0; y < height; ++y) {
+				for (unsigned int x = 0; x < width; ++x) {
+					sampler->StartSample(x, y, frameCount * samplePerPass + i);
+					const float screenX = x + sampler->GetSample() - .5f;
+					const float screenY = y + sampler->GetSample() - .5f;
+
+					Spectrum s = SampleImage(*sampler, *accel, cameraCopy,
+							sphereRecords, screenX, screenY, frameRayCount) * sampleScale;
+
+					if (i == 0)
+						passFrameBuffer->SetPixel(x, y, s);
+					else
+						passFrameBuffer->AddPixel(x, y, s);
+				}
 			}
 		}
 	}
 
 	delete accel;
+	++frameCount;
+	rayCount += frameRayCount;
 
 	//--------------------------------------------------------------------------
 	// Apply a filter: approximated by applying a box filter multiple times
 	//--------------------------------------------------------------------------
 
-	ApplyFilter();
+	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_FILTER);
+		ApplyFilter(&filterRowSums[0]);
+	}
 
 	//--------------------------------------------------------------------------
-	// Blend the new frame with the old one
+	// Blend the new frame with the old one and tone mapping
 	//--------------------------------------------------------------------------
 
-	BlendFrame();
+	const float blendFactor = UpdateBlendFactor();
+	unsigned int pixelBufferIndex;
+	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_GL_UPLOAD);
+		pixelBufferIndex = pixelBuffers->Acquire();
+	}
+
+	{
+		// The last Y pass of the filter is fused with the blend and the tone mapping
+		ScopedStageTimer timer(profiler, FRAME_STAGE_BLEND_TONEMAP);
+		averageLuminance = PostProcess(0, height, blendFactor,
+				pixelBuffers->GetPixels(pixelBufferIndex), &filterRowSums[0]) / (width * height);
+	}
 
 	//--------------------------------------------------------------------------
-	// Tone mapping
+	// Copy the frame
 	//--------------------------------------------------------------------------
 
-	ApplyToneMapping();
-	CopyFrame();
-
+	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_GL_UPLOAD);
+		pixelBuffers->Draw(pixelBufferIndex);
+	}
 
 	return samplePerPass * width * height;
 }
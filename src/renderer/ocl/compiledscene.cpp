@@ -25,8 +25,8 @@
 
 CompiledScene::CompiledScene(const GameLevel *level) : gameLevel(level) {
 	accel = NULL;
-	totRGBTexMem = 0;
-	rgbTexMem = NULL;
+	totTexMem = 0;
+	texMem = NULL;
 
 	CompileTextureMaps();
 
@@ -38,7 +38,7 @@ CompiledScene::CompiledScene(const GameLevel *level) : gameLevel(level) {
 
 CompiledScene::~CompiledScene() {
 	delete accel;
-	delete[] rgbTexMem;
+	delete[] texMem;
 }
 
 void CompiledScene::CompileCamera() {
@@ -47,6 +47,7 @@ void CompiledScene::CompileCamera() {
 	camera.focalDistance = perpCamera.GetFocalDistance();
 	camera.yon = perpCamera.GetClipYon();
 	camera.hither = perpCamera.GetClipHither();
+	camera.pixelSpreadAngle = perpCamera.GetPixelSpreadAngle();
 	memcpy(camera.rasterToCameraMatrix, perpCamera.GetRasterToCameraMatrix().m, sizeof(float[4][4]));
 	memcpy(camera.cameraToWorldMatrix, perpCamera.GetCameraToWorldMatrix().m, sizeof(float[4][4]));
 }
@@ -232,9 +233,10 @@ void CompiledScene::CompileTextureMaps() {
 	Scene &scene(*(gameLevel->scene));
 
 	texMaps.resize(0);
+	texMapIds.resize(0);
 	sphereTexs.resize(0);
 	sphereBumps.resize(0);
-	delete[] rgbTexMem;
+	delete[] texMem;
 
 	//--------------------------------------------------------------------------
 	// Translate sphere texture maps
@@ -244,37 +246,39 @@ void CompiledScene::CompileTextureMaps() {
 
 	std::vector<TextureMap *> tms;
 	gameLevel->texMapCache->GetTexMaps(tms);
-	// Calculate the amount of ram to allocate
-	totRGBTexMem = 0;
+	// Calculate the amount of ram to allocate. Each texture map is aligned
+	// to 4 bytes so the texels can be read as half or uchar4.
+	totTexMem = 0;
 
 	for (unsigned int i = 0; i < tms.size(); ++i) {
 		TextureMap *tm = tms[i];
-		const unsigned int pixelCount = tm->GetWidth() * tm->GetHeight();
 
-		totRGBTexMem += pixelCount;
+		totTexMem += RoundUp<unsigned int>(tm->GetTexelsSize(), 4);
 	}
 
 	// Allocate texture map memory
-	if (totRGBTexMem > 0) {
+	if (totTexMem > 0) {
 		texMaps.resize(tms.size());
+		texMapIds.resize(tms.size());
 
-		if (totRGBTexMem > 0) {
-			unsigned int rgbOffset = 0;
-			rgbTexMem = new Spectrum[totRGBTexMem];
+		if (totTexMem > 0) {
+			unsigned int texelsOffset = 0;
+			texMem = new unsigned char[totTexMem];
 
 			for (unsigned int i = 0; i < tms.size(); ++i) {
 				TextureMap *tm = tms[i];
-				const unsigned int pixelCount = tm->GetWidth() * tm->GetHeight();
 
-				memcpy(&rgbTexMem[rgbOffset], tm->GetPixels(), pixelCount * sizeof(Spectrum));
-				texMaps[i].rgbOffset = rgbOffset;
+				memcpy(&texMem[texelsOffset], tm->GetTexels(), tm->GetTexelsSize());
+				texMaps[i].texelsOffset = texelsOffset;
 				texMaps[i].width = tm->GetWidth();
 				texMaps[i].height = tm->GetHeight();
+				texMaps[i].format = tm->GetFormat();
+				texMapIds[i] = tm->GetId();
 
-				rgbOffset += pixelCount;
+				texelsOffset += RoundUp<unsigned int>(tm->GetTexelsSize(), 4);
 			}
 		} else
-			rgbTexMem = NULL;
+			texMem = NULL;
 
 		//----------------------------------------------------------------------
 
@@ -346,7 +350,7 @@ void CompiledScene::CompileTextureMaps() {
 		texMaps.resize(0);
 		sphereTexs.resize(0);
 		sphereBumps.resize(0);
-		rgbTexMem = NULL;
+		texMem = NULL;
 	}
 
 	const double tEnd = WallClockTime();
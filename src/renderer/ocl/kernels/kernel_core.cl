@@ -25,6 +25,8 @@
 //  PARAM_RAY_EPSILON
 //  PARAM_MAX_DIFFUSE_BOUNCE
 //  PARAM_MAX_SPECULARGLOSSY_BOUNCE
+//  PARAM_RR_DEPTH
+//  PARAM_RR_CAP
 //  PARAM_IL_SHIFT_U
 //  PARAM_IL_SHIFT_V
 //  PARAM_IL_GAIN_R
@@ -32,6 +34,12 @@
 //  PARAM_IL_GAIN_B
 //  PARAM_IL_MAP_WIDTH
 //  PARAM_IL_MAP_HEIGHT
+//  PARAM_IL_MAP_FORMAT
+//  PARAM_IL_DISTRIBUTION_WIDTH
+//  PARAM_IL_DISTRIBUTION_HEIGHT
+//  PARAM_SAMPLER_SOBOL
+//  PARAM_SAMPLER_SOBOL_BLUENOISE
+//  PARAM_SAMPLER_SEED
 //  PARAM_ENABLE_MAT_MATTE
 //  PARAM_ENABLE_MAT_MIRROR
 //  PARAM_ENABLE_MAT_GLASS
@@ -96,15 +104,6 @@ typedef struct {
 
 //------------------------------------------------------------------------------
 
-typedef struct {
-	unsigned int s1, s2, s3;
-} Seed;
-
-typedef struct {
-	// The task seed
-	Seed seed;
-} GPUTask;
-
 typedef Spectrum Pixel;
 
 //------------------------------------------------------------------------------
@@ -113,6 +112,7 @@ typedef struct {
 	float lensRadius;
 	float focalDistance;
 	float yon, hither;
+	float pixelSpreadAngle;
 
 	float rasterToCameraMatrix[4][4];
 	float cameraToWorldMatrix[4][4];
@@ -120,9 +120,20 @@ typedef struct {
 
 //------------------------------------------------------------------------------
 
+// Same values of TextureMapFormat
+#define TEXMAP_RGBA8 0
+#define TEXMAP_RGB_HALF 1
+#define TEXMAP_GRADIENT_HALF 2
+
+// Same layout of TextureMap: square tiles and an extra row and column used
+// for the wrapping, followed by the levels of the mip pyramid
+#define TEXMAP_TILE_SIZE 4
+#define TEXMAP_MAX_LEVELS 16
+
 typedef struct {
-	unsigned int rgbOffset;
+	unsigned int texelsOffset;
 	unsigned int width, height;
+	unsigned int format;
 } TexMap;
 
 typedef struct {
@@ -188,42 +199,177 @@ typedef struct {
 
 //------------------------------------------------------------------------------
 // Random number generator
-// maximally equidistributed combined Tausworthe generator
+// Philox4x32-10 counter-based generator, same as the CPU one (see
+// utils/randomgen.h)
 //------------------------------------------------------------------------------
 
-#define FLOATMASK 0x00ffffffu
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+void Philox4x32(const uint c0, const uint c1, const uint c2, const uint c3,
+		const uint key0, const uint key1, uint *result) {
+	uint x0 = c0;
+	uint x1 = c1;
+	uint x2 = c2;
+	uint x3 = c3;
+	uint k0 = key0;
+	uint k1 = key1;
+
+	for (uint i = 0; i < 10; ++i) {
+		const uint hi0 = mul_hi(PHILOX_M0, x0);
+		const uint lo0 = PHILOX_M0 * x0;
+		const uint hi1 = mul_hi(PHILOX_M1, x2);
+		const uint lo1 = PHILOX_M1 * x2;
+
+		x0 = hi1 ^ x1 ^ k0;
+		x1 = lo1;
+		x2 = hi0 ^ x3 ^ k1;
+		x3 = lo0;
+
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	result[0] = x0;
+	result[1] = x1;
+	result[2] = x2;
+	result[3] = x3;
+}
 
-uint TAUSWORTHE(const uint s, const uint a,
-	const uint b, const uint c,
-	const uint d) {
-	return ((s&c)<<d) ^ (((s << a) ^ s) >> b);
+float UIntToFloat(const uint x) {
+	return (x >> 8) * (1.f / 16777216.f);
 }
 
-uint LCG(const uint x) { return x * 69069; }
+//------------------------------------------------------------------------------
+// Samplers
+//
+// Same dimension layout of the CPU samplers (see utils/sampler.h): 0 and 1 for
+// the pixel jitter, 2 and 3 for the lens and then SAMPLER_BOUNCE_DIMENSION_COUNT
+// dimensions for each bounce of the path (the material sampling first, the
+// light sampling at SAMPLER_BOUNCE_LIGHT_OFFSET and the Russian roulette at
+// SAMPLER_BOUNCE_RR_OFFSET).
+//------------------------------------------------------------------------------
+
+#define SAMPLER_BOUNCE_DIMENSION_OFFSET 4
+#define SAMPLER_BOUNCE_DIMENSION_COUNT 8
+#define SAMPLER_BOUNCE_BSDF_OFFSET 0
+#define SAMPLER_BOUNCE_LIGHT_OFFSET 4
+#define SAMPLER_BOUNCE_RR_OFFSET 6
 
-uint ValidSeed(const uint x, const uint m) {
-	return (x < m) ? (x + m) : x;
+typedef struct {
+	uint sampleIndex;
+#if defined(PARAM_SAMPLER_SOBOL)
+	uint pixelSeed;
+#if defined(PARAM_SAMPLER_SOBOL_BLUENOISE)
+	float dither;
+#endif
+#else
+	uint pixel;
+	uint block;
+	uint values[4];
+#endif
+	uint dimension;
+} Sampler;
+
+#if defined(PARAM_SAMPLER_SOBOL)
+
+uint SamplerHash(uint x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+
+	return x;
 }
 
-void InitRandomGenerator(uint seed, Seed *s) {
-	// Avoid 0 value
-	seed = (seed == 0) ? (seed + 0xffffffu) : seed;
+uint ReverseBits(uint x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
 
-	s->s1 = ValidSeed(LCG(seed), 1);
-	s->s2 = ValidSeed(LCG(s->s1), 7);
-	s->s3 = ValidSeed(LCG(s->s2), 15);
+	return x;
 }
 
-unsigned long RndUintValue(Seed *s) {
-	s->s1 = TAUSWORTHE(s->s1, 13, 19, 4294967294UL, 12);
-	s->s2 = TAUSWORTHE(s->s2, 2, 25, 4294967288UL, 4);
-	s->s3 = TAUSWORTHE(s->s3, 3, 11, 4294967280UL, 17);
+uint NestedUniformScramble(uint x, const uint seed) {
+	x = ReverseBits(x);
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
 
-	return ((s->s1) ^ (s->s2) ^ (s->s3));
+	return ReverseBits(x);
 }
 
-float RndFloatValue(Seed *s) {
-	return (RndUintValue(s) & FLOATMASK) * (1.f / (FLOATMASK + 1UL));
+uint Sobol02(uint index, const uint dim) {
+	if (dim == 0)
+		return ReverseBits(index);
+
+	uint result = 0;
+	for (uint v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+		if (index & 1u)
+			result ^= v;
+	}
+
+	return result;
+}
+
+#endif
+
+void Sampler_Init(Sampler *sampler, const uint x, const uint y, const uint sampleIndex) {
+	sampler->dimension = 0;
+
+	sampler->sampleIndex = sampleIndex;
+#if defined(PARAM_SAMPLER_SOBOL)
+#if defined(PARAM_SAMPLER_SOBOL_BLUENOISE)
+	sampler->pixelSeed = SamplerHash(PARAM_SAMPLER_SEED);
+	// R2 sequence dither, in 0.32 fixed point to wrap around for free
+	sampler->dither = UIntToFloat(x * 3242174889u + y * 2447445414u);
+#else
+	sampler->pixelSeed = SamplerHash(SamplerHash(PARAM_SAMPLER_SEED) ^ SamplerHash(x ^ SamplerHash(y)));
+#endif
+#else
+	sampler->pixel = x | (y << 16);
+	sampler->block = 0xffffffffu;
+#endif
+}
+
+void Sampler_StartBounce(Sampler *sampler, const uint depth, const uint offset) {
+	sampler->dimension = SAMPLER_BOUNCE_DIMENSION_OFFSET + depth * SAMPLER_BOUNCE_DIMENSION_COUNT + offset;
+}
+
+float Sampler_GetSample(Sampler *sampler) {
+	const uint d = sampler->dimension++;
+
+#if defined(PARAM_SAMPLER_SOBOL)
+	const uint pairSeed = SamplerHash(sampler->pixelSeed ^ (d >> 1));
+	const uint index = NestedUniformScramble(sampler->sampleIndex, pairSeed);
+	const uint v = NestedUniformScramble(Sobol02(index, d & 1u),
+			SamplerHash(pairSeed ^ (d + 1)));
+
+	float u = UIntToFloat(v);
+#if defined(PARAM_SAMPLER_SOBOL_BLUENOISE)
+	u += sampler->dither + d * 0.6180339887f;
+	u -= floor(u);
+	u = fmin(u, 0.99999994f);
+#endif
+
+	return u;
+#else
+	// The 4 dimensions of a block are generated at once
+	if ((d >> 2) != sampler->block) {
+		sampler->block = d >> 2;
+		Philox4x32(sampler->pixel, sampler->sampleIndex, sampler->block, 0,
+				PARAM_SAMPLER_SEED, 0, sampler->values);
+	}
+
+	return UIntToFloat(sampler->values[d & 3u]);
+#endif
 }
 
 //------------------------------------------------------------------------------
@@ -350,6 +496,43 @@ void CoordinateSystem(const Vector *v1, Vector *v2, Vector *v3) {
 	Cross(v3, v1, v2);
 }
 
+#if defined(PARAM_FAST_SPHERICAL_MATH)
+
+// Same polynomial approximations of FastAcos() and FastAtan2()
+
+float SphericalTheta(const Vector *v) {
+	const float z = v->z;
+	const float az = min(fabs(z), 1.f);
+	const float r = sqrt(1.f - az) * (((((((-0.0012624911f * az + 0.0066700901f) * az -
+			0.0170881256f) * az + 0.0308918810f) * az - 0.0501743046f) * az +
+			0.0889789874f) * az - 0.2145988016f) * az + 1.5707963050f);
+
+	return (z < 0.f) ? M_PI - r : r;
+}
+
+float SphericalPhi(const Vector *v) {
+	const float ax = fabs(v->x);
+	const float ay = fabs(v->y);
+	const float maxA = max(ax, ay);
+	if (maxA == 0.f)
+		return 0.f;
+
+	const float a = min(ax, ay) / maxA;
+	const float s = a * a;
+	float r = (((((-0.01172120f * s + 0.05265332f) * s - 0.11643287f) * s +
+			0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;
+
+	if (ay > ax)
+		r = M_PI * .5f - r;
+	if (v->x < 0.f)
+		r = M_PI - r;
+
+	// [0, 2 * M_PI)
+	return (v->y < 0.f) ? 2.f * M_PI - r : r;
+}
+
+#else
+
 float SphericalTheta(const Vector *v) {
 	return acos(clamp(v->z, -1.f, 1.f));
 }
@@ -359,23 +542,67 @@ float SphericalPhi(const Vector *v) {
 	return (p < 0.f) ? p + 2.f * M_PI : p;
 }
 
+#endif
+
 //------------------------------------------------------------------------------
 // Texture maps
 //------------------------------------------------------------------------------
 
-void TexMap_GetTexel(__global Spectrum *pixels, const uint width, const uint height,
-		const int s, const int t, Spectrum *col) {
-	const uint u = Mod(s, width);
-	const uint v = Mod(t, height);
+uint TexMap_GetTexelIndex(const uint width, const uint x, const uint y) {
+	const uint tileCountX = width / TEXMAP_TILE_SIZE + 1;
+	const uint tileIndex = (y / TEXMAP_TILE_SIZE) * tileCountX + x / TEXMAP_TILE_SIZE;
 
-	const unsigned index = v * width + u;
+	return tileIndex * (TEXMAP_TILE_SIZE * TEXMAP_TILE_SIZE) +
+			(y % TEXMAP_TILE_SIZE) * TEXMAP_TILE_SIZE + x % TEXMAP_TILE_SIZE;
+}
 
-	col->r = pixels[index].r;
-	col->g = pixels[index].g;
-	col->b = pixels[index].b;
+void TexMap_GetTexel(__global uchar *texels, const uint format,
+		const uint index, Spectrum *col) {
+	switch (format) {
+		case TEXMAP_RGBA8: {
+			__global uchar *texel = &texels[index * 4];
+			col->r = texel[0] * (1.f / 255.f);
+			col->g = texel[1] * (1.f / 255.f);
+			col->b = texel[2] * (1.f / 255.f);
+			break;
+		}
+		case TEXMAP_RGB_HALF: {
+			__global half *texel = (__global half *)texels;
+			col->r = vload_half(index * 3, texel);
+			col->g = vload_half(index * 3 + 1, texel);
+			col->b = vload_half(index * 3 + 2, texel);
+			break;
+		}
+		case TEXMAP_GRADIENT_HALF: {
+			__global half *texel = (__global half *)texels;
+			col->r = vload_half(index * 2, texel);
+			col->g = vload_half(index * 2 + 1, texel);
+			col->b = 0.f;
+			break;
+		}
+		default:
+			col->r = 0.f;
+			col->g = 0.f;
+			col->b = 0.f;
+			break;
+	}
 }
 
-void TexMap_GetColor(__global Spectrum *pixels, const uint width, const uint height,
+uint TexMap_GetTexelSize(const uint format) {
+	switch (format) {
+		case TEXMAP_RGBA8:
+			return 4;
+		case TEXMAP_RGB_HALF:
+			return 3 * 2;
+		case TEXMAP_GRADIENT_HALF:
+			return 2 * 2;
+		default:
+			return 0;
+	}
+}
+
+void TexMap_GetLevelColor(__global uchar *texels, const uint format,
+		const uint width, const uint height,
 		const float u, const float v, Spectrum *col) {
 	const float s = u * width - 0.5f;
 	const float t = v * height - 0.5f;
@@ -389,11 +616,15 @@ void TexMap_GetColor(__global Spectrum *pixels, const uint width, const uint hei
 	const float ids = 1.f - ds;
 	const float idt = 1.f - dt;
 
+	// The padding takes care of the wrapping of x0 + 1 and y0 + 1
+	const uint x0 = Mod(s0, width);
+	const uint y0 = Mod(t0, height);
+
 	Spectrum c0, c1, c2, c3;
-	TexMap_GetTexel(pixels, width, height, s0, t0, &c0);
-	TexMap_GetTexel(pixels, width, height, s0, t0 + 1, &c1);
-	TexMap_GetTexel(pixels, width, height, s0 + 1, t0, &c2);
-	TexMap_GetTexel(pixels, width, height, s0 + 1, t0 + 1, &c3);
+	TexMap_GetTexel(texels, format, TexMap_GetTexelIndex(width, x0, y0), &c0);
+	TexMap_GetTexel(texels, format, TexMap_GetTexelIndex(width, x0, y0 + 1), &c1);
+	TexMap_GetTexel(texels, format, TexMap_GetTexelIndex(width, x0 + 1, y0), &c2);
+	TexMap_GetTexel(texels, format, TexMap_GetTexelIndex(width, x0 + 1, y0 + 1), &c3);
 
 	const float k0 = ids * idt;
 	const float k1 = ids * dt;
@@ -405,32 +636,146 @@ void TexMap_GetColor(__global Spectrum *pixels, const uint width, const uint hei
 	col->b = k0 * c0.b + k1 * c1.b + k2 * c2.b + k3 * c3.b;
 }
 
+// The levels of the mip pyramid are stored one after the other (see
+// TextureMap::BuildLevels()), footprintV is the size of the footprint along v
+// in the [0, 1] texture space
+void TexMap_GetColor(__global uchar *texels, const uint format,
+		const uint width, const uint height,
+		const float u, const float v, const float footprintV, Spectrum *col) {
+	const float lod = log2(footprintV * height);
+
+	// Look for the first level to use
+	const uint texelSize = TexMap_GetTexelSize(format);
+	uint level = 0;
+	uint w = width;
+	uint h = height;
+	uint offset = 0;
+	while ((level + 1 < lod) && (level + 1 < TEXMAP_MAX_LEVELS) && ((w > 1) || (h > 1))) {
+		offset += (w / TEXMAP_TILE_SIZE + 1) * (h / TEXMAP_TILE_SIZE + 1) * (TEXMAP_TILE_SIZE * TEXMAP_TILE_SIZE);
+		w = max(1u, w / 2);
+		h = max(1u, h / 2);
+		++level;
+	}
+
+	TexMap_GetLevelColor(&texels[offset * texelSize], format, w, h, u, v, col);
+
+	const float k = lod - level;
+	if ((k > 0.f) && (level + 1 < TEXMAP_MAX_LEVELS) && ((w > 1) || (h > 1))) {
+		// Blend with the next level
+		offset += (w / TEXMAP_TILE_SIZE + 1) * (h / TEXMAP_TILE_SIZE + 1) * (TEXMAP_TILE_SIZE * TEXMAP_TILE_SIZE);
+		w = max(1u, w / 2);
+		h = max(1u, h / 2);
+
+		Spectrum col1;
+		TexMap_GetLevelColor(&texels[offset * texelSize], format, w, h, u, v, &col1);
+
+		const float k1 = min(k, 1.f);
+		const float k0 = 1.f - k1;
+		col->r = k0 * col->r + k1 * col1.r;
+		col->g = k0 * col->g + k1 * col1.g;
+		col->b = k0 * col->b + k1 * col1.b;
+	}
+}
+
 //------------------------------------------------------------------------------
 // InfiniteLight_Le
 //------------------------------------------------------------------------------
 
-void InfiniteLight_Le(__global Spectrum *infiniteLightMap, Spectrum *le, const Vector *dir) {
+// The footprint is the angle covered by the ray
+void InfiniteLight_Le(__global uchar *infiniteLightMap, Spectrum *le, const Vector *dir,
+		const float footprint) {
 	const float u = 1.f - SphericalPhi(dir) * INV_TWOPI +  PARAM_IL_SHIFT_U;
 	const float v = SphericalTheta(dir) * INV_PI + PARAM_IL_SHIFT_V;
 
-	TexMap_GetColor(infiniteLightMap, PARAM_IL_MAP_WIDTH, PARAM_IL_MAP_HEIGHT, u, v, le);
+	TexMap_GetColor(infiniteLightMap, PARAM_IL_MAP_FORMAT, PARAM_IL_MAP_WIDTH, PARAM_IL_MAP_HEIGHT,
+			u, v, footprint * INV_PI, le);
 
 	le->r *= PARAM_IL_GAIN_R;
 	le->g *= PARAM_IL_GAIN_G;
 	le->b *= PARAM_IL_GAIN_B;
 }
 
+// The luminance distribution has the same layout of the CPU one (see
+// InfiniteLight::GetDistribution())
+
+uint InfiniteLight_SampleCDF(__global float *cdf, const uint count, const float u, float *du) {
+	// Look for the last entry <= u
+	uint first = 0;
+	uint last = count;
+	while (first + 1 < last) {
+		const uint middle = (first + last) >> 1;
+		if (cdf[middle] <= u)
+			first = middle;
+		else
+			last = middle;
+	}
+
+	const float width = cdf[first + 1] - cdf[first];
+	*du = (width > 0.f) ? clamp((u - cdf[first]) / width, 0.f, 1.f) : 0.f;
+
+	return first;
+}
+
+void InfiniteLight_Sample_L(__global uchar *infiniteLightMap, __global float *infiniteLightDistribution,
+		const float u0, const float u1, Vector *dir, float *pdf, Spectrum *le) {
+	const uint w = PARAM_IL_DISTRIBUTION_WIDTH;
+	const uint h = PARAM_IL_DISTRIBUTION_HEIGHT;
+
+	float dv;
+	const uint y = InfiniteLight_SampleCDF(infiniteLightDistribution, h, u1, &dv);
+	float du;
+	const uint x = InfiniteLight_SampleCDF(&infiniteLightDistribution[(h + 1) + y * (w + 1)], w, u0, &du);
+
+	const float cellPdf = infiniteLightDistribution[(h + 1) + h * (w + 1) + x + y * w];
+	const float theta = M_PI * (y + dv) / h;
+	const float sinTheta = sin(theta);
+	if ((cellPdf <= 0.f) || (sinTheta <= 0.f)) {
+		*pdf = 0.f;
+		return;
+	}
+
+	const float phi = 2.f * M_PI * (x + du) / w;
+	dir->x = sinTheta * cos(phi);
+	dir->y = sinTheta * sin(phi);
+	dir->z = cos(theta);
+	*pdf = cellPdf / (2.f * M_PI * M_PI * sinTheta);
+
+	InfiniteLight_Le(infiniteLightMap, le, dir, 0.f);
+}
+
+float InfiniteLight_Pdf(__global float *infiniteLightDistribution, const Vector *dir) {
+	const uint w = PARAM_IL_DISTRIBUTION_WIDTH;
+	const uint h = PARAM_IL_DISTRIBUTION_HEIGHT;
+
+	const float theta = SphericalTheta(dir);
+	const float sinTheta = sin(theta);
+	if (sinTheta <= 0.f)
+		return 0.f;
+
+	const uint x = min((uint)(SphericalPhi(dir) * INV_TWOPI * w), w - 1);
+	const uint y = min((uint)(theta * INV_PI * h), h - 1);
+
+	return infiniteLightDistribution[(h + 1) + h * (w + 1) + x + y * w] / (2.f * M_PI * M_PI * sinTheta);
+}
+
+float PowerHeuristic(const float fPdf, const float gPdf) {
+	const float f2 = fPdf * fPdf;
+	const float g2 = gPdf * gPdf;
+
+	return f2 / (f2 + g2);
+}
+
 //------------------------------------------------------------------------------
 // GenerateCameraRay
 //------------------------------------------------------------------------------
 
 void GenerateCameraRay(
-		Seed *seed,
+		Sampler *sampler,
 		PARAM_MEM_TYPE Camera *camera,
 		const uint pixelIndex,
 		Ray *ray) {
-	const float scrSampleX = RndFloatValue(seed);
-	const float scrSampleY = RndFloatValue(seed);
+	const float scrSampleX = Sampler_GetSample(sampler);
+	const float scrSampleY = Sampler_GetSample(sampler);
 
 	const float screenX = pixelIndex % PARAM_SCREEN_WIDTH + scrSampleX - .5f;
 	const float screenY = pixelIndex / PARAM_SCREEN_WIDTH + scrSampleY - .5f;
@@ -541,16 +886,37 @@ bool BVH_Intersect(
 	return (*primitiveIndex) != 0xffffffffu;
 }
 
+bool BVH_IntersectP(
+		const Ray *ray,
+		PARAM_MEM_TYPE BVHAccelArrayNode *bvhTree) {
+	unsigned int currentNode = 0; // Root Node
+	unsigned int stopNode = bvhTree[0].skipIndex; // Non-existent
+
+	while (currentNode < stopNode) {
+		float hitT;
+		if (Sphere_IntersectP(&bvhTree[currentNode], ray, &hitT)) {
+			// Stop at the first intersection found
+			if ((bvhTree[currentNode].primitiveIndex != 0xffffffffu) && (hitT < ray->maxt))
+				return true;
+
+			currentNode++;
+		} else
+			currentNode = bvhTree[currentNode].skipIndex;
+	}
+
+	return false;
+}
+
 //------------------------------------------------------------------------------
 // Materials
 //------------------------------------------------------------------------------
 
 void Matte_Sample_f(const PARAM_MEM_TYPE MatteParam *mat, const Vector *wo, Vector *wi,
 		float *pdf, Spectrum *f, const Vector *shadeN,
-		Seed *seed,
+		Sampler *sampler,
 		bool *diffuseBounce) {
 	Vector dir;
-	CosineSampleHemisphere(&dir, RndFloatValue(seed), RndFloatValue(seed));
+	CosineSampleHemisphere(&dir, Sampler_GetSample(sampler), Sampler_GetSample(sampler));
 	const float dp = dir.z;
 	// Using 0.0001 instead of 0.0 to cut down fireflies
 	if (dp <= 0.0001f) {
@@ -558,7 +924,7 @@ void Matte_Sample_f(const PARAM_MEM_TYPE MatteParam *mat, const Vector *wo, Vect
 		return;
 	}
 
-	*pdf = INV_PI;
+	*pdf = dp * INV_PI;
 
 	Vector v1, v2;
 	CoordinateSystem(shadeN, &v1, &v2);
@@ -574,6 +940,22 @@ void Matte_Sample_f(const PARAM_MEM_TYPE MatteParam *mat, const Vector *wo, Vect
 	*diffuseBounce = true;
 }
 
+void Matte_Evaluate(const PARAM_MEM_TYPE MatteParam *mat, const Vector *wi,
+		float *pdf, Spectrum *f, const Vector *shadeN) {
+	const float dp = Dot(shadeN, wi);
+	if (dp <= 0.0001f) {
+		*pdf = 0.f;
+		return;
+	}
+
+	*pdf = dp * INV_PI;
+
+	const float k = dp * (*pdf);
+	f->r = mat->r * k;
+	f->g = mat->g * k;
+	f->b = mat->b * k;
+}
+
 void Mirror_Sample_f(const PARAM_MEM_TYPE MirrorParam *mat, const Vector *wo, Vector *wi,
 		float *pdf, Spectrum *f, const Vector *shadeN,
 		bool *diffuseBounce) {
@@ -593,7 +975,7 @@ void Mirror_Sample_f(const PARAM_MEM_TYPE MirrorParam *mat, const Vector *wo, Ve
 
 void Glass_Sample_f(const PARAM_MEM_TYPE GlassParam *mat,
     const Vector *wo, Vector *wi, float *pdf, Spectrum *f, const Vector *N, const Vector *shadeN,
-    Seed *seed,
+    Sampler *sampler,
 	bool *diffuseBounce) {
     Vector reflDir;
     const float k = 2.f * Dot(N, wo);
@@ -658,7 +1040,7 @@ void Glass_Sample_f(const PARAM_MEM_TYPE GlassParam *mat,
             f->r = mat->refrct_r;
             f->g = mat->refrct_g;
             f->b = mat->refrct_b;
-        } else if (RndFloatValue(seed) < P) {
+        } else if (Sampler_GetSample(sampler) < P) {
             *wi = reflDir;
             *pdf = P / Re;
 
@@ -711,11 +1093,27 @@ void GlossyReflection(const Vector *wo, Vector *wi, const float exponent,
     wi->z = x * u.z + y * v.z + z * w.z;
 }
 
+float GlossyReflectionPdf(const Vector *wo, const float exponent,
+		const Vector *shadeN, const Vector *wi) {
+	Vector w;
+	const float RdotShadeN = Dot(shadeN, wo);
+	w.x = (2.f * RdotShadeN) * shadeN->x - wo->x;
+	w.y = (2.f * RdotShadeN) * shadeN->y - wo->y;
+	w.z = (2.f * RdotShadeN) * shadeN->z - wo->z;
+
+	const float cosAlpha = Dot(&w, wi);
+	if (cosAlpha <= 0.f)
+		return 0.f;
+
+	// exponent is 1 / (n + 1) of the Phong lobe
+	return INV_TWOPI / exponent * pow(cosAlpha, 1.f / exponent - 1.f);
+}
+
 void Metal_Sample_f(const PARAM_MEM_TYPE MetalParam *mat, const Vector *wo, Vector *wi,
 		float *pdf, Spectrum *f, const Vector *shadeN,
-		Seed *seed,
+		Sampler *sampler,
 		bool *diffuseBounce) {
-	GlossyReflection(wo, wi, mat->exponent, shadeN, RndFloatValue(seed), RndFloatValue(seed));
+	GlossyReflection(wo, wi, mat->exponent, shadeN, Sampler_GetSample(sampler), Sampler_GetSample(sampler));
 
 	f->r = mat->r;
 	f->g = mat->g;
@@ -723,12 +1121,26 @@ void Metal_Sample_f(const PARAM_MEM_TYPE MetalParam *mat, const Vector *wo, Vect
 
 	*diffuseBounce = true;
 
-	*pdf =  (Dot(wi, shadeN) > 0.f) ? 1.f : 0.f;
+	*pdf =  (Dot(wi, shadeN) > 0.f) ? GlossyReflectionPdf(wo, mat->exponent, shadeN, wi) : 0.f;
+}
+
+void Metal_Evaluate(const PARAM_MEM_TYPE MetalParam *mat, const Vector *wo, const Vector *wi,
+		float *pdf, Spectrum *f, const Vector *shadeN) {
+	if (Dot(wi, shadeN) <= 0.f) {
+		*pdf = 0.f;
+		return;
+	}
+
+	*pdf = GlossyReflectionPdf(wo, mat->exponent, shadeN, wi);
+
+	f->r = mat->r * (*pdf);
+	f->g = mat->g * (*pdf);
+	f->b = mat->b * (*pdf);
 }
 
 void Alloy_Sample_f(const PARAM_MEM_TYPE AlloyParam *mat, const Vector *wo, Vector *wi,
 		float *pdf, Spectrum *f, const Vector *shadeN,
-		Seed *seed,
+		Sampler *sampler,
 		bool *diffuseBounce) {
     // Schilick's approximation
     const float c = 1.f - Dot(wo, shadeN);
@@ -737,16 +1149,20 @@ void Alloy_Sample_f(const PARAM_MEM_TYPE AlloyParam *mat, const Vector *wo, Vect
 
     const float P = .25f + .5f * Re;
 
-	const float u0 = RndFloatValue(seed);
-	const float u1 = RndFloatValue(seed);
+	const float u0 = Sampler_GetSample(sampler);
+	const float u1 = Sampler_GetSample(sampler);
 
-    if (RndFloatValue(seed) <= P) {
+    if (Sampler_GetSample(sampler) <= P) {
         GlossyReflection(wo, wi, mat->exponent, shadeN, u0, u1);
-        *pdf = P / Re;
 
-        f->r = mat->refl_r / (*pdf);
-        f->g = mat->refl_g / (*pdf);
-        f->b = mat->refl_b / (*pdf);
+		// The pdf of both lobes is required by multiple importance sampling
+		const float dp = max(0.f, Dot(wi, shadeN));
+		*pdf = P * GlossyReflectionPdf(wo, mat->exponent, shadeN, wi) + (1.f - P) * dp * INV_PI;
+
+		const float k = Re / P;
+        f->r = mat->refl_r * k;
+        f->g = mat->refl_g * k;
+        f->b = mat->refl_b * k;
 
 		*diffuseBounce = true;
     } else {
@@ -759,8 +1175,6 @@ void Alloy_Sample_f(const PARAM_MEM_TYPE AlloyParam *mat, const Vector *wo, Vect
 			return;
 		}
 
-        *pdf = INV_PI;
-
         Vector v1, v2;
         CoordinateSystem(shadeN, &v1, &v2);
 
@@ -768,9 +1182,10 @@ void Alloy_Sample_f(const PARAM_MEM_TYPE AlloyParam *mat, const Vector *wo, Vect
         wi->y = v1.y * dir.x + v2.y * dir.y + shadeN->y * dir.z;
         wi->z = v1.z * dir.x + v2.z * dir.y + shadeN->z * dir.z;
 
+		*pdf = P * GlossyReflectionPdf(wo, mat->exponent, shadeN, wi) + (1.f - P) * dp * INV_PI;
+
 		const float iRe = 1.f - Re;
 		const float k = (1.f - P) / iRe;
-		*pdf *= k;
 
 		const float dpk = dp / k;
 		f->r = mat->diff_r * dpk;
@@ -781,28 +1196,56 @@ void Alloy_Sample_f(const PARAM_MEM_TYPE AlloyParam *mat, const Vector *wo, Vect
 	}
 }
 
-//------------------------------------------------------------------------------
-// Init Kernel
-//------------------------------------------------------------------------------
+void Alloy_Evaluate(const PARAM_MEM_TYPE AlloyParam *mat, const Vector *wo, const Vector *wi,
+		float *pdf, Spectrum *f, const Vector *shadeN) {
+    // Schilick's approximation
+    const float c = 1.f - Dot(wo, shadeN);
+    const float R0 = mat->R0;
+    const float Re = R0 + (1.f - R0) * c * c * c * c * c;
 
-__kernel void Init(
-		__global GPUTask *tasks
-		) {
-	const size_t gid = get_global_id(0);
-	if (gid >= PARAM_SCREEN_WIDTH * PARAM_SCREEN_HEIGHT)
-		return;
+    const float P = .25f + .5f * Re;
 
-	// Initialize the task
-	__global GPUTask *task = &tasks[gid];
+	const float glossyPdf = GlossyReflectionPdf(wo, mat->exponent, shadeN, wi);
+	float dp = Dot(wi, shadeN);
+	// Same cut of Alloy_Sample_f() for the diffuse lobe
+	if (dp <= 0.0001f)
+		dp = 0.f;
+	const float diffusePdf = dp * INV_PI;
 
-	// Initialize random number generator
-	Seed seed;
-	InitRandomGenerator(gid + 1, &seed);
+	*pdf = P * glossyPdf + (1.f - P) * diffusePdf;
 
-	// Save the seed
-	task->seed.s1 = seed.s1;
-	task->seed.s2 = seed.s2;
-	task->seed.s3 = seed.s3;
+	const float kr = Re * glossyPdf;
+	const float kd = (1.f - Re) * dp * diffusePdf;
+	f->r = mat->refl_r * kr + mat->diff_r * kd;
+	f->g = mat->refl_g * kr + mat->diff_g * kd;
+	f->b = mat->refl_b * kr + mat->diff_b * kd;
+}
+
+// Returns the value, for the direction wi, of the function sampled by the
+// Sample_f() of the material, used for next event estimation
+void Material_Evaluate(const PARAM_MEM_TYPE Material *mat, const Vector *wo, const Vector *wi,
+		float *pdf, Spectrum *f, const Vector *shadeN) {
+	switch (mat->type) {
+#if defined(PARAM_ENABLE_MAT_MATTE)
+		case MAT_MATTE:
+			Matte_Evaluate(&mat->param.matte, wi, pdf, f, shadeN);
+			break;
+#endif
+#if defined(PARAM_ENABLE_MAT_METAL)
+		case MAT_METAL:
+			Metal_Evaluate(&mat->param.metal, wo, wi, pdf, f, shadeN);
+			break;
+#endif
+#if defined(PARAM_ENABLE_MAT_ALLOY)
+		case MAT_ALLOY:
+			Alloy_Evaluate(&mat->param.alloy, wo, wi, pdf, f, shadeN);
+			break;
+#endif
+		default:
+			// Mirror and glass are specular
+			*pdf = 0.f;
+			break;
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -827,34 +1270,34 @@ __kernel void InitFB(
 //------------------------------------------------------------------------------
 
 __kernel void PathTracing(
-		__global GPUTask *tasks,
 		PARAM_MEM_TYPE BVHAccelArrayNode *bvhRoot,
 		PARAM_MEM_TYPE Camera *camera,
-		__global Spectrum *infiniteLightMap,
+		__global uchar *infiniteLightMap,
+		__global float *infiniteLightDistribution,
 		__global Pixel *frameBuffer,
 		PARAM_MEM_TYPE Material *mats,
 		__global uint *sphereMats
 #if defined(PARAM_HAS_TEXTUREMAPS)
 		, PARAM_MEM_TYPE TexMap *texMaps
-		, __global Spectrum *texMapRGB
+		, __global uchar *texMapTexels
 		, PARAM_MEM_TYPE TexMapInstance *sphereTexMaps
 #if defined (PARAM_HAS_BUMPMAPS)
 		, PARAM_MEM_TYPE BumpMapInstance *sphereBumpMaps
 #endif
 #endif
+#if defined(PARAM_COUNT_RAYS)
+		, __global uint *rayCounts
+#endif
+		, const uint sampleIndex
 		) {
 	const size_t gid = get_global_id(0);
 	if (gid >= PARAM_SCREEN_WIDTH * PARAM_SCREEN_HEIGHT)
 		return;
 
-	__global GPUTask *task = &tasks[gid];
 	const uint pixelIndex = gid;
 
-	// Read the seed
-	Seed seed;
-	seed.s1 = task->seed.s1;
-	seed.s2 = task->seed.s2;
-	seed.s3 = task->seed.s3;
+	Sampler sampler;
+	Sampler_Init(&sampler, pixelIndex % PARAM_SCREEN_WIDTH, pixelIndex / PARAM_SCREEN_WIDTH, sampleIndex);
 
 	Spectrum radiance;
 	radiance.r = 0.f;
@@ -862,7 +1305,7 @@ __kernel void PathTracing(
 	radiance.b = 0.f;
 
 	Ray ray;
-	GenerateCameraRay(&seed, camera, pixelIndex, &ray);
+	GenerateCameraRay(&sampler, camera, pixelIndex, &ray);
 
 	Spectrum throughput;
 	throughput.r = 1.f;
@@ -872,9 +1315,26 @@ __kernel void PathTracing(
 	uint diffuseBounces = 0;
 	uint specularGlossyBounces = 0;
 
+	// Used to weight the infinite light hit by a path with the next event
+	// estimation done at the previous vertex
+	bool lastSpecular = true;
+	float lastPdf = 0.f;
+
+	// A ray cone used to select the level of detail of the texture maps, its
+	// spread is the one of a camera pixel along the whole path
+	const float coneSpread = camera->pixelSpreadAngle;
+	float coneWidth = 0.f;
+
+#if defined(PARAM_COUNT_RAYS)
+	uint rayCount = 0;
+#endif
+
 	for(;;) {
 		PARAM_MEM_TYPE Sphere *hitSphere;
 		uint sphereIndex;
+#if defined(PARAM_COUNT_RAYS)
+		++rayCount;
+#endif
 		if (BVH_Intersect(&ray, &hitSphere, &sphereIndex, bvhRoot)) {
 			const PARAM_MEM_TYPE Material *hitPointMat = &mats[sphereMats[sphereIndex]];
 #if defined(PARAM_HAS_TEXTUREMAPS)
@@ -895,6 +1355,10 @@ __kernel void PathTracing(
 			N.z = hitPoint.z - hitSphere->center.z;
 			Normalize(&N);
 
+			// The angle covered by the cone on the sphere
+			coneWidth += coneSpread * ray.maxt;
+			const float footprint = coneWidth / hitSphere->rad;
+
 			Vector shadeN = N;
 
 #if defined (PARAM_HAS_BUMPMAPS)
@@ -903,29 +1367,16 @@ __kernel void PathTracing(
 				const float u0 = SphericalPhi(&N) * INV_TWOPI * hitBumpMapInst->scaleU + hitBumpMapInst->shiftU;
 				const float v0 = SphericalTheta(&N) * INV_PI * hitBumpMapInst->scaleV + hitBumpMapInst->shiftV;
 
+				// A gradient map (see TextureMap)
 				const PARAM_MEM_TYPE TexMap *tm = &texMaps[bumpMapIndex];
-				const unsigned int width = tm->width;
-				const unsigned int height = tm->height;
-
-				const float du = 1.f / width;
-				const float dv = 1.f / height;
-
-				Spectrum col0;
-				TexMap_GetColor(&texMapRGB[tm->rgbOffset], width, height, u0, v0, &col0);
-				const float b0 = Spectrum_Filter(&col0);
-
-				Spectrum colu;
-				TexMap_GetColor(&texMapRGB[tm->rgbOffset], width, height, u0 + du, v0, &colu);
-				const float bu = Spectrum_Filter(&colu);
-
-				Spectrum colv;
-				TexMap_GetColor(&texMapRGB[tm->rgbOffset], width, height, u0, v0 + dv, &colv);
-				const float bv = Spectrum_Filter(&colv);
+				Spectrum gradient;
+				TexMap_GetColor(&texMapTexels[tm->texelsOffset], tm->format, tm->width, tm->height, u0, v0,
+						footprint * INV_PI * hitBumpMapInst->scaleV, &gradient);
 
 				const float scale = hitBumpMapInst->scale;
 				Vector bump;
-				bump.x = scale * (bu - b0);
-				bump.y = scale * (bv - b0);
+				bump.x = scale * gradient.r;
+				bump.y = scale * gradient.g;
 				bump.z = 1.f;
 
 				Vector v1, v2;
@@ -959,11 +1410,13 @@ __kernel void PathTracing(
 			float materialPdf;
 			Spectrum f;
 			bool diffuseBounce;
+			const uint depth = diffuseBounces + specularGlossyBounces;
+			Sampler_StartBounce(&sampler, depth, SAMPLER_BOUNCE_BSDF_OFFSET);
 			switch (matType) {
 
 #if defined(PARAM_ENABLE_MAT_MATTE)
 				case MAT_MATTE:
-					Matte_Sample_f(&hitPointMat->param.matte, &wo, &wi, &materialPdf, &f, &shadeN, &seed, &diffuseBounce);
+					Matte_Sample_f(&hitPointMat->param.matte, &wo, &wi, &materialPdf, &f, &shadeN, &sampler, &diffuseBounce);
 					break;
 #endif
 
@@ -975,19 +1428,19 @@ __kernel void PathTracing(
 
 #if defined(PARAM_ENABLE_MAT_GLASS)
 				case MAT_GLASS:
-					Glass_Sample_f(&hitPointMat->param.glass, &wo, &wi, &materialPdf, &f, &N, &shadeN, &seed, &diffuseBounce);
+					Glass_Sample_f(&hitPointMat->param.glass, &wo, &wi, &materialPdf, &f, &N, &shadeN, &sampler, &diffuseBounce);
 					break;
 #endif
 
 #if defined(PARAM_ENABLE_MAT_METAL)
 				case MAT_METAL:
-					Metal_Sample_f(&hitPointMat->param.metal, &wo, &wi, &materialPdf, &f, &shadeN, &seed, &diffuseBounce);
+					Metal_Sample_f(&hitPointMat->param.metal, &wo, &wi, &materialPdf, &f, &shadeN, &sampler, &diffuseBounce);
 					break;
 #endif
 
 #if defined(PARAM_ENABLE_MAT_ALLOY)
 				case MAT_ALLOY:
-					Alloy_Sample_f(&hitPointMat->param.alloy, &wo, &wi, &materialPdf, &f, &shadeN, &seed, &diffuseBounce);
+					Alloy_Sample_f(&hitPointMat->param.alloy, &wo, &wi, &materialPdf, &f, &shadeN, &sampler, &diffuseBounce);
 					break;
 #endif
 
@@ -1016,23 +1469,88 @@ __kernel void PathTracing(
 #if defined(PARAM_HAS_TEXTUREMAPS)
 			const uint texMapIndex = hitTexMapInst->texMapIndex;
 
+			Spectrum texCol;
 			if (texMapIndex != 0xffffffffu) {
 				const float tu = SphericalPhi(&N) * INV_TWOPI * hitTexMapInst->scaleU + hitTexMapInst->shiftU;
 				const float tv = SphericalTheta(&N) * INV_PI * hitTexMapInst->scaleV + hitTexMapInst->shiftV;
 
 				PARAM_MEM_TYPE TexMap *tm = &texMaps[texMapIndex];
-				Spectrum texCol;
-				TexMap_GetColor(&texMapRGB[tm->rgbOffset], tm->width, tm->height, tu, tv, &texCol);
+				TexMap_GetColor(&texMapTexels[tm->texelsOffset], tm->format, tm->width, tm->height, tu, tv,
+						footprint * INV_PI * hitTexMapInst->scaleV, &texCol);
 
 				f.r *= texCol.r;
 				f.g *= texCol.g;
 				f.b *= texCol.b;
+			} else {
+				texCol.r = 1.f;
+				texCol.g = 1.f;
+				texCol.b = 1.f;
 			}
 #endif
 
+			//------------------------------------------------------------------
+			// Sample the infinite light
+			//------------------------------------------------------------------
+
+			lastSpecular = (matType == MAT_MIRROR) || (matType == MAT_GLASS);
+			if (!lastSpecular) {
+				Sampler_StartBounce(&sampler, depth, SAMPLER_BOUNCE_LIGHT_OFFSET);
+				const float u0 = Sampler_GetSample(&sampler);
+				const float u1 = Sampler_GetSample(&sampler);
+
+				Ray shadowRay;
+				float lightPdf;
+				Spectrum lightLe;
+				InfiniteLight_Sample_L(infiniteLightMap, infiniteLightDistribution,
+						u0, u1, &shadowRay.d, &lightPdf, &lightLe);
+
+				if (lightPdf > 0.f) {
+					float bsdfPdf;
+					Spectrum bsdfF;
+					Material_Evaluate(hitPointMat, &wo, &shadowRay.d, &bsdfPdf, &bsdfF, &shadeN);
+
+					if (bsdfPdf > 0.f) {
+						shadowRay.o = hitPoint;
+						shadowRay.mint = PARAM_RAY_EPSILON;
+						shadowRay.maxt = INFINITY;
+
+#if defined(PARAM_COUNT_RAYS)
+						++rayCount;
+#endif
+						if (!BVH_IntersectP(&shadowRay, bvhRoot)) {
+							const float weight = PowerHeuristic(lightPdf, bsdfPdf) / lightPdf;
+#if defined(PARAM_HAS_TEXTUREMAPS)
+							bsdfF.r *= texCol.r;
+							bsdfF.g *= texCol.g;
+							bsdfF.b *= texCol.b;
+#endif
+							radiance.r += throughput.r * bsdfF.r * lightLe.r * weight;
+							radiance.g += throughput.g * bsdfF.g * lightLe.g * weight;
+							radiance.b += throughput.b * bsdfF.b * lightLe.b * weight;
+						}
+					}
+				}
+			}
+			lastPdf = materialPdf;
+
 			throughput.r *= f.r;
 			throughput.g *= f.g;
 			throughput.b *= f.b;
+			if ((throughput.r == 0.f) && (throughput.g == 0.f) && (throughput.b == 0.f))
+				break;
+
+			// Russian roulette
+			if (depth >= PARAM_RR_DEPTH) {
+				const float rrProb = max(min(1.f, Spectrum_Y(&throughput)), PARAM_RR_CAP);
+				Sampler_StartBounce(&sampler, depth, SAMPLER_BOUNCE_RR_OFFSET);
+				if (Sampler_GetSample(&sampler) >= rrProb)
+					break;
+
+				const float invRRProb = 1.f / rrProb;
+				throughput.r *= invRRProb;
+				throughput.g *= invRRProb;
+				throughput.b *= invRRProb;
+			}
 
 			ray.o = hitPoint;
 			ray.d = wi;
@@ -1040,7 +1558,16 @@ __kernel void PathTracing(
 			ray.maxt = INFINITY;
 		} else {
 			Spectrum iLe;
-			InfiniteLight_Le(infiniteLightMap, &iLe, &ray.d);
+			InfiniteLight_Le(infiniteLightMap, &iLe, &ray.d, coneSpread);
+
+			if (!lastSpecular) {
+				// Multiple importance sampling with the next event estimation
+				const float weight = PowerHeuristic(lastPdf,
+						InfiniteLight_Pdf(infiniteLightDistribution, &ray.d));
+				iLe.r *= weight;
+				iLe.g *= weight;
+				iLe.b *= weight;
+			}
 
 			radiance.r += throughput.r * iLe.r;
 			radiance.g += throughput.g * iLe.g;
@@ -1053,15 +1580,15 @@ __kernel void PathTracing(
 			isnan(radiance.r) || isnan(radiance.g) || isnan(radiance.b))
 		printf(\"Error radiance: [%f, %f, %f]\\n\", radiance.r, radiance.g, radiance.b);*/
 
+#if defined(PARAM_COUNT_RAYS)
+	// The counters are only read back by the benchmark mode
+	rayCounts[pixelIndex] += rayCount;
+#endif
+
 	__global Pixel *p = &frameBuffer[pixelIndex];
 	p->r += radiance.r * (1.f / PARAM_SCREEN_SAMPLEPERPASS);
 	p->g += radiance.g * (1.f / PARAM_SCREEN_SAMPLEPERPASS);
 	p->b += radiance.b * (1.f / PARAM_SCREEN_SAMPLEPERPASS);
-
-	// Save the seed
-	task->seed.s1 = seed.s1;
-	task->seed.s2 = seed.s2;
-	task->seed.s3 = seed.s3;
 }
 
 //------------------------------------------------------------------------------
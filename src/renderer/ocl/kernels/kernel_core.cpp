@@ -28,6 +28,8 @@ string KernelSource_kernel_core =
 "//  PARAM_RAY_EPSILON\n"
 "//  PARAM_MAX_DIFFUSE_BOUNCE\n"
 "//  PARAM_MAX_SPECULARGLOSSY_BOUNCE\n"
+"//  PARAM_RR_DEPTH\n"
+"//  PARAM_RR_CAP\n"
 "//  PARAM_IL_SHIFT_U\n"
 "//  PARAM_IL_SHIFT_V\n"
 "//  PARAM_IL_GAIN_R\n"
@@ -35,6 +37,12 @@ string KernelSource_kernel_core =
 "//  PARAM_IL_GAIN_B\n"
 "//  PARAM_IL_MAP_WIDTH\n"
 "//  PARAM_IL_MAP_HEIGHT\n"
+"//  PARAM_IL_MAP_FORMAT\n"
+"//  PARAM_IL_DISTRIBUTION_WIDTH\n"
+"//  PARAM_IL_DISTRIBUTION_HEIGHT\n"
+"//  PARAM_SAMPLER_SOBOL\n"
+"//  PARAM_SAMPLER_SOBOL_BLUENOISE\n"
+"//  PARAM_SAMPLER_SEED\n"
 "//  PARAM_ENABLE_MAT_MATTE\n"
 "//  PARAM_ENABLE_MAT_MIRROR\n"
 "//  PARAM_ENABLE_MAT_GLASS\n"
@@ -99,15 +107,6 @@ string KernelSource_kernel_core =
 "\n"
 "//------------------------------------------------------------------------------\n"
 "\n"
-"typedef struct {\n"
-"	unsigned int s1, s2, s3;\n"
-"} Seed;\n"
-"\n"
-"typedef struct {\n"
-"	// The task seed\n"
-"	Seed seed;\n"
-"} GPUTask;\n"
-"\n"
 "typedef Spectrum Pixel;\n"
 "\n"
 "//------------------------------------------------------------------------------\n"
@@ -116,6 +115,7 @@ string KernelSource_kernel_core =
 "	float lensRadius;\n"
 "	float focalDistance;\n"
 "	float yon, hither;\n"
+"	float pixelSpreadAngle;\n"
 "\n"
 "	float rasterToCameraMatrix[4][4];\n"
 "	float cameraToWorldMatrix[4][4];\n"
@@ -123,9 +123,20 @@ string KernelSource_kernel_core =
 "\n"
 "//------------------------------------------------------------------------------\n"
 "\n"
+"// Same values of TextureMapFormat\n"
+"#define TEXMAP_RGBA8 0\n"
+"#define TEXMAP_RGB_HALF 1\n"
+"#define TEXMAP_GRADIENT_HALF 2\n"
+"\n"
+"// Same layout of TextureMap: square tiles and an extra row and column used\n"
+"// for the wrapping, followed by the levels of the mip pyramid\n"
+"#define TEXMAP_TILE_SIZE 4\n"
+"#define TEXMAP_MAX_LEVELS 16\n"
+"\n"
 "typedef struct {\n"
-"	unsigned int rgbOffset;\n"
+"	unsigned int texelsOffset;\n"
 "	unsigned int width, height;\n"
+"	unsigned int format;\n"
 "} TexMap;\n"
 "\n"
 "typedef struct {\n"
@@ -191,42 +202,177 @@ string KernelSource_kernel_core =
 "\n"
 "//------------------------------------------------------------------------------\n"
 "// Random number generator\n"
-"// maximally equidistributed combined Tausworthe generator\n"
+"// Philox4x32-10 counter-based generator, same as the CPU one (see\n"
+"// utils/randomgen.h)\n"
 "//------------------------------------------------------------------------------\n"
 "\n"
-"#define FLOATMASK 0x00ffffffu\n"
+"#define PHILOX_M0 0xD2511F53u\n"
+"#define PHILOX_M1 0xCD9E8D57u\n"
+"#define PHILOX_W0 0x9E3779B9u\n"
+"#define PHILOX_W1 0xBB67AE85u\n"
+"\n"
+"void Philox4x32(const uint c0, const uint c1, const uint c2, const uint c3,\n"
+"		const uint key0, const uint key1, uint *result) {\n"
+"	uint x0 = c0;\n"
+"	uint x1 = c1;\n"
+"	uint x2 = c2;\n"
+"	uint x3 = c3;\n"
+"	uint k0 = key0;\n"
+"	uint k1 = key1;\n"
+"\n"
+"	for (uint i = 0; i < 10; ++i) {\n"
+"		const uint hi0 = mul_hi(PHILOX_M0, x0);\n"
+"		const uint lo0 = PHILOX_M0 * x0;\n"
+"		const uint hi1 = mul_hi(PHILOX_M1, x2);\n"
+"		const uint lo1 = PHILOX_M1 * x2;\n"
+"\n"
+"		x0 = hi1 ^ x1 ^ k0;\n"
+"		x1 = lo1;\n"
+"		x2 = hi0 ^ x3 ^ k1;\n"
+"		x3 = lo0;\n"
+"\n"
+"		k0 += PHILOX_W0;\n"
+"		k1 += PHILOX_W1;\n"
+"	}\n"
+"\n"
+"	result[0] = x0;\n"
+"	result[1] = x1;\n"
+"	result[2] = x2;\n"
+"	result[3] = x3;\n"
+"}\n"
 "\n"
-"uint TAUSWORTHE(const uint s, const uint a,\n"
-"	const uint b, const uint c,\n"
-"	const uint d) {\n"
-"	return ((s&c)<<d) ^ (((s << a) ^ s) >> b);\n"
+"float UIntToFloat(const uint x) {\n"
+"	return (x >> 8) * (1.f / 16777216.f);\n"
 "}\n"
 "\n"
-"uint LCG(const uint x) { return x * 69069; }\n"
+"//------------------------------------------------------------------------------\n"
+"// Samplers\n"
+"//\n"
+"// Same dimension layout of the CPU samplers (see utils/sampler.h): 0 and 1 for\n"
+"// the pixel jitter, 2 and 3 for the lens and then SAMPLER_BOUNCE_DIMENSION_COUNT\n"
+"// dimensions for each bounce of the path (the material sampling first, the\n"
+"// light sampling at SAMPLER_BOUNCE_LIGHT_OFFSET and the Russian roulette at\n"
+"// SAMPLER_BOUNCE_RR_OFFSET).\n"
+"//------------------------------------------------------------------------------\n"
+"\n"
+"#define SAMPLER_BOUNCE_DIMENSION_OFFSET 4\n"
+"#define SAMPLER_BOUNCE_DIMENSION_COUNT 8\n"
+"#define SAMPLER_BOUNCE_BSDF_OFFSET 0\n"
+"#define SAMPLER_BOUNCE_LIGHT_OFFSET 4\n"
+"#define SAMPLER_BOUNCE_RR_OFFSET 6\n"
 "\n"
-"uint ValidSeed(const uint x, const uint m) {\n"
-"	return (x < m) ? (x + m) : x;\n"
+"typedef struct {\n"
+"	uint sampleIndex;\n"
+"#if defined(PARAM_SAMPLER_SOBOL)\n"
+"	uint pixelSeed;\n"
+"#if defined(PARAM_SAMPLER_SOBOL_BLUENOISE)\n"
+"	float dither;\n"
+"#endif\n"
+"#else\n"
+"	uint pixel;\n"
+"	uint block;\n"
+"	uint values[4];\n"
+"#endif\n"
+"	uint dimension;\n"
+"} Sampler;\n"
+"\n"
+"#if defined(PARAM_SAMPLER_SOBOL)\n"
+"\n"
+"uint SamplerHash(uint x) {\n"
+"	x ^= x >> 16;\n"
+"	x *= 0x7feb352du;\n"
+"	x ^= x >> 15;\n"
+"	x *= 0x846ca68bu;\n"
+"	x ^= x >> 16;\n"
+"\n"
+"	return x;\n"
 "}\n"
 "\n"
-"void InitRandomGenerator(uint seed, Seed *s) {\n"
-"	// Avoid 0 value\n"
-"	seed = (seed == 0) ? (seed + 0xffffffu) : seed;\n"
+"uint ReverseBits(uint x) {\n"
+"	x = (x << 16) | (x >> 16);\n"
+"	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);\n"
+"	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);\n"
+"	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);\n"
+"	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);\n"
 "\n"
-"	s->s1 = ValidSeed(LCG(seed), 1);\n"
-"	s->s2 = ValidSeed(LCG(s->s1), 7);\n"
-"	s->s3 = ValidSeed(LCG(s->s2), 15);\n"
+"	return x;\n"
 "}\n"
 "\n"
-"unsigned long RndUintValue(Seed *s) {\n"
-"	s->s1 = TAUSWORTHE(s->s1, 13, 19, 4294967294UL, 12);\n"
-"	s->s2 = TAUSWORTHE(s->s2, 2, 25, 4294967288UL, 4);\n"
-"	s->s3 = TAUSWORTHE(s->s3, 3, 11, 4294967280UL, 17);\n"
+"uint NestedUniformScramble(uint x, const uint seed) {\n"
+"	x = ReverseBits(x);\n"
+"	x ^= x * 0x3d20adeau;\n"
+"	x += seed;\n"
+"	x *= (seed >> 16) | 1u;\n"
+"	x ^= x * 0x05526c56u;\n"
+"	x ^= x * 0x53a22864u;\n"
 "\n"
-"	return ((s->s1) ^ (s->s2) ^ (s->s3));\n"
+"	return ReverseBits(x);\n"
 "}\n"
 "\n"
-"float RndFloatValue(Seed *s) {\n"
-"	return (RndUintValue(s) & FLOATMASK) * (1.f / (FLOATMASK + 1UL));\n"
+"uint Sobol02(uint index, const uint dim) {\n"
+"	if (dim == 0)\n"
+"		return ReverseBits(index);\n"
+"\n"
+"	uint result = 0;\n"
+"	for (uint v = 1u << 31; index; index >>= 1, v ^= v >> 1) {\n"
+"		if (index & 1u)\n"
+"			result ^= v;\n"
+"	}\n"
+"\n"
+"	return result;\n"
+"}\n"
+"\n"
+"#endif\n"
+"\n"
+"void Sampler_Init(Sampler *sampler, const uint x, const uint y, const uint sampleIndex) {\n"
+"	sampler->dimension = 0;\n"
+"\n"
+"	sampler->sampleIndex = sampleIndex;\n"
+"#if defined(PARAM_SAMPLER_SOBOL)\n"
+"#if defined(PARAM_SAMPLER_SOBOL_BLUENOISE)\n"
+"	sampler->pixelSeed = SamplerHash(PARAM_SAMPLER_SEED);\n"
+"	// R2 sequence dither, in 0.32 fixed point to wrap around for free\n"
+"	sampler->dither = UIntToFloat(x * 3242174889u + y * 2447445414u);\n"
+"#else\n"
+"	sampler->pixelSeed = SamplerHash(SamplerHash(PARAM_SAMPLER_SEED) ^ SamplerHash(x ^ SamplerHash(y)));\n"
+"#endif\n"
+"#else\n"
+"	sampler->pixel = x | (y << 16);\n"
+"	sampler->block = 0xffffffffu;\n"
+"#endif\n"
+"}\n"
+"\n"
+"void Sampler_StartBounce(Sampler *sampler, const uint depth, const uint offset) {\n"
+"	sampler->dimension = SAMPLER_BOUNCE_DIMENSION_OFFSET + depth * SAMPLER_BOUNCE_DIMENSION_COUNT + offset;\n"
+"}\n"
+"\n"
+"float Sampler_GetSample(Sampler *sampler) {\n"
+"	const uint d = sampler->dimension++;\n"
+"\n"
+"#if defined(PARAM_SAMPLER_SOBOL)\n"
+"	const uint pairSeed = SamplerHash(sampler->pixelSeed ^ (d >> 1));\n"
+"	const uint index = NestedUniformScramble(sampler->sampleIndex, pairSeed);\n"
+"	const uint v = NestedUniformScramble(Sobol02(index, d & 1u),\n"
+"			SamplerHash(pairSeed ^ (d + 1)));\n"
+"\n"
+"	float u = UIntToFloat(v);\n"
+"#if defined(PARAM_SAMPLER_SOBOL_BLUENOISE)\n"
+"	u += sampler->dither + d * 0.6180339887f;\n"
+"	u -= floor(u);\n"
+"	u = fmin(u, 0.99999994f);\n"
+"#endif\n"
+"\n"
+"	return u;\n"
+"#else\n"
+"	// The 4 dimensions of a block are generated at once\n"
+"	if ((d >> 2) != sampler->block) {\n"
+"		sampler->block = d >> 2;\n"
+"		Philox4x32(sampler->pixel, sampler->sampleIndex, sampler->block, 0,\n"
+"				PARAM_SAMPLER_SEED, 0, sampler->values);\n"
+"	}\n"
+"\n"
+"	return UIntToFloat(sampler->values[d & 3u]);\n"
+"#endif\n"
 "}\n"
 "\n"
 "//------------------------------------------------------------------------------\n"
@@ -353,6 +499,43 @@ string KernelSource_kernel_core =
 "	Cross(v3, v1, v2);\n"
 "}\n"
 "\n"
+"#if defined(PARAM_FAST_SPHERICAL_MATH)\n"
+"\n"
+"// Same polynomial approximations of FastAcos() and FastAtan2()\n"
+"\n"
+"float SphericalTheta(const Vector *v) {\n"
+"	const float z = v->z;\n"
+"	const float az = min(fabs(z), 1.f);\n"
+"	const float r = sqrt(1.f - az) * (((((((-0.0012624911f * az + 0.0066700901f) * az -\n"
+"			0.0170881256f) * az + 0.0308918810f) * az - 0.0501743046f) * az +\n"
+"			0.0889789874f) * az - 0.2145988016f) * az + 1.5707963050f);\n"
+"\n"
+"	return (z < 0.f) ? M_PI - r : r;\n"
+"}\n"
+"\n"
+"float SphericalPhi(const Vector *v) {\n"
+"	const float ax = fabs(v->x);\n"
+"	const float ay = fabs(v->y);\n"
+"	const float maxA = max(ax, ay);\n"
+"	if (maxA == 0.f)\n"
+"		return 0.f;\n"
+"\n"
+"	const float a = min(ax, ay) / maxA;\n"
+"	const float s = a * a;\n"
+"	float r = (((((-0.01172120f * s + 0.05265332f) * s - 0.11643287f) * s +\n"
+"			0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;\n"
+"\n"
+"	if (ay > ax)\n"
+"		r = M_PI * .5f - r;\n"
+"	if (v->x < 0.f)\n"
+"		r = M_PI - r;\n"
+"\n"
+"	// [0, 2 * M_PI)\n"
+"	return (v->y < 0.f) ? 2.f * M_PI - r : r;\n"
+"}\n"
+"\n"
+"#else\n"
+"\n"
 "float SphericalTheta(const Vector *v) {\n"
 "	return acos(clamp(v->z, -1.f, 1.f));\n"
 "}\n"
@@ -362,23 +545,67 @@ string KernelSource_kernel_core =
 "	return (p < 0.f) ? p + 2.f * M_PI : p;\n"
 "}\n"
 "\n"
+"#endif\n"
+"\n"
 "//------------------------------------------------------------------------------\n"
 "// Texture maps\n"
 "//------------------------------------------------------------------------------\n"
 "\n"
-"void TexMap_GetTexel(__global Spectrum *pixels, const uint width, const uint height,\n"
-"		const int s, const int t, Spectrum *col) {\n"
-"	const uint u = Mod(s, width);\n"
-"	const uint v = Mod(t, height);\n"
+"uint TexMap_GetTexelIndex(const uint width, const uint x, const uint y) {\n"
+"	const uint tileCountX = width / TEXMAP_TILE_SIZE + 1;\n"
+"	const uint tileIndex = (y / TEXMAP_TILE_SIZE) * tileCountX + x / TEXMAP_TILE_SIZE;\n"
 "\n"
-"	const unsigned index = v * width + u;\n"
+"	return tileIndex * (TEXMAP_TILE_SIZE * TEXMAP_TILE_SIZE) +\n"
+"			(y % TEXMAP_TILE_SIZE) * TEXMAP_TILE_SIZE + x % TEXMAP_TILE_SIZE;\n"
+"}\n"
 "\n"
-"	col->r = pixels[index].r;\n"
-"	col->g = pixels[index].g;\n"
-"	col->b = pixels[index].b;\n"
+"void TexMap_GetTexel(__global uchar *texels, const uint format,\n"
+"		const uint index, Spectrum *col) {\n"
+"	switch (format) {\n"
+"		case TEXMAP_RGBA8: {\n"
+"			__global uchar *texel = &texels[index * 4];\n"
+"			col->r = texel[0] * (1.f / 255.f);\n"
+"			col->g = texel[1] * (1.f / 255.f);\n"
+"			col->b = texel[2] * (1.f / 255.f);\n"
+"			break;\n"
+"		}\n"
+"		case TEXMAP_RGB_HALF: {\n"
+"			__global half *texel = (__global half *)texels;\n"
+"			col->r = vload_half(index * 3, texel);\n"
+"			col->g = vload_half(index * 3 + 1, texel);\n"
+"			col->b = vload_half(index * 3 + 2, texel);\n"
+"			break;\n"
+"		}\n"
+"		case TEXMAP_GRADIENT_HALF: {\n"
+"			__global half *texel = (__global half *)texels;\n"
+"			col->r = vload_half(index * 2, texel);\n"
+"			col->g = vload_half(index * 2 + 1, texel);\n"
+"			col->b = 0.f;\n"
+"			break;\n"
+"		}\n"
+"		default:\n"
+"			col->r = 0.f;\n"
+"			col->g = 0.f;\n"
+"			col->b = 0.f;\n"
+"			break;\n"
+"	}\n"
 "}\n"
 "\n"
-"void TexMap_GetColor(__global Spectrum *pixels, const uint width, const uint height,\n"
+"uint TexMap_GetTexelSize(const uint format) {\n"
+"	switch (format) {\n"
+"		case TEXMAP_RGBA8:\n"
+"			return 4;\n"
+"		case TEXMAP_RGB_HALF:\n"
+"			return 3 * 2;\n"
+"		case TEXMAP_GRADIENT_HALF:\n"
+"			return 2 * 2;\n"
+"		default:\n"
+"			return 0;\n"
+"	}\n"
+"}\n"
+"\n"
+"void TexMap_GetLevelColor(__global uchar *texels, const uint format,\n"
+"		const uint width, const uint height,\n"
 "		const float u, const float v, Spectrum *col) {\n"
 "	const float s = u * width - 0.5f;\n"
 "	const float t = v * height - 0.5f;\n"
@@ -392,11 +619,15 @@ string KernelSource_kernel_core =
 "	const float ids = 1.f - ds;\n"
 "	const float idt = 1.f - dt;\n"
 "\n"
+"	// The padding takes care of the wrapping of x0 + 1 and y0 + 1\n"
+"	const uint x0 = Mod(s0, width);\n"
+"	const uint y0 = Mod(t0, height);\n"
+"\n"
 "	Spectrum c0, c1, c2, c3;\n"
-"	TexMap_GetTexel(pixels, width, height, s0, t0, &c0);\n"
-"	TexMap_GetTexel(pixels, width, height, s0, t0 + 1, &c1);\n"
-"	TexMap_GetTexel(pixels, width, height, s0 + 1, t0, &c2);\n"
-"	TexMap_GetTexel(pixels, width, height, s0 + 1, t0 + 1, &c3);\n"
+"	TexMap_GetTexel(texels, format, TexMap_GetTexelIndex(width, x0, y0), &c0);\n"
+"	TexMap_GetTexel(texels, format, TexMap_GetTexelIndex(width, x0, y0 + 1), &c1);\n"
+"	TexMap_GetTexel(texels, format, TexMap_GetTexelIndex(width, x0 + 1, y0), &c2);\n"
+"	TexMap_GetTexel(texels, format, TexMap_GetTexelIndex(width, x0 + 1, y0 + 1), &c3);\n"
 "\n"
 "	const float k0 = ids * idt;\n"
 "	const float k1 = ids * dt;\n"
@@ -408,32 +639,146 @@ string KernelSource_kernel_core =
 "	col->b = k0 * c0.b + k1 * c1.b + k2 * c2.b + k3 * c3.b;\n"
 "}\n"
 "\n"
+"// The levels of the mip pyramid are stored one after the other (see\n"
+"// TextureMap::BuildLevels()), footprintV is the size of the footprint along v\n"
+"// in the [0, 1] texture space\n"
+"void TexMap_GetColor(__global uchar *texels, const uint format,\n"
+"		const uint width, const uint height,\n"
+"		const float u, const float v, const float footprintV, Spectrum *col) {\n"
+"	const float lod = log2(footprintV * height);\n"
+"\n"
+"	// Look for the first level to use\n"
+"	const uint texelSize = TexMap_GetTexelSize(format);\n"
+"	uint level = 0;\n"
+"	uint w = width;\n"
+"	uint h = height;\n"
+"	uint offset = 0;\n"
+"	while ((level + 1 < lod) && (level + 1 < TEXMAP_MAX_LEVELS) && ((w > 1) || (h > 1))) {\n"
+"		offset += (w / TEXMAP_TILE_SIZE + 1) * (h / TEXMAP_TILE_SIZE + 1) * (TEXMAP_TILE_SIZE * TEXMAP_TILE_SIZE);\n"
+"		w = max(1u, w / 2);\n"
+"		h = max(1u, h / 2);\n"
+"		++level;\n"
+"	}\n"
+"\n"
+"	TexMap_GetLevelColor(&texels[offset * texelSize], format, w, h, u, v, col);\n"
+"\n"
+"	const float k = lod - level;\n"
+"	if ((k > 0.f) && (level + 1 < TEXMAP_MAX_LEVELS) && ((w > 1) || (h > 1))) {\n"
+"		// Blend with the next level\n"
+"		offset += (w / TEXMAP_TILE_SIZE + 1) * (h / TEXMAP_TILE_SIZE + 1) * (TEXMAP_TILE_SIZE * TEXMAP_TILE_SIZE);\n"
+"		w = max(1u, w / 2);\n"
+"		h = max(1u, h / 2);\n"
+"\n"
+"		Spectrum col1;\n"
+"		TexMap_GetLevelColor(&texels[offset * texelSize], format, w, h, u, v, &col1);\n"
+"\n"
+"		const float k1 = min(k, 1.f);\n"
+"		const float k0 = 1.f - k1;\n"
+"		col->r = k0 * col->r + k1 * col1.r;\n"
+"		col->g = k0 * col->g + k1 * col1.g;\n"
+"		col->b = k0 * col->b + k1 * col1.b;\n"
+"	}\n"
+"}\n"
+"\n"
 "//------------------------------------------------------------------------------\n"
 "// InfiniteLight_Le\n"
 "//------------------------------------------------------------------------------\n"
 "\n"
-"void InfiniteLight_Le(__global Spectrum *infiniteLightMap, Spectrum *le, const Vector *dir) {\n"
+"// The footprint is the angle covered by the ray\n"
+"void InfiniteLight_Le(__global uchar *infiniteLightMap, Spectrum *le, const Vector *dir,\n"
+"		const float footprint) {\n"
 "	const float u = 1.f - SphericalPhi(dir) * INV_TWOPI +  PARAM_IL_SHIFT_U;\n"
 "	const float v = SphericalTheta(dir) * INV_PI + PARAM_IL_SHIFT_V;\n"
 "\n"
-"	TexMap_GetColor(infiniteLightMap, PARAM_IL_MAP_WIDTH, PARAM_IL_MAP_HEIGHT, u, v, le);\n"
+"	TexMap_GetColor(infiniteLightMap, PARAM_IL_MAP_FORMAT, PARAM_IL_MAP_WIDTH, PARAM_IL_MAP_HEIGHT,\n"
+"			u, v, footprint * INV_PI, le);\n"
 "\n"
 "	le->r *= PARAM_IL_GAIN_R;\n"
 "	le->g *= PARAM_IL_GAIN_G;\n"
 "	le->b *= PARAM_IL_GAIN_B;\n"
 "}\n"
 "\n"
+"// The luminance distribution has the same layout of the CPU one (see\n"
+"// InfiniteLight::GetDistribution())\n"
+"\n"
+"uint InfiniteLight_SampleCDF(__global float *cdf, const uint count, const float u, float *du) {\n"
+"	// Look for the last entry <= u\n"
+"	uint first = 0;\n"
+"	uint last = count;\n"
+"	while (first + 1 < last) {\n"
+"		const uint middle = (first + last) >> 1;\n"
+"		if (cdf[middle] <= u)\n"
+"			first = middle;\n"
+"		else\n"
+"			last = middle;\n"
+"	}\n"
+"\n"
+"	const float width = cdf[first + 1] - cdf[first];\n"
+"	*du = (width > 0.f) ? clamp((u - cdf[first]) / width, 0.f, 1.f) : 0.f;\n"
+"\n"
+"	return first;\n"
+"}\n"
+"\n"
+"void InfiniteLight_Sample_L(__global uchar *infiniteLightMap, __global float *infiniteLightDistribution,\n"
+"		const float u0, const float u1, Vector *dir, float *pdf, Spectrum *le) {\n"
+"	const uint w = PARAM_IL_DISTRIBUTION_WIDTH;\n"
+"	const uint h = PARAM_IL_DISTRIBUTION_HEIGHT;\n"
+"\n"
+"	float dv;\n"
+"	const uint y = InfiniteLight_SampleCDF(infiniteLightDistribution, h, u1, &dv);\n"
+"	float du;\n"
+"	const uint x = InfiniteLight_SampleCDF(&infiniteLightDistribution[(h + 1) + y * (w + 1)], w, u0, &du);\n"
+"\n"
+"	const float cellPdf = infiniteLightDistribution[(h + 1) + h * (w + 1) + x + y * w];\n"
+"	const float theta = M_PI * (y + dv) / h;\n"
+"	const float sinTheta = sin(theta);\n"
+"	if ((cellPdf <= 0.f) || (sinTheta <= 0.f)) {\n"
+"		*pdf = 0.f;\n"
+"		return;\n"
+"	}\n"
+"\n"
+"	const float phi = 2.f * M_PI * (x + du) / w;\n"
+"	dir->x = sinTheta * cos(phi);\n"
+"	dir->y = sinTheta * sin(phi);\n"
+"	dir->z = cos(theta);\n"
+"	*pdf = cellPdf / (2.f * M_PI * M_PI * sinTheta);\n"
+"\n"
+"	InfiniteLight_Le(infiniteLightMap, le, dir, 0.f);\n"
+"}\n"
+"\n"
+"float InfiniteLight_Pdf(__global float *infiniteLightDistribution, const Vector *dir) {\n"
+"	const uint w = PARAM_IL_DISTRIBUTION_WIDTH;\n"
+"	const uint h = PARAM_IL_DISTRIBUTION_HEIGHT;\n"
+"\n"
+"	const float theta = SphericalTheta(dir);\n"
+"	const float sinTheta = sin(theta);\n"
+"	if (sinTheta <= 0.f)\n"
+"		return 0.f;\n"
+"\n"
+"	const uint x = min((uint)(SphericalPhi(dir) * INV_TWOPI * w), w - 1);\n"
+"	const uint y = min((uint)(theta * INV_PI * h), h - 1);\n"
+"\n"
+"	return infiniteLightDistribution[(h + 1) + h * (w + 1) + x + y * w] / (2.f * M_PI * M_PI * sinTheta);\n"
+"}\n"
+"\n"
+"float PowerHeuristic(const float fPdf, const float gPdf) {\n"
+"	const float f2 = fPdf * fPdf;\n"
+"	const float g2 = gPdf * gPdf;\n"
+"\n"
+"	return f2 / (f2 + g2);\n"
+"}\n"
+"\n"
 "//------------------------------------------------------------------------------\n"
 "// GenerateCameraRay\n"
 "//------------------------------------------------------------------------------\n"
 "\n"
 "void GenerateCameraRay(\n"
-"		Seed *seed,\n"
+"		Sampler *sampler,\n"
 "		PARAM_MEM_TYPE Camera *camera,\n"
 "		const uint pixelIndex,\n"
 "		Ray *ray) {\n"
-"	const float scrSampleX = RndFloatValue(seed);\n"
-"	const float scrSampleY = RndFloatValue(seed);\n"
+"	const float scrSampleX = Sampler_GetSample(sampler);\n"
+"	const float scrSampleY = Sampler_GetSample(sampler);\n"
 "\n"
 "	const float screenX = pixelIndex % PARAM_SCREEN_WIDTH + scrSampleX - .5f;\n"
 "	const float screenY = pixelIndex / PARAM_SCREEN_WIDTH + scrSampleY - .5f;\n"
@@ -544,16 +889,37 @@ string KernelSource_kernel_core =
 "	return (*primitiveIndex) != 0xffffffffu;\n"
 "}\n"
 "\n"
+"bool BVH_IntersectP(\n"
+"		const Ray *ray,\n"
+"		PARAM_MEM_TYPE BVHAccelArrayNode *bvhTree) {\n"
+"	unsigned int currentNode = 0; // Root Node\n"
+"	unsigned int stopNode = bvhTree[0].skipIndex; // Non-existent\n"
+"\n"
+"	while (currentNode < stopNode) {\n"
+"		float hitT;\n"
+"		if (Sphere_IntersectP(&bvhTree[currentNode], ray, &hitT)) {\n"
+"			// Stop at the first intersection found\n"
+"			if ((bvhTree[currentNode].primitiveIndex != 0xffffffffu) && (hitT < ray->maxt))\n"
+"				return true;\n"
+"\n"
+"			currentNode++;\n"
+"		} else\n"
+"			currentNode = bvhTree[currentNode].skipIndex;\n"
+"	}\n"
+"\n"
+"	return false;\n"
+"}\n"
+"\n"
 "//------------------------------------------------------------------------------\n"
 "// Materials\n"
 "//------------------------------------------------------------------------------\n"
 "\n"
 "void Matte_Sample_f(const PARAM_MEM_TYPE MatteParam *mat, const Vector *wo, Vector *wi,\n"
 "		float *pdf, Spectrum *f, const Vector *shadeN,\n"
-"		Seed *seed,\n"
+"		Sampler *sampler,\n"
 "		bool *diffuseBounce) {\n"
 "	Vector dir;\n"
-"	CosineSampleHemisphere(&dir, RndFloatValue(seed), RndFloatValue(seed));\n"
+"	CosineSampleHemisphere(&dir, Sampler_GetSample(sampler), Sampler_GetSample(sampler));\n"
 "	const float dp = dir.z;\n"
 "	// Using 0.0001 instead of 0.0 to cut down fireflies\n"
 "	if (dp <= 0.0001f) {\n"
@@ -561,7 +927,7 @@ string KernelSource_kernel_core =
 "		return;\n"
 "	}\n"
 "\n"
-"	*pdf = INV_PI;\n"
+"	*pdf = dp * INV_PI;\n"
 "\n"
 "	Vector v1, v2;\n"
 "	CoordinateSystem(shadeN, &v1, &v2);\n"
@@ -577,6 +943,22 @@ string KernelSource_kernel_core =
 "	*diffuseBounce = true;\n"
 "}\n"
 "\n"
+"void Matte_Evaluate(const PARAM_MEM_TYPE MatteParam *mat, const Vector *wi,\n"
+"		float *pdf, Spectrum *f, const Vector *shadeN) {\n"
+"	const float dp = Dot(shadeN, wi);\n"
+"	if (dp <= 0.0001f) {\n"
+"		*pdf = 0.f;\n"
+"		return;\n"
+"	}\n"
+"\n"
+"	*pdf = dp * INV_PI;\n"
+"\n"
+"	const float k = dp * (*pdf);\n"
+"	f->r = mat->r * k;\n"
+"	f->g = mat->g * k;\n"
+"	f->b = mat->b * k;\n"
+"}\n"
+"\n"
 "void Mirror_Sample_f(const PARAM_MEM_TYPE MirrorParam *mat, const Vector *wo, Vector *wi,\n"
 "		float *pdf, Spectrum *f, const Vector *shadeN,\n"
 "		bool *diffuseBounce) {\n"
@@ -596,7 +978,7 @@ string KernelSource_kernel_core =
 "\n"
 "void Glass_Sample_f(const PARAM_MEM_TYPE GlassParam *mat,\n"
 "    const Vector *wo, Vector *wi, float *pdf, Spectrum *f, const Vector *N, const Vector *shadeN,\n"
-"    Seed *seed,\n"
+"    Sampler *sampler,\n"
 "	bool *diffuseBounce) {\n"
 "    Vector reflDir;\n"
 "    const float k = 2.f * Dot(N, wo);\n"
@@ -661,7 +1043,7 @@ string KernelSource_kernel_core =
 "            f->r = mat->refrct_r;\n"
 "            f->g = mat->refrct_g;\n"
 "            f->b = mat->refrct_b;\n"
-"        } else if (RndFloatValue(seed) < P) {\n"
+"        } else if (Sampler_GetSample(sampler) < P) {\n"
 "            *wi = reflDir;\n"
 "            *pdf = P / Re;\n"
 "\n"
@@ -714,11 +1096,27 @@ string KernelSource_kernel_core =
 "    wi->z = x * u.z + y * v.z + z * w.z;\n"
 "}\n"
 "\n"
+"float GlossyReflectionPdf(const Vector *wo, const float exponent,\n"
+"		const Vector *shadeN, const Vector *wi) {\n"
+"	Vector w;\n"
+"	const float RdotShadeN = Dot(shadeN, wo);\n"
+"	w.x = (2.f * RdotShadeN) * shadeN->x - wo->x;\n"
+"	w.y = (2.f * RdotShadeN) * shadeN->y - wo->y;\n"
+"	w.z = (2.f * RdotShadeN) * shadeN->z - wo->z;\n"
+"\n"
+"	const float cosAlpha = Dot(&w, wi);\n"
+"	if (cosAlpha <= 0.f)\n"
+"		return 0.f;\n"
+"\n"
+"	// exponent is 1 / (n + 1) of the Phong lobe\n"
+"	return INV_TWOPI / exponent * pow(cosAlpha, 1.f / exponent - 1.f);\n"
+"}\n"
+"\n"
 "void Metal_Sample_f(const PARAM_MEM_TYPE MetalParam *mat, const Vector *wo, Vector *wi,\n"
 "		float *pdf, Spectrum *f, const Vector *shadeN,\n"
-"		Seed *seed,\n"
+"		Sampler *sampler,\n"
 "		bool *diffuseBounce) {\n"
-"	GlossyReflection(wo, wi, mat->exponent, shadeN, RndFloatValue(seed), RndFloatValue(seed));\n"
+"	GlossyReflection(wo, wi, mat->exponent, shadeN, Sampler_GetSample(sampler), Sampler_GetSample(sampler));\n"
 "\n"
 "	f->r = mat->r;\n"
 "	f->g = mat->g;\n"
@@ -726,12 +1124,26 @@ string KernelSource_kernel_core =
 "\n"
 "	*diffuseBounce = true;\n"
 "\n"
-"	*pdf =  (Dot(wi, shadeN) > 0.f) ? 1.f : 0.f;\n"
+"	*pdf =  (Dot(wi, shadeN) > 0.f) ? GlossyReflectionPdf(wo, mat->exponent, shadeN, wi) : 0.f;\n"
+"}\n"
+"\n"
+"void Metal_Evaluate(const PARAM_MEM_TYPE MetalParam *mat, const Vector *wo, const Vector *wi,\n"
+"		float *pdf, Spectrum *f, const Vector *shadeN) {\n"
+"	if (Dot(wi, shadeN) <= 0.f) {\n"
+"		*pdf = 0.f;\n"
+"		return;\n"
+"	}\n"
+"\n"
+"	*pdf = GlossyReflectionPdf(wo, mat->exponent, shadeN, wi);\n"
+"\n"
+"	f->r = mat->r * (*pdf);\n"
+"	f->g = mat->g * (*pdf);\n"
+"	f->b = mat->b * (*pdf);\n"
 "}\n"
 "\n"
 "void Alloy_Sample_f(const PARAM_MEM_TYPE AlloyParam *mat, const Vector *wo, Vector *wi,\n"
 "		float *pdf, Spectrum *f, const Vector *shadeN,\n"
-"		Seed *seed,\n"
+"		Sampler *sampler,\n"
 "		bool *diffuseBounce) {\n"
 "    // Schilick's approximation\n"
 "    const float c = 1.f - Dot(wo, shadeN);\n"
@@ -740,16 +1152,20 @@ string KernelSource_kernel_core =
 "\n"
 "    const float P = .25f + .5f * Re;\n"
 "\n"
-"	const float u0 = RndFloatValue(seed);\n"
-"	const float u1 = RndFloatValue(seed);\n"
+"	const float u0 = Sampler_GetSample(sampler);\n"
+"	const float u1 = Sampler_GetSample(sampler);\n"
 "\n"
-"    if (RndFloatValue(seed) <= P) {\n"
+"    if (Sampler_GetSample(sampler) <= P) {\n"
 "        GlossyReflection(wo, wi, mat->exponent, shadeN, u0, u1);\n"
-"        *pdf = P / Re;\n"
 "\n"
-"        f->r = mat->refl_r / (*pdf);\n"
-"        f->g = mat->refl_g / (*pdf);\n"
-"        f->b = mat->refl_b / (*pdf);\n"
+"		// The pdf of both lobes is required by multiple importance sampling\n"
+"		const float dp = max(0.f, Dot(wi, shadeN));\n"
+"		*pdf = P * GlossyReflectionPdf(wo, mat->exponent, shadeN, wi) + (1.f - P) * dp * INV_PI;\n"
+"\n"
+"		const float k = Re / P;\n"
+"        f->r = mat->refl_r * k;\n"
+"        f->g = mat->refl_g * k;\n"
+"        f->b = mat->refl_b * k;\n"
 "\n"
 "		*diffuseBounce = true;\n"
 "    } else {\n"
@@ -762,8 +1178,6 @@ string KernelSource_kernel_core =
 "			return;\n"
 "		}\n"
 "\n"
-"        *pdf = INV_PI;\n"
-"\n"
 "        Vector v1, v2;\n"
 "        CoordinateSystem(shadeN, &v1, &v2);\n"
 "\n"
@@ -771,9 +1185,10 @@ string KernelSource_kernel_core =
 "        wi->y = v1.y * dir.x + v2.y * dir.y + shadeN->y * dir.z;\n"
 "        wi->z = v1.z * dir.x + v2.z * dir.y + shadeN->z * dir.z;\n"
 "\n"
+"		*pdf = P * GlossyReflectionPdf(wo, mat->exponent, shadeN, wi) + (1.f - P) * dp * INV_PI;\n"
+"\n"
 "		const float iRe = 1.f - Re;\n"
 "		const float k = (1.f - P) / iRe;\n"
-"		*pdf *= k;\n"
 "\n"
 "		const float dpk = dp / k;\n"
 "		f->r = mat->diff_r * dpk;\n"
@@ -784,28 +1199,56 @@ string KernelSource_kernel_core =
 "	}\n"
 "}\n"
 "\n"
-"//------------------------------------------------------------------------------\n"
-"// Init Kernel\n"
-"//------------------------------------------------------------------------------\n"
+"void Alloy_Evaluate(const PARAM_MEM_TYPE AlloyParam *mat, const Vector *wo, const Vector *wi,\n"
+"		float *pdf, Spectrum *f, const Vector *shadeN) {\n"
+"    // Schilick's approximation\n"
+"    const float c = 1.f - Dot(wo, shadeN);\n"
+"    const float R0 = mat->R0;\n"
+"    const float Re = R0 + (1.f - R0) * c * c * c * c * c;\n"
 "\n"
-"__kernel void Init(\n"
-"		__global GPUTask *tasks\n"
-"		) {\n"
-"	const size_t gid = get_global_id(0);\n"
-"	if (gid >= PARAM_SCREEN_WIDTH * PARAM_SCREEN_HEIGHT)\n"
-"		return;\n"
+"    const float P = .25f + .5f * Re;\n"
 "\n"
-"	// Initialize the task\n"
-"	__global GPUTask *task = &tasks[gid];\n"
+"	const float glossyPdf = GlossyReflectionPdf(wo, mat->exponent, shadeN, wi);\n"
+"	float dp = Dot(wi, shadeN);\n"
+"	// Same cut of Alloy_Sample_f() for the diffuse lobe\n"
+"	if (dp <= 0.0001f)\n"
+"		dp = 0.f;\n"
+"	const float diffusePdf = dp * INV_PI;\n"
 "\n"
-"	// Initialize random number generator\n"
-"	Seed seed;\n"
-"	InitRandomGenerator(gid + 1, &seed);\n"
+"	*pdf = P * glossyPdf + (1.f - P) * diffusePdf;\n"
 "\n"
-"	// Save the seed\n"
-"	task->seed.s1 = seed.s1;\n"
-"	task->seed.s2 = seed.s2;\n"
-"	task->seed.s3 = seed.s3;\n"
+"	const float kr = Re * glossyPdf;\n"
+"	const float kd = (1.f - Re) * dp * diffusePdf;\n"
+"	f->r = mat->refl_r * kr + mat->diff_r * kd;\n"
+"	f->g = mat->refl_g * kr + mat->diff_g * kd;\n"
+"	f->b = mat->refl_b * kr + mat->diff_b * kd;\n"
+"}\n"
+"\n"
+"// Returns the value, for the direction wi, of the function sampled by the\n"
+"// Sample_f() of the material, used for next event estimation\n"
+"void Material_Evaluate(const PARAM_MEM_TYPE Material *mat, const Vector *wo, const Vector *wi,\n"
+"		float *pdf, Spectrum *f, const Vector *shadeN) {\n"
+"	switch (mat->type) {\n"
+"#if defined(PARAM_ENABLE_MAT_MATTE)\n"
+"		case MAT_MATTE:\n"
+"			Matte_Evaluate(&mat->param.matte, wi, pdf, f, shadeN);\n"
+"			break;\n"
+"#endif\n"
+"#if defined(PARAM_ENABLE_MAT_METAL)\n"
+"		case MAT_METAL:\n"
+"			Metal_Evaluate(&mat->param.metal, wo, wi, pdf, f, shadeN);\n"
+"			break;\n"
+"#endif\n"
+"#if defined(PARAM_ENABLE_MAT_ALLOY)\n"
+"		case MAT_ALLOY:\n"
+"			Alloy_Evaluate(&mat->param.alloy, wo, wi, pdf, f, shadeN);\n"
+"			break;\n"
+"#endif\n"
+"		default:\n"
+"			// Mirror and glass are specular\n"
+"			*pdf = 0.f;\n"
+"			break;\n"
+"	}\n"
 "}\n"
 "\n"
 "//------------------------------------------------------------------------------\n"
@@ -830,34 +1273,34 @@ string KernelSource_kernel_core =
 "//------------------------------------------------------------------------------\n"
 "\n"
 "__kernel void PathTracing(\n"
-"		__global GPUTask *tasks,\n"
 "		PARAM_MEM_TYPE BVHAccelArrayNode *bvhRoot,\n"
 "		PARAM_MEM_TYPE Camera *camera,\n"
-"		__global Spectrum *infiniteLightMap,\n"
+"		__global uchar *infiniteLightMap,\n"
+"		__global float *infiniteLightDistribution,\n"
 "		__global Pixel *frameBuffer,\n"
 "		PARAM_MEM_TYPE Material *mats,\n"
 "		__global uint *sphereMats\n"
 "#if defined(PARAM_HAS_TEXTUREMAPS)\n"
 "		, PARAM_MEM_TYPE TexMap *texMaps\n"
-"		, __global Spectrum *texMapRGB\n"
+"		, __global uchar *texMapTexels\n"
 "		, PARAM_MEM_TYPE TexMapInstance *sphereTexMaps\n"
 "#if defined (PARAM_HAS_BUMPMAPS)\n"
 "		, PARAM_MEM_TYPE BumpMapInstance *sphereBumpMaps\n"
 "#endif\n"
 "#endif\n"
+"#if defined(PARAM_COUNT_RAYS)\n"
+"		, __global uint *rayCounts\n"
+"#endif\n"
+"		, const uint sampleIndex\n"
 "		) {\n"
 "	const size_t gid = get_global_id(0);\n"
 "	if (gid >= PARAM_SCREEN_WIDTH * PARAM_SCREEN_HEIGHT)\n"
 "		return;\n"
 "\n"
-"	__global GPUTask *task = &tasks[gid];\n"
 "	const uint pixelIndex = gid;\n"
 "\n"
-"	// Read the seed\n"
-"	Seed seed;\n"
-"	seed.s1 = task->seed.s1;\n"
-"	seed.s2 = task->seed.s2;\n"
-"	seed.s3 = task->seed.s3;\n"
+"	Sampler sampler;\n"
+"	Sampler_Init(&sampler, pixelIndex % PARAM_SCREEN_WIDTH, pixelIndex / PARAM_SCREEN_WIDTH, sampleIndex);\n"
 "\n"
 "	Spectrum radiance;\n"
 "	radiance.r = 0.f;\n"
@@ -865,7 +1308,7 @@ string KernelSource_kernel_core =
 "	radiance.b = 0.f;\n"
 "\n"
 "	Ray ray;\n"
-"	GenerateCameraRay(&seed, camera, pixelIndex, &ray);\n"
+"	GenerateCameraRay(&sampler, camera, pixelIndex, &ray);\n"
 "\n"
 "	Spectrum throughput;\n"
 "	throughput.r = 1.f;\n"
@@ -875,9 +1318,26 @@ string KernelSource_kernel_core =
 "	uint diffuseBounces = 0;\n"
 "	uint specularGlossyBounces = 0;\n"
 "\n"
+"	// Used to weight the infinite light hit by a path with the next event\n"
+"	// estimation done at the previous vertex\n"
+"	bool lastSpecular = true;\n"
+"	float lastPdf = 0.f;\n"
+"\n"
+"	// A ray cone used to select the level of detail of the texture maps, its\n"
+"	// spread is the one of a camera pixel along the whole path\n"
+"	const float coneSpread = camera->pixelSpreadAngle;\n"
+"	float coneWidth = 0.f;\n"
+"\n"
+"#if defined(PARAM_COUNT_RAYS)\n"
+"	uint rayCount = 0;\n"
+"#endif\n"
+"\n"
 "	for(;;) {\n"
 "		PARAM_MEM_TYPE Sphere *hitSphere;\n"
 "		uint sphereIndex;\n"
+"#if defined(PARAM_COUNT_RAYS)\n"
+"		++rayCount;\n"
+"#endif\n"
 "		if (BVH_Intersect(&ray, &hitSphere, &sphereIndex, bvhRoot)) {\n"
 "			const PARAM_MEM_TYPE Material *hitPointMat = &mats[sphereMats[sphereIndex]];\n"
 "#if defined(PARAM_HAS_TEXTUREMAPS)\n"
@@ -898,6 +1358,10 @@ string KernelSource_kernel_core =
 "			N.z = hitPoint.z - hitSphere->center.z;\n"
 "			Normalize(&N);\n"
 "\n"
+"			// The angle covered by the cone on the sphere\n"
+"			coneWidth += coneSpread * ray.maxt;\n"
+"			const float footprint = coneWidth / hitSphere->rad;\n"
+"\n"
 "			Vector shadeN = N;\n"
 "\n"
 "#if defined (PARAM_HAS_BUMPMAPS)\n"
@@ -906,29 +1370,16 @@ string KernelSource_kernel_core =
 "				const float u0 = SphericalPhi(&N) * INV_TWOPI * hitBumpMapInst->scaleU + hitBumpMapInst->shiftU;\n"
 "				const float v0 = SphericalTheta(&N) * INV_PI * hitBumpMapInst->scaleV + hitBumpMapInst->shiftV;\n"
 "\n"
+"				// A gradient map (see TextureMap)\n"
 "				const PARAM_MEM_TYPE TexMap *tm = &texMaps[bumpMapIndex];\n"
-"				const unsigned int width = tm->width;\n"
-"				const unsigned int height = tm->height;\n"
-"\n"
-"				const float du = 1.f / width;\n"
-"				const float dv = 1.f / height;\n"
-"\n"
-"				Spectrum col0;\n"
-"				TexMap_GetColor(&texMapRGB[tm->rgbOffset], width, height, u0, v0, &col0);\n"
-"				const float b0 = Spectrum_Filter(&col0);\n"
-"\n"
-"				Spectrum colu;\n"
-"				TexMap_GetColor(&texMapRGB[tm->rgbOffset], width, height, u0 + du, v0, &colu);\n"
-"				const float bu = Spectrum_Filter(&colu);\n"
-"\n"
-"				Spectrum colv;\n"
-"				TexMap_GetColor(&texMapRGB[tm->rgbOffset], width, height, u0, v0 + dv, &colv);\n"
-"				const float bv = Spectrum_Filter(&colv);\n"
+"				Spectrum gradient;\n"
+"				TexMap_GetColor(&texMapTexels[tm->texelsOffset], tm->format, tm->width, tm->height, u0, v0,\n"
+"						footprint * INV_PI * hitBumpMapInst->scaleV, &gradient);\n"
 "\n"
 "				const float scale = hitBumpMapInst->scale;\n"
 "				Vector bump;\n"
-"				bump.x = scale * (bu - b0);\n"
-"				bump.y = scale * (bv - b0);\n"
+"				bump.x = scale * gradient.r;\n"
+"				bump.y = scale * gradient.g;\n"
 "				bump.z = 1.f;\n"
 "\n"
 "				Vector v1, v2;\n"
@@ -962,11 +1413,13 @@ string KernelSource_kernel_core =
 "			float materialPdf;\n"
 "			Spectrum f;\n"
 "			bool diffuseBounce;\n"
+"			const uint depth = diffuseBounces + specularGlossyBounces;\n"
+"			Sampler_StartBounce(&sampler, depth, SAMPLER_BOUNCE_BSDF_OFFSET);\n"
 "			switch (matType) {\n"
 "\n"
 "#if defined(PARAM_ENABLE_MAT_MATTE)\n"
 "				case MAT_MATTE:\n"
-"					Matte_Sample_f(&hitPointMat->param.matte, &wo, &wi, &materialPdf, &f, &shadeN, &seed, &diffuseBounce);\n"
+"					Matte_Sample_f(&hitPointMat->param.matte, &wo, &wi, &materialPdf, &f, &shadeN, &sampler, &diffuseBounce);\n"
 "					break;\n"
 "#endif\n"
 "\n"
@@ -978,19 +1431,19 @@ string KernelSource_kernel_core =
 "\n"
 "#if defined(PARAM_ENABLE_MAT_GLASS)\n"
 "				case MAT_GLASS:\n"
-"					Glass_Sample_f(&hitPointMat->param.glass, &wo, &wi, &materialPdf, &f, &N, &shadeN, &seed, &diffuseBounce);\n"
+"					Glass_Sample_f(&hitPointMat->param.glass, &wo, &wi, &materialPdf, &f, &N, &shadeN, &sampler, &diffuseBounce);\n"
 "					break;\n"
 "#endif\n"
 "\n"
 "#if defined(PARAM_ENABLE_MAT_METAL)\n"
 "				case MAT_METAL:\n"
-"					Metal_Sample_f(&hitPointMat->param.metal, &wo, &wi, &materialPdf, &f, &shadeN, &seed, &diffuseBounce);\n"
+"					Metal_Sample_f(&hitPointMat->param.metal, &wo, &wi, &materialPdf, &f, &shadeN, &sampler, &diffuseBounce);\n"
 "					break;\n"
 "#endif\n"
 "\n"
 "#if defined(PARAM_ENABLE_MAT_ALLOY)\n"
 "				case MAT_ALLOY:\n"
-"					Alloy_Sample_f(&hitPointMat->param.alloy, &wo, &wi, &materialPdf, &f, &shadeN, &seed, &diffuseBounce);\n"
+"					Alloy_Sample_f(&hitPointMat->param.alloy, &wo, &wi, &materialPdf, &f, &shadeN, &sampler, &diffuseBounce);\n"
 "					break;\n"
 "#endif\n"
 "\n"
@@ -1019,23 +1472,88 @@ string KernelSource_kernel_core =
 "#if defined(PARAM_HAS_TEXTUREMAPS)\n"
 "			const uint texMapIndex = hitTexMapInst->texMapIndex;\n"
 "\n"
+"			Spectrum texCol;\n"
 "			if (texMapIndex != 0xffffffffu) {\n"
 "				const float tu = SphericalPhi(&N) * INV_TWOPI * hitTexMapInst->scaleU + hitTexMapInst->shiftU;\n"
 "				const float tv = SphericalTheta(&N) * INV_PI * hitTexMapInst->scaleV + hitTexMapInst->shiftV;\n"
 "\n"
 "				PARAM_MEM_TYPE TexMap *tm = &texMaps[texMapIndex];\n"
-"				Spectrum texCol;\n"
-"				TexMap_GetColor(&texMapRGB[tm->rgbOffset], tm->width, tm->height, tu, tv, &texCol);\n"
+"				TexMap_GetColor(&texMapTexels[tm->texelsOffset], tm->format, tm->width, tm->height, tu, tv,\n"
+"						footprint * INV_PI * hitTexMapInst->scaleV, &texCol);\n"
 "\n"
 "				f.r *= texCol.r;\n"
 "				f.g *= texCol.g;\n"
 "				f.b *= texCol.b;\n"
+"			} else {\n"
+"				texCol.r = 1.f;\n"
+"				texCol.g = 1.f;\n"
+"				texCol.b = 1.f;\n"
 "			}\n"
 "#endif\n"
 "\n"
+"			//------------------------------------------------------------------\n"
+"			// Sample the infinite light\n"
+"			//------------------------------------------------------------------\n"
+"\n"
+"			lastSpecular = (matType == MAT_MIRROR) || (matType == MAT_GLASS);\n"
+"			if (!lastSpecular) {\n"
+"				Sampler_StartBounce(&sampler, depth, SAMPLER_BOUNCE_LIGHT_OFFSET);\n"
+"				const float u0 = Sampler_GetSample(&sampler);\n"
+"				const float u1 = Sampler_GetSample(&sampler);\n"
+"\n"
+"				Ray shadowRay;\n"
+"				float lightPdf;\n"
+"				Spectrum lightLe;\n"
+"				InfiniteLight_Sample_L(infiniteLightMap, infiniteLightDistribution,\n"
+"						u0, u1, &shadowRay.d, &lightPdf, &lightLe);\n"
+"\n"
+"				if (lightPdf > 0.f) {\n"
+"					float bsdfPdf;\n"
+"					Spectrum bsdfF;\n"
+"					Material_Evaluate(hitPointMat, &wo, &shadowRay.d, &bsdfPdf, &bsdfF, &shadeN);\n"
+"\n"
+"					if (bsdfPdf > 0.f) {\n"
+"						shadowRay.o = hitPoint;\n"
+"						shadowRay.mint = PARAM_RAY_EPSILON;\n"
+"						shadowRay.maxt = INFINITY;\n"
+"\n"
+"#if defined(PARAM_COUNT_RAYS)\n"
+"						++rayCount;\n"
+"#endif\n"
+"						if (!BVH_IntersectP(&shadowRay, bvhRoot)) {\n"
+"							const float weight = PowerHeuristic(lightPdf, bsdfPdf) / lightPdf;\n"
+"#if defined(PARAM_HAS_TEXTUREMAPS)\n"
+"							bsdfF.r *= texCol.r;\n"
+"							bsdfF.g *= texCol.g;\n"
+"							bsdfF.b *= texCol.b;\n"
+"#endif\n"
+"							radiance.r += throughput.r * bsdfF.r * lightLe.r * weight;\n"
+"							radiance.g += throughput.g * bsdfF.g * lightLe.g * weight;\n"
+"							radiance.b += throughput.b * bsdfF.b * lightLe.b * weight;\n"
+"						}\n"
+"					}\n"
+"				}\n"
+"			}\n"
+"			lastPdf = materialPdf;\n"
+"\n"
 "			throughput.r *= f.r;\n"
 "			throughput.g *= f.g;\n"
 "			throughput.b *= f.b;\n"
+"			if ((throughput.r == 0.f) && (throughput.g == 0.f) && (throughput.b == 0.f))\n"
+"				break;\n"
+"\n"
+"			// Russian roulette\n"
+"			if (depth >= PARAM_RR_DEPTH) {\n"
+"				const float rrProb = max(min(1.f, Spectrum_Y(&throughput)), PARAM_RR_CAP);\n"
+"				Sampler_StartBounce(&sampler, depth, SAMPLER_BOUNCE_RR_OFFSET);\n"
+"				if (Sampler_GetSample(&sampler) >= rrProb)\n"
+"					break;\n"
+"\n"
+"				const float invRRProb = 1.f / rrProb;\n"
+"				throughput.r *= invRRProb;\n"
+"				throughput.g *= invRRProb;\n"
+"				throughput.b *= invRRProb;\n"
+"			}\n"
 "\n"
 "			ray.o = hitPoint;\n"
 "			ray.d = wi;\n"
@@ -1043,7 +1561,16 @@ string KernelSource_kernel_core =
 "			ray.maxt = INFINITY;\n"
 "		} else {\n"
 "			Spectrum iLe;\n"
-"			InfiniteLight_Le(infiniteLightMap, &iLe, &ray.d);\n"
+"			InfiniteLight_Le(infiniteLightMap, &iLe, &ray.d, coneSpread);\n"
+"\n"
+"			if (!lastSpecular) {\n"
+"				// Multiple importance sampling with the next event estimation\n"
+"				const float weight = PowerHeuristic(lastPdf,\n"
+"						InfiniteLight_Pdf(infiniteLightDistribution, &ray.d));\n"
+"				iLe.r *= weight;\n"
+"				iLe.g *= weight;\n"
+"				iLe.b *= weight;\n"
+"			}\n"
 "\n"
 "			radiance.r += throughput.r * iLe.r;\n"
 "			radiance.g += throughput.g * iLe.g;\n"
@@ -1056,15 +1583,15 @@ string KernelSource_kernel_core =
 "			isnan(radiance.r) || isnan(radiance.g) || isnan(radiance.b))\n"
 "		printf(\"Error radiance: [%f, %f, %f]\\n\", radiance.r, radiance.g, radiance.b);*/\n"
 "\n"
+"#if defined(PARAM_COUNT_RAYS)\n"
+"	// The counters are only read back by the benchmark mode\n"
+"	rayCounts[pixelIndex] += rayCount;\n"
+"#endif\n"
+"\n"
 "	__global Pixel *p = &frameBuffer[pixelIndex];\n"
 "	p->r += radiance.r * (1.f / PARAM_SCREEN_SAMPLEPERPASS);\n"
 "	p->g += radiance.g * (1.f / PARAM_SCREEN_SAMPLEPERPASS);\n"
 "	p->b += radiance.b * (1.f / PARAM_SCREEN_SAMPLEPERPASS);\n"
-"\n"
-"	// Save the seed\n"
-"	task->seed.s1 = seed.s1;\n"
-"	task->seed.s2 = seed.s2;\n"
-"	task->seed.s3 = seed.s3;\n"
 "}\n"
 "\n"
 "//------------------------------------------------------------------------------\n"
@@ -39,7 +39,25 @@
 // OCLRenderer
 //------------------------------------------------------------------------------
 
-OCLRenderer::OCLRenderer(GameLevel *level) : LevelRenderer(level) {
+vector<OCLDeviceResources *> OCLRenderer::deviceResources;
+
+void OCLRenderer::FreeDeviceResources(OCLDeviceResources *resources) {
+	delete resources->infiniteLightBuffer;
+	delete resources->texMapTexelsBuffer;
+	delete resources->ctx;
+	delete resources;
+}
+
+void OCLRenderer::FreeDeviceResources() {
+	for (size_t i = 0; i < deviceResources.size(); ++i) {
+		if (deviceResources[i])
+			FreeDeviceResources(deviceResources[i]);
+	}
+	deviceResources.clear();
+}
+
+OCLRenderer::OCLRenderer(GameLevel *level, const bool headless) :
+	LevelRenderer(level, headless) {
 	compiledScene = new CompiledScene(level);
 
 	timeSinceLastCameraEdit = WallClockTime();
@@ -129,9 +147,11 @@ size_t OCLRenderer::DrawFrame() {
 	// Recompile the scene
 	//--------------------------------------------------------------------------
 
+	StageProfiler *profiler = gameLevel->frameProfiler;
 	{
 		//const double t1 = WallClockTime();
 
+		ScopedStageTimer timer(profiler, FRAME_STAGE_RECOMPILE);
 		boost::unique_lock<boost::mutex> lock(gameLevel->levelMutex);
 		compiledScene->Recompile(gameLevel->editActionList);
 		gameLevel->editActionList.Reset();
@@ -160,9 +180,13 @@ size_t OCLRenderer::DrawFrame() {
 	// Render
 	//--------------------------------------------------------------------------
 
-	barrier->wait();
-	// Other threads do the rendering
-	barrier->wait();
+	{
+		ScopedStageTimer timer(profiler, FRAME_STAGE_SYNC);
+
+		barrier->wait();
+		// Other threads do the rendering
+		barrier->wait();
+	}
 
 	//--------------------------------------------------------------------------
 	// Blend frames, tone mapping and copy the OpenCL frame buffer to OpenGL one
@@ -175,13 +199,26 @@ size_t OCLRenderer::DrawFrame() {
 			gameConfig.GetScreenHeight();
 }
 
+unsigned long long OCLRenderer::GetRayCount() const {
+	if (!headless)
+		return 0;
+
+	// The render threads are waiting for the next frame so their queues can
+	// be used here
+	unsigned long long count = 0;
+	for (size_t i = 0; i < renderThread.size(); ++i)
+		count += renderThread[i]->GetRayCount();
+
+	return count;
+}
+
 //------------------------------------------------------------------------------
 // OCLRendererThread
 //------------------------------------------------------------------------------
 
 OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *renderer,
 			cl::Device device) : index(threadIndex), renderer(renderer),
-		dev(device), usedDeviceMemory(0) {
+		dev(device), usedDeviceMemory(0), passCount(0) {
 	const GameLevel &gameLevel(*(renderer->gameLevel));
 	const unsigned int width = gameLevel.gameConfig->GetScreenWidth();
 	const unsigned int height = gameLevel.gameConfig->GetScreenHeight();
@@ -197,45 +234,70 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 	// OpenCL setup
 	//--------------------------------------------------------------------------
 
-	// Allocate a context with the selected device
+	// Allocate a context with the selected device or reuse the one of the
+	// previous level
+
+	if (renderer->deviceResources.size() <= index)
+		renderer->deviceResources.resize(index + 1, NULL);
+	OCLDeviceResources *&resources(renderer->deviceResources[index]);
+	if (resources && (resources->device() != dev())) {
+		OCLRenderer::FreeDeviceResources(resources);
+		resources = NULL;
+	}
 
-	VECTOR_CLASS<cl::Device> devices;
-	devices.push_back(dev);
-	cl::Platform platform = dev.getInfo<CL_DEVICE_PLATFORM>();
+	if (resources) {
+		SFERA_LOG("[OCLRenderer::" << index << "] Reusing the OpenCL context");
+		ctx = resources->ctx;
+	} else {
+		VECTOR_CLASS<cl::Device> devices;
+		devices.push_back(dev);
+		cl::Platform platform = dev.getInfo<CL_DEVICE_PLATFORM>();
 
-	// The first thread uses OpenCL/OpenGL interoperability
-	if (index == 0) {
+		// The first thread uses OpenCL/OpenGL interoperability
+		if ((index == 0) && !renderer->headless) {
 #if defined (__APPLE__)
-		CGLContextObj kCGLContext = CGLGetCurrentContext();
-		CGLShareGroupObj kCGLShareGroup = CGLGetShareGroup(kCGLContext);
-		cl_context_properties cps[] = {
-			CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE, (cl_context_properties)kCGLShareGroup,
-			0
-		};
+			CGLContextObj kCGLContext = CGLGetCurrentContext();
+			CGLShareGroupObj kCGLShareGroup = CGLGetShareGroup(kCGLContext);
+			cl_context_properties cps[] = {
+				CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE, (cl_context_properties)kCGLShareGroup,
+				0
+			};
 #else
 #ifdef WIN32
-		cl_context_properties cps[] = {
-			CL_GL_CONTEXT_KHR, (intptr_t)wglGetCurrentContext(),
-			CL_WGL_HDC_KHR, (intptr_t)wglGetCurrentDC(),
-			CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
-			0
-		};
+			cl_context_properties cps[] = {
+				CL_GL_CONTEXT_KHR, (intptr_t)wglGetCurrentContext(),
+				CL_WGL_HDC_KHR, (intptr_t)wglGetCurrentDC(),
+				CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
+				0
+			};
 #else
-		cl_context_properties cps[] = {
-			CL_GL_CONTEXT_KHR, (intptr_t)glXGetCurrentContext(),
-			CL_GLX_DISPLAY_KHR, (intptr_t)glXGetCurrentDisplay(),
-			CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
-			0
-		};
+			cl_context_properties cps[] = {
+				CL_GL_CONTEXT_KHR, (intptr_t)glXGetCurrentContext(),
+				CL_GLX_DISPLAY_KHR, (intptr_t)glXGetCurrentDisplay(),
+				CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
+				0
+			};
 #endif
 #endif
 
-		ctx = new cl::Context(devices, cps);
-	} else
-		ctx = new cl::Context(devices);
+			ctx = new cl::Context(devices, cps);
+		} else
+			ctx = new cl::Context(devices);
+
+		resources = new OCLDeviceResources();
+		resources->device = dev;
+		resources->ctx = ctx;
+		resources->infiniteLightBuffer = NULL;
+		resources->texMapTexelsBuffer = NULL;
+	}
+
+	// Only the first device is profiled, its kernels are timed with the
+	// OpenCL profiling events
+	profiler = (index == 0) ? renderer->gameLevel->frameProfiler : NULL;
 
 	// Allocate the queue for this device
-	cmdQueue = new cl::CommandQueue(*ctx, dev);
+	cmdQueue = new cl::CommandQueue(*ctx, dev,
+			profiler ? CL_QUEUE_PROFILING_ENABLE : 0);
 
 	//--------------------------------------------------------------------------
 	// Allocate the buffers
@@ -246,15 +308,16 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 	frameBuffer = NULL;
 	toneMapFrameBuffer = NULL;
 	bvhBuffer = NULL;
-	gpuTaskBuffer = NULL;
 	cameraBuffer = NULL;
 	infiniteLightBuffer = NULL;
+	infiniteLightDistributionBuffer = NULL;
 	matBuffer = NULL;
 	matIndexBuffer = NULL;
 	texMapBuffer = NULL;
-	texMapRGBBuffer = NULL;
+	texMapTexelsBuffer = NULL;
 	texMapInstanceBuffer = NULL;
 	bumpMapInstanceBuffer = NULL;
+	rayCountBuffer = NULL;
 
 	AllocOCLBufferRW(&passFrameBuffer, sizeof(Pixel) * width * height, "Pass FrameBuffer");
 	AllocOCLBufferRW(&tmpFrameBuffer, sizeof(Pixel) * width * height, "Temporary FrameBuffer");
@@ -262,11 +325,14 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 		AllocOCLBufferRW(&frameBuffer, sizeof(Pixel) * width * height, "FrameBuffer");
 		AllocOCLBufferRW(&toneMapFrameBuffer, sizeof(Pixel) * width * height, "ToneMap FrameBuffer");
 	}
-	AllocOCLBufferRW(&gpuTaskBuffer, sizeof(ocl_kernels::GPUTask) * width * height, "GPUTask");
 	AllocOCLBufferRO(&cameraBuffer, sizeof(compiledscene::Camera), "Camera");
-	AllocOCLBufferRO(&infiniteLightBuffer, (void *)(gameLevel.scene->infiniteLight->GetTexture()->GetTexMap()->GetPixels()),
-			sizeof(Spectrum) * gameLevel.scene->infiniteLight->GetTexture()->GetTexMap()->GetWidth() *
-			gameLevel.scene->infiniteLight->GetTexture()->GetTexMap()->GetHeight(), "Inifinite Light");
+	const TextureMap *infiniteLightMap = gameLevel.scene->infiniteLight->GetTexture()->GetTexMap();
+	UpdateTexelsBuffer(&resources->infiniteLightBuffer, vector<unsigned int>(1, infiniteLightMap->GetId()),
+			resources->infiniteLightMapIds, (void *)(infiniteLightMap->GetTexels()),
+			infiniteLightMap->GetTexelsSize(), "Inifinite Light");
+	infiniteLightBuffer = resources->infiniteLightBuffer;
+	AllocOCLBufferRO(&infiniteLightDistributionBuffer, (void *)&(gameLevel.scene->infiniteLight->GetDistribution()[0]),
+			sizeof(float) * gameLevel.scene->infiniteLight->GetDistribution().size(), "Inifinite Light Distribution");
 
 	AllocOCLBufferRO(&matBuffer, (void *)(&compiledScene.mats[0]),
 			sizeof(compiledscene::Material) * compiledScene.mats.size(), "Materials");
@@ -277,8 +343,10 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 		AllocOCLBufferRO(&texMapBuffer, (void *)(&compiledScene.texMaps[0]),
 				sizeof(compiledscene::TexMap) * compiledScene.texMaps.size(), "Texture Maps");
 
-		AllocOCLBufferRO(&texMapRGBBuffer, (void *)(compiledScene.rgbTexMem),
-				sizeof(Spectrum) * compiledScene.totRGBTexMem, "Texture Map Images");
+		UpdateTexelsBuffer(&resources->texMapTexelsBuffer, compiledScene.texMapIds,
+				resources->texMapIds, (void *)(compiledScene.texMem),
+				compiledScene.totTexMem, "Texture Map Images");
+		texMapTexelsBuffer = resources->texMapTexelsBuffer;
 
 		AllocOCLBufferRO(&texMapInstanceBuffer, (void *)(&compiledScene.sphereTexs[0]),
 				sizeof(compiledscene::TexMapInstance) * compiledScene.sphereTexs.size(), "Texture Map Instances");
@@ -288,6 +356,14 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 					sizeof(compiledscene::BumpMapInstance) * compiledScene.sphereBumps.size(), "Bump Map Instances");
 	}
 
+	if (renderer->headless) {
+		AllocOCLBufferRW(&rayCountBuffer, sizeof(unsigned int) * width * height, "Ray Counts");
+
+		const vector<unsigned int> zeros(width * height, 0);
+		cmdQueue->enqueueWriteBuffer(*rayCountBuffer, CL_TRUE, 0,
+				sizeof(unsigned int) * width * height, &zeros[0]);
+	}
+
 	SFERA_LOG("[OCLRenderer] Total OpenCL device memory used: " << fixed << setprecision(2) << usedDeviceMemory / (1024 * 1024) << "Mbytes");
 
 	if (index == 0) {
@@ -295,12 +371,17 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 		// Create pixel buffer object for display
 		//--------------------------------------------------------------------------
 
-		glGenBuffersARB(1, &pbo);
-		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
-		glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, width * height *
-				sizeof(GLubyte) * 4, 0, GL_STREAM_DRAW_ARB);
-		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
-		pboBuff = new cl::BufferGL(*ctx, CL_MEM_READ_WRITE, pbo);
+		if (renderer->headless) {
+			pbo = 0;
+			pboBuff = new cl::Buffer(*ctx, CL_MEM_WRITE_ONLY, width * height * sizeof(GLubyte) * 4);
+		} else {
+			glGenBuffersARB(1, &pbo);
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+			glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, width * height *
+					sizeof(GLubyte) * 4, 0, GL_STREAM_DRAW_ARB);
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+			pboBuff = new cl::BufferGL(*ctx, CL_MEM_READ_WRITE, pbo);
+		}
 	}
 
 	//--------------------------------------------------------------------------
@@ -317,6 +398,8 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 			" -D PARAM_RAY_EPSILON=" << EPSILON << "f" <<
 			" -D PARAM_MAX_DIFFUSE_BOUNCE=" << gameLevel.maxPathDiffuseBounces <<
 			" -D PARAM_MAX_SPECULARGLOSSY_BOUNCE=" << gameLevel.maxPathSpecularGlossyBounces <<
+			" -D PARAM_RR_DEPTH=" << gameLevel.russianRouletteDepth <<
+			" -D PARAM_RR_CAP=" << gameLevel.russianRouletteCap << "f" <<
 			" -D PARAM_IL_SHIFT_U=" << gameLevel.scene->infiniteLight->GetShiftU() << "f" <<
 			" -D PARAM_IL_SHIFT_V=" << gameLevel.scene->infiniteLight->GetShiftV() << "f" <<
 			" -D PARAM_IL_GAIN_R=" << gameLevel.scene->infiniteLight->GetGain().r << "f" <<
@@ -324,6 +407,9 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 			" -D PARAM_IL_GAIN_B=" << gameLevel.scene->infiniteLight->GetGain().b << "f" <<
 			" -D PARAM_IL_MAP_WIDTH=" << gameLevel.scene->infiniteLight->GetTexture()->GetTexMap()->GetWidth() <<
 			" -D PARAM_IL_MAP_HEIGHT=" << gameLevel.scene->infiniteLight->GetTexture()->GetTexMap()->GetHeight() <<
+			" -D PARAM_IL_MAP_FORMAT=" << gameLevel.scene->infiniteLight->GetTexture()->GetTexMap()->GetFormat() <<
+			" -D PARAM_IL_DISTRIBUTION_WIDTH=" << gameLevel.scene->infiniteLight->GetDistributionWidth() <<
+			" -D PARAM_IL_DISTRIBUTION_HEIGHT=" << gameLevel.scene->infiniteLight->GetDistributionHeight() <<
 			" -D PARAM_GAMMA=" << gameLevel.toneMap->GetGamma() << "f" <<
 			" -D PARAM_MEM_TYPE=" << gameLevel.gameConfig->GetOpenCLMemType();
 
@@ -345,6 +431,27 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 			ss << " -D PARAM_HAS_BUMPMAPS";
 	}
 
+	if (gameLevel.gameConfig->GetRendererFastSphericalMath())
+		ss << " -D PARAM_FAST_SPHERICAL_MATH";
+
+	if (rayCountBuffer)
+		ss << " -D PARAM_COUNT_RAYS";
+
+	switch (gameLevel.gameConfig->GetRendererSamplerType()) {
+		case SAMPLER_RANDOM:
+			break;
+		case SAMPLER_SOBOL:
+			ss << " -D PARAM_SAMPLER_SOBOL";
+			break;
+		case SAMPLER_SOBOL_BLUENOISE:
+			ss << " -D PARAM_SAMPLER_SOBOL -D PARAM_SAMPLER_SOBOL_BLUENOISE";
+			break;
+		default:
+			assert (false);
+	}
+	// Each device uses a different seed for its samples
+	ss << " -D PARAM_SAMPLER_SEED=" << index << "u";
+
 	switch (gameLevel.toneMap->GetType()) {
 		case TONEMAP_REINHARD02:
 			ss << " -D PARAM_TM_LINEAR_SCALE=1.0f";
@@ -379,12 +486,6 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 		throw err;
 	}
 
-	kernelInit = new cl::Kernel(program, "Init");
-	kernelInit->setArg(0, *gpuTaskBuffer);
-	cmdQueue->enqueueNDRangeKernel(*kernelInit, cl::NullRange,
-			cl::NDRange(RoundUp<unsigned int>(width * height, WORKGROUP_SIZE)),
-			cl::NDRange(WORKGROUP_SIZE));
-
 	kernelInitFrameBuffer = new cl::Kernel(program, "InitFB");
 	if (index == 0) {
 		kernelInitFrameBuffer->setArg(0, *frameBuffer);
@@ -396,20 +497,24 @@ OCLRendererThread::OCLRendererThread(const size_t threadIndex, OCLRenderer *rend
 
 	kernelPathTracing = new cl::Kernel(program, "PathTracing");
 	unsigned int argIndex = 0;
-	kernelPathTracing->setArg(argIndex++, *gpuTaskBuffer);
 	argIndex++;
 	kernelPathTracing->setArg(argIndex++, *cameraBuffer);
 	kernelPathTracing->setArg(argIndex++, *infiniteLightBuffer);
+	kernelPathTracing->setArg(argIndex++, *infiniteLightDistributionBuffer);
 	kernelPathTracing->setArg(argIndex++, *passFrameBuffer);
 	kernelPathTracing->setArg(argIndex++, *matBuffer);
 	kernelPathTracing->setArg(argIndex++, *matIndexBuffer);
 	if (texMapBuffer) {
 		kernelPathTracing->setArg(argIndex++, *texMapBuffer);
-		kernelPathTracing->setArg(argIndex++, *texMapRGBBuffer);
+		kernelPathTracing->setArg(argIndex++, *texMapTexelsBuffer);
 		kernelPathTracing->setArg(argIndex++, *texMapInstanceBuffer);
 		if (compiledScene.sphereBumps.size() > 0)
 			kernelPathTracing->setArg(argIndex++, *bumpMapInstanceBuffer);
 	}
+	if (rayCountBuffer)
+		kernelPathTracing->setArg(argIndex++, *rayCountBuffer);
+	// The sample index is set before each run of the kernel
+	pathTracingSampleIndexArg = argIndex++;
 
 	kernelApplyBlurLightFilterXR1 = new cl::Kernel(program, "ApplyBlurLightFilterXR1");
 	kernelApplyBlurLightFilterXR1->setArg(0, *passFrameBuffer);
@@ -460,19 +565,22 @@ OCLRendererThread::~OCLRendererThread() {
 	FreeOCLBuffer(&frameBuffer);
 	FreeOCLBuffer(&toneMapFrameBuffer);
 	FreeOCLBuffer(&bvhBuffer);
-	FreeOCLBuffer(&gpuTaskBuffer);
 	FreeOCLBuffer(&cameraBuffer);
-	FreeOCLBuffer(&infiniteLightBuffer);
+	// Kept for the next level (see OCLDeviceResources)
+	infiniteLightBuffer = NULL;
+	FreeOCLBuffer(&infiniteLightDistributionBuffer);
 	FreeOCLBuffer(&matBuffer);
 	FreeOCLBuffer(&matIndexBuffer);
 	FreeOCLBuffer(&texMapBuffer);
-	FreeOCLBuffer(&texMapRGBBuffer);
+	texMapTexelsBuffer = NULL;
 	FreeOCLBuffer(&texMapInstanceBuffer);
 	FreeOCLBuffer(&bumpMapInstanceBuffer);
+	FreeOCLBuffer(&rayCountBuffer);
 
 	if (index == 0) {
 		delete pboBuff;
-		glDeleteBuffersARB(1, &pbo);
+		if (!renderer->headless)
+			glDeleteBuffersARB(1, &pbo);
 	}
 
 	delete kernelUpdatePixelBuffer;
@@ -486,9 +594,8 @@ OCLRendererThread::~OCLRendererThread() {
 	delete kernelApplyBlurLightFilterYR1;
 	delete kernelPathTracing;
 	delete kernelInitFrameBuffer;
-	delete kernelInit;
 	delete cmdQueue;
-	delete ctx;
+	// The context is kept for the next level
 
 	delete cpuFrameBuffer;
 }
@@ -567,6 +674,21 @@ void OCLRendererThread::FreeOCLBuffer(cl::Buffer **buff) {
 	}
 }
 
+void OCLRendererThread::UpdateTexelsBuffer(cl::Buffer **buff, const vector<unsigned int> &ids,
+		vector<unsigned int> &bufferIds, void *src, const size_t size, const string &desc) {
+	if (*buff && (bufferIds == ids)) {
+		SFERA_LOG("[OCLRenderer::" << index << "] " << desc << " buffer already uploaded");
+		usedDeviceMemory += (*buff)->getInfo<CL_MEM_SIZE>();
+	} else {
+		// The buffer has been allocated by a previous renderer
+		delete *buff;
+		*buff = NULL;
+
+		AllocOCLBufferRO(buff, src, size, desc);
+		bufferIds = ids;
+	}
+}
+
 void OCLRendererThread::Start() {
 	renderThread = new boost::thread(boost::bind(OCLRendererThread::OCLRenderThreadStaticImpl, this));
 }
@@ -590,7 +712,7 @@ void OCLRendererThread::UpdateBVHBuffer() {
 
 	if (!bvhBuffer || (bvhBuffer->getInfo<CL_MEM_SIZE>() < bvhBufferSize)) {
 		AllocOCLBufferRO(&bvhBuffer, compiledScene.accel->bvhTree, bvhBufferSize, "BVH");
-		kernelPathTracing->setArg(1, *bvhBuffer);
+		kernelPathTracing->setArg(0, *bvhBuffer);
 	} else if (compiledScene.editActionsUsed.Has(GEOMETRY_EDIT)) {
 		// Upload the new BVH to the GPU
 		cmdQueue->enqueueWriteBuffer(*bvhBuffer, CL_FALSE, 0, bvhBufferSize, compiledScene.accel->bvhTree);
@@ -647,13 +769,15 @@ void OCLRendererThread::OCLRenderThreadImpl() {
 
 			cmdQueue->enqueueNDRangeKernel(*kernelInitFrameBuffer, cl::NullRange,
 					cl::NDRange(RoundUp<unsigned int>(width * height, WORKGROUP_SIZE)),
-					cl::NDRange(WORKGROUP_SIZE));
+					cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_INITFB));
 
 			for (unsigned int i = 0; i < samplePerPass; ++i) {
+				kernelPathTracing->setArg(pathTracingSampleIndexArg, passCount * samplePerPass + i);
 				cmdQueue->enqueueNDRangeKernel(*kernelPathTracing, cl::NullRange,
 					cl::NDRange(RoundUp<unsigned int>(width * height, WORKGROUP_SIZE)),
-					cl::NDRange(WORKGROUP_SIZE));
+					cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_PATHTRACING));
 			}
+			++passCount;
 
 			//------------------------------------------------------------------
 			// Apply a filter: approximated by applying a box filter
@@ -668,11 +792,11 @@ void OCLRendererThread::OCLRenderThreadImpl() {
 					for (unsigned int i = 0; i < filterPassCount; ++i) {
 						cmdQueue->enqueueNDRangeKernel(*kernelApplyBlurLightFilterXR1, cl::NullRange,
 								cl::NDRange(RoundUp<unsigned int>(height, WORKGROUP_SIZE)),
-								cl::NDRange(WORKGROUP_SIZE));
+								cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_FILTER));
 
 						cmdQueue->enqueueNDRangeKernel(*kernelApplyBlurLightFilterYR1, cl::NullRange,
 								cl::NDRange(RoundUp<unsigned int>(width, WORKGROUP_SIZE)),
-								cl::NDRange(WORKGROUP_SIZE));
+								cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_FILTER));
 					}
 					break;
 				}
@@ -681,11 +805,11 @@ void OCLRendererThread::OCLRenderThreadImpl() {
 					for (unsigned int i = 0; i < filterPassCount; ++i) {
 						cmdQueue->enqueueNDRangeKernel(*kernelApplyBlurHeavyFilterXR1, cl::NullRange,
 								cl::NDRange(RoundUp<unsigned int>(height, WORKGROUP_SIZE)),
-								cl::NDRange(WORKGROUP_SIZE));
+								cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_FILTER));
 
 						cmdQueue->enqueueNDRangeKernel(*kernelApplyBlurHeavyFilterYR1, cl::NullRange,
 								cl::NDRange(RoundUp<unsigned int>(width, WORKGROUP_SIZE)),
-								cl::NDRange(WORKGROUP_SIZE));
+								cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_FILTER));
 					}
 					break;
 				}
@@ -694,11 +818,11 @@ void OCLRendererThread::OCLRenderThreadImpl() {
 					for (unsigned int i = 0; i < filterPassCount; ++i) {
 						cmdQueue->enqueueNDRangeKernel(*kernelApplyBoxFilterXR1, cl::NullRange,
 								cl::NDRange(RoundUp<unsigned int>(height, WORKGROUP_SIZE)),
-								cl::NDRange(WORKGROUP_SIZE));
+								cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_FILTER));
 
 						cmdQueue->enqueueNDRangeKernel(*kernelApplyBoxFilterYR1, cl::NullRange,
 								cl::NDRange(RoundUp<unsigned int>(width, WORKGROUP_SIZE)),
-								cl::NDRange(WORKGROUP_SIZE));
+								cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_FILTER));
 					}
 					break;
 				}
@@ -715,12 +839,14 @@ void OCLRendererThread::OCLRenderThreadImpl() {
 				// done on the CPU
 
 				cmdQueue->enqueueReadBuffer(*passFrameBuffer,
-					CL_FALSE, 0, sizeof(Pixel) * width * height, cpuFrameBuffer->GetPixels());
+					CL_FALSE, 0, sizeof(Pixel) * width * height, cpuFrameBuffer->GetPixels(),
+					NULL, ProfileEvent(FRAME_STAGE_READBACK));
 			}
 
 			//------------------------------------------------------------------
 
 			cmdQueue->finish();
+			AddProfileEventTimes();
 			barrier->wait();
 		}
 	} catch (boost::thread_interrupted) {
@@ -740,6 +866,8 @@ void OCLRendererThread::DrawFrame() {
 
 	const size_t threadCount = renderer->renderThread.size();
 	if (threadCount > 1) {
+		ScopedStageTimer timer(profiler, FRAME_STAGE_MERGE);
+
 		vector<Pixel *> cpuFrameBuffers(threadCount);
 		for (size_t i = 0; i < threadCount; ++i)
 				cpuFrameBuffers[i] = renderer->renderThread[i]->cpuFrameBuffer->GetPixels();
@@ -777,7 +905,7 @@ void OCLRendererThread::DrawFrame() {
 
 	cmdQueue->enqueueNDRangeKernel(*kernelBlendFrame, cl::NullRange,
 			cl::NDRange(RoundUp<unsigned int>(width * height, WORKGROUP_SIZE)),
-			cl::NDRange(WORKGROUP_SIZE));
+			cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_BLEND));
 
 	//--------------------------------------------------------------------------
 	// Tone mapping
@@ -788,7 +916,7 @@ void OCLRendererThread::DrawFrame() {
 		case TONEMAP_LINEAR:
 			cmdQueue->enqueueNDRangeKernel(*kernelToneMapLinear, cl::NullRange,
 			cl::NDRange(RoundUp<unsigned int>(width * height, WORKGROUP_SIZE)),
-			cl::NDRange(WORKGROUP_SIZE));
+			cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_TONEMAP));
 			break;
 		default:
 			assert (false);
@@ -799,21 +927,80 @@ void OCLRendererThread::DrawFrame() {
 	// Copy the OpenCL frame buffer to OpenGL one
 	//--------------------------------------------------------------------------
 
-	VECTOR_CLASS<cl::Memory> buffs;
-	buffs.push_back(*pboBuff);
-	cmdQueue->enqueueAcquireGLObjects(&buffs);
+	if (renderer->headless) {
+		// Nothing to display, the pixels are only computed
+		cmdQueue->enqueueNDRangeKernel(*kernelUpdatePixelBuffer, cl::NullRange,
+				cl::NDRange(RoundUp<unsigned int>(width * height, WORKGROUP_SIZE)),
+				cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_UPDATEPIXELBUFFER));
+		cmdQueue->finish();
+		AddProfileEventTimes();
+		return;
+	}
 
-	cmdQueue->enqueueNDRangeKernel(*kernelUpdatePixelBuffer, cl::NullRange,
-			cl::NDRange(RoundUp<unsigned int>(width * height, WORKGROUP_SIZE)),
-			cl::NDRange(WORKGROUP_SIZE));
+	{
+		// It includes the wait for all the kernels enqueued above
+		ScopedStageTimer timer(profiler, FRAME_STAGE_PBO_DRAW);
+
+		VECTOR_CLASS<cl::Memory> buffs;
+		buffs.push_back(*pboBuff);
+		cmdQueue->enqueueAcquireGLObjects(&buffs);
+
+		cmdQueue->enqueueNDRangeKernel(*kernelUpdatePixelBuffer, cl::NullRange,
+				cl::NDRange(RoundUp<unsigned int>(width * height, WORKGROUP_SIZE)),
+				cl::NDRange(WORKGROUP_SIZE), NULL, ProfileEvent(FRAME_STAGE_KERNEL_UPDATEPIXELBUFFER));
+
+		cmdQueue->enqueueReleaseGLObjects(&buffs);
+		cmdQueue->finish();
+
+		// Draw the image on the screen
+		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+		glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	}
+
+	AddProfileEventTimes();
+}
+
+cl::Event *OCLRendererThread::ProfileEvent(const FrameStage stage) {
+	if (!profiler)
+		return NULL;
+
+	profileStages.push_back(stage);
+	profileEvents.push_back(cl::Event());
+
+	return &profileEvents.back();
+}
+
+void OCLRendererThread::AddProfileEventTimes() {
+	if (!profiler)
+		return;
+
+	// The queue has been flushed so all the events are completed
+	for (size_t i = 0; i < profileEvents.size(); ++i) {
+		const cl_ulong start = profileEvents[i].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		const cl_ulong end = profileEvents[i].getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+		profiler->AddTime(profileStages[i], (end - start) * 1e-9);
+	}
+
+	profileStages.clear();
+	profileEvents.clear();
+}
+
+unsigned long long OCLRendererThread::GetRayCount() const {
+	const GameConfig &gameConfig(*(renderer->gameLevel->gameConfig));
+	const unsigned int width = gameConfig.GetScreenWidth();
+	const unsigned int height = gameConfig.GetScreenHeight();
+
+	vector<unsigned int> rayCounts(width * height);
+	cmdQueue->enqueueReadBuffer(*rayCountBuffer, CL_TRUE, 0,
+			sizeof(unsigned int) * width * height, &rayCounts[0]);
 
-	cmdQueue->enqueueReleaseGLObjects(&buffs);
-	cmdQueue->finish();
+	unsigned long long count = 0;
+	for (size_t i = 0; i < rayCounts.size(); ++i)
+		count += rayCounts[i];
 
-	// Draw the image on the screen
-	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
-    glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-    glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	return count;
 }
 
 #endif
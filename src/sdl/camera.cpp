@@ -74,6 +74,9 @@ void PerspectiveCamera::Update(const unsigned int filmWidth, const unsigned int
 			::Translate(Vector(-screen[0], -screen[3], 0.f));
 
 	RasterToCamera = CameraToScreen.GetInverse() * ScreenToRaster.GetInverse();
+
+	// The screen is [-1, 1] along the larger dimension of the film
+	pixelSpreadAngle = 2.f * tanf(Radians(fieldOfView) * .5f) / Max(filmWidth, filmHeight);
 }
 
 void PerspectiveCamera::GenerateRay(
@@ -0,0 +1,605 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <memory>
+#include <fstream>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "sfera.h"
+#include "sdl/compiledlevel.h"
+#include "physic/gamephysic.h"
+
+using namespace boost::interprocess;
+
+// The blocks of a compiled level file, each one is aligned to 16 bytes
+enum {
+	BLOCK_PROPERTIES,
+	BLOCK_NAMES,
+	BLOCK_TEXMAPREFS,
+	BLOCK_CENTERS,
+	BLOCK_RADIUS,
+	BLOCK_MASS,
+	BLOCK_LINEARDAMPING,
+	BLOCK_ANGULARDAMPING,
+	BLOCK_MATERIALINDICES,
+	BLOCK_TEXMAPINDICES,
+	BLOCK_BUMPMAPINDICES,
+	BLOCK_FLAGS,
+	BLOCK_COUNT
+};
+
+// The position of each block is computed from the counts of the header
+struct CompiledLevel::FileHeader {
+	char magic[4];
+	unsigned int version;
+	unsigned int sphereCount;
+	unsigned int materialCount;
+	unsigned int texMapRefCount;
+	// Size of the properties, as text
+	unsigned int propertiesSize;
+	// Size of the material and texture map file names, each one terminated
+	// by a '\0'
+	unsigned int namesSize;
+};
+
+struct CompiledLevel::FileTexMapRef {
+	unsigned int bumpMap;
+	float shiftU, shiftV, scaleU, scaleV;
+	float scale;
+};
+
+bool CompiledLevel::TexMapRef::operator<(const TexMapRef &ref) const {
+	if (fileName != ref.fileName)
+		return fileName < ref.fileName;
+	if (bumpMap != ref.bumpMap)
+		return bumpMap < ref.bumpMap;
+	if (shiftU != ref.shiftU)
+		return shiftU < ref.shiftU;
+	if (shiftV != ref.shiftV)
+		return shiftV < ref.shiftV;
+	if (scaleU != ref.scaleU)
+		return scaleU < ref.scaleU;
+	if (scaleV != ref.scaleV)
+		return scaleV < ref.scaleV;
+	return scale < ref.scale;
+}
+
+//------------------------------------------------------------------------------
+// Parser of the spheres of a .lvl file
+//------------------------------------------------------------------------------
+
+enum {
+	SPHERE_GEOMETRY,
+	SPHERE_MASS,
+	SPHERE_LINEARDAMPING,
+	SPHERE_ANGULARDAMPING,
+	SPHERE_STATIC,
+	SPHERE_ATTRACTOR,
+	SPHERE_PILL,
+	SPHERE_MATERIAL,
+	SPHERE_TEXMAP_FILE,
+	SPHERE_TEXMAP_SHIFT,
+	SPHERE_TEXMAP_SCALE,
+	SPHERE_BUMPMAP_FILE,
+	SPHERE_BUMPMAP_SHIFT,
+	SPHERE_BUMPMAP_SCALEUV,
+	SPHERE_BUMPMAP_SCALE,
+	SPHERE_FIELD_COUNT
+};
+
+static const char *sphereFieldNames[SPHERE_FIELD_COUNT] = {
+	"geometry",
+	"mass",
+	"lineardamping",
+	"angulardamping",
+	"static",
+	"attractor",
+	"pill",
+	"material",
+	"texmap.file",
+	"texmap.shift",
+	"texmap.scale",
+	"bumpmap.file",
+	"bumpmap.shift",
+	"bumpmap.scaleuv",
+	"bumpmap.scale"
+};
+
+// The same rules of Properties::GetFloat() and Properties::GetParameters()
+static float GetFloat(const string *value, const float defaultValue) {
+	if (!value || (value->length() == 0))
+		return defaultValue;
+	else
+		return atof(value->c_str());
+}
+
+static vector<float> GetParameters(const string *value, const string &sphereName,
+		const int field, const unsigned int paramCount, const string &defaultValue) {
+	const vector<float> vf = Properties::ConvertToFloatVector(
+			(!value || (value->length() == 0)) ? defaultValue : *value);
+	if (vf.size() != paramCount) {
+		stringstream ss;
+		ss << "Syntax error in scene.spheres." << sphereName << "." << sphereFieldNames[field] <<
+				" (required " << paramCount << " parameters)";
+		throw runtime_error(ss.str());
+	}
+
+	return vf;
+}
+
+// The keys are sorted so all the properties of a sphere are one after the
+// other: each sphere is read with a single pass over its properties, without
+// any lookup
+class CompiledLevel::SphereParser {
+public:
+	SphereParser(CompiledLevel *l) : level(l), sphereName("") {
+		lastPrint = WallClockTime();
+		std::fill(values, values + SPHERE_FIELD_COUNT, (const string *)NULL);
+	}
+
+	// Called for each scene.spheres.<name>.<field> property
+	void operator()(const string &key, const string &value) {
+		const size_t prefixLength = 14;
+		const size_t nameEnd = std::min(key.find('.', prefixLength), key.length());
+		const size_t nameLength = nameEnd - prefixLength;
+		if (nameLength == 0)
+			throw runtime_error("Syntax error in " + key);
+
+		if (key.compare(prefixLength, nameLength, sphereName) != 0) {
+			AddSphere();
+			sphereName.assign(key, prefixLength, nameLength);
+		}
+
+		if (nameEnd < key.length()) {
+			for (int i = 0; i < SPHERE_FIELD_COUNT; ++i) {
+				if (key.compare(nameEnd + 1, string::npos, sphereFieldNames[i]) == 0) {
+					values[i] = &value;
+					break;
+				}
+			}
+		}
+	}
+
+	// Adds the sphere defined by the properties collected so far
+	void AddSphere();
+
+private:
+	CompiledLevel *level;
+
+	string sphereName;
+	const string *values[SPHERE_FIELD_COUNT];
+
+	double lastPrint;
+};
+
+void CompiledLevel::SphereParser::AddSphere() {
+	if (sphereName.length() == 0)
+		return;
+
+	const vector<float> vf = GetParameters(values[SPHERE_GEOMETRY], sphereName, SPHERE_GEOMETRY, 4, "0.0 0.0 0.0 1.0");
+
+	unsigned char flags = 0;
+	if (values[SPHERE_STATIC] && (*values[SPHERE_STATIC] == "yes"))
+		flags |= COMPILEDLEVEL_SPHERE_STATIC;
+	if (values[SPHERE_ATTRACTOR] && (*values[SPHERE_ATTRACTOR] == "yes"))
+		flags |= COMPILEDLEVEL_SPHERE_ATTRACTOR;
+	if (values[SPHERE_PILL] && (*values[SPHERE_PILL] == "yes"))
+		flags |= COMPILEDLEVEL_SPHERE_PILL;
+
+	// Get the material, it is checked when the scene is built
+	if (!values[SPHERE_MATERIAL] || (values[SPHERE_MATERIAL]->length() == 0))
+		throw runtime_error("Syntax error in material name of sphere: " + sphereName);
+	const unsigned int materialIndex = level->AddMaterial(*values[SPHERE_MATERIAL]);
+
+	// Get the texture map and the bump map
+	int texMapIndices[2];
+	for (int i = 0; i < 2; ++i) {
+		const bool bumpMap = (i == 1);
+		const int fileField = bumpMap ? SPHERE_BUMPMAP_FILE : SPHERE_TEXMAP_FILE;
+		const int shiftField = bumpMap ? SPHERE_BUMPMAP_SHIFT : SPHERE_TEXMAP_SHIFT;
+		const int scaleField = bumpMap ? SPHERE_BUMPMAP_SCALEUV : SPHERE_TEXMAP_SCALE;
+
+		if (!values[fileField] || (values[fileField]->length() == 0)) {
+			texMapIndices[i] = -1;
+			continue;
+		}
+
+		TexMapRef ref;
+		ref.fileName = *values[fileField];
+		ref.bumpMap = bumpMap;
+		const vector<float> vfshift = GetParameters(values[shiftField], sphereName, shiftField, 2, "0.0 0.0");
+		const vector<float> vfscale = GetParameters(values[scaleField], sphereName, scaleField, 2, "1.0 1.0");
+		ref.shiftU = vfshift[0];
+		ref.shiftV = vfshift[1];
+		ref.scaleU = vfscale[0];
+		ref.scaleV = vfscale[1];
+		ref.scale = bumpMap ? GetFloat(values[SPHERE_BUMPMAP_SCALE], 1.f) : 1.f;
+
+		texMapIndices[i] = level->AddTexMapRef(ref);
+	}
+
+	level->AddSphere(Point(vf[0], vf[1], vf[2]), vf[3],
+			GetFloat(values[SPHERE_MASS], Sphere::CalcMass(vf[3])),
+			GetFloat(values[SPHERE_LINEARDAMPING], COMPILEDLEVEL_DEFAULT_LINEAR_DAMPING),
+			GetFloat(values[SPHERE_ANGULARDAMPING], COMPILEDLEVEL_DEFAULT_ANGULAR_DAMPING),
+			flags, materialIndex, texMapIndices[0], texMapIndices[1]);
+
+	const double now = WallClockTime();
+	if (now - lastPrint > 2.0) {
+		SFERA_LOG("Spheres count: " << level->sphereCount);
+		lastPrint = now;
+	}
+
+	std::fill(values, values + SPHERE_FIELD_COUNT, (const string *)NULL);
+}
+
+//------------------------------------------------------------------------------
+// CompiledLevel
+//------------------------------------------------------------------------------
+
+// Copies all the properties but the spheres
+class PropertiesCopier {
+public:
+	PropertiesCopier(Properties *p) : props(p) { }
+
+	void operator()(const string &key, const string &value) {
+		if (key.compare(0, 14, "scene.spheres.") != 0)
+			props->SetString(key, value);
+	}
+
+private:
+	Properties *props;
+};
+
+CompiledLevel::CompiledLevel(const Properties &lvlProp) : region(NULL) {
+	// Everything but the spheres
+	PropertiesCopier copier(&properties);
+	lvlProp.Visit("", copier);
+
+	//--------------------------------------------------------------------------
+	// Read all spheres
+	//--------------------------------------------------------------------------
+
+	sphereCount = 0;
+	UpdateSpherePointers();
+
+	SphereParser parser(this);
+	lvlProp.Visit("scene.spheres.", parser);
+	parser.AddSphere();
+}
+
+CompiledLevel::CompiledLevel(const std::string &fileName) {
+	// The pages of the file are shared with the page cache and loaded
+	// on demand
+	file_mapping file(fileName.c_str(), read_only);
+	std::auto_ptr<mapped_region> mappedRegion(new mapped_region(file, read_only));
+	const char *data = (const char *)mappedRegion->get_address();
+	const size_t size = mappedRegion->get_size();
+
+	if (size < sizeof(FileHeader))
+		throw runtime_error("Wrong compiled level size: " + fileName);
+	const FileHeader *header = (const FileHeader *)data;
+	if (memcmp(header->magic, "SLVL", 4) != 0)
+		throw runtime_error("Not a compiled level: " + fileName);
+	if (header->version != COMPILEDLEVEL_VERSION)
+		throw runtime_error("Compiled level version mismatch: " + fileName);
+
+	size_t offsets[BLOCK_COUNT + 1], sizes[BLOCK_COUNT];
+	GetBlockOffsets(*header, offsets, sizes);
+	if (size < offsets[BLOCK_COUNT])
+		throw runtime_error("Wrong compiled level size: " + fileName);
+
+	// Read the properties
+	std::istringstream propStream(string(data + offsets[BLOCK_PROPERTIES], header->propertiesSize));
+	properties.LoadStream(propStream);
+
+	// Read the names
+	const char *names = data + offsets[BLOCK_NAMES];
+	const char *namesEnd = names + header->namesSize;
+	vector<string> fileNames;
+	for (unsigned int i = 0; i < header->materialCount + header->texMapRefCount; ++i) {
+		const char *nameEnd = std::find(names, namesEnd, '\0');
+		if (nameEnd == namesEnd)
+			throw runtime_error("Wrong names in compiled level: " + fileName);
+
+		if (i < header->materialCount)
+			materialNames.push_back(string(names, nameEnd));
+		else
+			fileNames.push_back(string(names, nameEnd));
+		names = nameEnd + 1;
+	}
+
+	// Read the texture map references
+	const FileTexMapRef *refs = (const FileTexMapRef *)(data + offsets[BLOCK_TEXMAPREFS]);
+	for (unsigned int i = 0; i < header->texMapRefCount; ++i) {
+		TexMapRef ref;
+		ref.fileName = fileNames[i];
+		ref.bumpMap = (refs[i].bumpMap != 0);
+		ref.shiftU = refs[i].shiftU;
+		ref.shiftV = refs[i].shiftV;
+		ref.scaleU = refs[i].scaleU;
+		ref.scaleV = refs[i].scaleV;
+		ref.scale = refs[i].scale;
+		texMapRefs.push_back(ref);
+	}
+
+	// The spheres are used directly from the mapped file
+	sphereCount = header->sphereCount;
+	centers = (const float *)(data + offsets[BLOCK_CENTERS]);
+	radius = (const float *)(data + offsets[BLOCK_RADIUS]);
+	mass = (const float *)(data + offsets[BLOCK_MASS]);
+	linearDamping = (const float *)(data + offsets[BLOCK_LINEARDAMPING]);
+	angularDamping = (const float *)(data + offsets[BLOCK_ANGULARDAMPING]);
+	materialIndices = (const unsigned int *)(data + offsets[BLOCK_MATERIALINDICES]);
+	texMapIndices = (const int *)(data + offsets[BLOCK_TEXMAPINDICES]);
+	bumpMapIndices = (const int *)(data + offsets[BLOCK_BUMPMAPINDICES]);
+	flags = (const unsigned char *)(data + offsets[BLOCK_FLAGS]);
+
+	region = mappedRegion.release();
+}
+
+CompiledLevel::~CompiledLevel() {
+	delete region;
+}
+
+void CompiledLevel::UpdateSpherePointers() {
+	// The vectors are empty for a mapped file
+	centers = centersData.empty() ? NULL : &centersData[0];
+	radius = radiusData.empty() ? NULL : &radiusData[0];
+	mass = massData.empty() ? NULL : &massData[0];
+	linearDamping = linearDampingData.empty() ? NULL : &linearDampingData[0];
+	angularDamping = angularDampingData.empty() ? NULL : &angularDampingData[0];
+	materialIndices = materialIndicesData.empty() ? NULL : &materialIndicesData[0];
+	texMapIndices = texMapIndicesData.empty() ? NULL : &texMapIndicesData[0];
+	bumpMapIndices = bumpMapIndicesData.empty() ? NULL : &bumpMapIndicesData[0];
+	flags = flagsData.empty() ? NULL : &flagsData[0];
+}
+
+unsigned int CompiledLevel::AddMaterial(const std::string &matName) {
+	std::map<string, unsigned int>::const_iterator it = materialIndexMap.find(matName);
+	if (it != materialIndexMap.end())
+		return it->second;
+
+	const unsigned int index = materialNames.size();
+	materialIndexMap[matName] = index;
+	materialNames.push_back(matName);
+
+	return index;
+}
+
+int CompiledLevel::AddTexMapRef(const TexMapRef &ref) {
+	std::map<TexMapRef, int>::const_iterator it = texMapIndexMap.find(ref);
+	if (it != texMapIndexMap.end())
+		return it->second;
+
+	const int index = texMapRefs.size();
+	texMapIndexMap[ref] = index;
+	texMapRefs.push_back(ref);
+
+	return index;
+}
+
+void CompiledLevel::AddSphere(const Point &center, const float rad, const float m,
+		const float linearDamp, const float angularDamp, const unsigned char sphereFlags,
+		const unsigned int materialIndex, const int texMapIndex, const int bumpMapIndex) {
+	assert (!region);
+
+	centersData.push_back(center.x);
+	centersData.push_back(center.y);
+	centersData.push_back(center.z);
+	radiusData.push_back(rad);
+	massData.push_back(m);
+	linearDampingData.push_back(linearDamp);
+	angularDampingData.push_back(angularDamp);
+	flagsData.push_back(sphereFlags);
+	materialIndicesData.push_back(materialIndex);
+	texMapIndicesData.push_back(texMapIndex);
+	bumpMapIndicesData.push_back(bumpMapIndex);
+
+	++sphereCount;
+	UpdateSpherePointers();
+}
+
+void CompiledLevel::GetBlockOffsets(const FileHeader &header, size_t *offsets, size_t *sizes) {
+	const size_t n = header.sphereCount;
+
+	sizes[BLOCK_PROPERTIES] = header.propertiesSize;
+	sizes[BLOCK_NAMES] = header.namesSize;
+	sizes[BLOCK_TEXMAPREFS] = header.texMapRefCount * sizeof(FileTexMapRef);
+	sizes[BLOCK_CENTERS] = 3 * n * sizeof(float);
+	sizes[BLOCK_RADIUS] = n * sizeof(float);
+	sizes[BLOCK_MASS] = n * sizeof(float);
+	sizes[BLOCK_LINEARDAMPING] = n * sizeof(float);
+	sizes[BLOCK_ANGULARDAMPING] = n * sizeof(float);
+	sizes[BLOCK_MATERIALINDICES] = n * sizeof(unsigned int);
+	sizes[BLOCK_TEXMAPINDICES] = n * sizeof(int);
+	sizes[BLOCK_BUMPMAPINDICES] = n * sizeof(int);
+	sizes[BLOCK_FLAGS] = n * sizeof(unsigned char);
+
+	// The last offset is the size of the file
+	offsets[0] = RoundUp<size_t>(sizeof(FileHeader), 16);
+	for (int i = 0; i < BLOCK_COUNT; ++i)
+		offsets[i + 1] = RoundUp<size_t>(offsets[i] + sizes[i], 16);
+}
+
+void CompiledLevel::Save(const std::string &fileName) const {
+	std::ostringstream propStream;
+	properties.SaveStream(propStream);
+	const string props = propStream.str();
+
+	string names;
+	for (size_t i = 0; i < materialNames.size(); ++i)
+		names.append(materialNames[i].c_str(), materialNames[i].size() + 1);
+	for (size_t i = 0; i < texMapRefs.size(); ++i)
+		names.append(texMapRefs[i].fileName.c_str(), texMapRefs[i].fileName.size() + 1);
+
+	vector<FileTexMapRef> refs(texMapRefs.size());
+	for (size_t i = 0; i < texMapRefs.size(); ++i) {
+		refs[i].bumpMap = texMapRefs[i].bumpMap ? 1 : 0;
+		refs[i].shiftU = texMapRefs[i].shiftU;
+		refs[i].shiftV = texMapRefs[i].shiftV;
+		refs[i].scaleU = texMapRefs[i].scaleU;
+		refs[i].scaleV = texMapRefs[i].scaleV;
+		refs[i].scale = texMapRefs[i].scale;
+	}
+
+	FileHeader header;
+	memset(&header, 0, sizeof(FileHeader));
+	memcpy(header.magic, "SLVL", 4);
+	header.version = COMPILEDLEVEL_VERSION;
+	header.sphereCount = sphereCount;
+	header.materialCount = materialNames.size();
+	header.texMapRefCount = texMapRefs.size();
+	header.propertiesSize = props.size();
+	header.namesSize = names.size();
+
+	size_t offsets[BLOCK_COUNT + 1], sizes[BLOCK_COUNT];
+	GetBlockOffsets(header, offsets, sizes);
+
+	const void *blocks[BLOCK_COUNT] = {
+		props.data(), names.data(), refs.empty() ? NULL : &refs[0],
+		centers, radius, mass, linearDamping, angularDamping,
+		materialIndices, texMapIndices, bumpMapIndices, flags
+	};
+
+	// Written with a temporary name so a partial file is never used
+	const string tmpName = fileName + ".tmp";
+	{
+		std::ofstream file(tmpName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (file.fail())
+			throw runtime_error("Unable to open file " + tmpName);
+
+		file.write((const char *)&header, sizeof(FileHeader));
+		const char padding[16] = { 0 };
+		size_t pos = sizeof(FileHeader);
+		for (int i = 0; i <= BLOCK_COUNT; ++i) {
+			// Align the block, the last one is the end of the file
+			file.write(padding, offsets[i] - pos);
+			if (i == BLOCK_COUNT)
+				break;
+
+			if (sizes[i] > 0)
+				file.write((const char *)blocks[i], sizes[i]);
+			pos = offsets[i] + sizes[i];
+		}
+
+		if (!file)
+			throw runtime_error("Error while writing file " + tmpName);
+	}
+
+	boost::filesystem::remove(fileName);
+	boost::filesystem::rename(tmpName, fileName);
+}
+
+void CompiledLevel::SaveText(const std::string &fileName) const {
+	std::ofstream file(fileName.c_str(), std::ios::out | std::ios::trunc);
+	if (file.fail())
+		throw runtime_error("Unable to open file " + fileName);
+
+	properties.SaveStream(file);
+
+	// Enough digits to read back the same values
+	file << std::setprecision(9);
+
+	// The names have all the same length, so the spheres are read back in
+	// the same order
+	const unsigned int digits = ToString(Max(sphereCount, 1u) - 1).length();
+	for (unsigned int i = 0; i < sphereCount; ++i) {
+		std::stringstream ss;
+		ss << "scene.spheres.sph" << std::setw(digits) << std::setfill('0') << i << ".";
+		const string propRoot = ss.str();
+
+		file << propRoot << "geometry=" << centers[3 * i] << " " << centers[3 * i + 1] << " " <<
+				centers[3 * i + 2] << " " << radius[i] << "\n";
+		// Only the values different from the default ones of the parser
+		if (mass[i] != Sphere::CalcMass(radius[i]))
+			file << propRoot << "mass=" << mass[i] << "\n";
+		if (linearDamping[i] != COMPILEDLEVEL_DEFAULT_LINEAR_DAMPING)
+			file << propRoot << "lineardamping=" << linearDamping[i] << "\n";
+		if (angularDamping[i] != COMPILEDLEVEL_DEFAULT_ANGULAR_DAMPING)
+			file << propRoot << "angulardamping=" << angularDamping[i] << "\n";
+		if (flags[i] & COMPILEDLEVEL_SPHERE_STATIC)
+			file << propRoot << "static=yes\n";
+		if (flags[i] & COMPILEDLEVEL_SPHERE_ATTRACTOR)
+			file << propRoot << "attractor=yes\n";
+		if (flags[i] & COMPILEDLEVEL_SPHERE_PILL)
+			file << propRoot << "pill=yes\n";
+		file << propRoot << "material=" << materialNames[materialIndices[i]] << "\n";
+
+		if (texMapIndices[i] >= 0) {
+			const TexMapRef &ref(texMapRefs[texMapIndices[i]]);
+			file << propRoot << "texmap.file=" << ref.fileName << "\n";
+			file << propRoot << "texmap.shift=" << ref.shiftU << " " << ref.shiftV << "\n";
+			file << propRoot << "texmap.scale=" << ref.scaleU << " " << ref.scaleV << "\n";
+		}
+
+		if (bumpMapIndices[i] >= 0) {
+			const TexMapRef &ref(texMapRefs[bumpMapIndices[i]]);
+			file << propRoot << "bumpmap.file=" << ref.fileName << "\n";
+			file << propRoot << "bumpmap.shift=" << ref.shiftU << " " << ref.shiftV << "\n";
+			file << propRoot << "bumpmap.scaleuv=" << ref.scaleU << " " << ref.scaleV << "\n";
+			file << propRoot << "bumpmap.scale=" << ref.scale << "\n";
+		}
+	}
+
+	if (!file)
+		throw runtime_error("Error while writing file " + fileName);
+}
+
+std::string CompiledLevel::GetCompiledFileName(const std::string &lvlFileName) {
+	const size_t extLen = 4;
+	if ((lvlFileName.size() >= extLen) && (lvlFileName.substr(lvlFileName.size() - extLen) == ".lvl"))
+		return lvlFileName.substr(0, lvlFileName.size() - extLen) + COMPILEDLEVEL_EXTENSION;
+	else
+		return lvlFileName + COMPILEDLEVEL_EXTENSION;
+}
+
+CompiledLevel *CompiledLevel::Read(const std::string &lvlFileName) {
+	const string compiledFileName = GetCompiledFileName(lvlFileName);
+
+	try {
+		// The compiled file is used if it is newer than the .lvl file (or if
+		// there is only the compiled file)
+		if (boost::filesystem::exists(compiledFileName) &&
+				(!boost::filesystem::exists(lvlFileName) ||
+				(boost::filesystem::last_write_time(compiledFileName) >= boost::filesystem::last_write_time(lvlFileName)))) {
+			SFERA_LOG("Reading compiled level: " << compiledFileName);
+			return new CompiledLevel(compiledFileName);
+		}
+	} catch (const std::exception &ex) {
+		SFERA_LOG("Unable to read compiled level " << compiledFileName << ": " << ex.what());
+	}
+
+	return new CompiledLevel(Properties(lvlFileName));
+}
+
+void CompiledLevel::Compile(const std::string &lvlFileName) {
+	const string compiledFileName = GetCompiledFileName(lvlFileName);
+	SFERA_LOG("Compiling level: " << lvlFileName << " => " << compiledFileName);
+
+	CompiledLevel level((Properties(lvlFileName)));
+	level.Save(compiledFileName);
+
+	SFERA_LOG("Spheres count: " << level.sphereCount);
+}
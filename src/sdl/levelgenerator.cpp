@@ -0,0 +1,321 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "sfera.h"
+#include "sdl/levelgenerator.h"
+#include "physic/gamephysic.h"
+
+// Copies all the properties but the generator ones, they are not part of the
+// generated level
+class LevelPropertiesCopier {
+public:
+	LevelPropertiesCopier(Properties *p) : props(p) { }
+
+	void operator()(const string &key, const string &value) {
+		if (key.compare(0, 10, "generator.") != 0)
+			props->SetString(key, value);
+	}
+
+private:
+	Properties *props;
+};
+
+static Properties GetLevelProperties(const Properties &genProp) {
+	Properties lvlProp;
+	LevelPropertiesCopier copier(&lvlProp);
+	genProp.Visit("", copier);
+
+	return lvlProp;
+}
+
+LevelGenerator::LevelGenerator(const Properties &genProp) : props(genProp),
+		level(GetLevelProperties(genProp)), rng(genProp.GetInt("generator.seed", 1)) {
+	//--------------------------------------------------------------------------
+	// Read the material mix
+	//--------------------------------------------------------------------------
+
+	const vector<string> mix = props.GetStringVector("generator.materials", "");
+	if (mix.size() == 0)
+		throw runtime_error("Missing generator.materials definition");
+
+	float totalWeight = 0.f;
+	for (size_t i = 0; i < mix.size(); ++i) {
+		// Each entry is: <material name> [weight]
+		std::istringstream ss(mix[i]);
+		string matName;
+		float weight = 1.f;
+		ss >> matName >> weight;
+		if ((matName == "") || (weight < 0.f))
+			throw runtime_error("Syntax error in generator.materials: " + mix[i]);
+
+		totalWeight += weight;
+		materials.push_back(level.AddMaterial(matName));
+		materialWeights.push_back(totalWeight);
+	}
+	if (totalWeight <= 0.f)
+		throw runtime_error("Wrong weights in generator.materials");
+	for (size_t i = 0; i < materialWeights.size(); ++i)
+		materialWeights[i] /= totalWeight;
+
+	//--------------------------------------------------------------------------
+	// Read the texture and bump maps
+	//--------------------------------------------------------------------------
+
+	texMapIndex = -1;
+	texMapFraction = 0.f;
+	const string texMapName = props.GetString("generator.texmap.file", "");
+	if (texMapName != "") {
+		CompiledLevel::TexMapRef ref;
+		ref.fileName = texMapName;
+		ref.bumpMap = false;
+		const vector<float> vf = Properties::GetParameters(props, "generator.texmap.scale", 2, "1.0 1.0");
+		ref.shiftU = 0.f;
+		ref.shiftV = 0.f;
+		ref.scaleU = vf[0];
+		ref.scaleV = vf[1];
+		ref.scale = 1.f;
+
+		texMapIndex = level.AddTexMapRef(ref);
+		texMapFraction = props.GetFloat("generator.texmap.fraction", 1.f);
+	}
+
+	bumpMapIndex = -1;
+	bumpMapFraction = 0.f;
+	const string bumpMapName = props.GetString("generator.bumpmap.file", "");
+	if (bumpMapName != "") {
+		CompiledLevel::TexMapRef ref;
+		ref.fileName = bumpMapName;
+		ref.bumpMap = true;
+		const vector<float> vf = Properties::GetParameters(props, "generator.bumpmap.scaleuv", 2, "1.0 1.0");
+		ref.shiftU = 0.f;
+		ref.shiftV = 0.f;
+		ref.scaleU = vf[0];
+		ref.scaleV = vf[1];
+		ref.scale = props.GetFloat("generator.bumpmap.scale", 1.f);
+
+		bumpMapIndex = level.AddTexMapRef(ref);
+		bumpMapFraction = props.GetFloat("generator.bumpmap.fraction", 1.f);
+	}
+
+	//--------------------------------------------------------------------------
+	// Build the spheres
+	//--------------------------------------------------------------------------
+
+	const int fractalDepth = props.GetInt("generator.fractal.depth", -1);
+	if (fractalDepth >= 0) {
+		const vector<float> vf = Properties::GetParameters(props, "generator.fractal.geometry", 4, "0.0 0.0 0.0 15.0");
+		const unsigned int startCount = level.sphereCount;
+		AddFractal(0, fractalDepth, Point(vf[0], vf[1], vf[2]), vf[3], -1);
+		SFERA_LOG("Generated fractal spheres: " << level.sphereCount - startCount);
+	}
+
+	AddRandomField();
+	AddShells();
+	AddBodies("generator.dynamic", 0, "0.25 0.5");
+	AddBodies("generator.attractors", COMPILEDLEVEL_SPHERE_STATIC | COMPILEDLEVEL_SPHERE_ATTRACTOR, "2.0 4.0");
+	AddPills();
+
+	SFERA_LOG("Generated spheres count: " << level.sphereCount);
+}
+
+LevelGenerator::~LevelGenerator() {
+}
+
+void LevelGenerator::Save(const std::string &fileName) const {
+	if (boost::ends_with(fileName, COMPILEDLEVEL_EXTENSION))
+		level.Save(fileName);
+	else
+		level.SaveText(fileName);
+}
+
+void LevelGenerator::AddSphere(const Point &center, const float rad, const unsigned char flags) {
+	// Pick the material
+	const float u = rng.floatValue();
+	size_t m = 0;
+	while ((m < materials.size() - 1) && (u >= materialWeights[m]))
+		++m;
+
+	const int texMap = ((texMapIndex >= 0) && (rng.floatValue() < texMapFraction)) ? texMapIndex : -1;
+	const int bumpMap = ((bumpMapIndex >= 0) && (rng.floatValue() < bumpMapFraction)) ? bumpMapIndex : -1;
+
+	level.AddSphere(center, rad, Sphere::CalcMass(rad),
+			COMPILEDLEVEL_DEFAULT_LINEAR_DAMPING, COMPILEDLEVEL_DEFAULT_ANGULAR_DAMPING, flags,
+			materials[m], texMap, bumpMap);
+}
+
+Point LevelGenerator::RandomPoint(const vector<float> &bbox) {
+	const float x = bbox[0] + rng.floatValue() * (bbox[3] - bbox[0]);
+	const float y = bbox[1] + rng.floatValue() * (bbox[4] - bbox[1]);
+	const float z = bbox[2] + rng.floatValue() * (bbox[5] - bbox[2]);
+
+	return Point(x, y, z);
+}
+
+//------------------------------------------------------------------------------
+// Fractal: the HyperSphere of gamedata/packs/Benchmark/scene_build.pl, 6
+// children for each sphere (5 after the first level), each one half the size
+// of its parent
+//------------------------------------------------------------------------------
+
+void LevelGenerator::AddFractal(const unsigned int depth, const unsigned int maxDepth,
+		const Point &center, const float rad, const int direction) {
+	AddSphere(center, rad, COMPILEDLEVEL_SPHERE_STATIC);
+
+	if (depth == maxDepth)
+		return;
+
+	// The directions are -x, +x, -y, +y, -z, +z, a child doesn't grow back
+	// toward its parent
+	const float newRad = rad * .5f;
+	const float d = rad + newRad;
+	for (int i = 0; i < 6; ++i) {
+		if (i == direction)
+			continue;
+
+		Vector offset(0.f, 0.f, 0.f);
+		offset[i / 2] = (i % 2) ? d : -d;
+		AddFractal(depth + 1, maxDepth, center + offset, newRad, i ^ 1);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Random field: static spheres scattered inside a box, they can overlap
+//------------------------------------------------------------------------------
+
+void LevelGenerator::AddRandomField() {
+	const unsigned int count = props.GetInt("generator.random.count", 0);
+	if (count == 0)
+		return;
+
+	const vector<float> bbox = Properties::GetParameters(props, "generator.random.bbox", 6, "-50.0 -50.0 -50.0 50.0 50.0 50.0");
+	const vector<float> radius = Properties::GetParameters(props, "generator.random.radius", 2, "0.25 1.0");
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const Point center = RandomPoint(bbox);
+		const float rad = radius[0] + rng.floatValue() * (radius[1] - radius[0]);
+
+		AddSphere(center, rad, COMPILEDLEVEL_SPHERE_STATIC);
+	}
+
+	SFERA_LOG("Generated random field spheres: " << count);
+}
+
+//------------------------------------------------------------------------------
+// Shells: static spheres evenly spread (along a Fibonacci spiral) over
+// concentric spheres
+//------------------------------------------------------------------------------
+
+void LevelGenerator::AddShells() {
+	const unsigned int count = props.GetInt("generator.shells.count", 0);
+	if (count == 0)
+		return;
+
+	const unsigned int sphereCount = Max(1, props.GetInt("generator.shells.spherecount", 1000));
+	const vector<float> center = Properties::GetParameters(props, "generator.shells.center", 3, "0.0 0.0 0.0");
+	const vector<float> radius = Properties::GetParameters(props, "generator.shells.radius", 2, "20.0 40.0");
+	const float sphereRadius = props.GetFloat("generator.shells.sphereradius", .5f);
+
+	const float goldenAngle = M_PI * (3.f - sqrtf(5.f));
+	for (unsigned int s = 0; s < count; ++s) {
+		const float r = (count == 1) ? radius[0] :
+			(radius[0] + (radius[1] - radius[0]) * s / (count - 1.f));
+		// Each shell is rotated by a random angle
+		const float phiOffset = 2.f * M_PI * rng.floatValue();
+
+		for (unsigned int i = 0; i < sphereCount; ++i) {
+			const float z = 1.f - 2.f * (i + .5f) / sphereCount;
+			const float rho = sqrtf(Max(0.f, 1.f - z * z));
+			const float phi = phiOffset + goldenAngle * i;
+
+			AddSphere(Point(center[0] + r * rho * cosf(phi), center[1] + r * rho * sinf(phi),
+					center[2] + r * z), sphereRadius, COMPILEDLEVEL_SPHERE_STATIC);
+		}
+	}
+
+	SFERA_LOG("Generated shell spheres: " << count * sphereCount);
+}
+
+//------------------------------------------------------------------------------
+// Bodies (dynamic spheres or attractors): one for each cell of a grid
+// covering a box, so they never overlap
+//------------------------------------------------------------------------------
+
+void LevelGenerator::AddBodies(const std::string &propRoot, const unsigned char flags,
+		const std::string &defaultRadius) {
+	const unsigned int count = props.GetInt(propRoot + ".count", 0);
+	if (count == 0)
+		return;
+
+	const vector<float> bbox = Properties::GetParameters(props, propRoot + ".bbox", 6, "-50.0 -50.0 -50.0 50.0 50.0 50.0");
+	const vector<float> radius = Properties::GetParameters(props, propRoot + ".radius", 2, defaultRadius);
+
+	unsigned int n = 1;
+	while (n * n * n < count)
+		++n;
+	const float cellSize[3] = {
+		(bbox[3] - bbox[0]) / n,
+		(bbox[4] - bbox[1]) / n,
+		(bbox[5] - bbox[2]) / n
+	};
+	const float maxRadius = .5f * Min(cellSize[0], Min(cellSize[1], cellSize[2]));
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const unsigned int cell[3] = { i % n, (i / n) % n, i / (n * n) };
+		const float rad = Min(maxRadius, radius[0] + rng.floatValue() * (radius[1] - radius[0]));
+
+		// A random position inside the cell
+		float c[3];
+		for (int j = 0; j < 3; ++j)
+			c[j] = bbox[j] + cell[j] * cellSize[j] + rad + rng.floatValue() * (cellSize[j] - 2.f * rad);
+
+		AddSphere(Point(c[0], c[1], c[2]), rad, flags);
+	}
+
+	SFERA_LOG("Generated spheres (" << propRoot << "): " << count);
+}
+
+//------------------------------------------------------------------------------
+// Pills: static spheres scattered inside a box, with their own material
+//------------------------------------------------------------------------------
+
+void LevelGenerator::AddPills() {
+	const unsigned int count = props.GetInt("generator.pills.count", 0);
+	if (count == 0)
+		return;
+
+	const string matName = props.GetString("generator.pills.material", "");
+	if (matName == "")
+		throw runtime_error("Missing generator.pills.material definition");
+	const unsigned int matIndex = level.AddMaterial(matName);
+
+	const vector<float> bbox = Properties::GetParameters(props, "generator.pills.bbox", 6, "-50.0 -50.0 -50.0 50.0 50.0 50.0");
+	const float rad = props.GetFloat("generator.pills.radius", .2f);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		level.AddSphere(RandomPoint(bbox), rad, Sphere::CalcMass(rad),
+				COMPILEDLEVEL_DEFAULT_LINEAR_DAMPING, COMPILEDLEVEL_DEFAULT_ANGULAR_DAMPING,
+				COMPILEDLEVEL_SPHERE_STATIC | COMPILEDLEVEL_SPHERE_PILL,
+				matIndex, -1, -1);
+	}
+
+	SFERA_LOG("Generated pills: " << count);
+}
@@ -19,6 +19,9 @@
  *   LuxRays website: http://www.luxrender.net                             *
  ***************************************************************************/
 
+#include <algorithm>
+
+#include "sfera.h"
 #include "sdl/light.h"
 
 //------------------------------------------------------------------------------
@@ -29,9 +32,140 @@ InfiniteLight::InfiniteLight(TexMapInstance *tx) {
 	tex = tx;
 	shiftU = 0.f;
 	shiftV = 0.f;
+	distributionWidth = 0;
+	distributionHeight = 0;
+}
+
+Spectrum InfiniteLight::Le(const float phi, const float theta, const float footprint) const {
+	const UV uv(1.f - phi * INV_TWOPI + shiftU, theta * INV_PI + shiftV);
+	const TextureMap *map = tex->GetTexMap();
+	return gain * map->GetColor(uv, map->GetLevelOfDetail(footprint * INV_PI));
 }
 
-Spectrum InfiniteLight::Le(const Vector &dir) const {
-	const UV uv(1.f - SphericalPhi(dir) * INV_TWOPI + shiftU, SphericalTheta(dir) * INV_PI + shiftV);
-	return gain * tex->GetTexMap()->GetColor(uv);
+void InfiniteLight::Preprocess() {
+	const TextureMap *map = tex->GetTexMap();
+	const unsigned int mapWidth = map->GetWidth();
+	const unsigned int mapHeight = map->GetHeight();
+
+	distributionWidth = Min<unsigned int>(mapWidth, INFINITELIGHT_DISTRIBUTION_MAX_WIDTH);
+	distributionHeight = Min<unsigned int>(mapHeight, INFINITELIGHT_DISTRIBUTION_MAX_HEIGHT);
+	const unsigned int w = distributionWidth;
+	const unsigned int h = distributionHeight;
+
+	// Average the luminance of the texels falling inside each cell of the
+	// (phi, theta) space, so small and very bright spots (i.e. the sun) are
+	// not missed
+	vector<float> func(w * h, 0.f);
+	vector<unsigned int> texelCount(w * h, 0);
+	for (unsigned int y = 0; y < mapHeight; ++y) {
+		float t = (y + .5f) / mapHeight - shiftV;
+		t -= Floor2Int(t);
+		const unsigned int cellY = Min<unsigned int>(Floor2Int(t * h), h - 1);
+
+		for (unsigned int x = 0; x < mapWidth; ++x) {
+			float s = 1.f - ((x + .5f) / mapWidth - shiftU);
+			s -= Floor2Int(s);
+			const unsigned int cellX = Min<unsigned int>(Floor2Int(s * w), w - 1);
+
+			const unsigned int index = cellX + cellY * w;
+			func[index] += Max(0.f, (gain * map->GetTexel(x, y)).Y());
+			++texelCount[index];
+		}
+	}
+
+	// Account for the solid angle of each cell
+	double total = 0.0;
+	for (unsigned int y = 0; y < h; ++y) {
+		const float sinTheta = sinf(M_PI * (y + .5f) / h);
+
+		for (unsigned int x = 0; x < w; ++x) {
+			const unsigned int index = x + y * w;
+			if (texelCount[index] > 0)
+				func[index] *= sinTheta / texelCount[index];
+			total += func[index];
+		}
+	}
+
+	// A black map is sampled uniformly
+	if (total <= 0.0) {
+		std::fill(func.begin(), func.end(), 1.f);
+		total = w * h;
+	}
+
+	distribution.resize((h + 1) + h * (w + 1) + w * h);
+	float *marginalCDF = &distribution[0];
+	float *conditionalCDFs = &distribution[h + 1];
+	float *pdfs = &distribution[(h + 1) + h * (w + 1)];
+
+	marginalCDF[0] = 0.f;
+	double marginalSum = 0.0;
+	for (unsigned int y = 0; y < h; ++y) {
+		float *cdf = &conditionalCDFs[y * (w + 1)];
+
+		cdf[0] = 0.f;
+		double sum = 0.0;
+		for (unsigned int x = 0; x < w; ++x) {
+			sum += func[x + y * w];
+			cdf[x + 1] = (float)sum;
+		}
+
+		for (unsigned int x = 1; x <= w; ++x)
+			cdf[x] = (sum > 0.0) ? (float)(cdf[x] / sum) : ((float)x / w);
+
+		marginalSum += sum;
+		marginalCDF[y + 1] = (float)(marginalSum / total);
+	}
+
+	// The pdf of each cell in the unit square
+	for (unsigned int i = 0; i < w * h; ++i)
+		pdfs[i] = (float)(func[i] * (w * h) / total);
+}
+
+unsigned int InfiniteLight::SampleCDF(const float *cdf, const unsigned int count,
+		const float u, float *du) {
+	const float *ptr = std::upper_bound(cdf, cdf + count + 1, u);
+	const unsigned int index = Clamp<int>(ptr - cdf - 1, 0, count - 1);
+
+	const float width = cdf[index + 1] - cdf[index];
+	*du = (width > 0.f) ? Clamp((u - cdf[index]) / width, 0.f, 1.f) : 0.f;
+
+	return index;
+}
+
+Spectrum InfiniteLight::Sample_L(const float u0, const float u1, Vector *dir, float *pdf) const {
+	const unsigned int w = distributionWidth;
+	const unsigned int h = distributionHeight;
+
+	float dv;
+	const unsigned int y = SampleCDF(&distribution[0], h, u1, &dv);
+	float du;
+	const unsigned int x = SampleCDF(&distribution[(h + 1) + y * (w + 1)], w, u0, &du);
+
+	const float cellPdf = distribution[(h + 1) + h * (w + 1) + x + y * w];
+	const float theta = M_PI * (y + dv) / h;
+	const float sinTheta = sinf(theta);
+	if ((cellPdf <= 0.f) || (sinTheta <= 0.f)) {
+		*pdf = 0.f;
+		return Spectrum();
+	}
+
+	const float phi = 2.f * M_PI * (x + du) / w;
+	*dir = SphericalDirection(sinTheta, cosf(theta), phi);
+	*pdf = cellPdf / (2.f * M_PI * M_PI * sinTheta);
+
+	return Le(phi, theta);
+}
+
+float InfiniteLight::Pdf(const float phi, const float theta) const {
+	const unsigned int w = distributionWidth;
+	const unsigned int h = distributionHeight;
+
+	const float sinTheta = sinf(theta);
+	if (sinTheta <= 0.f)
+		return 0.f;
+
+	const unsigned int x = Min<unsigned int>(Floor2Int(phi * INV_TWOPI * w), w - 1);
+	const unsigned int y = Min<unsigned int>(Floor2Int(theta * INV_PI * h), h - 1);
+
+	return distribution[(h + 1) + h * (w + 1) + x + y * w] / (2.f * M_PI * M_PI * sinTheta);
 }
@@ -21,10 +21,12 @@
 #include "sfera.h"
 #include "sdl/sdl.h"
 #include "sdl/light.h"
-#include "physic/gamephysic.h"
 
-Scene::Scene(const Properties &scnProp, TextureMapCache *texMapCache) {
+Scene::Scene(const CompiledLevel &level, TextureMapCache *texMapCache) {
+	const Properties &scnProp(level.GetProperties());
+
 	pillOffMaterial = NULL;
+	pillOffMaterialIndex = 0;
 	pillCount = 0;
 
 	gravityConstant = scnProp.GetFloat("scene.gravity.constant", 10.f);
@@ -44,6 +46,8 @@ Scene::Scene(const Properties &scnProp, TextureMapCache *texMapCache) {
 
 		vf = Properties::GetParameters(scnProp, "scene.infinitelight.shift", 2, "0.0 0.0");
 		infiniteLight->SetShift(vf[0], vf[1]);
+
+		infiniteLight->Preprocess();
 	} else
 		throw runtime_error("Missing infinite light source definition");
 
@@ -75,7 +79,8 @@ Scene::Scene(const Properties &scnProp, TextureMapCache *texMapCache) {
 			if (pillOffMaterial)
 				throw runtime_error("Multiple definition of pill off material");
 
-			pillOffMaterial = materials[materials.size() - 1];
+			pillOffMaterialIndex = materials.size() - 1;
+			pillOffMaterial = materials[pillOffMaterialIndex];
 		}
 	}
 
@@ -83,80 +88,65 @@ Scene::Scene(const Properties &scnProp, TextureMapCache *texMapCache) {
 	// Read all spheres
 	//--------------------------------------------------------------------------
 
-	vector<string> objKeys = scnProp.GetAllKeys("scene.spheres.");
-	if (objKeys.size() == 0)
+	const unsigned int sphereCount = level.sphereCount;
+	if (sphereCount == 0)
 		throw runtime_error("No object definition found");
 
-	double lastPrint = WallClockTime();
-	for (vector<string>::const_iterator objKey = objKeys.begin(); objKey != objKeys.end(); ++objKey) {
-		const string &key = *objKey;
-
-		const string sphereName = Properties::ExtractField(key, 2);
-		if (sphereName == "")
-			throw runtime_error("Syntax error in " + key);
-
-		// Check if the object has been already defined
-		if (sphereIndices.count(sphereName) > 0)
-			continue;
-
-		const string propRoot = "scene.spheres." + sphereName;
+	// The materials used by the spheres
+	vector<unsigned int> levelMaterials;
+	for (size_t i = 0; i < level.materialNames.size(); ++i) {
+		const string &matName = level.materialNames[i];
+		if (materialIndices.count(matName) < 1)
+			throw std::runtime_error("Unknown material: " + matName);
+		levelMaterials.push_back(materialIndices[matName]);
+	}
 
-		// Build the sphere
-		const vector<float> vf = Properties::GetParameters(scnProp, propRoot + ".geometry", 4, "0.0 0.0 0.0 1.0");
-		const float mass = scnProp.GetFloat(propRoot + ".mass", Sphere::CalcMass(vf[3]));
-		const float linearDamping = scnProp.GetFloat(propRoot + ".lineardamping", PHYSIC_DEFAULT_ANGULAR_DAMPING);
-		const float angularDamping = scnProp.GetFloat(propRoot + ".angulardamping", PHYSIC_DEFAULT_LINEAR_DAMPING);
-		const bool staticObject = ("yes" == scnProp.GetString(propRoot + ".static", "no"));
-		const bool attractorObject = ("yes" == scnProp.GetString(propRoot + ".attractor", "no"));
-		const bool pillObject = ("yes" == scnProp.GetString(propRoot + ".pill", "no"));
+	// The texture and bump maps used by the spheres, the instances are
+	// shared by all the spheres with the same parameters
+	vector<TexMapInstance *> levelTexMaps(level.texMapRefs.size(), NULL);
+	vector<BumpMapInstance *> levelBumpMaps(level.texMapRefs.size(), NULL);
+	for (size_t i = 0; i < level.texMapRefs.size(); ++i) {
+		const CompiledLevel::TexMapRef &ref(level.texMapRefs[i]);
+
+		if (ref.bumpMap)
+			levelBumpMaps[i] = texMapCache->GetBumpMapInstance(ref.fileName,
+					ref.shiftU, ref.shiftV, ref.scaleU, ref.scaleV, ref.scale);
+		else
+			levelTexMaps[i] = texMapCache->GetTexMapInstance(ref.fileName,
+					ref.shiftU, ref.shiftV, ref.scaleU, ref.scaleV);
+	}
 
-		sphereIndices[sphereName] = spheres.size();
-		spheres.push_back(GameSphere(spheres.size(), Point(vf[0], vf[1], vf[2]), vf[3],
-				mass, linearDamping, angularDamping,
-				staticObject, attractorObject, pillObject, false));
+	spheres.reserve(sphereCount);
+	sphereMaterials.reserve(sphereCount);
+	sphereMaterialIndices.reserve(sphereCount);
+	sphereTexMaps.reserve(sphereCount);
+	sphereBumpMaps.reserve(sphereCount);
+	for (unsigned int i = 0; i < sphereCount; ++i) {
+		const unsigned char flags = level.flags[i];
+		const bool pillObject = (flags & COMPILEDLEVEL_SPHERE_PILL) != 0;
+
+		spheres.push_back(GameSphere(i,
+				Point(level.centers[3 * i], level.centers[3 * i + 1], level.centers[3 * i + 2]),
+				level.radius[i], level.mass[i], level.linearDamping[i], level.angularDamping[i],
+				(flags & COMPILEDLEVEL_SPHERE_STATIC) != 0,
+				(flags & COMPILEDLEVEL_SPHERE_ATTRACTOR) != 0,
+				pillObject, false));
 
 		if (pillObject)
 			++pillCount;
 
-		const double now = WallClockTime();
-		if (now - lastPrint > 2.0) {
-			SFERA_LOG("Spheres count: " << spheres.size());
-			lastPrint = now;
-		}
-
-		// Get the material
-		const std::string matName = scnProp.GetString(propRoot + ".material", "");
-		if (matName == "")
-			throw std::runtime_error("Syntax error in material name of sphere: " + sphereName);
-		if (materialIndices.count(matName) < 1)
-			throw std::runtime_error("Unknown material: " + matName);
-		Material *mat = materials[materialIndices[matName]];
-		sphereMaterials.push_back(mat);
-
-		// Get the texture map
-		const std::string texName = scnProp.GetString(propRoot + ".texmap.file", "");
-		if (texName != "") {
-			const vector<float> vfshift = Properties::GetParameters(scnProp, propRoot + ".texmap.shift", 2, "0.0 0.0");
-			const vector<float> vfscale = Properties::GetParameters(scnProp, propRoot + ".texmap.scale", 2, "1.0 1.0");
-
-			TexMapInstance *tmi = texMapCache->GetTexMapInstance(texName,
-					vfshift[0], vfshift[1], vfscale[0], vfscale[1]);
-			sphereTexMaps.push_back(tmi);
-		} else
-			sphereTexMaps.push_back(NULL);
-
-		// Get the bump map
-		const std::string bumpName = scnProp.GetString(propRoot + ".bumpmap.file", "");
-		if (bumpName != "") {
-			const vector<float> vfshift = Properties::GetParameters(scnProp, propRoot + ".bumpmap.shift", 2, "0.0 0.0");
-			const vector<float> vfscaleuv = Properties::GetParameters(scnProp, propRoot + ".bumpmap.scaleuv", 2, "1.0 1.0");
-			const float scale = scnProp.GetFloat(propRoot + ".bumpmap.scale", 1.f);
-
-			BumpMapInstance *bmi = texMapCache->GetBumpMapInstance(bumpName,
-					vfshift[0], vfshift[1], vfscaleuv[0], vfscaleuv[1], scale);
-			sphereBumpMaps.push_back(bmi);
-		} else
-			sphereBumpMaps.push_back(NULL);
+		const unsigned int matIndex = level.materialIndices[i];
+		const int texMapIndex = level.texMapIndices[i];
+		const int bumpMapIndex = level.bumpMapIndices[i];
+		if ((matIndex >= levelMaterials.size()) ||
+				(texMapIndex >= (int)levelTexMaps.size()) ||
+				(bumpMapIndex >= (int)levelBumpMaps.size()))
+			throw runtime_error("Wrong definition of sphere: " + ToString(i));
+
+		sphereMaterials.push_back(materials[levelMaterials[matIndex]]);
+		sphereMaterialIndices.push_back(levelMaterials[matIndex]);
+		sphereTexMaps.push_back((texMapIndex < 0) ? NULL : levelTexMaps[texMapIndex]);
+		sphereBumpMaps.push_back((bumpMapIndex < 0) ? NULL : levelBumpMaps[bumpMapIndex]);
 	}
 	SFERA_LOG("Spheres count: " << spheres.size());
 	SFERA_LOG("Pills count: " << pillCount);
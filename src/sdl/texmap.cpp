@@ -22,14 +22,57 @@
 #include <windows.h>
 #endif
 
+#include <memory>
+
 #include <FreeImage.h>
 
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
 #include "sfera.h"
 #include "sdl/texmap.h"
 
-TextureMap::TextureMap(const std::string &fileName) {
+using namespace boost::interprocess;
+
+// Source of the identifiers of the texture maps
+static boost::mutex texMapIdMutex;
+static unsigned int texMapIdCount = 0;
+
+// Layout of a cache file: the header, the name of the source image and the
+// texels starting at texelsOffset
+struct TextureMap::CacheHeader {
+	char magic[4];
+	unsigned int version;
+	unsigned int tileSize;
+	unsigned int bumpMap;
+	// Last write time of the source image
+	boost::uint64_t sourceTime;
+	unsigned int nameLength;
+
+	unsigned int width, height;
+	unsigned int levelCount;
+	Level levels[TEXMAP_MAX_LEVELS];
+	unsigned int format;
+	unsigned int texelCount;
+	boost::uint64_t texelsOffset;
+};
+
+TextureMap::TextureMap(const std::string &fileName, const bool bumpMap) :
+	texels(NULL), texelsRegion(NULL) {
 	SFERA_LOG("Reading texture map: " << fileName);
 
+	{
+		boost::unique_lock<boost::mutex> lock(texMapIdMutex);
+		id = texMapIdCount++;
+	}
+
+	if (LoadCache(fileName, bumpMap))
+		return;
+
 	string name = "gamedata/" + fileName;
 	FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(name.c_str(), 0);
 	if(fif == FIF_UNKNOWN)
@@ -49,10 +92,12 @@ TextureMap::TextureMap(const std::string &fileName) {
 		unsigned int bpp = FreeImage_GetBPP(dib);
 		BYTE *bits = (BYTE *)FreeImage_GetBits(dib);
 
+		// The image is decoded to floats first and then packed in the texels
+		vector<Spectrum> pixels(width * height);
+		bool isHDR;
 		if ((imageType == FIT_RGBAF) && (bpp == 128)) {
-			SFERA_LOG("HDR RGB (128bit) texture map size: " << width << "x" << height << " (" <<
-					width * height * sizeof(Spectrum) / 1024 << "Kbytes)");
-			pixels = new Spectrum[width * height];
+			SFERA_LOG("HDR RGB (128bit) texture map size: " << width << "x" << height);
+			isHDR = true;
 
 			for (unsigned int y = 0; y < height; ++y) {
 				FIRGBAF *pixel = (FIRGBAF *)bits;
@@ -67,9 +112,8 @@ TextureMap::TextureMap(const std::string &fileName) {
 				bits += pitch;
 			}
 		} else if ((imageType == FIT_RGBF) && (bpp == 96)) {
-			SFERA_LOG("HDR RGB (96bit) texture map size: " << width << "x" << height << " (" <<
-					width * height * sizeof(Spectrum) / 1024 << "Kbytes)");
-			pixels = new Spectrum[width * height];
+			SFERA_LOG("HDR RGB (96bit) texture map size: " << width << "x" << height);
+			isHDR = true;
 
 			for (unsigned int y = 0; y < height; ++y) {
 				FIRGBF *pixel = (FIRGBF *)bits;
@@ -84,10 +128,8 @@ TextureMap::TextureMap(const std::string &fileName) {
 				bits += pitch;
 			}
 		} else if ((imageType == FIT_BITMAP) && (bpp == 32)) {
-			SFERA_LOG("RGBA texture map size: " << width << "x" << height << " (" <<
-					width * height * (sizeof(Spectrum) + sizeof(float)) / 1024 << "Kbytes)");
-			const unsigned int pixelCount = width * height;
-			pixels = new Spectrum[pixelCount];
+			SFERA_LOG("RGBA texture map size: " << width << "x" << height);
+			isHDR = false;
 
 			for (unsigned int y = 0; y < height; ++y) {
 				BYTE *pixel = (BYTE *)bits;
@@ -103,17 +145,16 @@ TextureMap::TextureMap(const std::string &fileName) {
 				bits += pitch;
 			}
 		} else if (bpp == 24) {
-			SFERA_LOG("RGB texture map size: " << width << "x" << height << " (" <<
-					width * height * sizeof(Spectrum) / 1024 << "Kbytes)");
-			pixels = new Spectrum[width * height];
+			SFERA_LOG("RGB texture map size: " << width << "x" << height);
+			isHDR = false;
 
 			for (unsigned int y = 0; y < height; ++y) {
 				BYTE *pixel = (BYTE *)bits;
 				for (unsigned int x = 0; x < width; ++x) {
-					const unsigned int offest = x + (height - y - 1) * width;
-					pixels[offest].r = pixel[FI_RGBA_RED] / 255.f;
-					pixels[offest].g = pixel[FI_RGBA_GREEN] / 255.f;
-					pixels[offest].b = pixel[FI_RGBA_BLUE] / 255.f;
+					const unsigned int offset = x + (height - y - 1) * width;
+					pixels[offset].r = pixel[FI_RGBA_RED] / 255.f;
+					pixels[offset].g = pixel[FI_RGBA_GREEN] / 255.f;
+					pixels[offset].b = pixel[FI_RGBA_BLUE] / 255.f;
 					pixel += 3;
 				}
 
@@ -121,40 +162,442 @@ TextureMap::TextureMap(const std::string &fileName) {
 				bits += pitch;
 			}
 		} else if (bpp == 8) {
-			SFERA_LOG("Converting 8bpp image to 24bpp RGB texture map size: " << width << "x" << height << " (" <<
-					width * height * sizeof (Spectrum) / 1024 << "Kbytes)");
-
-			pixels = new Spectrum[width * height];
+			SFERA_LOG("8bpp texture map size: " << width << "x" << height);
+			isHDR = false;
 
 			for (unsigned int y = 0; y < height; ++y) {
 				BYTE pixel;
 				for (unsigned int x = 0; x < width; ++x) {
 					FreeImage_GetPixelIndex(dib, x, y, &pixel);
-					const unsigned int offest = x + (height - y - 1) * width;
-					pixels[offest].r = pixel / 255.f;
-					pixels[offest].g = pixel / 255.f;
-					pixels[offest].b = pixel / 255.f;
+					const unsigned int offset = x + (height - y - 1) * width;
+					pixels[offset].r = pixel / 255.f;
+					pixels[offset].g = pixel / 255.f;
+					pixels[offset].b = pixel / 255.f;
 				}
 
 				// Next line
 				bits += pitch;
 			}
 		} else {
+			FreeImage_Unload(dib);
+
 			std::stringstream msg;
 			msg << "Unsupported bitmap depth (" << bpp << ") in a texture map: " << fileName;
 			throw std::runtime_error(msg.str());
 		}
 
 		FreeImage_Unload(dib);
+
+		PackTexels(pixels, isHDR, bumpMap);
+		SaveCache(fileName, bumpMap);
 	} else
 		throw std::runtime_error("Unknown image file format: " + fileName);
+}
+
+TextureMap::TextureMap(const unsigned int w, const unsigned int h,
+		const vector<Spectrum> &pixels, const bool isHDR, const bool bumpMap) :
+	width(w), height(h), texels(NULL), texelsRegion(NULL) {
+	assert (pixels.size() == width * height);
 
-	DuDv.u = 1.f / width;
-	DuDv.v = 1.f / height;
+	{
+		boost::unique_lock<boost::mutex> lock(texMapIdMutex);
+		id = texMapIdCount++;
+	}
+
+	vector<Spectrum> p(pixels);
+	PackTexels(p, isHDR, bumpMap);
 }
 
 TextureMap::~TextureMap() {
-	delete[] pixels;
+	if (texelsRegion)
+		delete texelsRegion;
+	else
+		delete[] texels;
+}
+
+string TextureMap::GetCacheFileName(const std::string &fileName, const bool bumpMap) {
+	// The source path is part of the name, it is checked again in the header
+	string name = fileName;
+	for (size_t i = 0; i < name.size(); ++i) {
+		if ((name[i] == '/') || (name[i] == '\\') || (name[i] == ':'))
+			name[i] = '_';
+	}
+
+	return TEXMAP_CACHE_DIR + name + (bumpMap ? ".gradient.stex" : ".stex");
+}
+
+bool TextureMap::LoadCache(const std::string &fileName, const bool bumpMap) {
+	const string cacheName = GetCacheFileName(fileName, bumpMap);
+
+	try {
+		if (!boost::filesystem::exists(cacheName))
+			return false;
+		const boost::uint64_t sourceTime = boost::filesystem::last_write_time("gamedata/" + fileName);
+
+		// The pages of the file are shared with the page cache and loaded
+		// on demand
+		file_mapping file(cacheName.c_str(), read_only);
+		std::auto_ptr<mapped_region> region(new mapped_region(file, read_only));
+		const char *data = (const char *)region->get_address();
+		const size_t size = region->get_size();
+
+		if (size < sizeof(CacheHeader))
+			return false;
+		const CacheHeader *header = (const CacheHeader *)data;
+		if ((memcmp(header->magic, "STEX", 4) != 0) ||
+				(header->version != TEXMAP_CACHE_VERSION) ||
+				(header->tileSize != TEXMAP_TILE_SIZE) ||
+				(header->bumpMap != (bumpMap ? 1u : 0u)) ||
+				(header->sourceTime != sourceTime) ||
+				(header->nameLength != fileName.size()) ||
+				(size < sizeof(CacheHeader) + header->nameLength) ||
+				(fileName.compare(0, string::npos, data + sizeof(CacheHeader), header->nameLength) != 0) ||
+				(header->format > TEXMAP_GRADIENT_HALF)) {
+			SFERA_LOG("Texture map cache out of date: " << cacheName);
+			return false;
+		}
+
+		// The layout of the levels has to be the one of a map of the same
+		// size, otherwise the lookups could read past the texels
+		Level expectedLevels[TEXMAP_MAX_LEVELS];
+		unsigned int expectedLevelCount;
+		const unsigned long long expectedTexelCount = ((header->width == 0) || (header->height == 0)) ? 0 :
+			ComputeLevels(header->width, header->height, expectedLevels, &expectedLevelCount);
+		if ((expectedTexelCount == 0) ||
+				(header->levelCount != expectedLevelCount) ||
+				(memcmp(header->levels, expectedLevels, expectedLevelCount * sizeof(Level)) != 0) ||
+				(header->texelCount != expectedTexelCount) ||
+				(header->texelsOffset < sizeof(CacheHeader) + header->nameLength) ||
+				(header->texelsOffset % 16 != 0) ||
+				(header->texelsOffset > size) ||
+				(size - header->texelsOffset < expectedTexelCount * GetTexelSize((TextureMapFormat)header->format))) {
+			SFERA_LOG("Texture map cache corrupted: " << cacheName);
+			return false;
+		}
+
+		width = header->width;
+		height = header->height;
+		levelCount = header->levelCount;
+		memcpy(levels, header->levels, sizeof(levels));
+		format = (TextureMapFormat)header->format;
+		texelCount = header->texelCount;
+		texels = (unsigned char *)(data + header->texelsOffset);
+		texelsRegion = region.release();
+	} catch (const std::exception &ex) {
+		SFERA_LOG("Unable to read texture map cache " << cacheName << ": " << ex.what());
+		return false;
+	}
+
+	SFERA_LOG("Texture map cache: " << cacheName);
+	SFERA_LOG("Texture map size: " << width << "x" << height << " (" << levelCount << " levels)");
+	return true;
+}
+
+void TextureMap::SaveCache(const std::string &fileName, const bool bumpMap) const {
+	const string cacheName = GetCacheFileName(fileName, bumpMap);
+
+	try {
+		CacheHeader header;
+		memset(&header, 0, sizeof(CacheHeader));
+		memcpy(header.magic, "STEX", 4);
+		header.version = TEXMAP_CACHE_VERSION;
+		header.tileSize = TEXMAP_TILE_SIZE;
+		header.bumpMap = bumpMap ? 1 : 0;
+		header.sourceTime = boost::filesystem::last_write_time("gamedata/" + fileName);
+		header.nameLength = fileName.size();
+		header.width = width;
+		header.height = height;
+		header.levelCount = levelCount;
+		memcpy(header.levels, levels, sizeof(levels));
+		header.format = format;
+		header.texelCount = texelCount;
+		// The texels are aligned for the mapping
+		header.texelsOffset = RoundUp<size_t>(sizeof(CacheHeader) + fileName.size(), 16);
+
+		boost::filesystem::create_directories(TEXMAP_CACHE_DIR);
+
+		// Written with a temporary name so a partial file is never used
+		const string tmpName = cacheName + ".tmp";
+		{
+			ofstream file(tmpName.c_str(), ios::out | ios::binary | ios::trunc);
+			file.write((const char *)&header, sizeof(CacheHeader));
+			file.write(fileName.data(), fileName.size());
+			const vector<char> padding(header.texelsOffset - sizeof(CacheHeader) - fileName.size(), 0);
+			if (padding.size() > 0)
+				file.write(&padding[0], padding.size());
+			file.write((const char *)texels, GetTexelsSize());
+
+			if (!file)
+				throw runtime_error("write error");
+		}
+
+		boost::filesystem::remove(cacheName);
+		boost::filesystem::rename(tmpName, cacheName);
+	} catch (const std::exception &ex) {
+		// The cache is optional
+		SFERA_LOG("Unable to write texture map cache " << cacheName << ": " << ex.what());
+	}
+}
+
+void TextureMap::PackTexels(vector<Spectrum> &pixels, const bool isHDR, const bool bumpMap) {
+	if (bumpMap)
+		format = TEXMAP_GRADIENT_HALF;
+	else
+		format = isHDR ? TEXMAP_RGB_HALF : TEXMAP_RGBA8;
+
+	if (bumpMap) {
+		// The bilinear interpolation of the forward differences is the
+		// difference of the interpolated heights one texel apart
+		vector<Spectrum> gradients(width * height);
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x) {
+				const float h = pixels[x + y * width].Filter();
+				const float hu = pixels[(x + 1) % width + y * width].Filter();
+				const float hv = pixels[x + ((y + 1) % height) * width].Filter();
+
+				gradients[x + y * width] = Spectrum(hu - h, hv - h, 0.f);
+			}
+		}
+
+		BuildLevels(gradients);
+	} else
+		BuildLevels(pixels);
+}
+
+unsigned long long TextureMap::ComputeLevels(const unsigned int width, const unsigned int height,
+		Level *levels, unsigned int *levelCount) {
+	// Each level has its own tiles and padding, the levels are stored one
+	// after the other
+	*levelCount = 0;
+	unsigned long long count = 0;
+	unsigned int w = width;
+	unsigned int h = height;
+	for (;;) {
+		Level &lvl(levels[(*levelCount)++]);
+		lvl.width = w;
+		lvl.height = h;
+		lvl.tileCountX = w / TEXMAP_TILE_SIZE + 1;
+		lvl.tileCountY = h / TEXMAP_TILE_SIZE + 1;
+		lvl.offset = (unsigned int)count;
+		count += (unsigned long long)lvl.tileCountX * lvl.tileCountY * TEXMAP_TILE_SIZE * TEXMAP_TILE_SIZE;
+
+		if (((w <= 1) && (h <= 1)) || (*levelCount == TEXMAP_MAX_LEVELS))
+			break;
+
+		w = Max(1u, w / 2);
+		h = Max(1u, h / 2);
+	}
+
+	return count;
+}
+
+void TextureMap::BuildLevels(vector<Spectrum> &pixels) {
+	texelCount = (unsigned int)ComputeLevels(width, height, levels, &levelCount);
+
+	texels = new unsigned char[GetTexelsSize()];
+	// The texels of the last tiles past the padding are never used
+	memset(texels, 0, GetTexelsSize());
+	SFERA_LOG("Texture map levels: " << levelCount);
+	SFERA_LOG("Texture map memory: " << GetTexelsSize() / 1024 << "Kbytes");
+
+	for (unsigned int level = 0; level < levelCount; ++level) {
+		const Level &lvl(levels[level]);
+
+		if (level > 0) {
+			// A box filter of the previous level, the last row and column
+			// of an odd sized level are used twice
+			const Level &prev(levels[level - 1]);
+			vector<Spectrum> filtered(lvl.width * lvl.height);
+			for (unsigned int y = 0; y < lvl.height; ++y) {
+				const unsigned int y0 = Min(2 * y, prev.height - 1);
+				const unsigned int y1 = Min(2 * y + 1, prev.height - 1);
+
+				for (unsigned int x = 0; x < lvl.width; ++x) {
+					const unsigned int x0 = Min(2 * x, prev.width - 1);
+					const unsigned int x1 = Min(2 * x + 1, prev.width - 1);
+
+					filtered[x + y * lvl.width] = .25f * (
+							pixels[x0 + y0 * prev.width] + pixels[x1 + y0 * prev.width] +
+							pixels[x0 + y1 * prev.width] + pixels[x1 + y1 * prev.width]);
+				}
+			}
+
+			pixels.swap(filtered);
+		}
+
+		for (unsigned int y = 0; y < lvl.height; ++y)
+			for (unsigned int x = 0; x < lvl.width; ++x)
+				SetTexel(level, x, y, pixels[x + y * lvl.width]);
+
+		FillPadding(level);
+	}
+}
+
+void TextureMap::SetTexel(const unsigned int level, const unsigned int x, const unsigned int y,
+		const Spectrum &c) {
+	const unsigned int index = GetTexelIndex(level, x, y);
+
+	switch (format) {
+		case TEXMAP_RGBA8: {
+			unsigned char *texel = &texels[index * 4];
+			texel[0] = (unsigned char)Clamp(Float2Int(c.r * 255.f + .5f), 0, 255);
+			texel[1] = (unsigned char)Clamp(Float2Int(c.g * 255.f + .5f), 0, 255);
+			texel[2] = (unsigned char)Clamp(Float2Int(c.b * 255.f + .5f), 0, 255);
+			texel[3] = 255;
+			break;
+		}
+		case TEXMAP_RGB_HALF: {
+			unsigned short *texel = &((unsigned short *)texels)[index * 3];
+			texel[0] = FloatToHalf(c.r);
+			texel[1] = FloatToHalf(c.g);
+			texel[2] = FloatToHalf(c.b);
+			break;
+		}
+		case TEXMAP_GRADIENT_HALF: {
+			unsigned short *texel = &((unsigned short *)texels)[index * 2];
+			texel[0] = FloatToHalf(c.r);
+			texel[1] = FloatToHalf(c.g);
+			break;
+		}
+		default:
+			assert (false);
+			break;
+	}
+}
+
+void TextureMap::FillPadding(const unsigned int level) {
+	const Level &lvl(levels[level]);
+	const size_t texelSize = GetTexelSize(format);
+
+	for (unsigned int y = 0; y < lvl.height; ++y)
+		memcpy(&texels[GetTexelIndex(level, lvl.width, y) * texelSize],
+				&texels[GetTexelIndex(level, 0, y) * texelSize], texelSize);
+	for (unsigned int x = 0; x <= lvl.width; ++x)
+		memcpy(&texels[GetTexelIndex(level, x, lvl.height) * texelSize],
+				&texels[GetTexelIndex(level, x % lvl.width, 0) * texelSize], texelSize);
+}
+
+//------------------------------------------------------------------------------
+// TextureMapCache
+//------------------------------------------------------------------------------
+
+// The process-wide cache, shared by all the levels
+typedef struct {
+	// NULL while the map is still being loaded
+	TextureMap *map;
+	// Number of levels using the map
+	unsigned int refCount;
+	// Used to evict the least recently used maps
+	unsigned int lastUse;
+} SharedTextureMap;
+typedef std::map<std::pair<std::string, bool>, SharedTextureMap> SharedTextureMaps;
+
+static boost::mutex sharedMapsMutex;
+// Signaled each time a map has been loaded (or has failed to load)
+static boost::condition_variable sharedMapsLoaded;
+static SharedTextureMaps sharedMaps;
+static size_t sharedMapsSize = 0;
+static size_t sharedMapsMaxSize = 256 * 1024 * 1024;
+static unsigned int sharedMapsUseCount = 0;
+
+// It has to be called with sharedMapsMutex locked
+static void EvictSharedMaps() {
+	while (sharedMapsSize > sharedMapsMaxSize) {
+		// Look for the least recently used map not in use
+		SharedTextureMaps::iterator lru = sharedMaps.end();
+		for (SharedTextureMaps::iterator it = sharedMaps.begin(); it != sharedMaps.end(); ++it) {
+			if ((it->second.refCount == 0) &&
+					((lru == sharedMaps.end()) || (it->second.lastUse < lru->second.lastUse)))
+				lru = it;
+		}
+
+		if (lru == sharedMaps.end())
+			break;
+
+		SFERA_LOG("Evicted texture map: " << lru->first.first);
+		sharedMapsSize -= lru->second.map->GetTexelsSize();
+		delete lru->second.map;
+		sharedMaps.erase(lru);
+	}
+}
+
+static TextureMap *AcquireSharedMap(const std::string &fileName, const bool bumpMap) {
+	boost::unique_lock<boost::mutex> lock(sharedMapsMutex);
+
+	const std::pair<std::string, bool> key(fileName, bumpMap);
+	for (;;) {
+		SharedTextureMaps::iterator it = sharedMaps.find(key);
+		if (it == sharedMaps.end())
+			break;
+
+		if (it->second.map) {
+			SFERA_LOG("Cached texture map: " << fileName);
+
+			++(it->second.refCount);
+			it->second.lastUse = ++sharedMapsUseCount;
+
+			return it->second.map;
+		}
+
+		// Another thread is loading the file, wait for it. If the loading
+		// fails, the entry is removed and I try to load the file myself.
+		sharedMapsLoaded.wait(lock);
+	}
+
+	// I have yet to load the file: insert a placeholder so other threads
+	// don't load the same file. It is already referenced so it can not be
+	// evicted.
+	SharedTextureMap stm;
+	stm.map = NULL;
+	stm.refCount = 1;
+	stm.lastUse = ++sharedMapsUseCount;
+	SharedTextureMaps::iterator it = sharedMaps.insert(std::make_pair(key, stm)).first;
+
+	// Decode the file without holding the lock
+	TextureMap *map;
+	lock.unlock();
+	try {
+		map = new TextureMap(fileName, bumpMap);
+	} catch (...) {
+		lock.lock();
+		sharedMaps.erase(it);
+		sharedMapsLoaded.notify_all();
+		throw;
+	}
+	lock.lock();
+
+	it->second.map = map;
+	sharedMapsSize += map->GetTexelsSize();
+	sharedMapsLoaded.notify_all();
+
+	return map;
+}
+
+static void ReleaseSharedMap(const std::string &fileName, const bool bumpMap) {
+	boost::unique_lock<boost::mutex> lock(sharedMapsMutex);
+
+	SharedTextureMaps::iterator it = sharedMaps.find(std::make_pair(fileName, bumpMap));
+	assert (it != sharedMaps.end());
+	assert (it->second.refCount > 0);
+	--(it->second.refCount);
+
+	EvictSharedMaps();
+}
+
+void TextureMapCache::SetSharedMaxSize(const size_t maxSize) {
+	boost::unique_lock<boost::mutex> lock(sharedMapsMutex);
+
+	sharedMapsMaxSize = maxSize;
+	EvictSharedMaps();
+}
+
+void TextureMapCache::FreeShared() {
+	boost::unique_lock<boost::mutex> lock(sharedMapsMutex);
+
+	const size_t maxSize = sharedMapsMaxSize;
+	sharedMapsMaxSize = 0;
+	EvictSharedMaps();
+	sharedMapsMaxSize = maxSize;
 }
 
 TextureMapCache::TextureMapCache() {
@@ -167,29 +610,29 @@ TextureMapCache::~TextureMapCache() {
 		delete bumpInstances[i];
 
 	for (std::map<std::string, TextureMap *>::const_iterator it = maps.begin(); it != maps.end(); ++it)
-		delete it->second;
+		ReleaseSharedMap(it->first, false);
+	for (std::map<std::string, TextureMap *>::const_iterator it = gradientMaps.begin(); it != gradientMaps.end(); ++it)
+		ReleaseSharedMap(it->first, true);
 }
 
-TextureMap *TextureMapCache::GetTextureMap(const std::string &fileName) {
-	// Check if the texture map has been already loaded
-	std::map<std::string, TextureMap *>::const_iterator it = maps.find(fileName);
+TextureMap *TextureMapCache::GetTextureMap(const std::string &fileName, const bool bumpMap) {
+	std::map<std::string, TextureMap *> &levelMaps(bumpMap ? gradientMaps : maps);
 
-	if (it == maps.end()) {
-		// I have yet to load the file
+	// Check if the texture map is already used by the level
+	std::map<std::string, TextureMap *>::const_iterator it = levelMaps.find(fileName);
 
-		TextureMap *tm = new TextureMap(fileName);
-		maps.insert(std::make_pair(fileName, tm));
+	if (it == levelMaps.end()) {
+		TextureMap *tm = AcquireSharedMap(fileName, bumpMap);
+		levelMaps.insert(std::make_pair(fileName, tm));
 
 		return tm;
-	} else {
-		//SFERA_LOG("Cached texture map: " << fileName);
+	} else
 		return it->second;
-	}
 }
 
 TexMapInstance *TextureMapCache::GetTexMapInstance(const std::string &fileName,
 		const float shiftU, const float shiftV, const float scaleU, const float scaleV) {
-	TextureMap *tm = GetTextureMap(fileName);
+	TextureMap *tm = GetTextureMap(fileName, false);
 	TexMapInstance *texm = new TexMapInstance(tm, shiftU, shiftV, scaleU, scaleV);
 	texInstances.push_back(texm);
 
@@ -199,7 +642,7 @@ TexMapInstance *TextureMapCache::GetTexMapInstance(const std::string &fileName,
 BumpMapInstance *TextureMapCache::GetBumpMapInstance(const std::string &fileName,
 		const float shiftU, const float shiftV, const float scaleU, const float scaleV,
 		const float scale) {
-	TextureMap *tm = GetTextureMap(fileName);
+	TextureMap *tm = GetTextureMap(fileName, true);
 	BumpMapInstance *bm = new BumpMapInstance(tm, shiftU, shiftV, scaleU, scaleV, scale);
 	bumpInstances.push_back(bm);
 
@@ -209,4 +652,6 @@ BumpMapInstance *TextureMapCache::GetBumpMapInstance(const std::string &fileName
 void TextureMapCache::GetTexMaps(std::vector<TextureMap *> &tms) {
 	for (std::map<std::string, TextureMap *>::const_iterator it = maps.begin(); it != maps.end(); ++it)
 		tms.push_back(it->second);
+	for (std::map<std::string, TextureMap *>::const_iterator it = gradientMaps.begin(); it != gradientMaps.end(); ++it)
+		tms.push_back(it->second);
 }
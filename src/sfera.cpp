@@ -25,6 +25,10 @@
 #include "sfera.h"
 #include "gameconfig.h"
 #include "displaysession.h"
+#include "benchmarksession.h"
+#include "sdl/texmap.h"
+#include "sdl/compiledlevel.h"
+#include "sdl/levelgenerator.h"
 
 void SferaDebugHandler(const char *msg) {
 	cerr << "[Sfera] " << msg << endl;
@@ -94,6 +98,9 @@ int main(int argc, char *argv[]) {
 				" -e [window height]" << endl <<
 				" -D [property name] [property value]" << endl <<
 				" -d [current directory path]" << endl <<
+				" -c [level file] <compile the level and exit>" << endl <<
+				" -g [generator file] [level file] <generate a level and exit>" << endl <<
+				" --benchmark [level file] <run the level without display, print the result and exit>" << endl <<
 				" -h <display this help and exit>");
 
 		// Initialize FreeImage Library
@@ -102,12 +109,16 @@ int main(int argc, char *argv[]) {
 
 		GameConfig *config = NULL;
 		Properties cmdLineProp;
+		string generatorFileName, generatedLevelFileName;
+		string benchmarkLevelFileName;
 		for (int i = 1; i < argc; i++) {
 			if (argv[i][0] == '-') {
 				// I should check for out of range array index...
 
 				if (argv[i][1] == 'h') exit(EXIT_SUCCESS);
 
+				else if (string(argv[i]) == "--benchmark") benchmarkLevelFileName = argv[++i];
+
 				else if (argv[i][1] == 'o') {
 					if (config)
 						throw runtime_error("Used multiple configuration files");
@@ -126,6 +137,17 @@ int main(int argc, char *argv[]) {
 
 				else if (argv[i][1] == 'd') boost::filesystem::current_path(boost::filesystem::path(argv[++i]));
 
+				else if (argv[i][1] == 'c') {
+					CompiledLevel::Compile(argv[++i]);
+					exit(EXIT_SUCCESS);
+				}
+
+				else if (argv[i][1] == 'g') {
+					generatorFileName = argv[i + 1];
+					generatedLevelFileName = argv[i + 2];
+					i += 2;
+				}
+
 				else {
 					SFERA_LOG("Invalid option: " << argv[i]);
 					exit(EXIT_FAILURE);
@@ -141,6 +163,15 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
+		if (generatorFileName != "") {
+			// The -D options can overwrite the generator parameters
+			Properties genProp(generatorFileName);
+			genProp.Load(cmdLineProp);
+
+			LevelGenerator(genProp).Save(generatedLevelFileName);
+			exit(EXIT_SUCCESS);
+		}
+
 		if (!config) {
 			// Look for the default config
 
@@ -155,8 +186,17 @@ int main(int argc, char *argv[]) {
 		config->LoadProperties(cmdLineProp);
 		config->LogParameters();
 
-		DisplaySession displaySession(config);
-		displaySession.RunGame();
+		TextureMapCache::SetSharedMaxSize((size_t)config->GetTextureMapsCacheMaxSize() * 1024 * 1024);
+
+		if (benchmarkLevelFileName != "") {
+			BenchmarkSession benchmarkSession(config);
+			benchmarkSession.Run(benchmarkLevelFileName);
+		} else {
+			DisplaySession displaySession(config);
+			displaySession.RunGame();
+		}
+
+		TextureMapCache::FreeShared();
 
 		delete config;
 #if !defined(SFERA_DISABLE_OPENCL)
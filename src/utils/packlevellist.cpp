@@ -23,6 +23,7 @@
 using namespace boost::filesystem;
 
 #include "utils/packlevellist.h"
+#include "sdl/compiledlevel.h"
 
 PackLevelList::PackLevelList(const string &pack) : packName(pack) {
 	// Build the list of levels
@@ -48,10 +49,14 @@ PackLevelList::PackLevelList(const string &pack) : packName(pack) {
 			string levelName = it->filename().generic_string();
 			SFERA_LOG("  " << levelName);
 
-			// Check if it is the definition of the level
-			if (boost::starts_with(levelName, ss.str()) && boost::ends_with(levelName, ".lvl")) {
+			// Check if it is the definition of the level, it can be available
+			// only in the compiled format
+			const bool lvlFile = boost::ends_with(levelName, ".lvl");
+			const bool compiledFile = boost::ends_with(levelName, COMPILEDLEVEL_EXTENSION);
+			if (boost::starts_with(levelName, ss.str()) && (lvlFile || compiledFile)) {
 				SFERA_LOG("    Used for level: " << level);
-				names.push_back(levelName.substr(6, levelName.length() - 6 - 4));
+				const size_t extLen = lvlFile ? 4 : string(COMPILEDLEVEL_EXTENSION).length();
+				names.push_back(levelName.substr(6, levelName.length() - 6 - extLen));
 
 				// Look for the next level
 				++level;
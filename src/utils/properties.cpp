@@ -33,9 +33,8 @@ Properties::Properties(const std::string &fileName) {
 }
 
 void Properties::Load(const Properties &p) {
-	std::vector<std::string> keys = p.GetAllKeys();
-	for (std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
-		SetString(*it, p.GetString(*it, ""));
+	for (std::map<std::string, Value>::const_iterator it = p.props.begin(); it != p.props.end(); ++it)
+		SetString(it->first, it->second.value);
 }
 
 void Properties::LoadFile(const std::string &fileName) {
@@ -43,39 +42,47 @@ void Properties::LoadFile(const std::string &fileName) {
 	if (file.fail())
 		throw std::runtime_error("Unable to open file" + fileName);
 
-	char buf[512];
-	for (int lineNumber = 1;; ++lineNumber) {
-		file.getline(buf, 512);
-		if (file.eof())
-			break;
+	LoadStream(file);
+}
+
+static void Trim(const std::string &s, size_t *begin, size_t *end) {
+	// The CR is for DOS files read under Linux/MacOS
+	while ((*begin < *end) && isspace((unsigned char)s[*begin]))
+		++(*begin);
+	while ((*end > *begin) && isspace((unsigned char)s[*end - 1]))
+		--(*end);
+}
+
+void Properties::LoadStream(std::istream &stream) {
+	std::string line;
+	for (int lineNumber = 1; std::getline(stream, line); ++lineNumber) {
 		// Ignore comments
-		if (buf[0] == '#')
+		if ((line.length() > 0) && (line[0] == '#'))
 			continue;
 
-		std::string line = buf;
-		boost::trim(line);
+		size_t begin = 0;
+		size_t end = line.length();
+		Trim(line, &begin, &end);
 
 		// Ignore empty lines
-		if (line.length() == 0)
+		if (begin == end)
 			continue;
 
-		size_t idx = line.find('=');
-		if (idx == std::string::npos) {
-			sprintf(buf, "Syntax error at line %d", lineNumber);
-			throw std::runtime_error(buf);
+		const size_t idx = line.find('=', begin);
+		if ((idx == std::string::npos) || (idx >= end)) {
+			std::stringstream ss;
+			ss << "Syntax error at line " << lineNumber;
+			throw std::runtime_error(ss.str());
 		}
 
-		// Check if it is a valid key
-		std::string key(line.substr(0, idx));
-		boost::trim(key);
-		std::string value(line.substr(idx + 1));
-		// Check if the last char is a LF or a CR and remove that (in case of
-		// a DOS file red under Linux/MacOS)
-		if ((value.size() > 0) && ((value[value.size() - 1] == '\n') || (value[value.size() - 1] == '\r')))
-			value.resize(value.size() - 1);
-		boost::trim(value);
-
-		props[key] = value;
+		size_t keyEnd = idx;
+		Trim(line, &begin, &keyEnd);
+		size_t valueBegin = idx + 1;
+		Trim(line, &valueBegin, &end);
+
+		Value &v(props[line.substr(begin, keyEnd - begin)]);
+		v.value.assign(line, valueBegin, end - valueBegin);
+		v.floatsParsed = false;
 	}
 }
 
@@ -84,96 +91,112 @@ void Properties::SaveFile(const std::string &fileName) {
 	if (file.fail())
 		throw std::runtime_error("Unable to open file" + fileName);
 
-	std::vector<std::string> keys = GetAllKeys();
-	for (size_t i = 0; i < keys.size(); ++i)
-		file << keys[i] << "=" << GetString(keys[i], "0.0") << "\n";
+	SaveStream(file);
 
 	file.close();
 }
 
+void Properties::SaveStream(std::ostream &stream) const {
+	for (std::map<std::string, Value>::const_iterator it = props.begin(); it != props.end(); ++it)
+		stream << it->first << "=" << it->second.value << "\n";
+}
+
 std::vector<std::string> Properties::GetAllKeys() const {
 	std::vector<std::string> keys;
-	for (std::map<std::string, std::string>::const_iterator it = props.begin(); it != props.end(); ++it)
+	keys.reserve(props.size());
+	for (std::map<std::string, Value>::const_iterator it = props.begin(); it != props.end(); ++it)
 		keys.push_back(it->first);
 
 	return keys;
 }
 
-std::vector<std::string> Properties::GetAllKeys(const std::string prefix) const {
+std::vector<std::string> Properties::GetAllKeys(const std::string &prefix) const {
+	// The keys with the same prefix are one after the other
 	std::vector<std::string> keys;
-	for (std::map<std::string, std::string>::const_iterator it = props.begin(); it != props.end(); ++it) {
-		if (it->first.find(prefix) == 0)
-			keys.push_back(it->first);
-	}
+	for (std::map<std::string, Value>::const_iterator it = props.lower_bound(prefix);
+			(it != props.end()) && (it->first.compare(0, prefix.length(), prefix) == 0); ++it)
+		keys.push_back(it->first);
 
 	return keys;
 }
 
-bool Properties::IsDefined(const std::string propName) const {
-	std::map<std::string, std::string>::const_iterator it = props.find(propName);
+const Properties::Value *Properties::GetValue(const std::string &propName) const {
+	std::map<std::string, Value>::const_iterator it = props.find(propName);
 
 	if (it == props.end())
-		return false;
+		return NULL;
 	else
-		return true;
+		return &(it->second);
 }
 
-std::string Properties::GetString(const std::string propName, const std::string defaultValue) const {
-	std::map<std::string, std::string>::const_iterator it = props.find(propName);
+bool Properties::IsDefined(const std::string &propName) const {
+	return (GetValue(propName) != NULL);
+}
 
-	if (it == props.end())
+std::string Properties::GetString(const std::string &propName, const std::string &defaultValue) const {
+	const Value *v = GetValue(propName);
+
+	if (!v)
 		return defaultValue;
 	else
-		return it->second;
+		return v->value;
 }
 
-int Properties::GetInt(const std::string propName, const int defaultValue) const {
-	std::string s = GetString(propName, "");
+int Properties::GetInt(const std::string &propName, const int defaultValue) const {
+	const Value *v = GetValue(propName);
 
-	if (s.compare("") == 0)
+	if (!v || (v->value.length() == 0))
 		return defaultValue;
 	else
-		return atoi(s.c_str());
+		return atoi(v->value.c_str());
 }
 
-float Properties::GetFloat(const std::string propName, const float defaultValue) const {
-	std::string s = GetString(propName, "");
+float Properties::GetFloat(const std::string &propName, const float defaultValue) const {
+	const Value *v = GetValue(propName);
 
-	if (s.compare("") == 0)
+	if (!v || (v->value.length() == 0))
 		return defaultValue;
 	else
-		return atof(s.c_str());
+		return atof(v->value.c_str());
 }
 
-std::vector<std::string> Properties::GetStringVector(const std::string propName, const std::string &defaultValue) const {
-	std::string s = GetString(propName, "");
+std::vector<std::string> Properties::GetStringVector(const std::string &propName, const std::string &defaultValue) const {
+	const Value *v = GetValue(propName);
 
-	if (s.compare("") == 0)
+	if (!v || (v->value.length() == 0))
 		return ConvertToStringVector(defaultValue);
 	else
-		return ConvertToStringVector(s);
+		return ConvertToStringVector(v->value);
 }
 
-std::vector<int> Properties::GetIntVector(const std::string propName, const std::string &defaultValue) const {
-	std::string s = GetString(propName, "");
+std::vector<int> Properties::GetIntVector(const std::string &propName, const std::string &defaultValue) const {
+	const Value *v = GetValue(propName);
 
-	if (s.compare("") == 0)
+	if (!v || (v->value.length() == 0))
 		return ConvertToIntVector(defaultValue);
 	else
-		return ConvertToIntVector(s);
+		return ConvertToIntVector(v->value);
 }
 
-std::vector<float> Properties::GetFloatVector(const std::string propName, const std::string &defaultValue) const {
-	std::string s = GetString(propName, "");
+std::vector<float> Properties::GetFloatVector(const std::string &propName, const std::string &defaultValue) const {
+	const Value *v = GetValue(propName);
 
-	if (s.compare("") == 0)
+	if (!v || (v->value.length() == 0))
 		return ConvertToFloatVector(defaultValue);
-	else
-		return ConvertToFloatVector(s);
+	else {
+		if (!v->floatsParsed) {
+			v->floats = ConvertToFloatVector(v->value);
+			v->floatsParsed = true;
+		}
+
+		return v->floats;
+	}
 }
 
 void Properties::SetString(const std::string &propName, const std::string &value) {
-	props[propName] = value;
+	Value &v(props[propName]);
+	v.value = value;
+	v.floatsParsed = false;
 }
 
 std::string Properties::SetString(const std::string &property) {
@@ -191,17 +214,18 @@ std::string Properties::SetString(const std::string &property) {
 }
 
 std::string Properties::ExtractField(const std::string &value, const size_t index) {
-	char buf[512];
-	memcpy(buf, value.c_str(), value.length() + 1);
-	char *t = strtok(buf, ".");
-	if ((index == 0) && (t == NULL))
+	// Empty fields are skipped
+	size_t i = index;
+	size_t start = value.find_first_not_of('.');
+	if ((index == 0) && (start == std::string::npos))
 		return value;
 
-	size_t i = index;
-	while (t != NULL) {
+	while (start != std::string::npos) {
+		const size_t end = value.find('.', start);
 		if (i-- == 0)
-			return std::string(t);
-		t = strtok(NULL, ".");
+			return value.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+
+		start = (end == std::string::npos) ? end : value.find_first_not_of('.', end);
 	}
 
 	return "";
@@ -220,27 +244,43 @@ std::vector<std::string>  Properties::ConvertToStringVector(const std::string &v
 	return strs2;
 }
 
-std::vector<int> Properties::ConvertToIntVector(const std::string &values) {
-	std::vector<std::string> strs;
-	boost::split(strs, values, boost::is_any_of("\t "));
+// The values are separated by spaces or tabs, each one is parsed like atoi()
+// and atof() do
+static const char *NextToken(const char *s, const char **tokenEnd) {
+	while ((*s == ' ') || (*s == '\t'))
+		++s;
+
+	const char *e = s;
+	while ((*e != '\0') && (*e != ' ') && (*e != '\t'))
+		++e;
+	*tokenEnd = e;
 
+	return s;
+}
+
+std::vector<int> Properties::ConvertToIntVector(const std::string &values) {
 	std::vector<int> ints;
-	for (std::vector<std::string>::iterator it = strs.begin(); it != strs.end(); ++it) {
-		if (it->length() != 0)
-			ints.push_back(atoi(it->c_str()));
+	const char *tokenEnd = values.c_str();
+	for (;;) {
+		const char *token = NextToken(tokenEnd, &tokenEnd);
+		if (token == tokenEnd)
+			break;
+
+		ints.push_back(atoi(token));
 	}
 
 	return ints;
 }
 
 std::vector<float> Properties::ConvertToFloatVector(const std::string &values) {
-	std::vector<std::string> strs;
-	boost::split(strs, values, boost::is_any_of("\t "));
-
 	std::vector<float> floats;
-	for (std::vector<std::string>::iterator it = strs.begin(); it != strs.end(); ++it) {
-		if (it->length() != 0)
-			floats.push_back(atof(it->c_str()));
+	const char *tokenEnd = values.c_str();
+	for (;;) {
+		const char *token = NextToken(tokenEnd, &tokenEnd);
+		if (token == tokenEnd)
+			break;
+
+		floats.push_back(atof(token));
 	}
 
 	return floats;
@@ -0,0 +1,152 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2010 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of Sfera.                                           *
+ *                                                                         *
+ *   Sfera is free software; you can redistribute it and/or modify         *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Sfera is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "sfera.h"
+#include "utils/stageprofiler.h"
+
+const char *FrameStageNames[FRAME_STAGE_COUNT] = {
+	"accel_build", "render", "filter", "blend_tonemap", "gl_upload",
+	"recompile", "kernel_initfb", "kernel_pathtracing", "kernel_filter",
+	"kernel_blend", "kernel_tonemap", "kernel_updatepixelbuffer", "readback",
+	"pbo_draw", "merge", "sync", "text", "swap"
+};
+
+const char *PhysicStageNames[PHYSIC_STAGE_COUNT] = {
+	"gravity", "step_simulation", "manifold_scan"
+};
+
+StageProfiler::StageProfiler(const string &profilerName, const char **names,
+		const unsigned int count, const unsigned int size) : name(profilerName),
+		stageNames(names), stageCount(count), ringSize(Max(1u, size)),
+		current(count, 0.0), records(ringSize * (count + 2), 0.0) {
+	Reset();
+}
+
+void StageProfiler::EndRecord() {
+	const double now = WallClockTime();
+
+	boost::unique_lock<boost::mutex> lock(mutex);
+
+	double *record = &records[nextRecord * (stageCount + 2)];
+	record[0] = now;
+	record[1] = now - lastEndTime;
+	for (unsigned int i = 0; i < stageCount; ++i) {
+		record[i + 2] = current[i];
+		current[i] = 0.0;
+	}
+
+	nextRecord = (nextRecord + 1) % ringSize;
+	recordCount = Min(recordCount + 1, ringSize);
+	lastEndTime = now;
+}
+
+void StageProfiler::Reset() {
+	boost::unique_lock<boost::mutex> lock(mutex);
+
+	fill(current.begin(), current.end(), 0.0);
+	nextRecord = 0;
+	recordCount = 0;
+	startTime = WallClockTime();
+	lastEndTime = startTime;
+}
+
+unsigned int StageProfiler::GetMeanTimes(vector<double> &stageTimes, double *recordTime) const {
+	boost::unique_lock<boost::mutex> lock(mutex);
+
+	stageTimes.assign(stageCount, 0.0);
+	*recordTime = 0.0;
+	if (recordCount == 0)
+		return 0;
+
+	for (unsigned int i = 0; i < recordCount; ++i) {
+		const double *record = GetRecord(GetRecordIndex(i));
+
+		*recordTime += record[1];
+		for (unsigned int j = 0; j < stageCount; ++j)
+			stageTimes[j] += record[j + 2];
+	}
+
+	*recordTime /= recordCount;
+	for (unsigned int j = 0; j < stageCount; ++j)
+		stageTimes[j] /= recordCount;
+
+	return recordCount;
+}
+
+void StageProfiler::WriteCSV(ostream &os) const {
+	boost::unique_lock<boost::mutex> lock(mutex);
+
+	os << "record,time,total";
+	for (unsigned int j = 0; j < stageCount; ++j)
+		os << "," << stageNames[j];
+	os << "\n";
+
+	os << fixed << setprecision(3);
+	for (unsigned int i = 0; i < recordCount; ++i) {
+		const double *record = GetRecord(GetRecordIndex(i));
+
+		os << i << "," << 1000.0 * (record[0] - startTime) << "," << 1000.0 * record[1];
+		for (unsigned int j = 0; j < stageCount; ++j)
+			os << "," << 1000.0 * record[j + 2];
+		os << "\n";
+	}
+}
+
+void StageProfiler::WriteJSON(ostream &os) const {
+	boost::unique_lock<boost::mutex> lock(mutex);
+
+	os << fixed << setprecision(3) <<
+			"{\n"
+			"  \"name\": \"" << name << "\",\n"
+			"  \"stages\": [";
+	for (unsigned int j = 0; j < stageCount; ++j)
+		os << ((j == 0) ? "" : ", ") << "\"" << stageNames[j] << "\"";
+	os << "],\n"
+			"  \"records\": [\n";
+
+	for (unsigned int i = 0; i < recordCount; ++i) {
+		const double *record = GetRecord(GetRecordIndex(i));
+
+		os << "    { \"time\": " << 1000.0 * (record[0] - startTime) <<
+				", \"total\": " << 1000.0 * record[1] << ", \"stages\": [";
+		for (unsigned int j = 0; j < stageCount; ++j)
+			os << ((j == 0) ? "" : ", ") << 1000.0 * record[j + 2];
+		os << "] }" << ((i + 1 < recordCount) ? ",\n" : "\n");
+	}
+
+	os << "  ]\n"
+			"}\n";
+}
+
+void StageProfiler::Save(const string &fileName) const {
+	SFERA_LOG("Saving " << name << " profile: " << fileName);
+
+	ofstream file(fileName.c_str());
+	if (!file.is_open())
+		throw runtime_error("Unable to open profile file: " + fileName);
+
+	if (boost::iends_with(fileName, ".json"))
+		WriteJSON(file);
+	else
+		WriteCSV(file);
+
+	if (!file.good())
+		throw runtime_error("Error while writing profile file: " + fileName);
+}